@@ -0,0 +1,448 @@
+#include "bench_server.hpp"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include "buffer_pool.hpp"
+#include "esp_app_desc.h"
+#include "esp_chip_info.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "dap_phy.hpp"
+#include "session_manager.hpp"
+#include "target_access.hpp"
+#include "task_topology.hpp"
+#include "text_writer.hpp"
+#include "usbip_wire.hpp"
+
+namespace bench {
+
+namespace {
+
+// any non-null context marks a connection that only echoes
+char ECHO_MODE;
+
+constexpr size_t URB_PAYLOAD = 64;
+constexpr size_t URB_FRAME = sizeof(usbip::cmd_submit_t) + URB_PAYLOAD;
+constexpr size_t URB_BATCH = 16;
+constexpr size_t SWD_CHUNK = 1024;
+constexpr size_t SWD_SEQUENCE_BITS = 64;
+constexpr size_t MAX_LINE = 96;
+
+// ladder for the UART pass, up to the 5 Mbaud the S3 divider can reach
+constexpr uint32_t UART_RATES[] = {
+    115200, 460800, 921600, 1000000, 2000000, 3000000, 4000000, 5000000,
+};
+
+uint8_t urb_frames[URB_BATCH][URB_FRAME];
+uint8_t swd_chunk[SWD_CHUNK];
+
+unsigned long per_second(uint64_t units, int64_t elapsed_us) {
+  return static_cast<unsigned long>(units * 1000000 /
+                                    std::max<int64_t>(elapsed_us, 1));
+}
+
+uint8_t uart_pattern(uint32_t index) {
+  return static_cast<uint8_t>(index ^ (index >> 8));
+}
+
+}  // namespace
+
+BenchServer& BenchServer::get_instance() {
+  static BenchServer instance;
+  return instance;
+}
+
+BenchServer::BenchServer()
+    : unit_(
+          server::tcp_server_config_t{
+              .name = "bench_server",
+              .port = CONFIG_FLUIDITY_BENCH_PORT,
+              // a command client and an echo client at most
+              .max_clients = 2,
+              // echo throughput scales with how much one read takes
+              .rx_buffer_size = RX_BUFFER_SIZE,
+              .rx_region = memory::region_t::INTERNAL,
+              .stack_size = topology::BENCH_SERVER.stack_size,
+              .priority = topology::BENCH_SERVER.priority,
+              .core_id = topology::BENCH_SERVER.core_id,
+          },
+          *this),
+      engine_(backend_) {}
+
+esp_err_t BenchServer::start() {
+  return unit_.start();
+}
+
+esp_err_t BenchServer::stop() {
+  return unit_.stop();
+}
+
+size_t BenchServer::on_receive(server::connection_t& connection,
+                               std::span<const uint8_t> data) {
+  if (connection.context == &ECHO_MODE) {
+    if (server::TcpServerUnit::send_all(connection.socket, data.data(),
+                                        data.size()) != ESP_OK) {
+      return CLOSE_CONNECTION;
+    }
+    return data.size();
+  }
+
+  const auto* end =
+      static_cast<const uint8_t*>(memchr(data.data(), '\n', data.size()));
+  if (end == nullptr) {
+    return data.size() < MAX_LINE ? 0 : CLOSE_CONNECTION;
+  }
+  size_t consumed = (end - data.data()) + 1;
+  if (consumed > MAX_LINE) {
+    return CLOSE_CONNECTION;
+  }
+
+  char line[MAX_LINE + 1];
+  memcpy(line, data.data(), consumed);
+  line[consumed] = '\0';
+
+  char command[16] = {};
+  unsigned long args[3] = {0, 0, 0};
+  int fields = sscanf(line, "%15s %lu %lu %lu", command, &args[0], &args[1],
+                      &args[2]);
+  auto arg = [&](int index, unsigned long fallback) {
+    return static_cast<uint32_t>(fields > index + 1 ? args[index] : fallback);
+  };
+
+  size_t length = 0;
+  if (strcmp(command, "info") == 0) {
+    length = info();
+  } else if (strcmp(command, "alloc") == 0) {
+    length = alloc(std::clamp<uint32_t>(arg(0, 100000), 1, 10000000));
+  } else if (strcmp(command, "urb") == 0) {
+    length = urb(connection.socket,
+                 std::clamp<uint32_t>(arg(0, 10000), 1, 10000000));
+    if (length == 0) {
+      // the RET_SUBMITs the host waits for are short, end the stream
+      return CLOSE_CONNECTION;
+    }
+  } else if (strcmp(command, "swd") == 0) {
+    length = swd(arg(0, 4000000), arg(1, 0x20000000),
+                 std::clamp<uint32_t>(arg(2, 65536), 1, 1 << 22));
+  } else if (strcmp(command, "uart") == 0) {
+    length = uart(std::clamp<uint32_t>(arg(0, 16384), 256, 1 << 20));
+  } else if (strcmp(command, "echo") == 0) {
+    connection.context = &ECHO_MODE;
+    append(length, "{\"bench\":\"echo\"}\n");
+  } else {
+    append(length, "{\"error\":\"unknown command\"}\n");
+  }
+
+  if (server::TcpServerUnit::send_all(connection.socket, reply_, length) !=
+      ESP_OK) {
+    ESP_LOGW(TAG, "Failed to send %s result", command);
+    return CLOSE_CONNECTION;
+  }
+  return consumed;
+}
+
+size_t BenchServer::info() {
+  const esp_app_desc_t* app = esp_app_get_description();
+  esp_chip_info_t chip;
+  esp_chip_info(&chip);
+
+  size_t length = 0;
+  append(length,
+         "{\"bench\":\"info\",\"app\":\"%s\",\"idf\":\"%s\",\"cores\":%u,"
+         "\"revision\":%u,\"cpu_mhz\":%u,\"free_internal\":%u,"
+         "\"free_psram\":%u}\n",
+         app->version, app->idf_ver, static_cast<unsigned>(chip.cores),
+         static_cast<unsigned>(chip.revision),
+         static_cast<unsigned>(CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ),
+         static_cast<unsigned>(heap_caps_get_free_size(
+             memory::region_caps(memory::region_t::INTERNAL))),
+         static_cast<unsigned>(heap_caps_get_free_size(
+             memory::region_caps(memory::region_t::PSRAM))));
+  return length;
+}
+
+size_t BenchServer::alloc(uint32_t pairs) {
+  memory::BufferPool& pool = memory::BufferPool::get_instance();
+
+  size_t length = 0;
+  append(length, "{\"bench\":\"alloc\",\"pairs\":%lu,\"classes\":[",
+         static_cast<unsigned long>(pairs));
+
+  for (size_t i = 0; i < memory::BufferPool::CLASS_COUNT; i++) {
+    memory::pool_stats_t stats = pool.get_stats(i);
+    uint32_t caps = memory::region_caps(stats.region);
+
+    // the same size through the pool and through the general heap
+    unsigned long pool_rate = 0;
+    int64_t start = esp_timer_get_time();
+    uint32_t done = 0;
+    for (; done < pairs; done++) {
+      void* block = pool.allocate(stats.block_size, stats.region);
+      if (block == nullptr) {
+        break;
+      }
+      pool.release(block);
+    }
+    if (done == pairs) {
+      pool_rate = per_second(uint64_t{pairs} * 2,
+                             esp_timer_get_time() - start);
+    }
+
+    unsigned long heap_rate = 0;
+    start = esp_timer_get_time();
+    for (done = 0; done < pairs; done++) {
+      void* block = heap_caps_malloc(stats.block_size, caps);
+      if (block == nullptr) {
+        break;
+      }
+      heap_caps_free(block);
+    }
+    if (done == pairs) {
+      heap_rate = per_second(uint64_t{pairs} * 2,
+                             esp_timer_get_time() - start);
+    }
+
+    append(length,
+           "%s{\"size\":%u,\"region\":\"%s\",\"pool_ops_per_s\":%lu,"
+           "\"heap_ops_per_s\":%lu}",
+           i == 0 ? "" : ",", static_cast<unsigned>(stats.block_size),
+           stats.region == memory::region_t::INTERNAL ? "internal" : "psram",
+           pool_rate, heap_rate);
+  }
+
+  append(length, "]}\n");
+  return length;
+}
+
+esp_err_t BenchServer::LoopbackBackend::submit(
+    usbip::UrbEngine& engine,
+    usbip::urb_t& urb,
+    std::span<const uint8_t> out_data,
+    std::span<const uint8_t> iso_descriptors) {
+  engine.complete(urb.seq_num,
+                  usbip::urb_completion_t{
+                      .status = usbip::URB_STATUS_OK,
+                      .actual_length = static_cast<uint32_t>(out_data.size()),
+                  });
+  return ESP_OK;
+}
+
+size_t BenchServer::urb(int socket, uint32_t count) {
+  // the replies go to this client; OUT URBs, so each is a bare header
+  if (engine_.attach(socket) != ESP_OK) {
+    return 0;
+  }
+
+  usbip::cmd_submit_t command{};
+  command.header.command = usbip::CMD_SUBMIT;
+  command.header.direction = usbip::OUT;
+  command.header.endpoint = 1;
+  command.transfer_buffer_length = URB_PAYLOAD;
+  command.number_of_packets = usbip::NON_ISO_PACKETS;
+
+  uint32_t sent = 0;
+  int64_t start = esp_timer_get_time();
+  while (sent < count) {
+    size_t batch = std::min<size_t>(URB_BATCH, count - sent);
+    for (size_t i = 0; i < batch; i++) {
+      command.header.seq_num = sent + i + 1;
+      usbip::wire::encode(command, urb_frames[i]);
+    }
+
+    bool deferred = false;
+    size_t size = batch * URB_FRAME;
+    size_t consumed = engine_.handle(
+        std::span<const uint8_t>(&urb_frames[0][0], size), deferred);
+    if (consumed != size) {
+      ESP_LOGW(TAG, "URB engine stopped after %lu submits",
+               static_cast<unsigned long>(sent));
+      engine_.detach();
+      return 0;
+    }
+    sent += batch;
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  engine_.detach();
+
+  size_t length = 0;
+  append(length,
+         "{\"bench\":\"urb\",\"count\":%lu,\"payload\":%u,"
+         "\"urbs_per_s\":%lu,\"elapsed_us\":%lld}\n",
+         static_cast<unsigned long>(count), static_cast<unsigned>(URB_PAYLOAD),
+         per_second(count, elapsed), static_cast<long long>(elapsed));
+  return length;
+}
+
+size_t BenchServer::swd(uint32_t clock, uint32_t address, uint32_t words) {
+  size_t length = 0;
+  dap::DapPhy& phy = dap::debug_phy();
+  if (phy.ensure_init() != ESP_OK ||
+      session::leases().begin(session::RESOURCE_SWD, session::CLIENT_BENCH) ==
+          session::grant_t::DENIED) {
+    append(length,
+           "{\"bench\":\"swd\",\"error\":\"debug port unavailable\"}\n");
+    return length;
+  }
+
+  // raw clocking first, it needs no target: all ones is a line reset
+  unsigned long line_rate = 0;
+  if (phy.connect(dap::PORT_SWD)) {
+    phy.set_clock(clock);
+    uint8_t ones[SWD_SEQUENCE_BITS / 8];
+    memset(ones, 0xff, sizeof(ones));
+
+    uint64_t bits = uint64_t{words} * 32;
+    int64_t start = esp_timer_get_time();
+    for (uint64_t done = 0; done < bits; done += SWD_SEQUENCE_BITS) {
+      phy.swd_sequence(SWD_SEQUENCE_BITS, ones, nullptr);
+    }
+    line_rate = per_second(bits, esp_timer_get_time() - start);
+    phy.disconnect();
+  }
+
+  // then MEM-AP reads, re-reading one window so any target with RAM works
+  dap::TargetAccess access(phy);
+  bool target = access.connect(clock) == ESP_OK;
+  unsigned long word_rate = 0;
+  if (target) {
+    uint64_t bytes = uint64_t{words} * 4;
+    int64_t start = esp_timer_get_time();
+    for (uint64_t done = 0; target && done < bytes; done += SWD_CHUNK) {
+      size_t count = std::min<uint64_t>(SWD_CHUNK, bytes - done);
+      target = access.read_memory(address & ~3u, swd_chunk, count) == ESP_OK;
+    }
+    word_rate = target ? per_second(words, esp_timer_get_time() - start) : 0;
+  }
+  access.disconnect();
+  session::leases().release(session::RESOURCE_SWD, session::CLIENT_BENCH);
+
+  append(length,
+         "{\"bench\":\"swd\",\"clock\":%lu,\"words\":%lu,"
+         "\"line_bits_per_s\":%lu,\"target\":%s,\"words_per_s\":%lu}\n",
+         static_cast<unsigned long>(clock), static_cast<unsigned long>(words),
+         line_rate, target ? "true" : "false", word_rate);
+  return length;
+}
+
+size_t BenchServer::uart(uint32_t bytes) {
+  size_t length = 0;
+  if (!uart_ready_) {
+    if (session::leases().begin(session::RESOURCE_TARGET_UART,
+                                session::CLIENT_BENCH) ==
+        session::grant_t::DENIED) {
+      append(length, "{\"bench\":\"uart\",\"error\":\"UART in use\"}\n");
+      return length;
+    }
+    esp_err_t ret = uart_.init(serial::uart_dma_config_t{
+        .port = CONFIG_FLUIDITY_RFC2217_UART_NUM,
+        .tx_pin = CONFIG_FLUIDITY_RFC2217_TX_PIN,
+        .rx_pin = CONFIG_FLUIDITY_RFC2217_RX_PIN,
+        .baud_rate = UART_RATES[0],
+    });
+    if (ret == ESP_OK) {
+      // TXD feeds RXD inside the peripheral
+      ret = uart_set_loop_back(CONFIG_FLUIDITY_RFC2217_UART_NUM, true);
+    }
+    if (ret != ESP_OK) {
+      append(length,
+             "{\"bench\":\"uart\",\"error\":\"%s\"}\n", esp_err_to_name(ret));
+      return length;
+    }
+    uart_ready_ = true;
+  }
+
+  append(length, "{\"bench\":\"uart\",\"bytes\":%lu,\"steps\":[",
+         static_cast<unsigned long>(bytes));
+
+  uint32_t max_clean = 0;
+  for (size_t i = 0; i < std::size(UART_RATES); i++) {
+    if (uart_.set_baud_rate(UART_RATES[i]) != ESP_OK) {
+      break;
+    }
+    uart_.purge_rx();
+    size_t overruns = uart_.overruns();
+
+    uint32_t elapsed_us = 0;
+    bool clean = uart_pass(bytes, elapsed_us) && uart_.overruns() == overruns;
+    uint32_t baud_rate = uart_.baud_rate();
+    append(length,
+           "%s{\"baud\":%lu,\"clean\":%s,\"bytes_per_s\":%lu}",
+           i == 0 ? "" : ",", static_cast<unsigned long>(baud_rate),
+           clean ? "true" : "false",
+           clean ? per_second(bytes, elapsed_us) : 0);
+
+    // every faster rate would only fail slower
+    if (!clean) {
+      break;
+    }
+    max_clean = baud_rate;
+  }
+
+  append(length, "],\"max_clean_baud\":%lu}\n",
+         static_cast<unsigned long>(max_clean));
+  return length;
+}
+
+bool BenchServer::uart_pass(uint32_t bytes, uint32_t& elapsed_us) {
+  // twice the time on the wire plus slack before the pass counts as lost
+  int64_t budget_us =
+      int64_t{bytes} * 10 * 1000000 * 2 / uart_.baud_rate() + 100000;
+
+  uint32_t sent = 0;
+  uint32_t checked = 0;
+  bool match = true;
+  int64_t start = esp_timer_get_time();
+
+  while (checked < bytes) {
+    uint8_t* block;
+    while (sent < bytes && (block = uart_.acquire_tx()) != nullptr) {
+      size_t count = std::min<size_t>(serial::UartDma::TX_BLOCK_SIZE,
+                                      bytes - sent);
+      for (size_t i = 0; i < count; i++) {
+        block[i] = uart_pattern(sent + i);
+      }
+      if (uart_.transmit(block, count) != ESP_OK) {
+        return false;
+      }
+      sent += count;
+    }
+
+    serial::rx_chunk_t chunk;
+    if (uart_.receive(chunk, 1)) {
+      for (size_t i = 0; i < chunk.length; i++) {
+        if (checked + i >= bytes ||
+            chunk.data[i] != uart_pattern(checked + i)) {
+          match = false;
+        }
+      }
+      checked += chunk.length;
+      uart_.release(chunk);
+    }
+
+    if (esp_timer_get_time() - start > budget_us) {
+      match = false;
+      break;
+    }
+  }
+
+  elapsed_us = static_cast<uint32_t>(esp_timer_get_time() - start);
+  uart_.wait_tx_done(pdMS_TO_TICKS(1000));
+  return match;
+}
+
+void BenchServer::append(size_t& length, const char* format, ...) {
+  text::TextWriter out(reply_, REPLY_SIZE, length);
+  va_list args;
+  va_start(args, format);
+  out.vprint(format, args);
+  va_end(args);
+  length = out.length();
+}
+
+esp_err_t start_bench_server() {
+  return BenchServer::get_instance().start();
+}
+
+}  // namespace bench
@@ -0,0 +1,234 @@
+#include "buffer_pool.hpp"
+
+#include <new>
+
+namespace memory {
+
+uint32_t region_caps(region_t region) {
+#if CONFIG_SPIRAM
+  if (region == region_t::PSRAM) {
+    return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+  }
+#endif
+  return MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+}
+
+esp_err_t SlabPool::init(size_t block_size, size_t block_count, uint32_t caps) {
+  if (base_ != nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if (block_count == 0 || block_count >= END) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // keep every block word aligned for the wire structs placed in them
+  block_size = (block_size + 3) & ~static_cast<size_t>(3);
+
+  base_ =
+      static_cast<uint8_t*>(heap_caps_malloc(block_size * block_count, caps));
+  next_ = new (std::nothrow) std::atomic<uint16_t>[block_count];
+  if (base_ == nullptr || next_ == nullptr) {
+    heap_caps_free(base_);
+    delete[] next_;
+    base_ = nullptr;
+    next_ = nullptr;
+    return ESP_ERR_NO_MEM;
+  }
+
+  for (size_t i = 0; i < block_count; i++) {
+    next_[i].store(i + 1 < block_count ? i + 1 : END,
+                   std::memory_order_relaxed);
+  }
+
+  block_size_ = block_size;
+  block_count_ = block_count;
+  available_.store(block_count, std::memory_order_relaxed);
+  low_watermark_.store(block_count, std::memory_order_relaxed);
+  head_.store(0, std::memory_order_release);
+  return ESP_OK;
+}
+
+void* SlabPool::allocate() {
+  uint32_t head = head_.load(std::memory_order_acquire);
+
+  while (true) {
+    uint16_t index = head & 0xffff;
+    if (index == END) {
+      return nullptr;
+    }
+
+    // the tag makes a stale next index fail the exchange instead of corrupt
+    uint32_t tag = (head >> 16) + 1;
+    uint32_t desired =
+        (tag << 16) | next_[index].load(std::memory_order_relaxed);
+    if (head_.compare_exchange_weak(head, desired, std::memory_order_acq_rel,
+                                    std::memory_order_acquire)) {
+      size_t left = available_.fetch_sub(1, std::memory_order_relaxed) - 1;
+      size_t watermark = low_watermark_.load(std::memory_order_relaxed);
+      while (left < watermark &&
+             !low_watermark_.compare_exchange_weak(
+                 watermark, left, std::memory_order_relaxed)) {
+      }
+      return base_ + index * block_size_;
+    }
+  }
+}
+
+void SlabPool::release(void* block) {
+  if (!owns(block)) {
+    return;
+  }
+
+  uint16_t index = (static_cast<uint8_t*>(block) - base_) / block_size_;
+  uint32_t head = head_.load(std::memory_order_acquire);
+
+  while (true) {
+    next_[index].store(head & 0xffff, std::memory_order_relaxed);
+    uint32_t desired = (((head >> 16) + 1) << 16) | index;
+    if (head_.compare_exchange_weak(head, desired, std::memory_order_acq_rel,
+                                    std::memory_order_acquire)) {
+      available_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+}
+
+bool SlabPool::owns(const void* block) const {
+  const uint8_t* address = static_cast<const uint8_t*>(block);
+  return base_ != nullptr && address >= base_ &&
+         address < base_ + block_size_ * block_count_;
+}
+
+size_t SlabPool::available() const {
+  return available_.load(std::memory_order_relaxed);
+}
+
+size_t SlabPool::low_watermark() const {
+  return low_watermark_.load(std::memory_order_relaxed);
+}
+
+SlabPool::~SlabPool() {
+  heap_caps_free(base_);
+  delete[] next_;
+}
+
+BufferPool& BufferPool::get_instance() {
+  static BufferPool instance;
+  return instance;
+}
+
+esp_err_t BufferPool::init() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (ready_.load(std::memory_order_acquire)) {
+    return ESP_OK;
+  }
+
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    const size_class_t& size_class = CLASSES[i];
+    if (size_class.block_count == 0 || pools_[i].block_count() > 0) {
+      continue;
+    }
+
+    esp_err_t ret = pools_[i].init(size_class.block_size,
+                                   size_class.block_count,
+                                   region_caps(size_class.region));
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to reserve %zu x %zu bytes in %s: %s",
+               size_class.block_count, size_class.block_size,
+               size_class.region == region_t::PSRAM ? "PSRAM" : "internal RAM",
+               esp_err_to_name(ret));
+      return ret;
+    }
+  }
+
+  ready_.store(true, std::memory_order_release);
+  ESP_LOGI(TAG, "Buffer pool initialized");
+  return ESP_OK;
+}
+
+bool BufferPool::is_ok() const {
+  return ready_.load(std::memory_order_acquire);
+}
+
+void* BufferPool::allocate(size_t size, region_t region) {
+  if (!ready_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+
+  // fall through to the next larger class when the best fit is exhausted
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    if (CLASSES[i].region != region || CLASSES[i].block_size < size) {
+      continue;
+    }
+
+    void* block = pools_[i].allocate();
+    if (block != nullptr) {
+      return block;
+    }
+  }
+
+  return nullptr;
+}
+
+void BufferPool::release(void* block) {
+  if (block == nullptr) {
+    return;
+  }
+
+  size_t owner = find_owner(block);
+  if (owner == CLASS_COUNT) {
+    ESP_LOGE(TAG, "Releasing a block the pool does not own: %p", block);
+    return;
+  }
+
+  pools_[owner].release(block);
+}
+
+void* BufferPool::allocate_or_heap(size_t size, region_t region) {
+  void* block = allocate(size, region);
+  if (block == nullptr) {
+    block = heap_caps_malloc(size, region_caps(region));
+  }
+  return block;
+}
+
+void BufferPool::release_any(void* block) {
+  if (find_owner(block) == CLASS_COUNT) {
+    heap_caps_free(block);
+    return;
+  }
+  release(block);
+}
+
+size_t BufferPool::block_size(const void* block) const {
+  size_t owner = find_owner(block);
+  return owner == CLASS_COUNT ? 0 : pools_[owner].block_size();
+}
+
+pool_stats_t BufferPool::get_stats(size_t index) const {
+  const SlabPool& pool = pools_[index];
+  return pool_stats_t{
+      .block_size = pool.block_size(),
+      .block_count = pool.block_count(),
+      .available = pool.available(),
+      .low_watermark = pool.low_watermark(),
+      .region = CLASSES[index].region,
+  };
+}
+
+size_t BufferPool::find_owner(const void* block) const {
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    if (pools_[i].owns(block)) {
+      return i;
+    }
+  }
+  return CLASS_COUNT;
+}
+
+esp_err_t ensure_buffer_pool() {
+  return BufferPool::get_instance().init();
+}
+
+}  // namespace memory
@@ -0,0 +1,1109 @@
+#include "dap_engine.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "dap_sequences.hpp"
+#if CONFIG_FLUIDITY_SWO
+#include "swo_server.hpp"
+#endif
+
+namespace dap {
+
+namespace {
+
+constexpr char VENDOR_NAME[] = "Fluidity";
+constexpr char PRODUCT_NAME[] = "Fluidity CMSIS-DAP";
+
+constexpr uint8_t RDBUFF_READ = uint8_t{DP_RDBUFF} | uint8_t{TRANSFER_RNW};
+constexpr uint8_t DPIDR_READ = uint8_t{DP_DPIDR} | uint8_t{TRANSFER_RNW};
+constexpr uint8_t SELECT_WRITE = DP_SELECT;
+constexpr uint8_t CSW_READ = uint8_t{TRANSFER_APNDP} | uint8_t{TRANSFER_RNW};
+constexpr uint8_t TAR_READ = CSW_READ | uint8_t{TRANSFER_A2};
+constexpr uint8_t CSW_WRITE = TRANSFER_APNDP;
+constexpr uint8_t TAR_WRITE = CSW_WRITE | uint8_t{TRANSFER_A2};
+constexpr uint8_t REQUEST_REGISTER = uint8_t{TRANSFER_APNDP} |
+                                     uint8_t{TRANSFER_RNW} |
+                                     uint8_t{TRANSFER_A2} |
+                                     uint8_t{TRANSFER_A3};
+
+// APSEL and DPBANKSEL of a SELECT value, with APBANKSEL at the CSW/TAR bank
+constexpr uint32_t AP_BANK_ZERO = 0xff00000f;
+
+// TAP moves from Run-Test/Idle, TMS LSB first
+constexpr uint32_t IDLE_TO_SHIFT_IR = 0b0011;  // 4 cycles
+constexpr uint32_t IDLE_TO_SHIFT_DR = 0b001;   // 3 cycles
+constexpr uint32_t EXIT_TO_IDLE = 0b01;        // 2 cycles, through Update
+constexpr uint32_t SHIFT_TO_IDLE = 0b011;      // 3 cycles, through Update
+
+// longest response of a command that does not take a capacity, DAP_Info
+constexpr size_t FIXED_RESPONSE_MAX =
+    2 + std::max({sizeof(VENDOR_NAME), sizeof(PRODUCT_NAME),
+                  sizeof(PROTOCOL_VERSION), size_t{4}});
+
+size_t sequence_bytes(uint8_t info) {
+  size_t bits = info & 0x3f;
+  return ((bits == 0 ? 64 : bits) + 7) / 8;
+}
+
+}  // namespace
+
+DapEngine::DapEngine(DapPhy& phy) : phy_(phy) {}
+
+esp_err_t DapEngine::init() {
+  esp_err_t ret = phy_.ensure_init();
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "DAP PHY is unavailable");
+    return ret;
+  }
+
+  phy_.configure_swd(swd_config_);
+  return ESP_OK;
+}
+
+size_t DapEngine::command_length(std::span<const uint8_t> data) {
+  if (data.empty()) {
+    return 0;
+  }
+
+  auto fixed = [&](size_t length) -> size_t {
+    return data.size() >= length ? length : 0;
+  };
+
+  size_t length = 0;
+  switch (data[0]) {
+    case DAP_TRANSFER_ABORT:
+    case DAP_DISCONNECT:
+    case DAP_RESET_TARGET:
+    case DAP_SWO_STATUS:
+      length = 1;
+      break;
+    case DAP_INFO:
+    case DAP_CONNECT:
+    case DAP_SWD_CONFIGURE:
+    case DAP_JTAG_IDCODE:
+    case DAP_SWO_TRANSPORT:
+    case DAP_SWO_MODE:
+    case DAP_SWO_CONTROL:
+    case DAP_SWO_EXTENDED_STATUS:
+      length = fixed(2);
+      break;
+    case DAP_HOST_STATUS:
+    case DAP_DELAY:
+    case DAP_SWO_DATA:
+      length = fixed(3);
+      break;
+    case DAP_SWJ_CLOCK:
+    case DAP_SWO_BAUDRATE:
+      length = fixed(5);
+      break;
+    case DAP_TRANSFER_CONFIGURE:
+    case DAP_WRITE_ABORT:
+      length = fixed(6);
+      break;
+    case DAP_SWJ_PINS:
+      length = fixed(7);
+      break;
+    case DAP_TRANSFER:
+      length = transfer_length(data);
+      break;
+    case DAP_TRANSFER_BLOCK:
+      if (data.size() >= 5) {
+        size_t count = data[2] | data[3] << 8;
+        length = data[4] & TRANSFER_RNW ? 5 : fixed(5 + 4 * count);
+      }
+      break;
+    case DAP_SWJ_SEQUENCE:
+      if (data.size() >= 2) {
+        size_t bits = data[1] == 0 ? 256 : data[1];
+        length = fixed(2 + (bits + 7) / 8);
+      }
+      break;
+    case DAP_JTAG_CONFIGURE:
+      if (data.size() >= 2) {
+        length = fixed(2 + data[1]);
+      }
+      break;
+    case DAP_SWD_SEQUENCE:
+      length = swd_sequence_length(data);
+      break;
+    case DAP_JTAG_SEQUENCE:
+      length = jtag_sequence_length(data);
+      break;
+    case DAP_QUEUE_COMMANDS:
+    case DAP_EXECUTE_COMMANDS:
+      length = execute_commands_length(data);
+      break;
+    default:
+      // vendor or unknown, only the command byte can be accounted for
+      length = 1;
+      break;
+  }
+
+  // a command still incomplete with a whole packet at hand never will be
+  if ((length == 0 && data.size() >= PACKET_SIZE) || length > PACKET_SIZE) {
+    return MALFORMED;
+  }
+  return length;
+}
+
+size_t DapEngine::execute(std::span<const uint8_t> command,
+                          std::span<uint8_t> response) {
+  static_assert(PACKET_SIZE >= FIXED_RESPONSE_MAX);
+  cursor_t in{command.data(), command.data() + command.size()};
+  return execute_one(in, response.data(), response.size());
+}
+
+void DapEngine::reset() {
+  if (port_ != PORT_DISABLED) {
+    phy_.disconnect();
+  }
+  forget();
+}
+
+void DapEngine::forget() {
+  port_ = PORT_DISABLED;
+  clock_ = 0;
+  jtag_ir_valid_ = false;
+  select_valid_ = false;
+  saved_ = false;
+}
+
+void DapEngine::suspend() {
+  saved_ = false;
+  if (port_ == PORT_DISABLED || !select_valid_) {
+    return;
+  }
+
+  // AP reads are posted: the TAR read returns CSW, RDBUFF returns TAR
+  uint32_t host_select = select_;
+  uint32_t value = host_select & AP_BANK_ZERO;
+  uint32_t csw = 0;
+  uint32_t tar = 0;
+  bool ok = transfer_retry(SELECT_WRITE, value) == TRANSFER_OK &&
+            transfer_retry(CSW_READ, csw) == TRANSFER_OK &&
+            transfer_retry(TAR_READ, csw) == TRANSFER_OK &&
+            transfer_retry(RDBUFF_READ, tar) == TRANSFER_OK;
+  value = host_select;
+  transfer_retry(SELECT_WRITE, value);
+
+  saved_ = ok;
+  saved_csw_ = csw;
+  saved_tar_ = tar;
+}
+
+void DapEngine::resume() {
+  if (port_ == PORT_DISABLED) {
+    return;
+  }
+  if (!phy_.connect(port_)) {
+    port_ = PORT_DISABLED;
+    return;
+  }
+  if (clock_ != 0) {
+    phy_.set_clock(clock_);
+  }
+  phy_.configure_swd(swd_config_);
+  jtag_ir_valid_ = false;
+
+  // the other client left the SWJ-DP in SWD, perhaps just after a line
+  // reset, which holds the DP in reset until DPIDR is read
+  phy_.swj_sequence(LINE_RESET.BITS, LINE_RESET.data.data());
+  if (port_ == PORT_JTAG) {
+    phy_.swj_sequence(SWD_TO_JTAG.BITS, SWD_TO_JTAG.data.data());
+    // Test-Logic-Reset, then Run-Test/Idle where every scan starts
+    phy_.swj_sequence(LINE_RESET.BITS, LINE_RESET.data.data());
+    phy_.swj_sequence(IDLE_CYCLES.BITS, IDLE_CYCLES.data.data());
+  } else {
+    phy_.swj_sequence(IDLE_CYCLES.BITS, IDLE_CYCLES.data.data());
+    uint32_t dpidr;
+    transfer_retry(DPIDR_READ, dpidr);
+  }
+
+  if (select_valid_) {
+    uint32_t host_select = select_;
+    uint32_t value;
+    if (saved_) {
+      value = host_select & AP_BANK_ZERO;
+      transfer_retry(SELECT_WRITE, value);
+      value = saved_csw_;
+      transfer_retry(CSW_WRITE, value);
+      value = saved_tar_;
+      transfer_retry(TAR_WRITE, value);
+    }
+    value = host_select;
+    transfer_retry(SELECT_WRITE, value);
+    // AP writes are posted too
+    transfer_retry(RDBUFF_READ, value);
+  }
+  saved_ = false;
+}
+
+size_t DapEngine::execute_one(cursor_t& in, uint8_t* out, size_t capacity) {
+  uint8_t command = in.u8();
+  out[0] = command;
+  out[1] = DAP_OK;
+
+  switch (command) {
+    case DAP_INFO:
+      return info(in, out);
+
+    case DAP_HOST_STATUS:
+      // there are no status LEDs to drive
+      in.u16();
+      return 2;
+
+    case DAP_CONNECT: {
+      uint8_t port = in.u8();
+      if (port == PORT_DISABLED) {
+        port = PORT_SWD;
+      }
+      port_ = phy_.connect(port) ? port : uint8_t{PORT_DISABLED};
+      jtag_ir_valid_ = false;
+      out[1] = port_;
+      return 2;
+    }
+
+    case DAP_DISCONNECT:
+      phy_.disconnect();
+      port_ = PORT_DISABLED;
+      return 2;
+
+    case DAP_TRANSFER_CONFIGURE:
+      swd_config_.idle_cycles = in.u8();
+      wait_retry_ = in.u16();
+      match_retry_ = in.u16();
+      phy_.configure_swd(swd_config_);
+      return 2;
+
+    case DAP_TRANSFER:
+      return transfer(in, out, capacity);
+
+    case DAP_TRANSFER_BLOCK:
+      return transfer_block(in, out, capacity);
+
+    case DAP_TRANSFER_ABORT:
+      // commands run to completion before the next is parsed, so there is
+      // never a transfer to abort; the command has no response
+      return 0;
+
+    case DAP_WRITE_ABORT: {
+      uint8_t index = in.u8();
+      uint32_t value = in.u32();
+      if (port_ == PORT_JTAG && select_device(index)) {
+        jtag_write_abort(value);
+      } else if (port_ != PORT_SWD ||
+                 transfer_retry(DP_ABORT, value) != TRANSFER_OK) {
+        out[1] = DAP_ERROR;
+      }
+      return 2;
+    }
+
+    case DAP_DELAY:
+      esp_rom_delay_us(in.u16());
+      return 2;
+
+    case DAP_RESET_TARGET:
+      // no device-specific reset sequence is implemented
+      out[2] = 0;
+      return 3;
+
+    case DAP_SWJ_PINS:
+      return swj_pins(in, out);
+
+    case DAP_SWJ_CLOCK: {
+      uint32_t frequency = in.u32();
+      if (frequency == 0) {
+        out[1] = DAP_ERROR;
+      } else {
+        phy_.set_clock(frequency);
+        clock_ = frequency;
+      }
+      return 2;
+    }
+
+    case DAP_SWJ_SEQUENCE: {
+      size_t bits = in.u8();
+      if (bits == 0) {
+        bits = 256;
+      }
+      phy_.swj_sequence(bits, in.data);
+      in.data += (bits + 7) / 8;
+      // the TAP may have been moved anywhere
+      jtag_ir_valid_ = false;
+      return 2;
+    }
+
+    case DAP_SWD_CONFIGURE: {
+      uint8_t config = in.u8();
+      swd_config_.turnaround = (config & 0x03) + 1;
+      swd_config_.data_phase = config & 0x04;
+      phy_.configure_swd(swd_config_);
+      return 2;
+    }
+
+    case DAP_SWD_SEQUENCE:
+      return swd_sequence(in, out, capacity);
+
+    case DAP_JTAG_SEQUENCE:
+      return jtag_sequence(in, out, capacity);
+
+    case DAP_JTAG_CONFIGURE:
+      return jtag_configure(in, out);
+
+    case DAP_JTAG_IDCODE:
+      return jtag_idcode(in, out);
+
+    case DAP_EXECUTE_COMMANDS: {
+      uint8_t count = in.u8();
+      size_t length = 2;
+      uint8_t done = 0;
+      for (; done < count; done++) {
+        // each nested command is skipped by its length, whatever it read
+        std::span<const uint8_t> nested(
+            in.data, static_cast<size_t>(in.end - in.data));
+        // the rest is not run once a response might not fit, the host sees
+        // how many were
+        if (response_length(nested) > capacity - length) {
+          break;
+        }
+        const uint8_t* next = in.data + command_length(nested);
+        length += execute_one(in, out + length, capacity - length);
+        in.data = next;
+      }
+      out[1] = done;
+      return length;
+    }
+
+#if CONFIG_FLUIDITY_SWO
+    case DAP_SWO_TRANSPORT:
+    case DAP_SWO_MODE:
+    case DAP_SWO_BAUDRATE:
+    case DAP_SWO_CONTROL:
+    case DAP_SWO_STATUS:
+    case DAP_SWO_EXTENDED_STATUS:
+    case DAP_SWO_DATA:
+      return swo(command, in, out);
+#endif
+
+    default:
+      // DAP_QueueCommands is not served, nor SWO without a capture UART
+      out[0] = DAP_INVALID;
+      return 1;
+  }
+}
+
+size_t DapEngine::info(cursor_t& in, uint8_t* out) {
+  auto put_string = [&](const char* text) -> size_t {
+    size_t length = strlen(text) + 1;
+    out[1] = static_cast<uint8_t>(length);
+    memcpy(out + 2, text, length);
+    return length + 2;
+  };
+
+  switch (in.u8()) {
+    case INFO_VENDOR:
+      return put_string(VENDOR_NAME);
+    case INFO_PRODUCT:
+      return put_string(PRODUCT_NAME);
+    case INFO_PROTOCOL_VERSION:
+      return put_string(PROTOCOL_VERSION);
+    case INFO_CAPABILITIES:
+      out[1] = 1;
+      out[2] = CAPABILITY_SWD | CAPABILITY_ATOMIC_COMMANDS;
+      if (phy_.has_jtag()) {
+        out[2] |= CAPABILITY_JTAG;
+      }
+#if CONFIG_FLUIDITY_SWO
+      out[2] |= CAPABILITY_SWO_UART | CAPABILITY_SWO_STREAMING;
+#endif
+      return 3;
+#if CONFIG_FLUIDITY_SWO
+    case INFO_SWO_BUFFER_SIZE:
+      out[1] = 4;
+      put_u32(out + 2, swo::SwoServer::BUFFER_SIZE);
+      return 6;
+#endif
+    case INFO_PACKET_COUNT:
+      out[1] = 1;
+      out[2] = PACKET_COUNT;
+      return 3;
+    case INFO_PACKET_SIZE:
+      out[1] = 2;
+      put_u16(out + 2, PACKET_SIZE);
+      return 4;
+    default:
+      // not provided
+      out[1] = 0;
+      return 2;
+  }
+}
+
+size_t DapEngine::transfer(cursor_t& in, uint8_t* out, size_t capacity) {
+  uint8_t index = in.u8();  // Only JTAG chains have more than one DAP
+  uint8_t count = in.u8();
+  uint8_t done = 0;
+  uint8_t ack = 0;
+  uint8_t mismatch = 0;
+  size_t length = 3;
+
+  bool jtag = port_ == PORT_JTAG;
+  if (!(port_ == PORT_SWD || (jtag && select_device(index)))) {
+    out[1] = 0;
+    out[2] = 0;
+    return length;
+  }
+
+  // an AP read (any read over JTAG) returns the result of the previous one,
+  // so consecutive reads of one port are issued back to back and the value
+  // lands one packet late
+  auto posts = [&](uint8_t request) {
+    return jtag || (request & TRANSFER_APNDP);
+  };
+  bool posted = false;
+  uint8_t posted_port = 0;
+  // writes are confirmed by a final RDBUFF read
+  bool check_write = false;
+  uint32_t data = 0;
+
+  auto store = [&](uint32_t value) {
+    if (length + 4 > capacity) {
+      return false;
+    }
+    put_u32(out + length, value);
+    length += 4;
+    return true;
+  };
+
+  for (; done < count; done++) {
+    uint8_t request = in.u8();
+
+    if (request & TRANSFER_RNW) {
+      if (posted) {
+        if (!(request & TRANSFER_MATCH_VALUE) && posts(request) &&
+            (request & TRANSFER_APNDP) == posted_port) {
+          // this read fetches the posted value and posts its own
+          ack = transfer_retry(request, data);
+        } else {
+          ack = transfer_retry(RDBUFF_READ, data);
+          posted = false;
+        }
+        if (ack != TRANSFER_OK) {
+          break;
+        }
+        if (!store(data)) {
+          ack = TRANSFER_ERROR;
+          break;
+        }
+      }
+
+      if (request & TRANSFER_MATCH_VALUE) {
+        uint32_t match_value = in.u32();
+        uint16_t retry = match_retry_;
+        if (posts(request)) {
+          ack = transfer_retry(request, data);
+          if (ack != TRANSFER_OK) {
+            break;
+          }
+        }
+        do {
+          ack = transfer_retry(request, data);
+        } while (ack == TRANSFER_OK &&
+                 (data & match_mask_) != match_value && retry-- != 0);
+        if (ack != TRANSFER_OK) {
+          break;
+        }
+        if ((data & match_mask_) != match_value) {
+          mismatch = TRANSFER_MISMATCH;
+          break;
+        }
+      } else if (posts(request)) {
+        if (!posted) {
+          ack = transfer_retry(request, data);
+          if (ack != TRANSFER_OK) {
+            break;
+          }
+          posted = true;
+          posted_port = request & TRANSFER_APNDP;
+        }
+      } else {
+        ack = transfer_retry(request, data);
+        if (ack != TRANSFER_OK) {
+          break;
+        }
+        if (!store(data)) {
+          ack = TRANSFER_ERROR;
+          break;
+        }
+      }
+      check_write = false;
+    } else {
+      if (posted) {
+        ack = transfer_retry(RDBUFF_READ, data);
+        posted = false;
+        if (ack != TRANSFER_OK) {
+          break;
+        }
+        if (!store(data)) {
+          ack = TRANSFER_ERROR;
+          break;
+        }
+      }
+
+      data = in.u32();
+      if (request & TRANSFER_MATCH_MASK) {
+        match_mask_ = data;
+        ack = TRANSFER_OK;
+      } else {
+        ack = transfer_retry(request, data);
+        if (ack != TRANSFER_OK) {
+          break;
+        }
+        check_write = true;
+      }
+    }
+  }
+
+  if (ack == TRANSFER_OK && mismatch == 0) {
+    if (posted) {
+      ack = transfer_retry(RDBUFF_READ, data);
+      if (ack == TRANSFER_OK && !store(data)) {
+        ack = TRANSFER_ERROR;
+      }
+    } else if (check_write) {
+      ack = transfer_retry(RDBUFF_READ, data);
+    }
+  }
+
+  out[1] = done;
+  out[2] = ack | mismatch;
+  return length;
+}
+
+size_t DapEngine::transfer_block(cursor_t& in, uint8_t* out, size_t capacity) {
+  uint8_t index = in.u8();
+  size_t count = in.u16();
+  uint8_t request = in.u8();
+  size_t done = 0;
+  uint8_t ack = 0;
+  size_t length = 4;
+  uint32_t data = 0;
+
+  bool jtag = port_ == PORT_JTAG;
+  if ((port_ == PORT_SWD || (jtag && select_device(index))) && count > 0) {
+    ack = TRANSFER_OK;
+
+    if (request & TRANSFER_RNW) {
+      // never read more than the response can carry
+      count = std::min(count, capacity > length ? (capacity - length) / 4 : 0);
+
+      bool posts = jtag || (request & TRANSFER_APNDP);
+      if (posts) {
+        ack = transfer_retry(request, data);
+      }
+      while (ack == TRANSFER_OK && done < count) {
+        // the last posted read is collected from RDBUFF
+        bool last = posts && done + 1 == count;
+        ack = transfer_retry(last ? RDBUFF_READ : request, data);
+        if (ack != TRANSFER_OK) {
+          break;
+        }
+        put_u32(out + length, data);
+        length += 4;
+        done++;
+      }
+    } else {
+      while (done < count) {
+        data = in.u32();
+        ack = transfer_retry(request, data);
+        if (ack != TRANSFER_OK) {
+          break;
+        }
+        done++;
+      }
+      if (ack == TRANSFER_OK) {
+        ack = transfer_retry(RDBUFF_READ, data);
+      }
+    }
+  }
+
+  put_u16(out + 1, static_cast<uint16_t>(done));
+  out[3] = ack;
+  return length;
+}
+
+size_t DapEngine::swj_pins(cursor_t& in, uint8_t* out) {
+  uint8_t output = in.u8();
+  uint8_t select = in.u8();
+  uint32_t wait = in.u32();
+
+  uint8_t levels = phy_.swj_pins(output, select);
+  if (wait > 0) {
+    // wait for the selected pins to settle, e.g. a target holding nRESET
+    int64_t deadline = esp_timer_get_time() + wait;
+    while (((levels ^ output) & select) != 0 &&
+           esp_timer_get_time() < deadline) {
+      levels = phy_.swj_pins(0, 0);
+    }
+  }
+
+  out[1] = levels;
+  return 2;
+}
+
+size_t DapEngine::swd_sequence(cursor_t& in, uint8_t* out, size_t capacity) {
+  uint8_t count = in.u8();
+  size_t length = 2;
+
+  if (port_ != PORT_SWD) {
+    out[1] = DAP_ERROR;
+    return length;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t info = in.u8();
+    size_t bits = info & 0x3f;
+    if (bits == 0) {
+      bits = 64;
+    }
+    size_t bytes = (bits + 7) / 8;
+
+    if (info & 0x80) {
+      if (length + bytes > capacity) {
+        out[1] = DAP_ERROR;
+        break;
+      }
+      phy_.swd_sequence(bits, nullptr, out + length);
+      length += bytes;
+    } else {
+      phy_.swd_sequence(bits, in.data, nullptr);
+      in.data += bytes;
+    }
+  }
+
+  return length;
+}
+
+size_t DapEngine::jtag_sequence(cursor_t& in, uint8_t* out, size_t capacity) {
+  uint8_t count = in.u8();
+  size_t length = 2;
+
+  if (port_ != PORT_JTAG) {
+    out[1] = DAP_ERROR;
+    return length;
+  }
+
+  // the TAP may end up anywhere
+  jtag_ir_valid_ = false;
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t info = in.u8();
+    size_t bits = info & 0x3f;
+    if (bits == 0) {
+      bits = 64;
+    }
+    size_t bytes = (bits + 7) / 8;
+    bool capture = info & 0x80;
+    uint32_t tms = info & 0x40 ? 0xffffffff : 0;
+
+    if (capture && length + bytes > capacity) {
+      out[1] = DAP_ERROR;
+      break;
+    }
+
+    // a word of TCK cycles per PHY call
+    for (size_t bit = 0; bit < bits; bit += 32) {
+      size_t chunk = std::min<size_t>(bits - bit, 32);
+      const uint8_t* tdi = in.data + bit / 8;
+      uint32_t value = 0;
+      for (size_t byte = 0; byte < (chunk + 7) / 8; byte++) {
+        value |= static_cast<uint32_t>(tdi[byte]) << (8 * byte);
+      }
+
+      uint32_t tdo = phy_.jtag_shift(chunk, tms, value);
+      if (capture) {
+        for (size_t byte = 0; byte < (chunk + 7) / 8; byte++) {
+          out[length + bit / 8 + byte] = static_cast<uint8_t>(tdo >> 8 * byte);
+        }
+      }
+    }
+
+    in.data += bytes;
+    if (capture) {
+      length += bytes;
+    }
+  }
+
+  return length;
+}
+
+size_t DapEngine::jtag_configure(cursor_t& in, uint8_t* out) {
+  uint8_t count = in.u8();
+
+  if (count == 0 || count > JTAG_MAX_DEVICES) {
+    in.data += count;
+    out[1] = DAP_ERROR;
+    return 2;
+  }
+
+  uint16_t bits = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    chain_.ir_length[i] = in.u8();
+    chain_.ir_before[i] = bits;
+    bits += chain_.ir_length[i];
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    chain_.ir_after[i] = bits - chain_.ir_before[i] - chain_.ir_length[i];
+  }
+  chain_.count = count;
+  chain_.index = 0;
+  jtag_ir_valid_ = false;
+
+  return 2;
+}
+
+size_t DapEngine::jtag_idcode(cursor_t& in, uint8_t* out) {
+  uint8_t index = in.u8();
+
+  if (port_ != PORT_JTAG || !select_device(index)) {
+    out[1] = DAP_ERROR;
+    return 2;
+  }
+
+  jtag_write_ir(IR_IDCODE);
+  phy_.jtag_shift(3, IDLE_TO_SHIFT_DR, 0);
+  jtag_scan(chain_.index, 0xffffffff, false);
+  // the devices after it never need to be shifted through
+  uint32_t idcode = jtag_scan(32, 0, true);
+  phy_.jtag_shift(2, EXIT_TO_IDLE, 0);
+
+  put_u32(out + 2, idcode);
+  return 6;
+}
+
+#if CONFIG_FLUIDITY_SWO
+size_t DapEngine::swo(uint8_t command, cursor_t& in, uint8_t* out) {
+  swo::SwoServer& server = swo::SwoServer::get_instance();
+
+  auto status = [&]() -> uint8_t {
+    uint8_t value = server.is_capturing() ? SWO_CAPTURE_ACTIVE : 0;
+    return server.take_overrun() ? value | SWO_BUFFER_OVERRUN : value;
+  };
+
+  switch (command) {
+    case DAP_SWO_TRANSPORT: {
+      // trace data leaves through the stream only
+      uint8_t transport = in.u8();
+      if (transport != SWO_TRANSPORT_NONE &&
+          transport != SWO_TRANSPORT_STREAM) {
+        out[1] = DAP_ERROR;
+      }
+      return 2;
+    }
+
+    case DAP_SWO_MODE: {
+      uint8_t mode = in.u8();
+      if (mode == SWO_MODE_OFF) {
+        server.set_capturing(false);
+      } else if (mode != SWO_MODE_UART) {
+        out[1] = DAP_ERROR;
+      }
+      return 2;
+    }
+
+    case DAP_SWO_BAUDRATE:
+      put_u32(out + 1, server.set_baud_rate(in.u32()));
+      return 5;
+
+    case DAP_SWO_CONTROL:
+      server.set_capturing(in.u8() & 1);
+      return 2;
+
+    case DAP_SWO_STATUS:
+      out[1] = status();
+      put_u32(out + 2, server.pending());
+      return 6;
+
+    case DAP_SWO_EXTENDED_STATUS: {
+      // there are no trace timestamps, the stream frames carry their own
+      uint8_t control = in.u8();
+      size_t length = 1;
+      if (control & SWO_EXTENDED_STATUS) {
+        out[length++] = status();
+      }
+      if (control & SWO_EXTENDED_COUNT) {
+        put_u32(out + length, server.pending());
+        length += 4;
+      }
+      return length;
+    }
+
+    default:
+      // DAP_SWO_Data, with nothing to hand out of band
+      in.u16();
+      out[1] = status();
+      put_u16(out + 2, 0);
+      return 4;
+  }
+}
+#endif
+
+bool DapEngine::select_device(uint8_t index) {
+  if (index >= chain_.count) {
+    return false;
+  }
+
+  if (index != chain_.index) {
+    // the bypassed devices around it change, so does every IR scan
+    chain_.index = index;
+    jtag_ir_valid_ = false;
+  }
+  return true;
+}
+
+uint8_t DapEngine::transfer_retry(uint8_t request, uint32_t& data) {
+  uint16_t retry = wait_retry_;
+  uint8_t ack;
+
+  do {
+    ack = port_ == PORT_JTAG ? jtag_transfer(request, data)
+                             : phy_.swd_transfer(request, data);
+  } while (ack == TRANSFER_WAIT && retry-- != 0);
+
+  // SELECT is write-only, a handoff can only restore what was seen here
+  if (ack == TRANSFER_OK && (request & REQUEST_REGISTER) == SELECT_WRITE) {
+    select_ = data;
+    select_valid_ = true;
+  }
+  return ack;
+}
+
+uint8_t DapEngine::jtag_transfer(uint8_t request, uint32_t& data) {
+  jtag_write_ir(request & TRANSFER_APNDP ? IR_APACC : IR_DPACC);
+
+  size_t after = chain_.count - chain_.index - 1;
+  phy_.jtag_shift(3, IDLE_TO_SHIFT_DR, 0);
+  jtag_scan(chain_.index, 0xffffffff, false);
+
+  // RnW, A2 and A3 go in while the ACK comes out
+  uint8_t ack = static_cast<uint8_t>(phy_.jtag_shift(3, 0, request >> 1));
+  if (ack != JTAG_ACK_OK) {
+    // the access never happens, leave the data phase early
+    phy_.jtag_shift(3, SHIFT_TO_IDLE, 0);
+    return ack == JTAG_ACK_WAIT ? TRANSFER_WAIT : TRANSFER_NO_ACK;
+  }
+
+  uint32_t value = jtag_scan(32, data, after == 0);
+  jtag_scan(after, 0xffffffff, true);
+  phy_.jtag_shift(2, EXIT_TO_IDLE, 0);
+  jtag_scan(swd_config_.idle_cycles, 0, false);
+
+  if (request & TRANSFER_RNW) {
+    data = value;
+  }
+  return TRANSFER_OK;
+}
+
+void DapEngine::jtag_write_abort(uint32_t data) {
+  jtag_write_ir(IR_ABORT);
+
+  size_t after = chain_.count - chain_.index - 1;
+  phy_.jtag_shift(3, IDLE_TO_SHIFT_DR, 0);
+  jtag_scan(chain_.index, 0xffffffff, false);
+  // the ABORT chain has no ACK, its three low bits are written as zero
+  phy_.jtag_shift(3, 0, 0);
+  jtag_scan(32, data, after == 0);
+  jtag_scan(after, 0xffffffff, true);
+  phy_.jtag_shift(2, EXIT_TO_IDLE, 0);
+}
+
+void DapEngine::jtag_write_ir(uint32_t ir) {
+  if (jtag_ir_valid_ && jtag_ir_ == ir) {
+    return;
+  }
+
+  size_t index = chain_.index;
+  // every other device gets BYPASS, all ones
+  phy_.jtag_shift(4, IDLE_TO_SHIFT_IR, 0);
+  jtag_scan(chain_.ir_before[index], 0xffffffff, false);
+  jtag_scan(chain_.ir_length[index], ir, chain_.ir_after[index] == 0);
+  jtag_scan(chain_.ir_after[index], 0xffffffff, true);
+  phy_.jtag_shift(2, EXIT_TO_IDLE, 0);
+
+  jtag_ir_ = ir;
+  jtag_ir_valid_ = true;
+}
+
+uint32_t DapEngine::jtag_scan(size_t bits, uint32_t value, bool exit) {
+  uint32_t tdo = 0;
+  bool first = true;
+
+  while (bits > 0) {
+    size_t chunk = std::min<size_t>(bits, 32);
+    bits -= chunk;
+    uint32_t tms = exit && bits == 0 ? 1u << (chunk - 1) : 0;
+    uint32_t captured = phy_.jtag_shift(chunk, tms, first ? value : 0xffffffff);
+    if (first) {
+      tdo = captured;
+      first = false;
+    }
+  }
+
+  return tdo;
+}
+
+size_t DapEngine::transfer_length(std::span<const uint8_t> data) {
+  if (data.size() < 3) {
+    return 0;
+  }
+
+  size_t length = 3;
+  for (size_t i = 0; i < data[2]; i++) {
+    if (length >= data.size()) {
+      return 0;
+    }
+    uint8_t request = data[length++];
+    // writes and value matches carry a word
+    if (!(request & TRANSFER_RNW) || (request & TRANSFER_MATCH_VALUE)) {
+      length += 4;
+    }
+  }
+
+  return length <= data.size() ? length : 0;
+}
+
+size_t DapEngine::swd_sequence_length(std::span<const uint8_t> data) {
+  if (data.size() < 2) {
+    return 0;
+  }
+
+  size_t length = 2;
+  for (size_t i = 0; i < data[1]; i++) {
+    if (length >= data.size()) {
+      return 0;
+    }
+    uint8_t info = data[length++];
+    // only output sequences carry data
+    if (!(info & 0x80)) {
+      length += sequence_bytes(info);
+    }
+  }
+
+  return length <= data.size() ? length : 0;
+}
+
+size_t DapEngine::jtag_sequence_length(std::span<const uint8_t> data) {
+  if (data.size() < 2) {
+    return 0;
+  }
+
+  size_t length = 2;
+  for (size_t i = 0; i < data[1]; i++) {
+    if (length >= data.size()) {
+      return 0;
+    }
+    // TDI data follows every sequence, captured or not
+    length += 1 + sequence_bytes(data[length]);
+  }
+
+  return length <= data.size() ? length : 0;
+}
+
+size_t DapEngine::execute_commands_length(std::span<const uint8_t> data) {
+  if (data.size() < 2) {
+    return 0;
+  }
+
+  size_t length = 2;
+  for (size_t i = 0; i < data[1]; i++) {
+    if (length >= data.size()) {
+      return 0;
+    }
+    size_t command = command_length(data.subspan(length));
+    if (command == 0 || command == MALFORMED) {
+      return command;
+    }
+    length += command;
+  }
+
+  return length;
+}
+
+size_t DapEngine::response_length(std::span<const uint8_t> data) {
+  switch (data[0]) {
+    case DAP_TRANSFER_ABORT:
+      return 0;
+    case DAP_INFO:
+      return FIXED_RESPONSE_MAX;
+    case DAP_RESET_TARGET:
+      return 3;
+    case DAP_SWO_DATA:
+      return 4;
+    case DAP_SWO_BAUDRATE:
+      return 5;
+    case DAP_JTAG_IDCODE:
+    case DAP_SWO_STATUS:
+    case DAP_SWO_EXTENDED_STATUS:
+      return 6;
+
+    case DAP_TRANSFER: {
+      // every read but a value match returns a word
+      size_t length = 3;
+      size_t offset = 3;
+      for (size_t i = 0; i < data[2]; i++) {
+        uint8_t request = data[offset++];
+        if (!(request & TRANSFER_RNW) || (request & TRANSFER_MATCH_VALUE)) {
+          offset += 4;
+        }
+        if ((request & TRANSFER_RNW) && !(request & TRANSFER_MATCH_VALUE)) {
+          length += 4;
+        }
+      }
+      return length;
+    }
+
+    case DAP_TRANSFER_BLOCK: {
+      size_t count = data[2] | data[3] << 8;
+      return data[4] & TRANSFER_RNW ? 4 + 4 * count : 4;
+    }
+
+    case DAP_SWD_SEQUENCE:
+    case DAP_JTAG_SEQUENCE: {
+      // both return what they capture; SWD only carries data for output
+      // sequences, JTAG carries TDI for every one
+      bool swd = data[0] == DAP_SWD_SEQUENCE;
+      size_t length = 2;
+      size_t offset = 2;
+      for (size_t i = 0; i < data[1]; i++) {
+        uint8_t info = data[offset++];
+        size_t bytes = sequence_bytes(info);
+        if (info & 0x80) {
+          length += bytes;
+        }
+        if (!swd || !(info & 0x80)) {
+          offset += bytes;
+        }
+      }
+      return length;
+    }
+
+    default:
+      // nested DAP_ExecuteCommands stops short of its capacity by itself
+      return 2;
+  }
+}
+
+void DapEngine::put_u16(uint8_t* out, uint16_t value) {
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void DapEngine::put_u32(uint8_t* out, uint32_t value) {
+  out[0] = static_cast<uint8_t>(value);
+  out[1] = static_cast<uint8_t>(value >> 8);
+  out[2] = static_cast<uint8_t>(value >> 16);
+  out[3] = static_cast<uint8_t>(value >> 24);
+}
+
+}  // namespace dap
@@ -0,0 +1,20 @@
+#include "dap_phy.hpp"
+
+#include "sdkconfig.h"
+#if CONFIG_FLUIDITY_DAP_PHY_DEDICATED_GPIO
+#include "dedicated_gpio_phy.hpp"
+#else
+#include "swd_gpio.hpp"
+#endif
+
+namespace dap {
+
+DapPhy& debug_phy() {
+#if CONFIG_FLUIDITY_DAP_PHY_DEDICATED_GPIO
+  return DedicatedGpioPhy::get_instance();
+#else
+  return GpioSwdPhy::get_instance();
+#endif
+}
+
+}  // namespace dap
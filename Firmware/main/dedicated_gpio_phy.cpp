@@ -0,0 +1,388 @@
+#include "dedicated_gpio_phy.hpp"
+
+#include <utility>
+#include "dap_defs.hpp"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "hal/dedic_gpio_cpu_ll.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc.h"
+
+namespace dap {
+
+namespace {
+
+constexpr uint32_t CPU_FREQUENCY = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000;
+
+// cycles one unpaced clock phase takes, subtracted from the pacing delay
+constexpr uint32_t PHASE_OVERHEAD = 4;
+
+// data and parity bits clocked through when a transfer is not answered OK
+constexpr size_t DATA_PHASE_BITS = 33;
+
+}  // namespace
+
+DedicatedGpioPhy& DedicatedGpioPhy::get_instance() {
+  static DedicatedGpioPhy instance;
+  return instance;
+}
+
+esp_err_t DedicatedGpioPhy::init() {
+  gpio_config_t io_config{};
+  io_config.pin_bit_mask = (1ULL << SWCLK) | (1ULL << SWDIO);
+  if (has_jtag()) {
+    io_config.pin_bit_mask |= (1ULL << TDI) | (1ULL << TDO);
+  }
+  io_config.mode = GPIO_MODE_INPUT_OUTPUT;
+  io_config.pull_up_en = GPIO_PULLUP_ENABLE;
+  io_config.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_config.intr_type = GPIO_INTR_DISABLE;
+
+  esp_err_t ret = gpio_config(&io_config);
+  if (ret == ESP_OK && NRESET >= 0) {
+    io_config.pin_bit_mask = 1ULL << NRESET;
+    io_config.mode = GPIO_MODE_INPUT_OUTPUT_OD;
+    ret = gpio_config(&io_config);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to configure DAP pins: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  int out_pins[] = {SWCLK, SWDIO, TDI};
+  dedic_gpio_bundle_config_t out_config{};
+  out_config.gpio_array = out_pins;
+  out_config.array_size = has_jtag() ? 3 : 2;
+  out_config.flags.out_en = 1;
+
+  int in_pins[] = {SWDIO, TDO};
+  dedic_gpio_bundle_config_t in_config{};
+  in_config.gpio_array = in_pins;
+  in_config.array_size = has_jtag() ? 2 : 1;
+  in_config.flags.in_en = 1;
+
+  ret = dedic_gpio_new_bundle(&out_config, &out_bundle_);
+  if (ret == ESP_OK) {
+    ret = dedic_gpio_new_bundle(&in_config, &in_bundle_);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to create GPIO bundles: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  uint32_t out_offset = 0;
+  uint32_t in_offset = 0;
+  dedic_gpio_get_out_offset(out_bundle_, &out_offset);
+  dedic_gpio_get_in_offset(in_bundle_, &in_offset);
+  clk_ = 1u << out_offset;
+  dio_ = 1u << (out_offset + 1);
+  tdi_ = has_jtag() ? 1u << (out_offset + 2) : 0;
+  dio_in_shift_ = in_offset;
+  tdo_in_shift_ = in_offset + 1;
+
+  // the bundle keeps its output signals routed for good, drivers are
+  // switched through GPIO_ENABLE_REG instead (SWDIO turns around mid-packet)
+  for (size_t i = 0; i < out_config.array_size; i++) {
+    gpio_ll_set_output_enable_ctrl(hw_, out_pins[i], false, false);
+  }
+
+  if (NRESET >= 0) {
+    gpio_ll_set_level(hw_, NRESET, 1);
+  }
+  disconnect();
+  set_clock(1000000);
+
+  ESP_LOGI(TAG, "DAP on dedicated GPIO, SWCLK/TCK %d, SWDIO/TMS %d%s", SWCLK,
+           SWDIO, has_jtag() ? ", JTAG" : "");
+  return ESP_OK;
+}
+
+bool DedicatedGpioPhy::connect(uint8_t port) {
+  if (port != PORT_SWD && !(port == PORT_JTAG && has_jtag())) {
+    return false;
+  }
+
+  dedic_gpio_cpu_ll_write_mask(clk_ | dio_ | tdi_, clk_ | dio_ | tdi_);
+  set_output(SWCLK, true);
+  set_swdio_output(true);
+
+  if (port == PORT_JTAG) {
+    set_output(TDI, true);
+    // a SWJ-DP may still be in SWD from an earlier session, switch it back
+    // and leave the TAP in Run-Test/Idle
+    emit(LINE_RESET);
+    emit(SWD_TO_JTAG);
+    emit(LINE_RESET);
+    write_bit<false>(0);
+  }
+  return true;
+}
+
+void DedicatedGpioPhy::disconnect() {
+  set_output(SWCLK, false);
+  set_swdio_output(false);
+  if (has_jtag()) {
+    set_output(TDI, false);
+  }
+}
+
+void DedicatedGpioPhy::set_clock(uint32_t frequency) {
+  if (frequency == 0) {
+    return;
+  }
+
+  uint32_t half_period = CPU_FREQUENCY / (2 * frequency);
+  half_period_ = half_period > PHASE_OVERHEAD ? half_period - PHASE_OVERHEAD
+                                              : 0;
+}
+
+void DedicatedGpioPhy::configure_swd(const swd_config_t& config) {
+  config_ = config;
+}
+
+void DedicatedGpioPhy::swj_sequence(size_t bits, const uint8_t* data) {
+  if (half_period_ == 0) {
+    write_sequence<false>(bits, data);
+  } else {
+    write_sequence<true>(bits, data);
+  }
+}
+
+void DedicatedGpioPhy::swd_sequence(size_t bits,
+                                    const uint8_t* out,
+                                    uint8_t* in) {
+  if (out != nullptr) {
+    swj_sequence(bits, out);
+    return;
+  }
+
+  set_swdio_output(false);
+  if (half_period_ == 0) {
+    read_sequence<false>(bits, in);
+  } else {
+    read_sequence<true>(bits, in);
+  }
+  set_swdio_output(true);
+}
+
+uint8_t DedicatedGpioPhy::swd_transfer(uint8_t request, uint32_t& data) {
+  return half_period_ == 0 ? transfer<false>(request, data)
+                           : transfer<true>(request, data);
+}
+
+uint8_t DedicatedGpioPhy::swj_pins(uint8_t output, uint8_t select) {
+  uint32_t mask = 0;
+  uint32_t value = 0;
+  auto drive = [&](uint32_t line, uint8_t pin) {
+    if (select & (1 << pin)) {
+      mask |= line;
+      value |= (output >> pin) & 1 ? line : 0;
+    }
+  };
+  drive(clk_, PIN_SWCLK_TCK);
+  drive(dio_, PIN_SWDIO_TMS);
+  drive(tdi_, PIN_TDI);
+  dedic_gpio_cpu_ll_write_mask(mask, value);
+
+  if (NRESET >= 0 && (select & (1 << PIN_NRESET))) {
+    // open drain, a one releases the line to the target's pull-up
+    gpio_ll_set_level(hw_, NRESET, (output >> PIN_NRESET) & 1);
+  }
+
+  uint32_t out = dedic_gpio_cpu_ll_read_out();
+  uint32_t in = dedic_gpio_cpu_ll_read_in();
+  uint8_t levels = (out & clk_ ? 1 : 0) << PIN_SWCLK_TCK |
+                   ((in >> dio_in_shift_) & 1) << PIN_SWDIO_TMS;
+  if (has_jtag()) {
+    levels |= (out & tdi_ ? 1 : 0) << PIN_TDI;
+    levels |= ((in >> tdo_in_shift_) & 1) << PIN_TDO;
+  }
+  if (NRESET >= 0) {
+    levels |= gpio_ll_get_level(hw_, NRESET) << PIN_NRESET;
+  }
+  return levels;
+}
+
+uint32_t DedicatedGpioPhy::jtag_shift(size_t bits, uint32_t tms, uint32_t tdi) {
+  return half_period_ == 0 ? shift_jtag<false>(bits, tms, tdi)
+                           : shift_jtag<true>(bits, tms, tdi);
+}
+
+void DedicatedGpioPhy::set_output(int pin, bool enable) {
+  // straight to the enable register, gpio_ll_output_disable() would also
+  // unroute the dedicated output signal from the pad
+  uint32_t bit = 1u << (pin % 32);
+  if (pin < 32) {
+    REG_WRITE(enable ? GPIO_ENABLE_W1TS_REG : GPIO_ENABLE_W1TC_REG, bit);
+  } else {
+    REG_WRITE(enable ? GPIO_ENABLE1_W1TS_REG : GPIO_ENABLE1_W1TC_REG, bit);
+  }
+}
+
+template <bool Paced>
+inline void DedicatedGpioPhy::delay() const {
+  if constexpr (Paced) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    while (esp_cpu_get_cycle_count() - start < half_period_) {
+    }
+  }
+}
+
+// the host changes SWDIO while SWCLK is low, the target samples on the rise
+template <bool Paced>
+inline void DedicatedGpioPhy::write_bit(uint32_t bit) {
+  dedic_gpio_cpu_ll_write_mask(clk_ | dio_, bit ? dio_ : 0);
+  delay<Paced>();
+  dedic_gpio_cpu_ll_write_mask(clk_, clk_);
+  delay<Paced>();
+}
+
+// the target changes SWDIO on the rise, so it is stable while SWCLK is low
+template <bool Paced>
+inline uint32_t DedicatedGpioPhy::read_bit() {
+  dedic_gpio_cpu_ll_write_mask(clk_, 0);
+  delay<Paced>();
+  uint32_t bit = (dedic_gpio_cpu_ll_read_in() >> dio_in_shift_) & 1;
+  dedic_gpio_cpu_ll_write_mask(clk_, clk_);
+  delay<Paced>();
+  return bit;
+}
+
+template <bool Paced>
+inline void DedicatedGpioPhy::clock_cycles(size_t cycles) {
+  for (size_t i = 0; i < cycles; i++) {
+    dedic_gpio_cpu_ll_write_mask(clk_, 0);
+    delay<Paced>();
+    dedic_gpio_cpu_ll_write_mask(clk_, clk_);
+    delay<Paced>();
+  }
+}
+
+template <size_t Bits, bool Paced>
+inline void DedicatedGpioPhy::write_word(uint32_t value) {
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    (write_bit<Paced>((value >> I) & 1), ...);
+  }(std::make_index_sequence<Bits>{});
+}
+
+template <size_t Bits, bool Paced>
+inline uint32_t DedicatedGpioPhy::read_word() {
+  uint32_t value = 0;
+  [&]<size_t... I>(std::index_sequence<I...>) {
+    ((value |= read_bit<Paced>() << I), ...);
+  }(std::make_index_sequence<Bits>{});
+  return value;
+}
+
+template <bool Paced>
+void DedicatedGpioPhy::write_sequence(size_t bits, const uint8_t* data) {
+  size_t i = 0;
+  for (; i + 8 <= bits; i += 8) {
+    write_word<8, Paced>(data[i / 8]);
+  }
+  for (; i < bits; i++) {
+    write_bit<Paced>((data[i / 8] >> (i % 8)) & 1);
+  }
+}
+
+template <bool Paced>
+void DedicatedGpioPhy::read_sequence(size_t bits, uint8_t* data) {
+  size_t i = 0;
+  for (; i + 8 <= bits; i += 8) {
+    data[i / 8] = static_cast<uint8_t>(read_word<8, Paced>());
+  }
+  if (i < bits) {
+    uint8_t last = 0;
+    for (size_t bit = 0; i < bits; i++, bit++) {
+      last |= static_cast<uint8_t>(read_bit<Paced>() << bit);
+    }
+    data[bits / 8] = last;
+  }
+}
+
+template <bool Paced>
+IRAM_ATTR uint8_t DedicatedGpioPhy::transfer(uint8_t request,
+                                             uint32_t& data) {
+  bool read = request & TRANSFER_RNW;
+
+  write_word<8, Paced>(REQUEST_HEADERS[request & 0x0f]);
+
+  set_swdio_output(false);
+  clock_cycles<Paced>(config_.turnaround);
+  uint8_t ack = static_cast<uint8_t>(read_word<3, Paced>());
+
+  if (ack == TRANSFER_OK) {
+    if (read) {
+      uint32_t value = read_word<32, Paced>();
+      uint32_t value_parity = read_bit<Paced>();
+      clock_cycles<Paced>(config_.turnaround);
+      set_swdio_output(true);
+      if (parity32(value) != value_parity) {
+        ack = TRANSFER_ERROR;
+      }
+      data = value;
+    } else {
+      clock_cycles<Paced>(config_.turnaround);
+      set_swdio_output(true);
+      write_word<32, Paced>(data);
+      write_bit<Paced>(parity32(data));
+    }
+
+    for (size_t i = 0; i < config_.idle_cycles; i++) {
+      write_bit<Paced>(0);
+    }
+    dedic_gpio_cpu_ll_write_mask(dio_, dio_);
+    return ack;
+  }
+
+  if (ack == TRANSFER_WAIT || ack == TRANSFER_FAULT) {
+    if (config_.data_phase && read) {
+      clock_cycles<Paced>(DATA_PHASE_BITS);
+    }
+    clock_cycles<Paced>(config_.turnaround);
+    set_swdio_output(true);
+    if (config_.data_phase && !read) {
+      write_word<32, Paced>(0);
+      write_bit<Paced>(0);
+    }
+    dedic_gpio_cpu_ll_write_mask(dio_, dio_);
+    return ack;
+  }
+
+  // no ACK or a garbled one, let the target drop back to idle
+  clock_cycles<Paced>(config_.turnaround + DATA_PHASE_BITS);
+  set_swdio_output(true);
+  dedic_gpio_cpu_ll_write_mask(dio_, dio_);
+  return ack;
+}
+
+// TMS and TDI change while TCK is low; TDO changes on the fall and is read
+// once TCK is high again
+template <bool Paced>
+IRAM_ATTR uint32_t DedicatedGpioPhy::shift_jtag(size_t bits,
+                                                uint32_t tms,
+                                                uint32_t tdi) {
+  uint32_t tdo = 0;
+
+  for (size_t i = 0; i < bits; i++) {
+    uint32_t value = ((tms >> i) & 1 ? dio_ : 0) | ((tdi >> i) & 1 ? tdi_ : 0);
+    dedic_gpio_cpu_ll_write_mask(clk_ | dio_ | tdi_, value);
+    delay<Paced>();
+    dedic_gpio_cpu_ll_write_mask(clk_, clk_);
+    tdo |= ((dedic_gpio_cpu_ll_read_in() >> tdo_in_shift_) & 1) << i;
+    delay<Paced>();
+  }
+
+  return tdo;
+}
+
+template <size_t Bits>
+void DedicatedGpioPhy::emit(const swj_sequence_t<Bits>& sequence) {
+  if (half_period_ == 0) {
+    write_sequence<false>(Bits, sequence.data.data());
+  } else {
+    write_sequence<true>(Bits, sequence.data.data());
+  }
+}
+
+}  // namespace dap
@@ -0,0 +1,126 @@
+#include "deferred_log.hpp"
+
+#include <cstdio>
+#include "task_topology.hpp"
+
+namespace logging {
+
+namespace {
+
+char level_letter(uint8_t level) {
+  switch (level) {
+    case ESP_LOG_ERROR:
+      return 'E';
+    case ESP_LOG_WARN:
+      return 'W';
+    case ESP_LOG_INFO:
+      return 'I';
+    case ESP_LOG_DEBUG:
+      return 'D';
+    default:
+      return 'V';
+  }
+}
+
+}  // namespace
+
+DeferredLog& DeferredLog::get_instance() {
+  static DeferredLog instance;
+  return instance;
+}
+
+DeferredLog::DeferredLog() {
+  for (size_t i = 0; i < CAPACITY; i++) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+esp_err_t DeferredLog::start() {
+  if (task_ != nullptr) {
+    return ESP_OK;
+  }
+
+  if (xTaskCreatePinnedToCore(drain_entry, "log_drain",
+                              topology::LOG_DRAIN.stack_size, this,
+                              topology::LOG_DRAIN.priority, &task_,
+                              topology::LOG_DRAIN.core_id) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create drain task");
+    task_ = nullptr;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+bool DeferredLog::push(const record_t& record) {
+  uint32_t position = head_.load(std::memory_order_relaxed);
+
+  while (true) {
+    cell_t& cell = cells_[position & (CAPACITY - 1)];
+    uint32_t sequence = cell.sequence.load(std::memory_order_acquire);
+    int32_t lag = static_cast<int32_t>(sequence - position);
+
+    if (lag == 0) {
+      // the cell is free for this position: claim it
+      if (head_.compare_exchange_weak(position, position + 1,
+                                      std::memory_order_relaxed)) {
+        cell.record = record;
+        cell.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (lag < 0) {
+      // still full from a whole ring ago
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      // another producer took it first
+      position = head_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+bool DeferredLog::pop(record_t& record) {
+  cell_t& cell = cells_[tail_ & (CAPACITY - 1)];
+  uint32_t sequence = cell.sequence.load(std::memory_order_acquire);
+  if (sequence != tail_ + 1) {
+    return false;
+  }
+
+  record = cell.record;
+  cell.sequence.store(tail_ + CAPACITY, std::memory_order_release);
+  tail_++;
+  return true;
+}
+
+void DeferredLog::print(const record_t& record) {
+  // each conversion takes one word, surplus words are ignored
+  char line[LINE_SIZE];
+  snprintf(line, sizeof(line), record.format, record.args[0], record.args[1],
+           record.args[2], record.args[3]);
+  esp_log_write(static_cast<esp_log_level_t>(record.level), record.tag,
+                "%c (%lu) %s: %s\n", level_letter(record.level),
+                static_cast<unsigned long>(record.timestamp), record.tag,
+                line);
+}
+
+void DeferredLog::run() {
+  record_t record;
+
+  while (true) {
+    while (pop(record)) {
+      print(record);
+    }
+
+    uint32_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      ESP_LOGW(TAG, "%lu deferred lines dropped",
+               static_cast<unsigned long>(dropped));
+    }
+    vTaskDelay(pdMS_TO_TICKS(DRAIN_INTERVAL_MS));
+  }
+}
+
+esp_err_t start_deferred_log() {
+  return DeferredLog::get_instance().start();
+}
+
+}  // namespace logging
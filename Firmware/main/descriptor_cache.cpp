@@ -0,0 +1,128 @@
+#include "descriptor_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include "usbip_wire.hpp"
+
+namespace usbip {
+
+namespace {
+
+// the OTG port is the only port, so the bus id never changes across replugs
+constexpr const char* BUS_ID = "1-1";
+
+}  // namespace
+
+DescriptorCache::DescriptorCache(UsbHostBackend& backend)
+    : backend_(backend) {}
+
+void DescriptorCache::refresh() {
+  // read before the device, so a change that races the rebuild is caught by
+  // the next refresh instead of being lost
+  uint32_t generation = backend_.generation();
+  if (valid_ && generation == generation_) {
+    return;
+  }
+
+  rebuild();
+  generation_ = generation;
+  valid_ = true;
+}
+
+std::span<const uint8_t> DescriptorCache::devlist() const {
+  return std::span<const uint8_t>(devlist_, devlist_length_);
+}
+
+std::span<const uint8_t> DescriptorCache::find(const char* bus_id) const {
+  uint32_t key = hash(bus_id);
+  for (size_t i = 0; i < entry_count_; i++) {
+    const entry_t& entry = entries_[i];
+    if (entry.hash == key && strncmp(entry.bus_id, bus_id, BUS_ID_SIZE) == 0) {
+      return std::span<const uint8_t>(devlist_ + entry.offset,
+                                      sizeof(device_descriptor_t));
+    }
+  }
+  return {};
+}
+
+void DescriptorCache::rebuild() {
+  exported_device_t device;
+  bool available = backend_.get_device(device);
+
+  // the image is sized for every device the backend can export
+  wire::StreamEncoder encoder(std::span<uint8_t>(devlist_, sizeof(devlist_)),
+                              [](std::span<const uint8_t>) { return false; });
+
+  encoder.emplace<op_rep_devlist_t>([&](op_rep_devlist_t& reply) {
+    reply.header.version = VERSION;
+    reply.header.code = OP_REP_DEVLIST;
+    reply.header.status = OK;
+    reply.exported_count = available ? 1 : 0;
+  });
+
+  entry_count_ = 0;
+  if (available) {
+    entry_t& entry = entries_[entry_count_++];
+    snprintf(entry.bus_id, sizeof(entry.bus_id), "%s", BUS_ID);
+    entry.hash = hash(entry.bus_id);
+    entry.offset = encoder.size();
+
+    encoder.emplace<device_descriptor_t>([&](device_descriptor_t& descriptor) {
+      fill_descriptor(device, entry.bus_id, descriptor);
+    });
+    for (uint8_t i = 0; i < device.interface_count; i++) {
+      encoder.put(device.interfaces[i]);
+    }
+  }
+
+  devlist_length_ = encoder.size();
+  ESP_LOGI(TAG, "Device list rebuilt, %zu devices in %zu bytes", entry_count_,
+           devlist_length_);
+}
+
+uint32_t DescriptorCache::hash(const char* bus_id) {
+  uint32_t value = 2166136261u;
+  for (size_t i = 0; i < BUS_ID_SIZE && bus_id[i] != '\0'; i++) {
+    value = (value ^ static_cast<uint8_t>(bus_id[i])) * 16777619u;
+  }
+  return value;
+}
+
+void DescriptorCache::fill_descriptor(const exported_device_t& device,
+                                      const char* bus_id,
+                                      device_descriptor_t& descriptor) {
+  memset(&descriptor, 0, sizeof(descriptor));
+
+  snprintf(descriptor.path, sizeof(descriptor.path),
+           "/sys/devices/platform/fluidity/usb%lu/%s",
+           static_cast<unsigned long>(UsbHostBackend::BUS_NUM), bus_id);
+  snprintf(descriptor.bus_id, sizeof(descriptor.bus_id), "%s", bus_id);
+
+  device_speed speed = UNKNOWN_SPEED;
+  switch (device.speed) {
+    case USB_SPEED_LOW:
+      speed = LOW_SPEED;
+      break;
+    case USB_SPEED_FULL:
+      speed = FULL_SPEED;
+      break;
+    default:
+      speed = HIGH_SPEED;
+      break;
+  }
+
+  descriptor.bus_num = UsbHostBackend::BUS_NUM;
+  descriptor.dev_num = device.address;
+  descriptor.speed = speed;
+  descriptor.vendor_id = device.descriptor.idVendor;
+  descriptor.product_id = device.descriptor.idProduct;
+  descriptor.device_bcd = device.descriptor.bcdDevice;
+  descriptor.device_class = device.descriptor.bDeviceClass;
+  descriptor.device_subclass = device.descriptor.bDeviceSubClass;
+  descriptor.device_protocol = device.descriptor.bDeviceProtocol;
+  descriptor.configuration_value = device.configuration_value;
+  descriptor.configuration_num = device.descriptor.bNumConfigurations;
+  descriptor.interface_num = device.interface_count;
+}
+
+}  // namespace usbip
@@ -0,0 +1,194 @@
+#include "elaphurelink_server.hpp"
+
+#include <cstring>
+#include "deferred_log.hpp"
+#include "metrics.hpp"
+#include "task_topology.hpp"
+
+namespace dap {
+
+ElaphurelinkServer& ElaphurelinkServer::get_instance() {
+  static ElaphurelinkServer instance;
+  return instance;
+}
+
+ElaphurelinkServer::ElaphurelinkServer()
+    : engine_(debug_phy()),
+      unit_(
+          server::tcp_server_config_t{
+              .name = "elaphurelink_server",
+              .port = CONFIG_FLUIDITY_DAP_PORT,
+              // the debug port has a single owner
+              .max_clients = 1,
+              // room for every packet the host may have in flight
+              .rx_buffer_size = TX_BUFFER_SIZE,
+              .rx_region = memory::region_t::INTERNAL,
+              .stack_size = topology::DAP_SERVER.stack_size,
+              .priority = topology::DAP_SERVER.priority,
+              .core_id = topology::DAP_SERVER.core_id,
+          },
+          *this) {}
+
+esp_err_t ElaphurelinkServer::start() {
+  esp_err_t ret = engine_.init();
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  session::leases().register_lessee(session::CLIENT_DAP, *this);
+
+  return unit_.start();
+}
+
+esp_err_t ElaphurelinkServer::stop() {
+  return unit_.stop();
+}
+
+esp_err_t ElaphurelinkServer::on_connect(server::connection_t& connection) {
+  // responses are already batched per read, Nagle would only delay them
+  int no_delay = 1;
+  setsockopt(connection.socket, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+             sizeof(no_delay));
+
+  handshaken_ = false;
+  fresh_ = true;
+  tx_length_ = 0;
+  return ESP_OK;
+}
+
+size_t ElaphurelinkServer::on_receive(server::connection_t& connection,
+                                      std::span<const uint8_t> data) {
+  size_t consumed = 0;
+
+  if (!handshaken_) {
+    consumed = handshake(connection.socket, data);
+    if (consumed == CLOSE_CONNECTION || !handshaken_) {
+      return consumed;
+    }
+  }
+
+  bool leased = false;
+  while (consumed < data.size()) {
+    std::span<const uint8_t> rest = data.subspan(consumed);
+    size_t length = DapEngine::command_length(rest);
+    if (length == DapEngine::MALFORMED) {
+      FLOG_W(DAP, TAG, "Malformed DAP command 0x%02x", rest[0]);
+      if (leased) {
+        session::leases().end(session::RESOURCE_SWD, session::CLIENT_DAP);
+      }
+      return CLOSE_CONNECTION;
+    }
+    if (length == 0) {
+      break;
+    }
+
+    // the batch waits, complete, until the lines are free again
+    if (!leased && !(leased = lease())) {
+      connection.deferred = true;
+      break;
+    }
+
+    if (TX_BUFFER_SIZE - tx_length_ < DapEngine::PACKET_SIZE &&
+        flush(connection.socket) != ESP_OK) {
+      session::leases().end(session::RESOURCE_SWD, session::CLIENT_DAP);
+      return CLOSE_CONNECTION;
+    }
+
+    uint32_t start = metrics::now();
+    tx_length_ += engine_.execute(
+        rest.first(length),
+        std::span<uint8_t>(tx_buffer_ + tx_length_, DapEngine::PACKET_SIZE));
+    metrics::observe(metrics::HIST_DAP_COMMAND, start);
+    metrics::count(metrics::DAP_COMMANDS);
+    consumed += length;
+  }
+
+  // the lines stay configured for this host until another client takes them
+  if (leased) {
+    session::leases().end(session::RESOURCE_SWD, session::CLIENT_DAP);
+  }
+  if (flush(connection.socket) != ESP_OK) {
+    return CLOSE_CONNECTION;
+  }
+  return consumed;
+}
+
+void ElaphurelinkServer::on_disconnect(server::connection_t& connection) {
+  // the host may vanish mid-session, stop driving the target; a client
+  // using the lines right now owns them, the next session forgets this one
+  session::SessionManager& leases = session::leases();
+  if (leases.begin(session::RESOURCE_SWD, session::CLIENT_DAP) !=
+      session::grant_t::DENIED) {
+    engine_.reset();
+    leases.release(session::RESOURCE_SWD, session::CLIENT_DAP);
+  }
+  handshaken_ = false;
+  tx_length_ = 0;
+}
+
+void ElaphurelinkServer::on_preempted(session::resource_t resource) {
+  engine_.suspend();
+}
+
+bool ElaphurelinkServer::lease() {
+  session::grant_t grant =
+      session::leases().begin(session::RESOURCE_SWD, session::CLIENT_DAP);
+  if (grant == session::grant_t::DENIED) {
+    return false;
+  }
+
+  if (fresh_) {
+    // whatever an earlier session left behind is not this host's
+    engine_.forget();
+    fresh_ = false;
+  } else if (grant == session::grant_t::HANDED_OVER) {
+    engine_.resume();
+  }
+  return true;
+}
+
+size_t ElaphurelinkServer::handshake(int socket,
+                                     std::span<const uint8_t> data) {
+  if (data.size() < sizeof(el_handshake_t)) {
+    return 0;
+  }
+
+  el_handshake_t request;
+  memcpy(&request, data.data(), sizeof(request));
+  if (ntohl(request.identifier) != EL_LINK_IDENTIFIER ||
+      ntohl(request.command) != EL_COMMAND_HANDSHAKE) {
+    ESP_LOGW(TAG, "Not an elaphureLink handshake");
+    return CLOSE_CONNECTION;
+  }
+
+  el_handshake_t reply{
+      .identifier = htonl(EL_LINK_IDENTIFIER),
+      .command = htonl(EL_COMMAND_HANDSHAKE),
+      .version = htonl(EL_DAP_VERSION),
+  };
+  if (server::TcpServerUnit::send_all(socket, &reply, sizeof(reply)) !=
+      ESP_OK) {
+    return CLOSE_CONNECTION;
+  }
+
+  ESP_LOGI(TAG, "elaphureLink proxy version %lu connected",
+           static_cast<unsigned long>(ntohl(request.version)));
+  handshaken_ = true;
+  return sizeof(el_handshake_t);
+}
+
+esp_err_t ElaphurelinkServer::flush(int socket) {
+  if (tx_length_ == 0) {
+    return ESP_OK;
+  }
+
+  esp_err_t ret = server::TcpServerUnit::send_all(socket, tx_buffer_,
+                                                  tx_length_);
+  tx_length_ = 0;
+  return ret;
+}
+
+esp_err_t start_elaphurelink_server() {
+  return ElaphurelinkServer::get_instance().start();
+}
+
+}  // namespace dap
@@ -0,0 +1,165 @@
+#include "eth_controller.hpp"
+#include "driver/gpio.h"
+#include "esp_mac.h"
+#include "network_manager.hpp"
+
+namespace controller {
+
+EthController& EthController::get_instance() {
+  static EthController instance;
+  return instance;
+}
+
+esp_err_t EthController::init() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+#if !CONFIG_FLUIDITY_ETH_W5500
+  return ESP_ERR_NOT_SUPPORTED;
+#else
+  if (initialized_) {
+    return ESP_OK;
+  }
+
+  esp_err_t ret = ensure_network();
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  ret = install_driver();
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to install W5500: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  esp_netif_config_t config = ESP_NETIF_DEFAULT_ETH();
+  netif_ = esp_netif_new(&config);
+  if (netif_ == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+  ESP_ERROR_CHECK(esp_netif_attach(netif_, esp_eth_new_netif_glue(handle_)));
+
+  ESP_ERROR_CHECK(esp_event_handler_instance_register(
+      ETH_EVENT, ESP_EVENT_ANY_ID, &eth_event_handler, this, nullptr));
+  ESP_ERROR_CHECK(esp_event_handler_instance_register(
+      IP_EVENT, IP_EVENT_ETH_GOT_IP, &ip_event_handler, this, nullptr));
+  ESP_ERROR_CHECK(esp_event_handler_instance_register(
+      IP_EVENT, IP_EVENT_ETH_LOST_IP, &ip_event_handler, this, nullptr));
+
+  ret = esp_eth_start(handle_);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start Ethernet: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  initialized_ = true;
+  ESP_LOGI(TAG, "W5500 Ethernet started");
+  return ESP_OK;
+#endif
+}
+
+esp_err_t EthController::subscribe(link_callback_t callback, void* arg) {
+  return link_.subscribe(callback, arg);
+}
+
+void EthController::unsubscribe(link_callback_t callback, void* arg) {
+  link_.unsubscribe(callback, arg);
+}
+
+esp_netif_t* EthController::get_netif() const {
+  return netif_;
+}
+
+esp_err_t EthController::install_driver() {
+#if CONFIG_FLUIDITY_ETH_W5500
+  const spi_host_device_t host =
+      static_cast<spi_host_device_t>(CONFIG_FLUIDITY_ETH_SPI_HOST);
+
+  spi_bus_config_t bus_config{};
+  bus_config.mosi_io_num = CONFIG_FLUIDITY_ETH_MOSI_PIN;
+  bus_config.miso_io_num = CONFIG_FLUIDITY_ETH_MISO_PIN;
+  bus_config.sclk_io_num = CONFIG_FLUIDITY_ETH_SCLK_PIN;
+  bus_config.quadwp_io_num = -1;
+  bus_config.quadhd_io_num = -1;
+  esp_err_t ret = spi_bus_initialize(host, &bus_config, SPI_DMA_CH_AUTO);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  // the W5500 interrupt line is serviced through the shared GPIO ISR
+  ret = gpio_install_isr_service(0);
+  if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+    return ret;
+  }
+
+  spi_device_interface_config_t device_config{};
+  device_config.mode = 0;
+  device_config.clock_speed_hz = CONFIG_FLUIDITY_ETH_SPI_CLOCK_MHZ * 1000000;
+  device_config.spics_io_num = CONFIG_FLUIDITY_ETH_CS_PIN;
+  device_config.queue_size = 20;
+
+  eth_w5500_config_t w5500_config =
+      ETH_W5500_DEFAULT_CONFIG(host, &device_config);
+  w5500_config.int_gpio_num = CONFIG_FLUIDITY_ETH_INT_PIN;
+  // without an interrupt line the driver polls the chip
+  if (CONFIG_FLUIDITY_ETH_INT_PIN < 0) {
+    w5500_config.poll_period_ms = 1;
+  }
+
+  eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
+  eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
+  phy_config.reset_gpio_num = CONFIG_FLUIDITY_ETH_RESET_PIN;
+
+  esp_eth_mac_t* mac = esp_eth_mac_new_w5500(&w5500_config, &mac_config);
+  esp_eth_phy_t* phy = esp_eth_phy_new_w5500(&phy_config);
+  if (mac == nullptr || phy == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  esp_eth_config_t config = ETH_DEFAULT_CONFIG(mac, phy);
+  ret = esp_eth_driver_install(&config, &handle_);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  // the W5500 carries no address of its own, use the one in eFuse
+  uint8_t address[6];
+  ESP_ERROR_CHECK(esp_read_mac(address, ESP_MAC_ETH));
+  return esp_eth_ioctl(handle_, ETH_CMD_S_MAC_ADDR, address);
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void EthController::handle_eth_event(int32_t event_id, void* event_data) {
+  switch (event_id) {
+    case ETHERNET_EVENT_CONNECTED:
+      ESP_LOGI(TAG, "Ethernet link up");
+      break;
+
+    case ETHERNET_EVENT_DISCONNECTED:
+      ESP_LOGW(TAG, "Ethernet link down");
+      link_.notify(false);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void EthController::handle_ip_event(int32_t event_id, void* event_data) {
+  if (event_id == IP_EVENT_ETH_GOT_IP) {
+    ip_event_got_ip_t* event = static_cast<ip_event_got_ip_t*>(event_data);
+    ESP_LOGI(TAG, "Ethernet IP address: " IPSTR,
+             IP2STR(&event->ip_info.ip));
+    link_.notify(true);
+  } else if (event_id == IP_EVENT_ETH_LOST_IP) {
+    ESP_LOGW(TAG, "Ethernet IP address lost");
+    link_.notify(false);
+  }
+}
+
+esp_err_t start_ethernet() {
+  return EthController::get_instance().init();
+}
+
+}  // namespace controller
@@ -0,0 +1,391 @@
+#include "flash_programmer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace flash {
+
+namespace {
+
+// Init()/UnInit() return quickly, erases and pages get their own timeouts
+constexpr uint32_t INIT_TIMEOUT_MS = 1000;
+
+// polls of a running call that go back to back before the task sleeps
+// between them
+constexpr int64_t BUSY_POLL_US = 1000;
+constexpr uint64_t POLL_INTERVAL_US = 200;
+
+flash_status target_error(esp_err_t ret) {
+  return ret == ESP_OK ? FLASH_OK : FLASH_ERROR_TARGET;
+}
+
+}  // namespace
+
+FlashProgrammer::FlashProgrammer(dap::DapPhy& phy) : access_(phy) {}
+
+FlashProgrammer::~FlashProgrammer() {
+  if (poll_timer_) {
+    esp_timer_stop(poll_timer_);
+    esp_timer_delete(poll_timer_);
+  }
+}
+
+flash_status FlashProgrammer::load(const flash_algorithm_t& algorithm,
+                                   std::span<const uint8_t> code) {
+  close();
+
+  if (algorithm.page_size == 0 || algorithm.page_size > MAX_PAGE_SIZE ||
+      algorithm.page_size % 4 != 0 || code.size() % 4 != 0 ||
+      algorithm.buffers[0] == 0 || algorithm.erase_sector == 0 ||
+      algorithm.program_page == 0 || algorithm.sectors[0].size == 0) {
+    ESP_LOGW(TAG, "Unusable flash algorithm");
+    return FLASH_ERROR_REQUEST;
+  }
+
+  esp_err_t ret = access_.connect(algorithm.clock != 0 ? algorithm.clock
+                                                       : DEFAULT_CLOCK);
+  if (ret == ESP_OK) {
+    ret = access_.halt();
+  }
+  if (ret == ESP_OK) {
+    ret = access_.write_memory(algorithm.load_address, code.data(),
+                               code.size());
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Algorithm upload failed: %s", esp_err_to_name(ret));
+    access_.disconnect();
+    return FLASH_ERROR_TARGET;
+  }
+
+  algorithm_ = algorithm;
+  loaded_ = true;
+  ESP_LOGI(TAG, "Algorithm loaded at 0x%08lx, %u byte pages%s",
+           static_cast<unsigned long>(algorithm.load_address),
+           static_cast<unsigned>(algorithm.page_size),
+           double_buffered() ? ", double buffered" : "");
+  return FLASH_OK;
+}
+
+flash_status FlashProgrammer::begin(uint32_t address, uint32_t length) {
+  streaming_ = false;
+  busy_ = false;
+  next_buffer_ = 0;
+  programmed_ = 0;
+  failed_address_ = address;
+  error_ = FLASH_OK;
+
+  uint32_t base = algorithm_.flash_base;
+  if (!loaded_ || address < base || address - base > algorithm_.flash_size ||
+      length > algorithm_.flash_size - (address - base)) {
+    return error_ = FLASH_ERROR_REQUEST;
+  }
+
+  flash_status status = erase(address, length);
+  if (status == FLASH_OK && algorithm_.init != 0) {
+    status = call(algorithm_.init, base, 0, FUNCTION_PROGRAM,
+                  INIT_TIMEOUT_MS);
+  }
+  if (status != FLASH_OK) {
+    return error_ = status;
+  }
+
+  // a stream that starts inside a page keeps the bytes before it erased
+  page_address_ = address - (address - base) % algorithm_.page_size;
+  page_fill_ = address - page_address_;
+  memset(page_, algorithm_.erased_value, page_fill_);
+  streaming_ = true;
+  return FLASH_OK;
+}
+
+flash_status FlashProgrammer::write(std::span<const uint8_t> data) {
+  if (!streaming_ || error_ != FLASH_OK) {
+    return error_ != FLASH_OK ? error_ : FLASH_ERROR_REQUEST;
+  }
+
+  while (!data.empty()) {
+    size_t length = std::min(data.size(), algorithm_.page_size - page_fill_);
+    memcpy(page_ + page_fill_, data.data(), length);
+    page_fill_ += length;
+    programmed_ += length;
+    data = data.subspan(length);
+
+    if (page_fill_ == algorithm_.page_size) {
+      flash_status status = submit_page();
+      if (status != FLASH_OK) {
+        return status;
+      }
+    }
+  }
+  return FLASH_OK;
+}
+
+flash_status FlashProgrammer::end() {
+  if (!streaming_ || error_ != FLASH_OK) {
+    abort();
+    return error_ != FLASH_OK ? error_ : FLASH_ERROR_REQUEST;
+  }
+
+  flash_status status = FLASH_OK;
+  if (page_fill_ > 0) {
+    memset(page_ + page_fill_, algorithm_.erased_value,
+           algorithm_.page_size - page_fill_);
+    status = submit_page();
+  }
+  if (status == FLASH_OK) {
+    status = wait_page();
+  }
+  if (status == FLASH_OK && algorithm_.uninit != 0) {
+    status = call(algorithm_.uninit, FUNCTION_PROGRAM, 0, 0,
+                  INIT_TIMEOUT_MS);
+  }
+
+  streaming_ = false;
+  if (status != FLASH_OK) {
+    abort();
+  }
+  return status;
+}
+
+void FlashProgrammer::abort() {
+  streaming_ = false;
+  busy_ = false;
+  if (loaded_) {
+    access_.halt();
+  }
+}
+
+flash_status FlashProgrammer::read(uint32_t address, uint8_t* data,
+                                   size_t length) {
+  if (!loaded_ || streaming_) {
+    return FLASH_ERROR_REQUEST;
+  }
+  return target_error(access_.read_memory(address, data, length));
+}
+
+flash_status FlashProgrammer::reset_target() {
+  if (!loaded_) {
+    return FLASH_ERROR_REQUEST;
+  }
+
+  flash_status status = target_error(access_.reset_and_run());
+  // the algorithm went with the reset
+  loaded_ = false;
+  access_.disconnect();
+  return status;
+}
+
+void FlashProgrammer::close() {
+  if (streaming_) {
+    abort();
+  }
+  loaded_ = false;
+  access_.disconnect();
+}
+
+bool FlashProgrammer::find_sector(uint32_t address, uint32_t& start,
+                                  uint32_t& size) const {
+  uint32_t offset = address - algorithm_.flash_base;
+  if (address < algorithm_.flash_base || offset >= algorithm_.flash_size) {
+    return false;
+  }
+
+  for (size_t i = 0; i < FLASH_MAX_SECTOR_REGIONS; i++) {
+    const flash_sector_region_t& region = algorithm_.sectors[i];
+    if (region.size == 0) {
+      break;
+    }
+
+    bool last = i + 1 == FLASH_MAX_SECTOR_REGIONS ||
+                algorithm_.sectors[i + 1].size == 0;
+    uint32_t end = last ? algorithm_.flash_size
+                        : algorithm_.sectors[i + 1].offset;
+    if (offset >= region.offset && offset < end) {
+      size = region.size;
+      start = algorithm_.flash_base + region.offset +
+              (offset - region.offset) / size * size;
+      return true;
+    }
+  }
+  return false;
+}
+
+flash_status FlashProgrammer::start_call(uint32_t entry, uint32_t r0,
+                                         uint32_t r1, uint32_t r2) {
+  const uint32_t registers[][2] = {
+      {dap::REG_R0, r0},
+      {dap::REG_R0 + 1, r1},
+      {dap::REG_R0 + 2, r2},
+      {dap::REG_R9, algorithm_.static_base},
+      {dap::REG_SP, algorithm_.stack_top},
+      // returns into the breakpoint, which halts the core again
+      {dap::REG_LR, algorithm_.breakpoint | 1},
+      {dap::REG_PC, entry & ~1u},
+      {dap::REG_XPSR, XPSR_THUMB},
+  };
+
+  for (const auto& [reg, value] : registers) {
+    esp_err_t ret = access_.write_core_register(reg, value);
+    if (ret != ESP_OK) {
+      return FLASH_ERROR_TARGET;
+    }
+  }
+  return target_error(access_.resume_masked());
+}
+
+flash_status FlashProgrammer::wait_call(uint32_t timeout_ms,
+                                        uint32_t& result) {
+  int64_t start = esp_timer_get_time();
+  int64_t deadline = start + static_cast<int64_t>(timeout_ms) * 1000;
+
+  while (true) {
+    bool halted = false;
+    if (access_.is_halted(halted) != ESP_OK) {
+      return FLASH_ERROR_TARGET;
+    }
+    if (halted) {
+      break;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (now > deadline) {
+      access_.halt();
+      return FLASH_ERROR_TIMEOUT;
+    }
+    // short calls are caught at once, long ones leave the core to the
+    // lower priorities between polls
+    if (now - start > BUSY_POLL_US) {
+      sleep(POLL_INTERVAL_US);
+    }
+  }
+
+  if (access_.read_core_register(dap::REG_R0, result) != ESP_OK) {
+    return FLASH_ERROR_TARGET;
+  }
+  return FLASH_OK;
+}
+
+void FlashProgrammer::sleep(uint64_t us) {
+  if (poll_timer_ == nullptr) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = &poll_timer_callback,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "flash_poll",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&timer_args, &poll_timer_) != ESP_OK) {
+      poll_timer_ = nullptr;
+    }
+  }
+
+  poll_task_ = xTaskGetCurrentTaskHandle();
+  if (poll_timer_ == nullptr ||
+      esp_timer_start_once(poll_timer_, us) != ESP_OK) {
+    vTaskDelay(1);
+    return;
+  }
+  // bounded, should the wakeup get lost; a late one only shortens a sleep
+  ulTaskNotifyTake(pdTRUE, 2);
+}
+
+flash_status FlashProgrammer::call(uint32_t entry, uint32_t r0, uint32_t r1,
+                                   uint32_t r2, uint32_t timeout_ms) {
+  uint32_t result = 0;
+  flash_status status = start_call(entry, r0, r1, r2);
+  if (status == FLASH_OK) {
+    status = wait_call(timeout_ms, result);
+  }
+  if (status == FLASH_OK && result != 0) {
+    status = FLASH_ERROR_ALGORITHM;
+  }
+  return status;
+}
+
+flash_status FlashProgrammer::erase(uint32_t address, uint32_t length) {
+  uint32_t base = algorithm_.flash_base;
+  flash_status status = FLASH_OK;
+  if (algorithm_.init != 0) {
+    status = call(algorithm_.init, base, 0, FUNCTION_ERASE, INIT_TIMEOUT_MS);
+  }
+
+  uint32_t end = address + length;
+  while (status == FLASH_OK && address < end) {
+    uint32_t start;
+    uint32_t size;
+    if (!find_sector(address, start, size)) {
+      return FLASH_ERROR_REQUEST;
+    }
+
+    status = call(algorithm_.erase_sector, start, 0, 0,
+                  algorithm_.erase_timeout_ms);
+    if (status != FLASH_OK) {
+      failed_address_ = start;
+      return status;
+    }
+    address = start + size;
+  }
+
+  if (status == FLASH_OK && algorithm_.uninit != 0) {
+    status = call(algorithm_.uninit, FUNCTION_ERASE, 0, 0, INIT_TIMEOUT_MS);
+  }
+  return status;
+}
+
+flash_status FlashProgrammer::submit_page() {
+  // a single buffer is only free again once its page is programmed
+  if (!double_buffered()) {
+    flash_status status = wait_page();
+    if (status != FLASH_OK) {
+      return status;
+    }
+  }
+
+  // the upload overlaps the ProgramPage running from the other buffer
+  uint32_t buffer = algorithm_.buffers[next_buffer_];
+  if (access_.write_memory(buffer, page_, algorithm_.page_size) != ESP_OK) {
+    return fail(FLASH_ERROR_TARGET, page_address_);
+  }
+
+  flash_status status = wait_page();
+  if (status == FLASH_OK) {
+    status = start_call(algorithm_.program_page, page_address_,
+                        algorithm_.page_size, buffer);
+  }
+  if (status != FLASH_OK) {
+    return fail(status, page_address_);
+  }
+
+  busy_ = true;
+  busy_address_ = page_address_;
+  next_buffer_ = double_buffered() ? next_buffer_ ^ 1 : 0;
+  page_address_ += algorithm_.page_size;
+  page_fill_ = 0;
+  return FLASH_OK;
+}
+
+flash_status FlashProgrammer::wait_page() {
+  if (!busy_) {
+    return FLASH_OK;
+  }
+
+  busy_ = false;
+  uint32_t result = 0;
+  flash_status status = wait_call(algorithm_.program_timeout_ms, result);
+  if (status == FLASH_OK && result != 0) {
+    status = FLASH_ERROR_ALGORITHM;
+  }
+  return status == FLASH_OK ? status : fail(status, busy_address_);
+}
+
+flash_status FlashProgrammer::fail(flash_status status, uint32_t address) {
+  if (error_ == FLASH_OK) {
+    error_ = status;
+    failed_address_ = address;
+    ESP_LOGW(TAG, "Programming failed at 0x%08lx (%u)",
+             static_cast<unsigned long>(address),
+             static_cast<unsigned>(status));
+  }
+  return error_;
+}
+
+}  // namespace flash
@@ -0,0 +1,546 @@
+#include "flash_server.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "buffer_pool.hpp"
+#include "esp_rom_crc.h"
+#include "mbedtls/sha256.h"
+#include "session_manager.hpp"
+#include "task_topology.hpp"
+
+namespace flash {
+
+FlashServer& FlashServer::get_instance() {
+  static FlashServer instance;
+  return instance;
+}
+
+FlashServer::FlashServer()
+    : programmer_(dap::debug_phy()),
+      cache_(ImageCache::get_instance()),
+      unit_(
+          server::tcp_server_config_t{
+              .name = "flash_server",
+              .port = CONFIG_FLUIDITY_FLASH_PORT,
+              // the debug port has a single owner
+              .max_clients = 1,
+              // a whole FLASH_LOAD request has to fit
+              .rx_buffer_size = RX_BUFFER_SIZE,
+              .rx_region = memory::region_t::INTERNAL,
+              .stack_size = topology::FLASH_SERVER.stack_size,
+              .priority = topology::FLASH_SERVER.priority,
+              .core_id = topology::FLASH_SERVER.core_id,
+          },
+          *this) {}
+
+esp_err_t FlashServer::start() {
+  esp_err_t ret = cache_.init();
+  if (ret == ESP_OK) {
+    ret = dap::debug_phy().ensure_init();
+  }
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  return unit_.start();
+}
+
+esp_err_t FlashServer::stop() {
+  return unit_.stop();
+}
+
+esp_err_t FlashServer::on_connect(server::connection_t& connection) {
+  remaining_ = 0;
+  status_ = FLASH_OK;
+  return ESP_OK;
+}
+
+size_t FlashServer::on_receive(server::connection_t& connection,
+                               std::span<const uint8_t> data) {
+  size_t consumed = 0;
+
+  while (consumed < data.size()) {
+    std::span<const uint8_t> rest = data.subspan(consumed);
+    if (remaining_ > 0) {
+      consumed += stream(connection.socket, rest);
+      continue;
+    }
+
+    if (rest.size() < sizeof(flash_request_t)) {
+      break;
+    }
+    flash_request_t request;
+    memcpy(&request, rest.data(), sizeof(request));
+
+    size_t length = handle(connection.socket, request,
+                           rest.subspan(sizeof(request)));
+    if (length == CLOSE_CONNECTION) {
+      return CLOSE_CONNECTION;
+    }
+    if (length == 0) {
+      break;
+    }
+    consumed += sizeof(request) + length;
+  }
+
+  // retried every tick until the DAP host is between batches
+  connection.deferred = deferred_;
+  deferred_ = false;
+  return consumed;
+}
+
+void FlashServer::on_disconnect(server::connection_t& connection) {
+  // a target left mid-image stays halted rather than half programmed
+  release_target();
+  cache_.cancel_store();
+  remaining_ = 0;
+}
+
+void FlashServer::release_target() {
+  programmer_.close();
+  session::leases().release(session::RESOURCE_SWD, session::CLIENT_FLASH);
+}
+
+size_t FlashServer::handle(int socket, const flash_request_t& request,
+                           std::span<const uint8_t> payload) {
+  switch (request.command) {
+    case FLASH_LOAD: {
+      if (sizeof(request) + request.length > RX_BUFFER_SIZE ||
+          request.length < sizeof(flash_algorithm_t)) {
+        ESP_LOGW(TAG, "Flash algorithm of %lu bytes does not fit",
+                 static_cast<unsigned long>(request.length));
+        respond(socket, request.command, FLASH_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < request.length) {
+        return 0;
+      }
+      if (session::leases().begin(session::RESOURCE_SWD,
+                                  session::CLIENT_FLASH) ==
+          session::grant_t::DENIED) {
+        deferred_ = true;
+        return 0;
+      }
+
+      // the job reconnects from scratch, whoever used the lines before
+      flash_algorithm_t algorithm;
+      memcpy(&algorithm, payload.data(), sizeof(algorithm));
+      flash_status status = programmer_.load(
+          algorithm, payload.subspan(sizeof(algorithm),
+                                     request.length - sizeof(algorithm)));
+      if (!programmer_.is_loaded()) {
+        release_target();
+      }
+      return respond(socket, request.command, status, 0) == ESP_OK
+                 ? request.length
+                 : CLOSE_CONNECTION;
+    }
+
+    case FLASH_PROGRAM: {
+      if (request.length < sizeof(flash_program_t)) {
+        respond(socket, request.command, FLASH_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < sizeof(flash_program_t)) {
+        return 0;
+      }
+
+      flash_program_t program;
+      memcpy(&program, payload.data(), sizeof(program));
+      uint32_t length = request.length - sizeof(program);
+      ESP_LOGI(TAG, "Programming %lu bytes at 0x%08lx",
+               static_cast<unsigned long>(length),
+               static_cast<unsigned long>(program.address));
+
+      // a failed start still takes the image off the stream
+      stream_ = FLASH_PROGRAM;
+      status_ = programmer_.begin(program.address, length);
+      remaining_ = length;
+      if (remaining_ == 0) {
+        finish_stream(socket);
+      }
+      return sizeof(program);
+    }
+
+    case FLASH_STORE: {
+      if (request.length < sizeof(flash_store_t)) {
+        respond(socket, request.command, FLASH_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < sizeof(flash_store_t)) {
+        return 0;
+      }
+
+      flash_store_t store;
+      memcpy(&store, payload.data(), sizeof(store));
+      image_digest_t digest;
+      memcpy(digest.data(), store.digest, digest.size());
+      uint32_t length = request.length - sizeof(store);
+
+      stream_ = FLASH_STORE;
+      status_ = cache_.begin_store(digest, length) == ESP_OK
+                    ? FLASH_OK
+                    : FLASH_ERROR_REQUEST;
+      remaining_ = length;
+      if (remaining_ == 0) {
+        finish_stream(socket);
+      }
+      return sizeof(store);
+    }
+
+    case FLASH_IMAGE: {
+      if (request.length != sizeof(flash_image_t)) {
+        respond(socket, request.command, FLASH_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < sizeof(flash_image_t)) {
+        return 0;
+      }
+
+      flash_image_t job;
+      memcpy(&job, payload.data(), sizeof(job));
+      image_digest_t digest;
+      memcpy(digest.data(), job.digest, digest.size());
+
+      ImageCache::image_t image;
+      flash_status status = FLASH_ERROR_NOT_CACHED;
+      uint32_t value = 0;
+      if (cache_.find(digest, image)) {
+        status = flash_image(job.address, image, value);
+      }
+      return respond(socket, request.command, status, value) == ESP_OK
+                 ? request.length
+                 : CLOSE_CONNECTION;
+    }
+
+    case FLASH_VERIFY: {
+      if (request.length != sizeof(flash_verify_t)) {
+        respond(socket, request.command, FLASH_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < sizeof(flash_verify_t)) {
+        return 0;
+      }
+
+      flash_verify_t job;
+      memcpy(&job, payload.data(), sizeof(job));
+      flash_digest_t digest{};
+      flash_status status = verify(job.address, job.length, digest);
+      flash_response_t response{
+          .command = request.command,
+          .status = status,
+          .reserved = 0,
+          .value = status == FLASH_OK ? job.length : 0,
+      };
+
+      iovec vectors[2] = {
+          {.iov_base = &response, .iov_len = sizeof(response)},
+          {.iov_base = &digest, .iov_len = sizeof(digest)},
+      };
+      return server::TcpServerUnit::send_vectored(socket, vectors, 2) ==
+                     ESP_OK
+                 ? request.length
+                 : CLOSE_CONNECTION;
+    }
+
+    case FLASH_RESET: {
+      flash_status status = programmer_.reset_target();
+      release_target();
+      return respond(socket, request.command, status, 0) == ESP_OK
+                 ? request.length
+                 : CLOSE_CONNECTION;
+    }
+
+    default:
+      // the payload length can not be trusted either
+      ESP_LOGW(TAG, "Unknown flash command 0x%02x", request.command);
+      respond(socket, request.command, FLASH_ERROR_REQUEST, 0);
+      return CLOSE_CONNECTION;
+  }
+}
+
+size_t FlashServer::stream(int socket, std::span<const uint8_t> data) {
+  size_t length = std::min<size_t>(data.size(), remaining_);
+  if (status_ == FLASH_OK) {
+    if (stream_ == FLASH_PROGRAM) {
+      status_ = programmer_.write(data.first(length));
+    } else {
+      cache_.append(data.first(length));
+    }
+  }
+  remaining_ -= length;
+
+  if (remaining_ == 0) {
+    finish_stream(socket);
+  }
+  return length;
+}
+
+void FlashServer::finish_stream(int socket) {
+  uint32_t value = 0;
+  if (stream_ == FLASH_PROGRAM) {
+    if (status_ == FLASH_OK) {
+      status_ = programmer_.end();
+    } else {
+      programmer_.abort();
+    }
+    value = status_ == FLASH_OK ? programmer_.programmed()
+                                : programmer_.failed_address();
+  } else if (status_ == FLASH_OK) {
+    esp_err_t ret = cache_.finish_store();
+    status_ = ret == ESP_OK                ? FLASH_OK
+              : ret == ESP_ERR_INVALID_CRC ? FLASH_ERROR_DIGEST
+                                           : FLASH_ERROR_REQUEST;
+  } else {
+    cache_.cancel_store();
+  }
+
+  ESP_LOGI(TAG, "Stream 0x%02x done: status %u", stream_,
+           static_cast<unsigned>(status_));
+  if (respond(socket, stream_, status_, value) != ESP_OK) {
+    // the connection goes with the next read
+    ESP_LOGW(TAG, "Failed to answer stream 0x%02x", stream_);
+  }
+  stream_ = 0;
+}
+
+flash_status FlashServer::flash_image(uint32_t address,
+                                      const ImageCache::image_t& image,
+                                      uint32_t& value) {
+  value = 0;
+  uint32_t end = address + image.length;
+  if (!programmer_.is_loaded() || end < address) {
+    return FLASH_ERROR_REQUEST;
+  }
+
+  // adjacent sectors that differ share one erase and page stream
+  uint32_t run = 0;
+  bool running = false;
+  size_t sectors = 0;
+  size_t changed = 0;
+  uint32_t programmed = 0;
+  flash_status status = FLASH_OK;
+
+  for (uint32_t at = address; at < end; sectors++) {
+    uint32_t start;
+    uint32_t size;
+    if (!programmer_.find_sector(at, start, size)) {
+      return FLASH_ERROR_REQUEST;
+    }
+    uint32_t next = size >= end - start ? end : start + size;
+
+    bool same = false;
+    status = compare(at, image, at - address, next - at, same);
+    if (status != FLASH_OK) {
+      value = at;
+      return status;
+    }
+
+    if (!same) {
+      changed++;
+      if (!running) {
+        run = at;
+        running = true;
+      }
+    } else if (running) {
+      status = program_range(run, image, run - address, at - run);
+      if (status != FLASH_OK) {
+        value = programmer_.failed_address();
+        return status;
+      }
+      programmed += at - run;
+      running = false;
+    }
+    at = next;
+  }
+
+  if (running) {
+    status = program_range(run, image, run - address, end - run);
+    if (status != FLASH_OK) {
+      value = programmer_.failed_address();
+      return status;
+    }
+    programmed += end - run;
+  }
+
+  ESP_LOGI(TAG, "Image of %lu bytes: %u of %u sectors changed",
+           static_cast<unsigned long>(image.length),
+           static_cast<unsigned>(changed), static_cast<unsigned>(sectors));
+  value = programmed;
+  return FLASH_OK;
+}
+
+flash_status FlashServer::verify(uint32_t address, uint32_t length,
+                                 flash_digest_t& digest) {
+  if (!programmer_.is_loaded() || address + length < address) {
+    return FLASH_ERROR_REQUEST;
+  }
+
+  // mbedtls hands SHA-256 to the SHA peripheral, the ROM CRC is table
+  // driven; either is quick next to the SWD read of the same chunk
+  mbedtls_sha256_context sha;
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  uint32_t crc = 0;
+
+  flash_status status = FLASH_OK;
+  while (length > 0) {
+    size_t count = std::min<size_t>(length, CHUNK_SIZE - 4);
+    const uint8_t* data;
+    status = read_target(address, count, data);
+    if (status != FLASH_OK) {
+      break;
+    }
+
+    crc = esp_rom_crc32_le(crc, data, count);
+    mbedtls_sha256_update(&sha, data, count);
+    address += count;
+    length -= count;
+  }
+
+  if (status == FLASH_OK) {
+    digest.crc32 = crc;
+    mbedtls_sha256_finish(&sha, digest.sha256);
+  }
+  mbedtls_sha256_free(&sha);
+  return status;
+}
+
+flash_status FlashServer::read_target(uint32_t address, size_t count,
+                                      const uint8_t*& data) {
+  // target reads go by words
+  uint32_t aligned = address & ~uint32_t{3};
+  size_t lead = address - aligned;
+  size_t words = (lead + count + 3) & ~size_t{3};
+  if (words > CHUNK_SIZE) {
+    return FLASH_ERROR_REQUEST;
+  }
+
+  data = target_chunk_ + lead;
+  return programmer_.read(aligned, target_chunk_, words);
+}
+
+flash_status FlashServer::compare(uint32_t address,
+                                  const ImageCache::image_t& image,
+                                  uint32_t offset, uint32_t length,
+                                  bool& same) {
+  same = true;
+  while (length > 0) {
+    size_t count = std::min<size_t>(length, CHUNK_SIZE - 4);
+    const uint8_t* data;
+    flash_status status = read_target(address, count, data);
+    if (status != FLASH_OK) {
+      return status;
+    }
+    if (cache_.read(image, offset, image_chunk_, count) != ESP_OK) {
+      return FLASH_ERROR_REQUEST;
+    }
+    if (memcmp(data, image_chunk_, count) != 0) {
+      same = false;
+      return FLASH_OK;
+    }
+
+    address += count;
+    offset += count;
+    length -= count;
+  }
+  return FLASH_OK;
+}
+
+flash_status FlashServer::program_range(uint32_t address,
+                                        const ImageCache::image_t& image,
+                                        uint32_t offset, uint32_t length) {
+  // the erase takes whole sectors, so the target bytes ahead of and behind
+  // the range in its first and last sector are read back first and
+  // streamed around the image
+  uint32_t first;
+  uint32_t last;
+  uint32_t size;
+  if (!programmer_.find_sector(address, first, size) ||
+      !programmer_.find_sector(address + length - 1, last, size)) {
+    return FLASH_ERROR_REQUEST;
+  }
+  size_t head = address - first;
+  size_t tail = last + size - (address + length);
+
+  memory::BufferPool& pool = memory::BufferPool::get_instance();
+  uint8_t* kept = nullptr;
+  if (head + tail > 0) {
+    kept = static_cast<uint8_t*>(
+        pool.allocate_or_heap(head + tail, memory::region_t::PSRAM));
+    if (kept == nullptr) {
+      ESP_LOGE(TAG, "No room to keep %u bytes around 0x%08lx",
+               static_cast<unsigned>(head + tail),
+               static_cast<unsigned long>(address));
+      return FLASH_ERROR_REQUEST;
+    }
+  }
+
+  flash_status status = keep_target(first, head, kept);
+  if (status == FLASH_OK) {
+    status = keep_target(address + length, tail, kept + head);
+  }
+  if (status == FLASH_OK) {
+    status = programmer_.begin(first, head + length + tail);
+  }
+  if (status == FLASH_OK && head > 0) {
+    status = programmer_.write(std::span(kept, head));
+  }
+  while (status == FLASH_OK && length > 0) {
+    size_t count = std::min<size_t>(length, CHUNK_SIZE);
+    if (cache_.read(image, offset, image_chunk_, count) != ESP_OK) {
+      status = FLASH_ERROR_REQUEST;
+      break;
+    }
+    status = programmer_.write(std::span(image_chunk_, count));
+    offset += count;
+    length -= count;
+  }
+  if (status == FLASH_OK && tail > 0) {
+    status = programmer_.write(std::span(kept + head, tail));
+  }
+
+  if (kept != nullptr) {
+    pool.release_any(kept);
+  }
+  if (status == FLASH_OK) {
+    return programmer_.end();
+  }
+  programmer_.abort();
+  return status;
+}
+
+flash_status FlashServer::keep_target(uint32_t address, size_t count,
+                                      uint8_t* kept) {
+  while (count > 0) {
+    size_t chunk = std::min<size_t>(count, CHUNK_SIZE - 4);
+    const uint8_t* data;
+    flash_status status = read_target(address, chunk, data);
+    if (status != FLASH_OK) {
+      return status;
+    }
+    memcpy(kept, data, chunk);
+    address += chunk;
+    kept += chunk;
+    count -= chunk;
+  }
+  return FLASH_OK;
+}
+
+esp_err_t FlashServer::respond(int socket, uint8_t command,
+                               flash_status status, uint32_t value) {
+  flash_response_t response{
+      .command = command,
+      .status = status,
+      .reserved = 0,
+      .value = value,
+  };
+  return server::TcpServerUnit::send_all(socket, &response,
+                                         sizeof(response));
+}
+
+esp_err_t start_flash_server() {
+  return FlashServer::get_instance().start();
+}
+
+}  // namespace flash
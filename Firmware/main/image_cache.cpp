@@ -0,0 +1,284 @@
+#include "image_cache.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "buffer_pool.hpp"
+#include "esp_heap_caps.h"
+
+namespace flash {
+
+ImageCache& ImageCache::get_instance() {
+  static ImageCache instance;
+  return instance;
+}
+
+esp_err_t ImageCache::init() {
+  if (ok_) {
+    return ESP_OK;
+  }
+
+  partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY, "imgcache");
+  if (partition_ != nullptr) {
+    slot_size_ = partition_->size / SLOT_COUNT / SECTOR_SIZE * SECTOR_SIZE;
+    if (slot_size_ < 2 * SECTOR_SIZE) {
+      ESP_LOGW(TAG, "Image cache partition too small, not spilling");
+      partition_ = nullptr;
+    } else {
+      scan_slots();
+    }
+  } else {
+    ESP_LOGI(TAG, "No image cache partition, images stay in PSRAM");
+  }
+
+  ok_ = true;
+  ESP_LOGI(TAG, "%u KiB of PSRAM, %u spill slots of %u KiB",
+           static_cast<unsigned>(CAPACITY / 1024),
+           partition_ != nullptr ? static_cast<unsigned>(SLOT_COUNT) : 0,
+           static_cast<unsigned>(slot_size_ / 1024));
+  return ESP_OK;
+}
+
+bool ImageCache::find(const image_digest_t& digest, image_t& image) {
+  for (entry_t& entry : entries_) {
+    if (entry.data != nullptr && &entry != storing_ &&
+        entry.digest == digest) {
+      entry.used = ++tick_;
+      image = image_t{.data = entry.data, .slot = 0, .length = entry.length};
+      return true;
+    }
+  }
+
+  for (size_t i = 0; i < SLOT_COUNT; i++) {
+    if (partition_ != nullptr && slots_[i].valid &&
+        slots_[i].digest == digest) {
+      image = image_t{.data = nullptr, .slot = i, .length = slots_[i].length};
+      return true;
+    }
+  }
+  return false;
+}
+
+esp_err_t ImageCache::read(const image_t& image, uint32_t offset,
+                           uint8_t* data, size_t length) const {
+  if (offset > image.length || length > image.length - offset) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (image.data != nullptr) {
+    memcpy(data, image.data + offset, length);
+    return ESP_OK;
+  }
+  return esp_partition_read(
+      partition_, image.slot * slot_size_ + SECTOR_SIZE + offset, data,
+      length);
+}
+
+esp_err_t ImageCache::begin_store(const image_digest_t& digest,
+                                  uint32_t length) {
+  cancel_store();
+  if (!ok_ || length == 0 || length > CAPACITY) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // a new copy replaces the old one
+  for (entry_t& entry : entries_) {
+    if (entry.data != nullptr && entry.digest == digest) {
+      drop(entry);
+    }
+  }
+
+  entry_t* free_entry = nullptr;
+  entry_t* victim = nullptr;
+  while (true) {
+    free_entry = nullptr;
+    for (entry_t& entry : entries_) {
+      if (entry.data == nullptr) {
+        free_entry = &entry;
+        break;
+      }
+    }
+    if (free_entry != nullptr && stored_ + length <= CAPACITY) {
+      break;
+    }
+    if ((victim = oldest()) == nullptr) {
+      break;
+    }
+    evict(*victim);
+  }
+
+  uint32_t caps = memory::region_caps(memory::region_t::PSRAM);
+  uint8_t* data = nullptr;
+  while (free_entry != nullptr &&
+         (data = static_cast<uint8_t*>(heap_caps_malloc(length, caps))) ==
+             nullptr &&
+         (victim = oldest()) != nullptr) {
+    // PSRAM shared with everything else may still be too fragmented
+    evict(*victim);
+  }
+  if (data == nullptr) {
+    ESP_LOGW(TAG, "No room for a %lu byte image",
+             static_cast<unsigned long>(length));
+    return ESP_ERR_NO_MEM;
+  }
+
+  *free_entry = entry_t{
+      .digest = digest,
+      .data = data,
+      .length = length,
+      .used = 0,
+  };
+  stored_ += length;
+  storing_ = free_entry;
+  fill_ = 0;
+
+  mbedtls_sha256_init(&sha_);
+  mbedtls_sha256_starts(&sha_, 0);
+  return ESP_OK;
+}
+
+void ImageCache::append(std::span<const uint8_t> data) {
+  if (storing_ == nullptr) {
+    return;
+  }
+
+  size_t length = std::min<size_t>(data.size(), storing_->length - fill_);
+  memcpy(storing_->data + fill_, data.data(), length);
+  mbedtls_sha256_update(&sha_, data.data(), length);
+  fill_ += length;
+}
+
+esp_err_t ImageCache::finish_store() {
+  if (storing_ == nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  image_digest_t digest;
+  mbedtls_sha256_finish(&sha_, digest.data());
+  mbedtls_sha256_free(&sha_);
+
+  entry_t& entry = *storing_;
+  storing_ = nullptr;
+  if (fill_ != entry.length || digest != entry.digest) {
+    ESP_LOGW(TAG, "Stored image does not match its digest");
+    drop(entry);
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  entry.used = ++tick_;
+  ESP_LOGI(TAG, "Cached a %lu byte image, %u KiB in use",
+           static_cast<unsigned long>(entry.length),
+           static_cast<unsigned>(stored_ / 1024));
+  return ESP_OK;
+}
+
+void ImageCache::cancel_store() {
+  if (storing_ != nullptr) {
+    mbedtls_sha256_free(&sha_);
+    drop(*storing_);
+    storing_ = nullptr;
+  }
+}
+
+void ImageCache::scan_slots() {
+  sequence_ = 0;
+  for (size_t i = 0; i < SLOT_COUNT; i++) {
+    slot_header_t header;
+    slots_[i].valid = false;
+    if (esp_partition_read(partition_, i * slot_size_, &header,
+                           sizeof(header)) != ESP_OK ||
+        header.magic != SLOT_MAGIC ||
+        header.length > slot_size_ - SECTOR_SIZE) {
+      continue;
+    }
+
+    slots_[i] = slot_t{
+        .digest = header.digest,
+        .length = header.length,
+        .sequence = header.sequence,
+        .valid = true,
+    };
+    sequence_ = std::max(sequence_, header.sequence + 1);
+  }
+}
+
+void ImageCache::drop(entry_t& entry) {
+  heap_caps_free(entry.data);
+  stored_ -= entry.length;
+  entry = entry_t{};
+}
+
+void ImageCache::evict(entry_t& entry) {
+  spill(entry);
+  drop(entry);
+}
+
+void ImageCache::spill(const entry_t& entry) {
+  if (partition_ == nullptr || entry.length > slot_size_ - SECTOR_SIZE) {
+    return;
+  }
+
+  // a free slot, else the one spilled longest ago
+  size_t slot = 0;
+  for (size_t i = 0; i < SLOT_COUNT; i++) {
+    if (slots_[i].valid && slots_[i].digest == entry.digest) {
+      return;
+    }
+    if (!slots_[i].valid) {
+      if (slots_[slot].valid) {
+        slot = i;
+      }
+    } else if (slots_[slot].valid &&
+               slots_[i].sequence < slots_[slot].sequence) {
+      slot = i;
+    }
+  }
+
+  slots_[slot].valid = false;
+  size_t offset = slot * slot_size_;
+  size_t length = (entry.length + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+  slot_header_t header{
+      .magic = SLOT_MAGIC,
+      .sequence = sequence_,
+      .length = entry.length,
+      .reserved = 0,
+      .digest = entry.digest,
+  };
+
+  esp_err_t ret =
+      esp_partition_erase_range(partition_, offset, SECTOR_SIZE + length);
+  if (ret == ESP_OK) {
+    ret = esp_partition_write(partition_, offset + SECTOR_SIZE, entry.data,
+                              entry.length);
+  }
+  if (ret == ESP_OK) {
+    ret = esp_partition_write(partition_, offset, &header, sizeof(header));
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to spill image: %s", esp_err_to_name(ret));
+    return;
+  }
+
+  slots_[slot] = slot_t{
+      .digest = entry.digest,
+      .length = entry.length,
+      .sequence = sequence_++,
+      .valid = true,
+  };
+  ESP_LOGI(TAG, "Spilled a %lu byte image to slot %u",
+           static_cast<unsigned long>(entry.length),
+           static_cast<unsigned>(slot));
+}
+
+ImageCache::entry_t* ImageCache::oldest() {
+  entry_t* oldest = nullptr;
+  for (entry_t& entry : entries_) {
+    if (entry.data != nullptr && &entry != storing_ &&
+        (oldest == nullptr || entry.used < oldest->used)) {
+      oldest = &entry;
+    }
+  }
+  return oldest;
+}
+
+}  // namespace flash
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "tcp_server_unit.hpp"
+#include "uart_dma.hpp"
+#include "urb_engine.hpp"
+
+namespace bench {
+
+// Benchmark firmware: instead of the probe services, one TCP server runs
+// fixed workloads against the real modules and answers each with a single
+// JSON line, so a host runner can collect and compare them. Commands are
+// text lines:
+//
+//   info                      build and chip description
+//   alloc <pairs>             allocate/release pairs per pool class
+//   urb <count>               CMD_SUBMITs through the URB engine; the
+//                             count RET_SUBMITs come back before the line
+//   swd <clock> <address> <words>
+//                             raw line rate and MEM-AP reads from address
+//   uart <bytes>              loopback transfer per rate, highest clean one
+//   echo                      echoes every later byte, for TCP RTT and
+//                             throughput measured on the host
+//
+// The UART runs in internal loopback, so no wiring is needed; SWD reads
+// need a target on the debug port and report how many words were acked.
+class BenchServer : public server::TcpHandler {
+ public:
+  static BenchServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+
+  BenchServer(const BenchServer&) = delete;
+  BenchServer& operator=(const BenchServer&) = delete;
+
+ private:
+  BenchServer();
+  ~BenchServer() = default;
+
+  static constexpr const char* TAG = "bench_server";
+  static constexpr size_t RX_BUFFER_SIZE = 4096;
+  static constexpr size_t REPLY_SIZE = 1024;
+
+  // Completes every URB inside submit(), so only the engine is measured
+  class LoopbackBackend : public usbip::UrbBackend {
+   public:
+    esp_err_t submit(usbip::UrbEngine& engine,
+                     usbip::urb_t& urb,
+                     std::span<const uint8_t> out_data,
+                     std::span<const uint8_t> iso_descriptors) override;
+    esp_err_t unlink(usbip::urb_t& urb) override { return ESP_OK; }
+  };
+
+  server::TcpServerUnit unit_;
+  LoopbackBackend backend_;
+  usbip::UrbEngine engine_;
+  serial::UartDma uart_;
+  bool uart_ready_{false};
+  char reply_[REPLY_SIZE];
+
+  size_t info();
+  size_t alloc(uint32_t pairs);
+  size_t urb(int socket, uint32_t count);
+  size_t swd(uint32_t clock, uint32_t address, uint32_t words);
+  size_t uart(uint32_t bytes);
+
+  // bytes through the loopback at the current rate; false on a mismatch
+  bool uart_pass(uint32_t bytes, uint32_t& elapsed_us);
+
+  // snprintf onto the end of reply_, dropping what does not fit
+  __attribute__((format(printf, 3, 4))) void append(size_t& length,
+                                                    const char* format,
+                                                    ...);
+};
+
+esp_err_t start_bench_server();
+
+}  // namespace bench
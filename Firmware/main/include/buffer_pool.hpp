@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+namespace memory {
+
+enum class region_t {
+  INTERNAL,  // Internal SRAM, for small and latency-critical buffers
+  PSRAM,     // External PSRAM, for bulk payloads and rings
+};
+
+uint32_t region_caps(region_t region);
+
+// Fixed block size pool carved out of a single heap_caps allocation. The
+// free list is a stack of block indices whose head carries a generation tag,
+// so allocate/release are lock-free with one 32-bit compare-and-swap.
+class SlabPool {
+ public:
+  SlabPool() = default;
+  ~SlabPool();
+
+  esp_err_t init(size_t block_size, size_t block_count, uint32_t caps);
+
+  void* allocate();
+  void release(void* block);
+
+  bool owns(const void* block) const;
+  size_t block_size() const { return block_size_; }
+  size_t block_count() const { return block_count_; }
+  size_t available() const;
+  size_t low_watermark() const;
+
+  SlabPool(const SlabPool&) = delete;
+  SlabPool& operator=(const SlabPool&) = delete;
+
+ private:
+  static constexpr uint16_t END = 0xffff;
+
+  uint8_t* base_{nullptr};
+  size_t block_size_{0};
+  size_t block_count_{0};
+
+  std::atomic<uint16_t>* next_{nullptr};  // Kept apart from the blocks
+  std::atomic<uint32_t> head_{END};       // (tag << 16) | index
+
+  std::atomic<size_t> available_{0};
+  std::atomic<size_t> low_watermark_{0};
+};
+
+struct pool_stats_t {
+  size_t block_size;
+  size_t block_count;
+  size_t available;
+  size_t low_watermark;
+  region_t region;
+};
+
+// Size-class allocator for hot paths: small classes live in internal RAM,
+// large ones in PSRAM. Every block is reserved at init, so allocate() never
+// reaches the general heap and never fragments it.
+class BufferPool {
+ public:
+  static constexpr size_t CLASS_COUNT = 5;
+
+  static BufferPool& get_instance();
+
+  esp_err_t init();
+  bool is_ok() const;
+
+  // Smallest free block of at least size bytes in region, or nullptr
+  void* allocate(size_t size, region_t region);
+  void release(void* block);
+
+  // For buffers that live as long as their owner: a pool block when a class
+  // fits and has one left, the heap in region otherwise. Never for a hot
+  // path; release_any() gives back either kind.
+  void* allocate_or_heap(size_t size, region_t region);
+  void release_any(void* block);
+
+  size_t block_size(const void* block) const;
+  pool_stats_t get_stats(size_t index) const;
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+ private:
+  BufferPool() = default;
+  ~BufferPool() = default;
+
+  static constexpr const char* TAG = "buffer_pool";
+
+  struct size_class_t {
+    size_t block_size;
+    size_t block_count;
+    region_t region;
+  };
+
+  // ordered by region, then ascending block size
+  static constexpr std::array<size_class_t, CLASS_COUNT> CLASSES = {{
+      {64, CONFIG_FLUIDITY_POOL_INTERNAL_64_COUNT, region_t::INTERNAL},
+      {512, CONFIG_FLUIDITY_POOL_INTERNAL_512_COUNT, region_t::INTERNAL},
+      {4096, CONFIG_FLUIDITY_POOL_PSRAM_4K_COUNT, region_t::PSRAM},
+      {16384, CONFIG_FLUIDITY_POOL_PSRAM_16K_COUNT, region_t::PSRAM},
+      {65536, CONFIG_FLUIDITY_POOL_PSRAM_64K_COUNT, region_t::PSRAM},
+  }};
+
+  mutable std::mutex mutex_;
+  std::atomic<bool> ready_{false};
+  std::array<SlabPool, CLASS_COUNT> pools_;
+
+  size_t find_owner(const void* block) const;
+};
+
+esp_err_t ensure_buffer_pool();
+
+}  // namespace memory
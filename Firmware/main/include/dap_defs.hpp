@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace dap {
+
+/* ------------------------------------------------------------------------- */
+/* CMSIS-DAP Commands                                                        */
+/* ------------------------------------------------------------------------- */
+
+enum dap_command : uint8_t {
+  DAP_INFO = 0x00,
+  DAP_HOST_STATUS = 0x01,
+  DAP_CONNECT = 0x02,
+  DAP_DISCONNECT = 0x03,
+  DAP_TRANSFER_CONFIGURE = 0x04,
+  DAP_TRANSFER = 0x05,
+  DAP_TRANSFER_BLOCK = 0x06,
+  DAP_TRANSFER_ABORT = 0x07,
+  DAP_WRITE_ABORT = 0x08,
+  DAP_DELAY = 0x09,
+  DAP_RESET_TARGET = 0x0a,
+  DAP_SWJ_PINS = 0x10,
+  DAP_SWJ_CLOCK = 0x11,
+  DAP_SWJ_SEQUENCE = 0x12,
+  DAP_SWD_CONFIGURE = 0x13,
+  DAP_JTAG_SEQUENCE = 0x14,
+  DAP_JTAG_CONFIGURE = 0x15,
+  DAP_JTAG_IDCODE = 0x16,
+  DAP_SWO_TRANSPORT = 0x17,
+  DAP_SWO_MODE = 0x18,
+  DAP_SWO_BAUDRATE = 0x19,
+  DAP_SWO_CONTROL = 0x1a,
+  DAP_SWO_STATUS = 0x1b,
+  DAP_SWO_DATA = 0x1c,
+  DAP_SWD_SEQUENCE = 0x1d,
+  DAP_SWO_EXTENDED_STATUS = 0x1e,
+  DAP_QUEUE_COMMANDS = 0x7e,
+  DAP_EXECUTE_COMMANDS = 0x7f,
+  DAP_INVALID = 0xff,  // Reply to an unsupported command
+};
+
+enum dap_status : uint8_t {
+  DAP_OK = 0x00,
+  DAP_ERROR = 0xff,
+};
+
+enum dap_info : uint8_t {
+  INFO_VENDOR = 0x01,
+  INFO_PRODUCT = 0x02,
+  INFO_SERIAL_NUMBER = 0x03,
+  INFO_PROTOCOL_VERSION = 0x04,
+  INFO_TARGET_DEVICE_VENDOR = 0x05,
+  INFO_TARGET_DEVICE_NAME = 0x06,
+  INFO_TARGET_BOARD_VENDOR = 0x07,
+  INFO_TARGET_BOARD_NAME = 0x08,
+  INFO_FIRMWARE_VERSION = 0x09,
+  INFO_CAPABILITIES = 0xf0,
+  INFO_TIMESTAMP_CLOCK = 0xf1,
+  INFO_UART_RX_BUFFER_SIZE = 0xfb,
+  INFO_UART_TX_BUFFER_SIZE = 0xfc,
+  INFO_SWO_BUFFER_SIZE = 0xfd,
+  INFO_PACKET_COUNT = 0xfe,
+  INFO_PACKET_SIZE = 0xff,
+};
+
+enum dap_capability : uint8_t {
+  CAPABILITY_SWD = 1 << 0,
+  CAPABILITY_JTAG = 1 << 1,
+  CAPABILITY_SWO_UART = 1 << 2,
+  CAPABILITY_SWO_MANCHESTER = 1 << 3,
+  CAPABILITY_ATOMIC_COMMANDS = 1 << 4,
+  CAPABILITY_TIMESTAMP = 1 << 5,
+  CAPABILITY_SWO_STREAMING = 1 << 6,
+};
+
+// DAP_SWO_Transport
+enum swo_transport : uint8_t {
+  SWO_TRANSPORT_NONE = 0,
+  SWO_TRANSPORT_DATA = 1,    // Through DAP_SWO_Data
+  SWO_TRANSPORT_STREAM = 2,  // Through the separate trace channel
+};
+
+// DAP_SWO_Mode
+enum swo_mode : uint8_t {
+  SWO_MODE_OFF = 0,
+  SWO_MODE_UART = 1,
+  SWO_MODE_MANCHESTER = 2,
+};
+
+// Trace status of DAP_SWO_Status and DAP_SWO_ExtendedStatus
+enum swo_status : uint8_t {
+  SWO_CAPTURE_ACTIVE = 1 << 0,
+  SWO_STREAM_ERROR = 1 << 6,
+  SWO_BUFFER_OVERRUN = 1 << 7,
+};
+
+// Fields requested from DAP_SWO_ExtendedStatus
+enum swo_extended : uint8_t {
+  SWO_EXTENDED_STATUS = 1 << 0,
+  SWO_EXTENDED_COUNT = 1 << 1,
+  SWO_EXTENDED_TIMESTAMP = 1 << 2,
+};
+
+enum dap_port : uint8_t {
+  PORT_DISABLED = 0,  // Also "default port" in DAP_Connect
+  PORT_SWD = 1,
+  PORT_JTAG = 2,
+};
+
+// Bit positions of DAP_SWJ_Pins
+enum dap_pin : uint8_t {
+  PIN_SWCLK_TCK = 0,
+  PIN_SWDIO_TMS = 1,
+  PIN_TDI = 2,
+  PIN_TDO = 3,
+  PIN_NTRST = 5,
+  PIN_NRESET = 7,
+};
+
+/* ------------------------------------------------------------------------- */
+/* Transfers                                                                 */
+/* ------------------------------------------------------------------------- */
+
+// Bits of a DAP_Transfer request byte
+enum transfer_request : uint8_t {
+  TRANSFER_APNDP = 1 << 0,        // Access port, otherwise debug port
+  TRANSFER_RNW = 1 << 1,          // Read, otherwise write
+  TRANSFER_A2 = 1 << 2,           // Register address bit 2
+  TRANSFER_A3 = 1 << 3,           // Register address bit 3
+  TRANSFER_MATCH_VALUE = 1 << 4,  // Read until the value matches
+  TRANSFER_MATCH_MASK = 1 << 5,   // Write the match mask instead
+  TRANSFER_TIMESTAMP = 1 << 7,
+};
+
+// Response bits of a transfer, the low three are the SWD ACK
+enum transfer_response : uint8_t {
+  TRANSFER_OK = 1 << 0,
+  TRANSFER_WAIT = 1 << 1,
+  TRANSFER_FAULT = 1 << 2,
+  TRANSFER_NO_ACK = 0x07,
+  TRANSFER_ERROR = 1 << 3,     // Parity error in the data phase
+  TRANSFER_MISMATCH = 1 << 4,  // Value match retries ran out
+};
+
+// Debug port registers, as A3:A2 of a request
+enum dp_register : uint8_t {
+  DP_ABORT = 0x00,   // Write
+  DP_DPIDR = 0x00,   // Read
+  DP_CTRL_STAT = 0x04,
+  DP_SELECT = 0x08,
+  DP_RDBUFF = 0x0c,
+};
+
+// MEM-AP registers of bank 0, as A3:A2 of a request
+enum ap_register : uint8_t {
+  AP_CSW = 0x00,
+  AP_TAR = 0x04,
+  AP_DRW = 0x0c,
+};
+
+// JTAG-DP instructions
+enum jtag_instruction : uint8_t {
+  IR_ABORT = 0x08,
+  IR_DPACC = 0x0a,
+  IR_APACC = 0x0b,
+  IR_IDCODE = 0x0e,
+};
+
+// ACK of a JTAG-DP DPACC/APACC scan, as captured LSB first
+enum jtag_ack : uint8_t {
+  JTAG_ACK_WAIT = 0x01,
+  JTAG_ACK_OK = 0x02,  // OK or FAULT, a fault only shows in CTRL/STAT
+};
+
+const char PROTOCOL_VERSION[] = "2.1.1";  // CMSIS-DAP protocol version
+
+}  // namespace dap
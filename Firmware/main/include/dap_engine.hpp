@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "dap_defs.hpp"
+#include "dap_phy.hpp"
+
+namespace dap {
+
+// CMSIS-DAP command processor, independent of the transport. A transport
+// hands over whole commands, as many as it has, and gathers the responses;
+// DAP_Transfer and DAP_TransferBlock run their whole batch against the PHY
+// in one go, with reads posted back to back (AP reads over SWD, every read
+// over JTAG) so that a batch of N reads costs N + 1 packets or scans and no
+// host round trip in between.
+class DapEngine {
+ public:
+  static constexpr size_t PACKET_SIZE = CONFIG_FLUIDITY_DAP_PACKET_SIZE;
+  static constexpr size_t PACKET_COUNT = CONFIG_FLUIDITY_DAP_PACKET_COUNT;
+
+  // Returned by command_length() for a command that can never fit a packet
+  static constexpr size_t MALFORMED = SIZE_MAX;
+
+  // Devices a JTAG chain may have, as configured by DAP_JTAG_Configure
+  static constexpr size_t JTAG_MAX_DEVICES = 8;
+
+  explicit DapEngine(DapPhy& phy);
+
+  esp_err_t init();
+
+  // Length of the command at the front of data, 0 while it is incomplete
+  static size_t command_length(std::span<const uint8_t> data);
+
+  // Runs one complete command and writes its response, returns the length
+  // of the response (DAP_TransferAbort has none)
+  size_t execute(std::span<const uint8_t> command, std::span<uint8_t> response);
+
+  // Releases the target, e.g. when the host went away without DAP_Disconnect
+  void reset();
+  // Drops the session state without touching the PHY, which another client
+  // holds
+  void forget();
+
+  // Another client is about to drive the lines: saves the CSW and TAR the
+  // host caches for the AP it selected last, as the other client will
+  // overwrite them
+  void suspend();
+  // The lines are back: reconnects them as the host configured them, wakes
+  // the DP and puts back SELECT and the saved CSW and TAR
+  void resume();
+
+  DapEngine(const DapEngine&) = delete;
+  DapEngine& operator=(const DapEngine&) = delete;
+
+ private:
+  static constexpr const char* TAG = "dap_engine";
+
+  // reader over a command that command_length() already validated
+  struct cursor_t {
+    const uint8_t* data;
+    const uint8_t* end;
+    uint8_t u8() { return *data++; }
+    uint16_t u16() {
+      uint16_t value = data[0] | data[1] << 8;
+      data += 2;
+      return value;
+    }
+    uint32_t u32() {
+      uint32_t value = data[0] | data[1] << 8 | data[2] << 16 |
+                       static_cast<uint32_t>(data[3]) << 24;
+      data += 4;
+      return value;
+    }
+  };
+
+  struct jtag_chain_t {
+    uint8_t count{1};
+    uint8_t index{0};  // Device the DAP commands address
+    uint8_t ir_length[JTAG_MAX_DEVICES]{4};
+    uint16_t ir_before[JTAG_MAX_DEVICES]{};  // IR bits shifted before its own
+    uint16_t ir_after[JTAG_MAX_DEVICES]{};   // IR bits shifted after its own
+  };
+
+  DapPhy& phy_;
+  uint8_t port_{PORT_DISABLED};
+  uint32_t clock_{0};  // Last DAP_SWJ_Clock, 0 leaves the PHY default
+  swd_config_t swd_config_{};
+  uint16_t wait_retry_{100};
+  uint16_t match_retry_{0};
+  uint32_t match_mask_{0xffffffff};
+  jtag_chain_t chain_{};
+  uint32_t jtag_ir_{0};  // Instruction the selected device holds
+  bool jtag_ir_valid_{false};
+
+  // what the host expects of the target across a handoff
+  uint32_t select_{0};  // Last DP SELECT written
+  bool select_valid_{false};
+  uint32_t saved_csw_{0};
+  uint32_t saved_tar_{0};
+  bool saved_{false};
+
+  size_t execute_one(cursor_t& in, uint8_t* out, size_t capacity);
+
+  size_t info(cursor_t& in, uint8_t* out);
+  size_t transfer(cursor_t& in, uint8_t* out, size_t capacity);
+  size_t transfer_block(cursor_t& in, uint8_t* out, size_t capacity);
+  size_t swj_pins(cursor_t& in, uint8_t* out);
+  size_t swd_sequence(cursor_t& in, uint8_t* out, size_t capacity);
+  size_t jtag_sequence(cursor_t& in, uint8_t* out, size_t capacity);
+  size_t jtag_configure(cursor_t& in, uint8_t* out);
+  size_t jtag_idcode(cursor_t& in, uint8_t* out);
+  size_t swo(uint8_t command, cursor_t& in, uint8_t* out);
+
+  // makes index the addressed device, false if the chain has no such device
+  bool select_device(uint8_t index);
+
+  // one SWD packet or JTAG scan, retried while the target answers WAIT
+  uint8_t transfer_retry(uint8_t request, uint32_t& data);
+
+  // DPACC or APACC scan of the addressed device, from and back to Idle
+  uint8_t jtag_transfer(uint8_t request, uint32_t& data);
+  void jtag_write_abort(uint32_t data);
+  void jtag_write_ir(uint32_t ir);
+  // bits cycles of a Shift state, TDI from value for the first 32 and ones
+  // after, TMS high on the last when exit; returns TDO of the first 32
+  uint32_t jtag_scan(size_t bits, uint32_t value, bool exit);
+
+  static size_t transfer_length(std::span<const uint8_t> data);
+  static size_t swd_sequence_length(std::span<const uint8_t> data);
+  static size_t jtag_sequence_length(std::span<const uint8_t> data);
+  static size_t execute_commands_length(std::span<const uint8_t> data);
+  // Longest response a command command_length() accepted can produce
+  static size_t response_length(std::span<const uint8_t> data);
+
+  static void put_u16(uint8_t* out, uint16_t value);
+  static void put_u32(uint8_t* out, uint32_t value);
+};
+
+}  // namespace dap
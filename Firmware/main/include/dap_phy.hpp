@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "esp_err.h"
+
+namespace dap {
+
+struct swd_config_t {
+  uint8_t turnaround{1};   // Turnaround cycles, 1 to 4
+  bool data_phase{false};  // Clock a data phase after WAIT and FAULT too
+  uint8_t idle_cycles{0};  // Idle cycles after every transfer
+};
+
+// Wire side of the DAP engine: drives SWCLK/SWDIO (or TCK/TMS) and the
+// target reset line. Clients take turns through the SWD lease of the
+// session manager (a DAP batch, a flash job) and only call everything else
+// while they hold it.
+class DapPhy {
+ public:
+  virtual ~DapPhy() = default;
+
+  virtual esp_err_t init() = 0;
+
+  // init() on first use, for every client sharing the PHY
+  esp_err_t ensure_init() {
+    std::lock_guard<std::mutex> lock(init_mutex_);
+    if (!initialised_) {
+      esp_err_t ret = init();
+      if (ret != ESP_OK) {
+        return ret;
+      }
+      initialised_ = true;
+    }
+    return ESP_OK;
+  }
+
+  // Takes the pins for port (PORT_SWD or PORT_JTAG), false if unsupported
+  virtual bool connect(uint8_t port) = 0;
+  // Releases every pin to high impedance
+  virtual void disconnect() = 0;
+
+  virtual void set_clock(uint32_t frequency) = 0;
+  virtual void configure_swd(const swd_config_t& config) = 0;
+
+  // bits SWCLK cycles with SWDIO/TMS taken from data, LSB first
+  virtual void swj_sequence(size_t bits, const uint8_t* data) = 0;
+  // bits SWCLK cycles, driving out or, when out is nullptr, capturing to in
+  virtual void swd_sequence(size_t bits, const uint8_t* out, uint8_t* in) = 0;
+
+  // One SWD packet: request, ACK and data phase. Returns the ACK, or
+  // TRANSFER_ERROR when the read data fails its parity.
+  virtual uint8_t swd_transfer(uint8_t request, uint32_t& data) = 0;
+
+  // Drives the pins selected in select to output, returns every pin level
+  // (both as dap_pin bits)
+  virtual uint8_t swj_pins(uint8_t output, uint8_t select) = 0;
+
+  virtual bool has_jtag() const { return false; }
+
+  // Up to 32 TCK cycles, TMS and TDI taken from the words LSB first;
+  // returns TDO sampled on each cycle
+  virtual uint32_t jtag_shift(size_t bits, uint32_t tms, uint32_t tdi) {
+    return 0;
+  }
+
+ private:
+  std::mutex init_mutex_;
+  bool initialised_{false};
+};
+
+// The PHY selected in Kconfig
+DapPhy& debug_phy();
+
+}  // namespace dap
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "dap_defs.hpp"
+
+namespace dap {
+
+// Everything a PHY would otherwise compute per packet or per connect, worked
+// out by the compiler: SWD request bytes with their parity, data parity, and
+// the SWJ-DP switching sequences (bits LSB first, as DAP_SWJ_Sequence).
+
+constexpr uint8_t parity8(uint8_t value) {
+  value ^= value >> 4;
+  value ^= value >> 2;
+  value ^= value >> 1;
+  return value & 1;
+}
+
+constexpr std::array<uint8_t, 256> PARITY_TABLE = [] {
+  std::array<uint8_t, 256> table{};
+  for (size_t i = 0; i < table.size(); i++) {
+    table[i] = parity8(static_cast<uint8_t>(i));
+  }
+  return table;
+}();
+
+constexpr uint32_t parity32(uint32_t value) {
+  value ^= value >> 16;
+  value ^= value >> 8;
+  return PARITY_TABLE[value & 0xff];
+}
+
+// start, APnDP, RnW, A2, A3, parity, stop, park
+constexpr uint8_t swd_request_header(uint8_t request) {
+  uint8_t header = request & 0x0f;
+  return static_cast<uint8_t>(1 | header << 1 | parity8(header) << 5 | 1 << 7);
+}
+
+// indexed by the low four bits of a DAP_Transfer request
+constexpr std::array<uint8_t, 16> REQUEST_HEADERS = [] {
+  std::array<uint8_t, 16> headers{};
+  for (size_t i = 0; i < headers.size(); i++) {
+    headers[i] = swd_request_header(static_cast<uint8_t>(i));
+  }
+  return headers;
+}();
+
+static_assert(REQUEST_HEADERS[TRANSFER_RNW] == 0xa5, "DP read IDCODE");
+static_assert(REQUEST_HEADERS[TRANSFER_APNDP | TRANSFER_RNW] == 0x87,
+              "AP read 0x00");
+
+template <size_t Bits>
+struct swj_sequence_t {
+  static constexpr size_t BITS = Bits;
+  std::array<uint8_t, (Bits + 7) / 8> data;
+};
+
+// Bits copies of level
+template <size_t Bits>
+constexpr swj_sequence_t<Bits> make_run(bool level) {
+  swj_sequence_t<Bits> sequence{};
+  for (size_t i = 0; i < Bits; i++) {
+    if (level) {
+      sequence.data[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+    }
+  }
+  return sequence;
+}
+
+// the pattern of value, Bits long
+template <size_t Bits>
+constexpr swj_sequence_t<Bits> make_pattern(uint64_t value) {
+  swj_sequence_t<Bits> sequence{};
+  for (size_t i = 0; i < Bits; i++) {
+    if ((value >> i) & 1) {
+      sequence.data[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+    }
+  }
+  return sequence;
+}
+
+// at least 50 cycles high: SWD line reset, JTAG Test-Logic-Reset
+constexpr auto LINE_RESET = make_run<56>(true);
+constexpr auto IDLE_CYCLES = make_run<8>(false);
+constexpr auto JTAG_TO_SWD = make_pattern<16>(0xe79e);
+constexpr auto SWD_TO_JTAG = make_pattern<16>(0xe73c);
+
+static_assert(JTAG_TO_SWD.data[0] == 0x9e && JTAG_TO_SWD.data[1] == 0xe7);
+
+}  // namespace dap
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "driver/dedic_gpio.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "hal/gpio_ll.h"
+#include "sdkconfig.h"
+#include "dap_phy.hpp"
+#include "dap_sequences.hpp"
+
+namespace dap {
+
+// SWD and JTAG on the S3's dedicated GPIO bundles: the CPU drives and samples
+// the lines with single-cycle instructions instead of going through the GPIO
+// matrix registers. Fixed-width shifts (request, ACK, data word) are unrolled
+// at compile time, and every shifting routine exists once with and once
+// without clock pacing, so the full-speed path carries no delay checks.
+class DedicatedGpioPhy : public DapPhy {
+ public:
+  static DedicatedGpioPhy& get_instance();
+
+  esp_err_t init() override;
+
+  bool connect(uint8_t port) override;
+  void disconnect() override;
+
+  void set_clock(uint32_t frequency) override;
+  void configure_swd(const swd_config_t& config) override;
+
+  void swj_sequence(size_t bits, const uint8_t* data) override;
+  void swd_sequence(size_t bits, const uint8_t* out, uint8_t* in) override;
+  uint8_t swd_transfer(uint8_t request, uint32_t& data) override;
+
+  uint8_t swj_pins(uint8_t output, uint8_t select) override;
+
+  bool has_jtag() const override { return TDI >= 0 && TDO >= 0; }
+  uint32_t jtag_shift(size_t bits, uint32_t tms, uint32_t tdi) override;
+
+  DedicatedGpioPhy(const DedicatedGpioPhy&) = delete;
+  DedicatedGpioPhy& operator=(const DedicatedGpioPhy&) = delete;
+
+ private:
+  DedicatedGpioPhy() = default;
+  ~DedicatedGpioPhy() = default;
+
+  static constexpr const char* TAG = "dedicated_gpio_phy";
+  static constexpr int SWCLK = CONFIG_FLUIDITY_DAP_SWCLK_PIN;  // Also TCK
+  static constexpr int SWDIO = CONFIG_FLUIDITY_DAP_SWDIO_PIN;  // Also TMS
+  static constexpr int TDI = CONFIG_FLUIDITY_DAP_TDI_PIN;      // -1: none
+  static constexpr int TDO = CONFIG_FLUIDITY_DAP_TDO_PIN;      // -1: none
+  static constexpr int NRESET = CONFIG_FLUIDITY_DAP_NRESET_PIN;
+
+  gpio_dev_t* hw_{GPIO_LL_GET_HW(GPIO_PORT_0)};
+  dedic_gpio_bundle_handle_t out_bundle_{nullptr};  // SWCLK, SWDIO, TDI
+  dedic_gpio_bundle_handle_t in_bundle_{nullptr};   // SWDIO, TDO
+
+  // bits of the lines in the CPU's dedicated GPIO registers
+  uint32_t clk_{0};
+  uint32_t dio_{0};
+  uint32_t tdi_{0};
+  uint32_t dio_in_shift_{0};
+  uint32_t tdo_in_shift_{0};
+
+  uint32_t half_period_{0};  // CPU cycles per clock phase, 0: no pacing
+  swd_config_t config_{};
+
+  static void set_output(int pin, bool enable);
+  void set_swdio_output(bool enable) { set_output(SWDIO, enable); }
+
+  template <bool Paced>
+  void delay() const;
+  template <bool Paced>
+  void write_bit(uint32_t bit);
+  template <bool Paced>
+  uint32_t read_bit();
+  template <bool Paced>
+  void clock_cycles(size_t cycles);
+  template <size_t Bits, bool Paced>
+  void write_word(uint32_t value);
+  template <size_t Bits, bool Paced>
+  uint32_t read_word();
+
+  template <bool Paced>
+  void write_sequence(size_t bits, const uint8_t* data);
+  template <bool Paced>
+  void read_sequence(size_t bits, uint8_t* data);
+  template <bool Paced>
+  uint8_t transfer(uint8_t request, uint32_t& data);
+  template <bool Paced>
+  uint32_t shift_jtag(size_t bits, uint32_t tms, uint32_t tdi);
+
+  template <size_t Bits>
+  void emit(const swj_sequence_t<Bits>& sequence);
+};
+
+}  // namespace dap
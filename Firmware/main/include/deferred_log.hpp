@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+// Logging for the data paths. FLOG_x(MODULE, tag, format, ...) compiles to
+// nothing below CONFIG_FLUIDITY_LOG_LEVEL_<MODULE>; what is left either
+// goes straight to ESP_LOG or, with CONFIG_FLUIDITY_LOG_DEFERRED, becomes
+// a record of the format pointer and up to four word-sized arguments that the
+// drain task formats later. Deferred arguments are read long after the
+// call, so %s may only name static strings (tags, literals,
+// esp_err_to_name()). Cold paths keep using ESP_LOGx directly.
+
+#define FLOG_E(module, tag, format, ...) \
+  FLOG(module, ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define FLOG_W(module, tag, format, ...) \
+  FLOG(module, ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define FLOG_I(module, tag, format, ...) \
+  FLOG(module, ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define FLOG_D(module, tag, format, ...) \
+  FLOG(module, ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+#define FLOG(module, level, tag, format, ...)                      \
+  do {                                                             \
+    if constexpr ((level) <= CONFIG_FLUIDITY_LOG_LEVEL_##module) { \
+      FLOG_EMIT(level, tag, format, ##__VA_ARGS__);                \
+    }                                                              \
+  } while (0)
+
+#if CONFIG_FLUIDITY_LOG_DEFERRED
+#define FLOG_EMIT(level, tag, format, ...) \
+  ::logging::defer<level>(tag, format, ##__VA_ARGS__)
+#else
+#define FLOG_EMIT(level, tag, format, ...) \
+  ESP_LOG_LEVEL_LOCAL(level, tag, format, ##__VA_ARGS__)
+#endif
+
+namespace logging {
+
+constexpr size_t MAX_ARGS = 4;
+
+// One deferred line; the strings stay where they are
+struct record_t {
+  const char* tag;
+  const char* format;
+  uint32_t timestamp;  // Milliseconds since boot, as ESP_LOG prints them
+  uint8_t level;       // esp_log_level_t
+  uint8_t argc;
+  uintptr_t args[MAX_ARGS];  // Machine words, as varargs pass them
+};
+
+// Bounded ring from any number of producers, tasks on either core or ISRs,
+// to the drain task. Producers claim a cell with one compare-and-swap on
+// the head and publish it through the cell's sequence, so a record costs
+// a copy and never a lock; a full ring drops the record and counts it.
+class DeferredLog {
+ public:
+  static DeferredLog& get_instance();
+
+  esp_err_t start();
+  bool push(const record_t& record);
+
+  DeferredLog(const DeferredLog&) = delete;
+  DeferredLog& operator=(const DeferredLog&) = delete;
+
+ private:
+  DeferredLog();
+  ~DeferredLog() = default;
+
+  static constexpr const char* TAG = "deferred_log";
+  static constexpr size_t CAPACITY =
+      std::bit_ceil(size_t{CONFIG_FLUIDITY_LOG_RING_SIZE});
+  static constexpr uint32_t DRAIN_INTERVAL_MS =
+      CONFIG_FLUIDITY_LOG_DRAIN_INTERVAL_MS;
+  static constexpr size_t LINE_SIZE = 160;
+
+  struct cell_t {
+    std::atomic<uint32_t> sequence;  // Position it is free or full for
+    record_t record;
+  };
+
+  cell_t cells_[CAPACITY];
+  std::atomic<uint32_t> head_{0};
+  uint32_t tail_{0};  // Drain task only
+  std::atomic<uint32_t> dropped_{0};
+  TaskHandle_t task_{nullptr};
+
+  bool pop(record_t& record);
+  void print(const record_t& record);
+  void run();
+
+  static void drain_entry(void* arg) {
+    auto* log = static_cast<DeferredLog*>(arg);
+    log->run();
+  };
+};
+
+template <typename T>
+inline uintptr_t to_word(T value) {
+  // 64-bit integers and doubles take two words, %s needs a pointer
+  static_assert(sizeof(T) <= sizeof(uintptr_t) && !std::is_floating_point_v<T>,
+                "deferred log arguments are word-sized integers or pointers");
+  if constexpr (std::is_pointer_v<T>) {
+    return reinterpret_cast<uintptr_t>(value);
+  } else {
+    return static_cast<uintptr_t>(value);
+  }
+}
+
+template <esp_log_level_t Level, typename... Args>
+inline void defer(const char* tag, const char* format, Args... args) {
+  static_assert(sizeof...(Args) <= MAX_ARGS, "too many deferred arguments");
+  record_t record{
+      .tag = tag,
+      .format = format,
+      .timestamp = static_cast<uint32_t>(esp_timer_get_time() / 1000),
+      .level = Level,
+      .argc = sizeof...(Args),
+      .args = {to_word(args)...},
+  };
+  DeferredLog::get_instance().push(record);
+}
+
+esp_err_t start_deferred_log();
+
+}  // namespace logging
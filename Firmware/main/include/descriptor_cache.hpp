@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "usb_host_backend.hpp"
+#include "usbip_defs.hpp"
+
+namespace usbip {
+
+// Wire images of every exported device, rebuilt only when the backend
+// reports that the device set changed. OP_REP_DEVLIST goes out in one send
+// straight from the cache and OP_REQ_IMPORT finds its device by bus id hash,
+// neither of them reaching the USB host stack. Owned by the server task and
+// not thread safe.
+class DescriptorCache {
+ public:
+  static constexpr size_t MAX_DEVICES = UsbHostBackend::MAX_DEVICES;
+
+  explicit DescriptorCache(UsbHostBackend& backend);
+
+  // Rebuilds the images if a device came or went since the last call
+  void refresh();
+
+  // Complete OP_REP_DEVLIST in wire order
+  std::span<const uint8_t> devlist() const;
+
+  // Wire-order device_descriptor_t exported under bus_id, or an empty span
+  std::span<const uint8_t> find(const char* bus_id) const;
+
+  DescriptorCache(const DescriptorCache&) = delete;
+  DescriptorCache& operator=(const DescriptorCache&) = delete;
+
+ private:
+  static constexpr const char* TAG = "descriptor_cache";
+  static constexpr size_t BUS_ID_SIZE = sizeof(device_descriptor_t::bus_id);
+  static constexpr size_t RECORD_SIZE =
+      sizeof(device_descriptor_t) +
+      CONFIG_FLUIDITY_USBIP_MAX_INTERFACES * sizeof(device_interface_t);
+
+  struct entry_t {
+    uint32_t hash;             // FNV-1a of bus_id
+    char bus_id[BUS_ID_SIZE];  // Kept for the final compare
+    size_t offset;             // Descriptor position in devlist_
+  };
+
+  UsbHostBackend& backend_;
+  uint32_t generation_{0};
+  bool valid_{false};
+
+  alignas(4) uint8_t devlist_[sizeof(op_rep_devlist_t) +
+                              MAX_DEVICES * RECORD_SIZE]{};
+  size_t devlist_length_{0};
+
+  std::array<entry_t, MAX_DEVICES> entries_{};
+  size_t entry_count_{0};
+
+  void rebuild();
+
+  static uint32_t hash(const char* bus_id);
+  static void fill_descriptor(const exported_device_t& device,
+                              const char* bus_id,
+                              device_descriptor_t& descriptor);
+};
+
+}  // namespace usbip
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "dap_engine.hpp"
+#include "session_manager.hpp"
+#include "tcp_server_unit.hpp"
+
+namespace dap {
+
+// elaphureLink handshake, every field big-endian
+struct el_handshake_t {
+  uint32_t identifier;  // EL_LINK_IDENTIFIER
+  uint32_t command;     // EL_COMMAND_HANDSHAKE
+  uint32_t version;     // Proxy version in requests, ours in the reply
+};
+
+const uint32_t EL_LINK_IDENTIFIER = 0x8a656c70;
+const uint32_t EL_COMMAND_HANDSHAKE = 0x00000000;
+const uint32_t EL_DAP_VERSION = 0x00000001;
+
+// elaphureLink server on top of tcp_server_unit: after the handshake the
+// stream carries raw CMSIS-DAP commands. Every complete command in a read is
+// executed before anything is sent, and the responses leave together in one
+// write, so a whole batch costs one round trip. The debug lines are leased
+// per batch, so a flash job can run while the host sits idle.
+class ElaphurelinkServer : public server::TcpHandler, public session::Lessee {
+ public:
+  static ElaphurelinkServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  esp_err_t on_connect(server::connection_t& connection) override;
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+  void on_disconnect(server::connection_t& connection) override;
+
+  void on_preempted(session::resource_t resource) override;
+
+  ElaphurelinkServer(const ElaphurelinkServer&) = delete;
+  ElaphurelinkServer& operator=(const ElaphurelinkServer&) = delete;
+
+ private:
+  ElaphurelinkServer();
+  ~ElaphurelinkServer() = default;
+
+  static constexpr const char* TAG = "elaphurelink_server";
+  static constexpr size_t TX_BUFFER_SIZE =
+      DapEngine::PACKET_SIZE * DapEngine::PACKET_COUNT;
+
+  DapEngine engine_;
+  server::TcpServerUnit unit_;
+
+  bool handshaken_{false};
+  bool fresh_{false};  // No batch ran for this client yet
+  uint8_t tx_buffer_[TX_BUFFER_SIZE]{};
+  size_t tx_length_{0};
+
+  size_t handshake(int socket, std::span<const uint8_t> data);
+  esp_err_t flush(int socket);
+  // Leases the lines for one batch, false while another client uses them
+  bool lease();
+};
+
+esp_err_t start_elaphurelink_server();
+
+}  // namespace dap
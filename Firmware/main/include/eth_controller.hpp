@@ -0,0 +1,71 @@
+#pragma once
+
+#include <mutex>
+#include "driver/spi_master.h"
+#include "esp_err.h"
+#include "esp_eth.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "sdkconfig.h"
+#include "link_notifier.hpp"
+
+namespace controller {
+
+// Wired path through a WIZnet W5500 on SPI. The S3's OTG port already
+// hosts the USB/IP devices, so USB-NCM is not an option; a W5500 module
+// only needs a few spare GPIOs and gives a deterministic sub-millisecond
+// round trip.
+class EthController {
+ public:
+  static EthController& get_instance();
+
+  // Brings up SPI, the W5500 and its netif; ESP_ERR_NOT_SUPPORTED when
+  // no module is configured
+  esp_err_t init();
+
+  esp_err_t subscribe(link_callback_t callback, void* arg);
+  void unsubscribe(link_callback_t callback, void* arg);
+
+  // nullptr until init()
+  esp_netif_t* get_netif() const;
+
+  EthController(const EthController&) = delete;
+  EthController& operator=(const EthController&) = delete;
+
+ private:
+  EthController() = default;
+  ~EthController() = default;
+
+  static constexpr const char* TAG = "eth_controller";
+
+  std::mutex mutex_;
+  bool initialized_{false};
+  esp_eth_handle_t handle_{nullptr};
+  esp_netif_t* netif_{nullptr};
+  LinkNotifier link_;
+
+  esp_err_t install_driver();
+  void handle_eth_event(int32_t event_id, void* event_data);
+  void handle_ip_event(int32_t event_id, void* event_data);
+
+  static void eth_event_handler(void* arg,
+                                esp_event_base_t event_base,
+                                int32_t event_id,
+                                void* event_data) {
+    auto* controller = static_cast<EthController*>(arg);
+    controller->handle_eth_event(event_id, event_data);
+  };
+
+  static void ip_event_handler(void* arg,
+                               esp_event_base_t event_base,
+                               int32_t event_id,
+                               void* event_data) {
+    auto* controller = static_cast<EthController*>(arg);
+    controller->handle_ip_event(event_id, event_data);
+  };
+};
+
+esp_err_t start_ethernet();
+
+}  // namespace controller
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace flash {
+
+/* ------------------------------------------------------------------------- */
+/* Flash server protocol, every field little-endian                          */
+/* ------------------------------------------------------------------------- */
+
+enum flash_command : uint8_t {
+  FLASH_LOAD = 0x01,     // flash_algorithm_t, then the algorithm's code
+  FLASH_PROGRAM = 0x02,  // flash_program_t, then the image bytes
+  FLASH_RESET = 0x03,    // No payload: reset the target and let it run
+  FLASH_STORE = 0x04,    // flash_store_t, then the image bytes to cache
+  FLASH_IMAGE = 0x05,    // flash_image_t: program a cached image
+  FLASH_VERIFY = 0x06,   // flash_verify_t: digest a range of target memory
+};
+
+enum flash_status : uint8_t {
+  FLASH_OK = 0x00,
+  FLASH_ERROR_REQUEST = 0x01,    // Malformed, or no algorithm loaded
+  FLASH_ERROR_TARGET = 0x02,     // SWD access failed
+  FLASH_ERROR_ALGORITHM = 0x03,  // A function returned non-zero
+  FLASH_ERROR_TIMEOUT = 0x04,    // A function did not return in time
+  FLASH_ERROR_NOT_CACHED = 0x05,  // FLASH_IMAGE of an unknown image
+  FLASH_ERROR_DIGEST = 0x06,      // FLASH_STORE bytes hash differently
+};
+
+// Precedes every request
+struct flash_request_t {
+  uint8_t command;  // flash_command
+  uint8_t reserved[3];
+  uint32_t length;  // Payload bytes that follow
+};
+
+// Answers every request once it has been carried out
+struct flash_response_t {
+  uint8_t command;  // As requested
+  uint8_t status;   // flash_status
+  uint16_t reserved;
+  // Bytes programmed, or the address that failed; bytes cached for
+  // FLASH_STORE, bytes digested for FLASH_VERIFY
+  uint32_t value;
+};
+
+constexpr size_t FLASH_MAX_SECTOR_REGIONS = 16;
+
+// Run of equally sized sectors, as the FlashDevice table of an FLM
+struct flash_sector_region_t {
+  uint32_t size;    // Sector size, 0 ends the table
+  uint32_t offset;  // First sector of the run, from flash_base
+};
+
+// A CMSIS-Pack flash algorithm, already linked by the host: code and data
+// are loaded at load_address and every entry point is absolute
+struct flash_algorithm_t {
+  uint32_t load_address;  // Target RAM the code is written to
+  uint32_t breakpoint;    // Return address of every call, a BKPT in the code
+  uint32_t static_base;   // R9 of every call
+  uint32_t stack_top;     // SP of every call
+
+  uint32_t init;          // Init(address, clock, function), 0: none
+  uint32_t uninit;        // UnInit(function), 0: none
+  uint32_t erase_sector;  // EraseSector(address)
+  uint32_t program_page;  // ProgramPage(address, size, buffer)
+
+  // Target RAM pages are uploaded into; with both set, one is written while
+  // ProgramPage works from the other
+  uint32_t buffers[2];
+
+  uint32_t flash_base;
+  uint32_t flash_size;
+  uint32_t page_size;           // Bytes per ProgramPage
+  uint32_t erased_value;        // Byte value of erased flash, low byte
+  uint32_t erase_timeout_ms;    // Per EraseSector
+  uint32_t program_timeout_ms;  // Per ProgramPage
+  uint32_t clock;               // SWCLK during the job, 0: default
+
+  flash_sector_region_t sectors[FLASH_MAX_SECTOR_REGIONS];
+};
+
+// Payload of FLASH_PROGRAM ahead of the image; the sectors the image
+// touches are erased whole first, so bytes in them outside the image read
+// back erased
+struct flash_program_t {
+  uint32_t address;
+};
+
+// Payload of FLASH_STORE ahead of the image
+struct flash_store_t {
+  uint8_t digest[32];  // SHA-256 of the image bytes
+};
+
+// Payload of FLASH_IMAGE. Only the sectors whose contents differ from the
+// image are erased and programmed, the response counts their bytes. Target
+// bytes outside the image in its first and last sector are kept.
+struct flash_image_t {
+  uint32_t address;
+  uint8_t digest[32];  // As stored
+};
+
+// Payload of FLASH_VERIFY; the target is read as the core sees it
+struct flash_verify_t {
+  uint32_t address;
+  uint32_t length;
+};
+
+// Follows the response to FLASH_VERIFY, zeroed unless it succeeded
+struct flash_digest_t {
+  uint32_t crc32;      // IEEE 802.3, as zlib's crc32()
+  uint8_t sha256[32];
+};
+
+// function argument of Init and UnInit
+enum flash_function : uint32_t {
+  FUNCTION_ERASE = 1,
+  FUNCTION_PROGRAM = 2,
+  FUNCTION_VERIFY = 3,
+};
+
+}  // namespace flash
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "dap_phy.hpp"
+#include "flash_defs.hpp"
+#include "target_access.hpp"
+
+namespace flash {
+
+// Runs a host-supplied flash algorithm on the target itself, so an image
+// crosses the network once as a plain stream. Pages are gathered on the
+// probe and uploaded into the algorithm's two target RAM buffers in turn:
+// while ProgramPage works from one, the next page goes over SWD into the
+// other, and the SWD time hides behind the flash programming time.
+//
+// The caller holds the SWD lease; everything runs on the caller's task.
+class FlashProgrammer {
+ public:
+  static constexpr size_t MAX_PAGE_SIZE = CONFIG_FLUIDITY_FLASH_MAX_PAGE_SIZE;
+
+  explicit FlashProgrammer(dap::DapPhy& phy);
+  ~FlashProgrammer();
+
+  // Connects to and halts the target, then uploads the algorithm's code
+  flash_status load(const flash_algorithm_t& algorithm,
+                    std::span<const uint8_t> code);
+  bool is_loaded() const { return loaded_; }
+
+  // Erases every sector of [address, address + length) and opens a page
+  // stream at address
+  flash_status begin(uint32_t address, uint32_t length);
+  // Image bytes, continuing where the last call stopped
+  flash_status write(std::span<const uint8_t> data);
+  // Pads and programs the last page, waits for every page to finish
+  flash_status end();
+  // Leaves a failed stream, the target halted
+  void abort();
+
+  // Image bytes written since begin(), and the page or sector that failed
+  uint32_t programmed() const { return programmed_; }
+  uint32_t failed_address() const { return failed_address_; }
+
+  // Target memory as the core sees it, word aligned
+  flash_status read(uint32_t address, uint8_t* data, size_t length);
+  // Sector holding address, false outside the algorithm's device
+  bool find_sector(uint32_t address, uint32_t& start, uint32_t& size) const;
+
+  flash_status reset_target();
+  // Forgets the algorithm and releases the target
+  void close();
+
+  FlashProgrammer(const FlashProgrammer&) = delete;
+  FlashProgrammer& operator=(const FlashProgrammer&) = delete;
+
+ private:
+  static constexpr const char* TAG = "flash_programmer";
+  static constexpr uint32_t DEFAULT_CLOCK = CONFIG_FLUIDITY_FLASH_CLOCK;
+  // EPSR.T, calls always run in Thumb state
+  static constexpr uint32_t XPSR_THUMB = 1 << 24;
+
+  dap::TargetAccess access_;
+  flash_algorithm_t algorithm_{};
+  bool loaded_{false};
+
+  // page being gathered
+  uint8_t page_[MAX_PAGE_SIZE]{};
+  size_t page_fill_{0};
+  uint32_t page_address_{0};
+
+  // ProgramPage still running on the target, if busy_
+  bool busy_{false};
+  uint32_t busy_address_{0};
+  size_t next_buffer_{0};
+
+  bool streaming_{false};
+  flash_status error_{FLASH_OK};  // First failure of the stream
+  uint32_t programmed_{0};
+  uint32_t failed_address_{0};
+
+  // wakes the task waiting on a long call between polls; a tick is far
+  // coarser than a page program
+  esp_timer_handle_t poll_timer_{nullptr};
+  TaskHandle_t poll_task_{nullptr};
+
+  bool double_buffered() const { return algorithm_.buffers[1] != 0; }
+
+  flash_status start_call(uint32_t entry, uint32_t r0, uint32_t r1,
+                          uint32_t r2);
+  flash_status wait_call(uint32_t timeout_ms, uint32_t& result);
+  // blocks the calling task for about us
+  void sleep(uint64_t us);
+  flash_status call(uint32_t entry, uint32_t r0, uint32_t r1, uint32_t r2,
+                    uint32_t timeout_ms);
+
+  flash_status erase(uint32_t address, uint32_t length);
+  flash_status submit_page();
+  flash_status wait_page();
+  flash_status fail(flash_status status, uint32_t address);
+
+  static void poll_timer_callback(void* arg) {
+    xTaskNotifyGive(static_cast<FlashProgrammer*>(arg)->poll_task_);
+  };
+};
+
+}  // namespace flash
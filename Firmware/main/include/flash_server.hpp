@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "flash_defs.hpp"
+#include "flash_programmer.hpp"
+#include "image_cache.hpp"
+#include "tcp_server_unit.hpp"
+
+namespace flash {
+
+// Flash jobs over TCP: the host loads an algorithm once, then streams each
+// image as a single FLASH_PROGRAM request whose bytes are programmed as
+// they arrive and answered once, so a whole image costs one round trip.
+// Images stored in the cache are flashed by digest instead, touching only
+// the sectors that differ from what the target already holds. A job leases
+// the debug lines from FLASH_LOAD until FLASH_RESET or the disconnect,
+// waiting for a DAP host's batch to finish first. FLASH_VERIFY hashes
+// target memory as it comes off SWD and only the digests go back.
+class FlashServer : public server::TcpHandler {
+ public:
+  static FlashServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  esp_err_t on_connect(server::connection_t& connection) override;
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+  void on_disconnect(server::connection_t& connection) override;
+
+  FlashServer(const FlashServer&) = delete;
+  FlashServer& operator=(const FlashServer&) = delete;
+
+ private:
+  FlashServer();
+  ~FlashServer() = default;
+
+  static constexpr const char* TAG = "flash_server";
+  static constexpr size_t RX_BUFFER_SIZE =
+      CONFIG_FLUIDITY_FLASH_RX_BUFFER_SIZE;
+
+  FlashProgrammer programmer_;
+  ImageCache& cache_;
+  server::TcpServerUnit unit_;
+
+  // Target and cache bytes compared or programmed at a time
+  static constexpr size_t CHUNK_SIZE = 1024;
+
+  // image bytes of the FLASH_PROGRAM or FLASH_STORE still to come, 0: none
+  uint8_t stream_{0};
+  uint32_t remaining_{0};
+  flash_status status_{FLASH_OK};
+  bool deferred_{false};  // A FLASH_LOAD waits for the lines
+
+  uint8_t target_chunk_[CHUNK_SIZE]{};
+  uint8_t image_chunk_[CHUNK_SIZE]{};
+
+  size_t handle(int socket, const flash_request_t& request,
+                std::span<const uint8_t> payload);
+  size_t stream(int socket, std::span<const uint8_t> data);
+  void finish_stream(int socket);
+  // Ends the job and gives the lines back
+  void release_target();
+
+  // value: bytes programmed, or the address that failed
+  flash_status flash_image(uint32_t address, const ImageCache::image_t& image,
+                           uint32_t& value);
+  flash_status verify(uint32_t address, uint32_t length,
+                      flash_digest_t& digest);
+  // count target bytes from address, unaligned, through target_chunk_
+  flash_status read_target(uint32_t address, size_t count,
+                           const uint8_t*& data);
+  // count target bytes from address into kept, ahead of an erase
+  flash_status keep_target(uint32_t address, size_t count, uint8_t* kept);
+  flash_status compare(uint32_t address, const ImageCache::image_t& image,
+                       uint32_t offset, uint32_t length, bool& same);
+  flash_status program_range(uint32_t address,
+                             const ImageCache::image_t& image,
+                             uint32_t offset, uint32_t length);
+  esp_err_t respond(int socket, uint8_t command, flash_status status,
+                    uint32_t value);
+};
+
+esp_err_t start_flash_server();
+
+}  // namespace flash
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "rfc2217_defs.hpp"
+
+namespace rfc2217 {
+
+// Index of the first IAC (0xff) in data, or length when there is none.
+//
+// Serial payloads rarely contain 0xff, so the scan has to be cheap when it
+// finds nothing: it tests two aligned words per step. A byte is 0xff exactly
+// when its complement is zero, so (~w - 0x01..) & w & 0x80.. is nonzero
+// whenever w holds one; the hit is then located byte by byte.
+inline size_t find_iac(const uint8_t* data, size_t length) {
+  constexpr uint32_t LOW = 0x01010101;
+  constexpr uint32_t HIGH = 0x80808080;
+
+  size_t i = 0;
+
+  // byte steps until the word loads are aligned
+  while (i < length && (reinterpret_cast<uintptr_t>(data + i) & 3) != 0) {
+    if (data[i] == IAC) {
+      return i;
+    }
+    i++;
+  }
+
+  for (; i + 8 <= length; i += 8) {
+    uint32_t first;
+    uint32_t second;
+    memcpy(&first, data + i, sizeof(first));
+    memcpy(&second, data + i + 4, sizeof(second));
+
+    if ((((~first - LOW) & first) | ((~second - LOW) & second)) & HIGH) {
+      break;
+    }
+  }
+
+  for (; i < length; i++) {
+    if (data[i] == IAC) {
+      return i;
+    }
+  }
+
+  return length;
+}
+
+}  // namespace rfc2217
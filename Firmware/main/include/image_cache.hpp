@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "mbedtls/sha256.h"
+#include "sdkconfig.h"
+
+namespace flash {
+
+using image_digest_t = std::array<uint8_t, 32>;  // SHA-256
+
+// Images the probe has seen, keyed by their SHA-256, so a board that gets
+// the same image again is flashed without it crossing the network. Images
+// live in PSRAM and the least recently used one makes room for a new one;
+// with a "imgcache" partition, an evicted image moves to one of its slots
+// instead of being lost, and slots outlive a reboot.
+//
+// Not thread-safe: the flash server task is the only user.
+class ImageCache {
+ public:
+  // Where a cached image is read from, valid until the next store
+  struct image_t {
+    const uint8_t* data;  // PSRAM copy, nullptr: spill slot only
+    size_t slot;          // Spill slot, if data is nullptr
+    uint32_t length;
+  };
+
+  static ImageCache& get_instance();
+
+  esp_err_t init();
+
+  bool find(const image_digest_t& digest, image_t& image);
+  esp_err_t read(const image_t& image, uint32_t offset, uint8_t* data,
+                 size_t length) const;
+
+  // Makes room for an image of length bytes, which then arrives in pieces
+  // through append(); finish_store() only keeps it if the bytes hash to
+  // digest, ESP_ERR_INVALID_CRC otherwise
+  esp_err_t begin_store(const image_digest_t& digest, uint32_t length);
+  void append(std::span<const uint8_t> data);
+  esp_err_t finish_store();
+  void cancel_store();
+
+  ImageCache(const ImageCache&) = delete;
+  ImageCache& operator=(const ImageCache&) = delete;
+
+ private:
+  ImageCache() = default;
+  ~ImageCache() = default;
+
+  static constexpr const char* TAG = "image_cache";
+  static constexpr size_t CAPACITY = CONFIG_FLUIDITY_FLASH_CACHE_SIZE * 1024;
+  static constexpr size_t ENTRY_COUNT = CONFIG_FLUIDITY_FLASH_CACHE_ENTRIES;
+  static constexpr size_t SLOT_COUNT = CONFIG_FLUIDITY_FLASH_CACHE_SLOTS;
+  static constexpr uint32_t SLOT_MAGIC = 0x31474d49;  // "IMG1"
+  // a slot opens with its header sector, the image follows
+  static constexpr size_t SECTOR_SIZE = 4096;
+
+  struct entry_t {
+    image_digest_t digest;
+    uint8_t* data;  // PSRAM, nullptr: entry unused
+    uint32_t length;
+    uint32_t used;  // Tick of the last find() or store
+  };
+
+  // Written once the slot's image is, so a torn copy stays erased
+  struct slot_header_t {
+    uint32_t magic;     // SLOT_MAGIC
+    uint32_t sequence;  // One more than the newest slot at the time
+    uint32_t length;
+    uint32_t reserved;
+    image_digest_t digest;
+  };
+
+  struct slot_t {
+    image_digest_t digest;
+    uint32_t length;
+    uint32_t sequence;
+    bool valid;
+  };
+
+  bool ok_{false};
+  entry_t entries_[ENTRY_COUNT]{};
+  size_t stored_{0};  // PSRAM bytes held by entries_
+  uint32_t tick_{0};
+
+  const esp_partition_t* partition_{nullptr};
+  size_t slot_size_{0};
+  slot_t slots_[SLOT_COUNT]{};
+  uint32_t sequence_{0};  // Of the next slot written
+
+  // image being stored
+  entry_t* storing_{nullptr};
+  uint32_t fill_{0};
+  mbedtls_sha256_context sha_{};
+
+  void scan_slots();
+  void drop(entry_t& entry);
+  void evict(entry_t& entry);
+  void spill(const entry_t& entry);
+  entry_t* oldest();
+};
+
+}  // namespace flash
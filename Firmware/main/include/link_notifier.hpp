@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include "esp_err.h"
+#include "esp_log.h"
+
+namespace controller {
+
+// Told whether a link has an IP (up) or lost it; runs in the default event
+// loop task and must not block
+using link_callback_t = void (*)(bool up, void* arg);
+
+// Fixed table of link subscribers. Callbacks are invoked under the table's
+// lock, so a subscription and a link change are never seen out of order.
+class LinkNotifier {
+ public:
+  static constexpr size_t MAX_SUBSCRIBERS = 8;
+
+  // Calls callback once with the current state, then on every change
+  esp_err_t subscribe(link_callback_t callback, void* arg);
+  void unsubscribe(link_callback_t callback, void* arg);
+
+  // Calls every subscriber when up differs from the current state
+  void notify(bool up);
+
+  bool is_up();
+
+ private:
+  static constexpr const char* TAG = "link_notifier";
+
+  struct subscriber_t {
+    link_callback_t callback;
+    void* arg;
+  };
+
+  std::mutex mutex_;
+  std::array<subscriber_t, MAX_SUBSCRIBERS> subscribers_{};
+  bool up_{false};
+};
+
+}  // namespace controller
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "spsc_ring.hpp"
+
+namespace metrics {
+
+enum counter_t : uint8_t {
+  DAP_COMMANDS,        // Commands the DAP engine executed
+  URB_SUBMITS,         // CMD_SUBMITs handed to the backend
+  URB_ERRORS,          // URBs that completed with a non-zero status
+  RFC2217_RX_BYTES,    // Target UART to client
+  RFC2217_TX_BYTES,    // Client to target UART
+  SWO_BYTES,           // Trace bytes captured
+  WIFI_RECONNECTS,     // Association attempts after a lost or failed link
+  LEASE_HANDOFFS,      // Resources that changed hands between clients
+  RFC2217_RX_DROPPED,  // Target UART bytes that found the backlog full
+  COUNTER_COUNT,
+};
+
+enum histogram_t : uint8_t {
+  HIST_DAP_COMMAND,   // One DAP command, as executed
+  HIST_URB,           // CMD_SUBMIT to completion
+  HIST_RFC2217_SEND,  // One backlog region onto the socket
+  HISTOGRAM_COUNT,
+};
+
+enum gauge_t : uint8_t {
+  GAUGE_URBS_IN_FLIGHT,
+  GAUGE_RFC2217_RX_BLOCKS,  // DMA blocks armed or not yet captured
+  GAUGE_RFC2217_BACKLOG,    // Received bytes the client has yet to take
+  GAUGE_SWO_BUFFERED,       // Bytes waiting in the SWO receive ring
+  GAUGE_COUNT,
+};
+
+// Bucket i holds latencies below 2^i microseconds, the last one the rest
+constexpr size_t BUCKET_COUNT = 24;
+
+// Counters, latency histograms and gauges for the hot paths. Every core
+// updates its own cache lines with relaxed atomics, so recording never
+// contends with the other core; readers sum the cores up when the endpoint
+// is scraped. Whatever a scrape reads as a counter is 64-bit, so none of it
+// wraps into what Prometheus would take for a reset.
+class Metrics {
+ public:
+  static Metrics& get_instance();
+
+  void add(counter_t counter, uint32_t count) {
+    local().counters[counter].fetch_add(count, std::memory_order_relaxed);
+  }
+
+  void observe(histogram_t histogram, uint32_t us) {
+    core_t& core = local();
+    size_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    core.buckets[histogram][bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1]
+        .fetch_add(1, std::memory_order_relaxed);
+    core.sums[histogram].fetch_add(us, std::memory_order_relaxed);
+  }
+
+  // Current level and the highest one since boot
+  void level(gauge_t gauge, uint32_t value);
+
+  // Prometheus text exposition, truncated at size; returns its length
+  size_t render(char* buffer, size_t size) const;
+
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+ private:
+  constexpr Metrics() = default;
+  ~Metrics() = default;
+
+  struct alignas(memory::CACHE_LINE_SIZE) core_t {
+    std::atomic<uint64_t> counters[COUNTER_COUNT]{};
+    std::atomic<uint64_t> buckets[HISTOGRAM_COUNT][BUCKET_COUNT]{};
+    std::atomic<uint64_t> sums[HISTOGRAM_COUNT]{};  // Microseconds
+  };
+
+  struct gauge_value_t {
+    std::atomic<uint32_t> value{0};
+    std::atomic<uint32_t> peak{0};
+  };
+
+  core_t cores_[portNUM_PROCESSORS]{};
+  gauge_value_t gauges_[GAUGE_COUNT]{};
+
+  core_t& local() { return cores_[xPortGetCoreID()]; }
+};
+
+// Shorthands for the hot paths, gone without CONFIG_FLUIDITY_METRICS
+
+inline uint32_t now() {
+#if CONFIG_FLUIDITY_METRICS
+  return static_cast<uint32_t>(esp_timer_get_time());
+#else
+  return 0;
+#endif
+}
+
+inline void count(counter_t counter, uint32_t count = 1) {
+#if CONFIG_FLUIDITY_METRICS
+  Metrics::get_instance().add(counter, count);
+#endif
+}
+
+// Latency of an operation that began at start, a now()
+inline void observe(histogram_t histogram, uint32_t start) {
+#if CONFIG_FLUIDITY_METRICS
+  Metrics::get_instance().observe(histogram, now() - start);
+#endif
+}
+
+inline void level(gauge_t gauge, uint32_t value) {
+#if CONFIG_FLUIDITY_METRICS
+  Metrics::get_instance().level(gauge, value);
+#endif
+}
+
+}  // namespace metrics
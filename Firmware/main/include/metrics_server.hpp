@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "metrics.hpp"
+#include "tcp_server_unit.hpp"
+
+namespace metrics {
+
+// Answers any HTTP request with the Prometheus text exposition of Metrics
+// and closes, so the probe can be scraped directly or read with
+// `curl probe:9100/metrics`. Rendering happens per scrape on this task;
+// the hot paths never see the endpoint.
+class MetricsServer : public server::TcpHandler {
+ public:
+  static MetricsServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+ private:
+  MetricsServer();
+  ~MetricsServer() = default;
+
+  static constexpr const char* TAG = "metrics_server";
+  static constexpr size_t RX_BUFFER_SIZE = 512;
+  static constexpr size_t TEXT_SIZE = CONFIG_FLUIDITY_METRICS_BUFFER_SIZE;
+
+  server::TcpServerUnit unit_;
+  char* text_{nullptr};  // TEXT_SIZE bytes of PSRAM
+};
+
+esp_err_t start_metrics_server();
+
+}  // namespace metrics
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "link_notifier.hpp"
+
+namespace controller {
+
+enum class interface_t {
+  NONE,      // No interface has an IP
+  WIFI,      // Wi-Fi station
+  ETHERNET,  // Wired W5500
+};
+
+// Follows every network interface and picks the path for outgoing traffic:
+// the wired link whenever it has an IP, the station otherwise. Servers
+// listen on all interfaces and subscribe here, so they stay up as long as
+// any path is.
+class NetworkManager {
+ public:
+  static NetworkManager& get_instance();
+
+  // Sets up esp_netif and the default event loop once, then follows the
+  // interface controllers
+  esp_err_t init();
+
+  // Up while at least one interface has an IP
+  esp_err_t subscribe(link_callback_t callback, void* arg);
+  void unsubscribe(link_callback_t callback, void* arg);
+
+  interface_t get_active_interface() const;
+
+  NetworkManager(const NetworkManager&) = delete;
+  NetworkManager& operator=(const NetworkManager&) = delete;
+
+ private:
+  NetworkManager() = default;
+  ~NetworkManager() = default;
+
+  static constexpr const char* TAG = "network_manager";
+
+  std::mutex mutex_;
+  bool initialized_{false};
+  bool wifi_up_{false};
+  bool ethernet_up_{false};
+  std::atomic<interface_t> active_{interface_t::NONE};
+  LinkNotifier link_;
+
+  void select_path();
+
+  static void wifi_link(bool up, void* arg) {
+    auto* manager = static_cast<NetworkManager*>(arg);
+    std::lock_guard<std::mutex> lock(manager->mutex_);
+    manager->wifi_up_ = up;
+    manager->select_path();
+  };
+
+  static void ethernet_link(bool up, void* arg) {
+    auto* manager = static_cast<NetworkManager*>(arg);
+    std::lock_guard<std::mutex> lock(manager->mutex_);
+    manager->ethernet_up_ = up;
+    manager->select_path();
+  };
+};
+
+// Safe to call from every interface controller before it creates its netif
+esp_err_t ensure_network();
+
+}  // namespace controller
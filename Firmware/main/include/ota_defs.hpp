@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ota {
+
+/* ------------------------------------------------------------------------- */
+/* Firmware update protocol, every field little-endian                       */
+/* ------------------------------------------------------------------------- */
+
+enum ota_command : uint8_t {
+  OTA_WRITE = 0x01,      // ota_write_t, then the application image
+  OTA_REBOOT = 0x02,     // ota_auth_t: boot the image just written
+  OTA_CONFIRM = 0x03,    // ota_auth_t: keep the running image for good
+  OTA_CHALLENGE = 0x04,  // No payload: answered with an ota_challenge_t
+};
+
+enum ota_status : uint8_t {
+  OTA_OK = 0x00,
+  OTA_ERROR_REQUEST = 0x01,  // Malformed, or nothing written to boot
+  OTA_ERROR_SIZE = 0x02,     // The image does not fit the update slot
+  OTA_ERROR_FLASH = 0x03,    // Erasing or writing the slot failed
+  OTA_ERROR_DIGEST = 0x04,   // The image bytes hash differently
+  OTA_ERROR_IMAGE = 0x05,    // Not a valid application for this chip
+  OTA_ERROR_AUTH = 0x06,     // Not signed with the update key and challenge
+};
+
+// Precedes every request
+struct ota_request_t {
+  uint8_t command;  // ota_command
+  uint8_t reserved[3];
+  uint32_t length;  // Payload bytes that follow
+};
+
+// Answers every request once it has been carried out
+struct ota_response_t {
+  uint8_t command;  // As requested
+  uint8_t status;   // ota_status
+  uint16_t reserved;
+  // Bytes written for OTA_WRITE; for OTA_CONFIRM, 1 when the running image
+  // was still pending and 0 when it had been confirmed already; for
+  // OTA_CHALLENGE, the size of the ota_challenge_t that follows
+  uint32_t value;
+};
+
+// Follows the response to OTA_CHALLENGE. Every signature is an HMAC-SHA256
+// keyed with the update key over the nonce, the command byte and, for
+// OTA_WRITE, the image digest; a nonce signs one request only
+struct ota_challenge_t {
+  uint8_t nonce[16];
+};
+
+// Payload of OTA_WRITE ahead of the image
+struct ota_write_t {
+  uint8_t digest[32];     // SHA-256 of the image bytes
+  uint8_t signature[32];  // Over nonce, OTA_WRITE and digest
+};
+
+// Payload of OTA_REBOOT and OTA_CONFIRM
+struct ota_auth_t {
+  uint8_t signature[32];  // Over nonce and the command
+};
+
+}  // namespace ota
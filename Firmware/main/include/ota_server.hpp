@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "sdkconfig.h"
+#include "ota_defs.hpp"
+#include "tcp_server_unit.hpp"
+
+namespace ota {
+
+// Firmware updates over TCP into the A/B application slots. OTA_WRITE
+// streams the image into the slot the probe is not running from: every
+// received chunk goes to flash as it arrives, sectors are erased just ahead
+// of it and the SHA peripheral hashes it on the way, so no image is ever
+// held in RAM and the probe services keep running throughout. The slot
+// only becomes the boot slot once the digest matches and the image
+// validates; OTA_REBOOT then starts it.
+//
+// Every request but OTA_CHALLENGE is signed with the pre-shared
+// FLUIDITY_OTA_KEY over a nonce the probe handed out on this connection, so
+// a captured request can not be replayed; an unsigned write is refused
+// before the slot is opened.
+//
+// A freshly booted image is on probation: unless a host sends OTA_CONFIRM
+// within FLUIDITY_OTA_CONFIRM_TIMEOUT, or if it resets before that, the
+// bootloader goes back to the image it replaced.
+class OtaServer : public server::TcpHandler {
+ public:
+  static OtaServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  esp_err_t on_connect(server::connection_t& connection) override;
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+  void on_disconnect(server::connection_t& connection) override;
+
+  OtaServer(const OtaServer&) = delete;
+  OtaServer& operator=(const OtaServer&) = delete;
+
+ private:
+  OtaServer();
+  ~OtaServer() = default;
+
+  static constexpr const char* TAG = "ota_server";
+  static constexpr size_t RX_BUFFER_SIZE = 4096;
+  static constexpr uint64_t CONFIRM_TIMEOUT_US =
+      CONFIG_FLUIDITY_OTA_CONFIRM_TIMEOUT * 1000000ULL;
+  // lets the last response leave before the restart
+  static constexpr uint32_t REBOOT_DELAY_MS = 100;
+
+  server::TcpServerUnit unit_;
+  esp_timer_handle_t confirm_timer_{nullptr};
+
+  // image of the OTA_WRITE still to come, 0: none
+  const esp_partition_t* slot_{nullptr};
+  esp_ota_handle_t handle_{0};
+  bool writing_{false};
+  uint32_t remaining_{0};
+  uint32_t written_{0};
+  ota_status status_{OTA_OK};
+  uint8_t digest_[32]{};
+  mbedtls_sha256_context sha_{};
+  // An image passed and waits for OTA_REBOOT
+  bool staged_{false};
+  // nonce of the last OTA_CHALLENGE, until a request is signed with it
+  ota_challenge_t challenge_{};
+  bool challenged_{false};
+
+  esp_err_t arm_probation();
+  bool authenticate(uint8_t command,
+                    std::span<const uint8_t> subject,
+                    const uint8_t* signature);
+  size_t handle(int socket, const ota_request_t& request,
+                std::span<const uint8_t> payload);
+  ota_status begin_write(const ota_write_t& write, uint32_t length);
+  size_t stream(int socket, std::span<const uint8_t> data);
+  void finish_write(int socket);
+  void abort_write();
+  esp_err_t respond(int socket, uint8_t command, ota_status status,
+                    uint32_t value);
+
+  static void confirm_timer_callback(void* arg) {
+    ESP_LOGE(TAG, "Image not confirmed in time, rolling back");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+  }
+};
+
+esp_err_t start_ota_server();
+
+}  // namespace ota
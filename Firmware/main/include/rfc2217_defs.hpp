@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace rfc2217 {
+
+/* ------------------------------------------------------------------------- */
+/* Telnet (RFC 854 / RFC 855)                                                */
+/* ------------------------------------------------------------------------- */
+
+enum telnet_command : uint8_t {
+  SE = 240,    // End of subnegotiation parameters
+  NOP = 241,   // No operation
+  SB = 250,    // Begin of subnegotiation
+  WILL = 251,  // Sender wants to enable an option
+  WONT = 252,  // Sender refuses to enable an option
+  DO = 253,    // Sender wants the receiver to enable an option
+  DONT = 254,  // Sender wants the receiver to disable an option
+  IAC = 255,   // Interpret as command
+};
+
+enum telnet_option : uint8_t {
+  OPTION_BINARY = 0,             // RFC 856, 8-bit clean data
+  OPTION_SUPPRESS_GO_AHEAD = 3,  // RFC 858
+  OPTION_COM_PORT = 44,          // RFC 2217
+};
+
+/* ------------------------------------------------------------------------- */
+/* Com Port Control Option (RFC 2217)                                        */
+/* ------------------------------------------------------------------------- */
+
+// Client to access server; the server echoes each with SERVER_OFFSET added
+enum com_port_command : uint8_t {
+  SIGNATURE = 0,
+  SET_BAUDRATE = 1,
+  SET_DATASIZE = 2,
+  SET_PARITY = 3,
+  SET_STOPSIZE = 4,
+  SET_CONTROL = 5,
+  NOTIFY_LINESTATE = 6,
+  NOTIFY_MODEMSTATE = 7,
+  FLOWCONTROL_SUSPEND = 8,
+  FLOWCONTROL_RESUME = 9,
+  SET_LINESTATE_MASK = 10,
+  SET_MODEMSTATE_MASK = 11,
+  PURGE_DATA = 12,
+};
+
+const uint8_t SERVER_OFFSET = 100;
+
+enum com_port_parity : uint8_t {
+  PARITY_REQUEST = 0,  // Query the current value
+  PARITY_NONE = 1,
+  PARITY_ODD = 2,
+  PARITY_EVEN = 3,
+  PARITY_MARK = 4,
+  PARITY_SPACE = 5,
+};
+
+enum com_port_stopsize : uint8_t {
+  STOPSIZE_REQUEST = 0,  // Query the current value
+  STOPSIZE_1 = 1,
+  STOPSIZE_2 = 2,
+  STOPSIZE_1_5 = 3,
+};
+
+enum com_port_control : uint8_t {
+  CONTROL_FLOW_REQUEST = 0,  // Query the outbound flow control setting
+  CONTROL_FLOW_NONE = 1,
+  CONTROL_FLOW_XONXOFF = 2,
+  CONTROL_FLOW_HARDWARE = 3,
+  CONTROL_BREAK_REQUEST = 4,
+  CONTROL_BREAK_ON = 5,
+  CONTROL_BREAK_OFF = 6,
+  CONTROL_DTR_REQUEST = 7,
+  CONTROL_DTR_ON = 8,
+  CONTROL_DTR_OFF = 9,
+  CONTROL_RTS_REQUEST = 10,
+  CONTROL_RTS_ON = 11,
+  CONTROL_RTS_OFF = 12,
+};
+
+enum com_port_purge : uint8_t {
+  PURGE_RX = 1,    // Access server receive buffer
+  PURGE_TX = 2,    // Access server transmit buffer
+  PURGE_BOTH = 3,  // Both of them
+};
+
+}  // namespace rfc2217
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "rfc2217_defs.hpp"
+#include "sdkconfig.h"
+#include "spsc_ring.hpp"
+#include "tcp_server_unit.hpp"
+#include "uart_dma.hpp"
+
+namespace rfc2217 {
+
+// RFC2217 access server for the target UART, on top of tcp_server_unit. The
+// port has one owner at a time. A capture task moves received serial data
+// out of the UART DMA blocks into a PSRAM backlog as soon as it arrives, so
+// the DMA ring is re-armed whatever the network does; a pump task sends the
+// backlog to the client, IAC-escaped by splitting the vectored write around
+// 0xff bytes instead of copying. Client data goes the other way unescaped
+// into DMA TX blocks. The pump is the only task writing to the socket:
+// telnet replies of the server task reach it through a lock-free ring, so
+// neither direction ever waits on the other.
+class Rfc2217Server : public server::TcpHandler {
+ public:
+  static Rfc2217Server& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  esp_err_t on_connect(server::connection_t& connection) override;
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+  void on_disconnect(server::connection_t& connection) override;
+
+  Rfc2217Server(const Rfc2217Server&) = delete;
+  Rfc2217Server& operator=(const Rfc2217Server&) = delete;
+
+ private:
+  Rfc2217Server();
+  ~Rfc2217Server() = default;
+
+  static constexpr const char* TAG = "rfc2217_server";
+  static constexpr size_t MAX_VECTORS = 16;
+  static constexpr size_t SUBNEGOTIATION_SIZE = 16;
+  static constexpr size_t OPTION_COUNT = 3;
+  // a reply is at most a few dozen bytes
+  static constexpr size_t CONTROL_RING_SIZE = 512;
+  static constexpr size_t BACKLOG_SIZE = CONFIG_FLUIDITY_RFC2217_BACKLOG_SIZE;
+  // a send the pump is stuck in fails once the socket is shut down
+  static constexpr TickType_t DISCONNECT_TIMEOUT = pdMS_TO_TICKS(1000);
+
+  static_assert((BACKLOG_SIZE & (BACKLOG_SIZE - 1)) == 0,
+                "backlog size must be a power of two");
+
+  enum class parse_state_t {
+    DATA,                // Plain data, IAC escaped
+    COMMAND,             // After IAC
+    OPTION,              // After IAC WILL/WONT/DO/DONT
+    SUBNEGOTIATION,      // Inside IAC SB ... IAC SE
+    SUBNEGOTIATION_IAC,  // IAC inside a subnegotiation
+  };
+
+  struct line_settings_t {
+    uint32_t baud_rate;
+    uint8_t data_size;  // 5 to 8
+    uint8_t parity;     // com_port_parity
+    uint8_t stop_size;  // com_port_stopsize
+    uint8_t flow;       // CONTROL_FLOW_*
+  };
+
+  serial::UartDma uart_;
+  server::TcpServerUnit unit_;
+  TaskHandle_t capture_task_{nullptr};
+  TaskHandle_t pump_task_{nullptr};
+
+  std::atomic<int> socket_{-1};             // Owner of the port, -1: free
+  std::atomic<bool> suspended_{false};      // FLOWCONTROL-SUSPEND by client
+  std::atomic<bool> sending_{false};        // Pump is writing to socket_
+  std::atomic<bool> purge_backlog_{false};  // Pump drops the backlog
+
+  // received data, from the capture task to the pump
+  memory::SpscBuffer<uint8_t> backlog_;
+  // replies queued by the server task for the pump
+  memory::SpscRing<uint8_t, CONTROL_RING_SIZE> control_;
+
+  // parser state, owned by the server task
+  parse_state_t state_{parse_state_t::DATA};
+  uint8_t command_{0};
+  uint8_t subnegotiation_[SUBNEGOTIATION_SIZE]{};
+  size_t subnegotiation_length_{0};
+  bool local_options_[OPTION_COUNT]{};   // Options we WILL
+  bool remote_options_[OPTION_COUNT]{};  // Options the client WILL
+  uint8_t* tx_block_{nullptr};
+  size_t tx_length_{0};
+
+  line_settings_t settings_{};
+  uint8_t linestate_mask_{0};
+  uint8_t modemstate_mask_{0};
+
+  size_t parse(std::span<const uint8_t> data, bool& deferred);
+  size_t write_uart(std::span<const uint8_t> data);
+  void flush_uart();
+
+  void negotiate();
+  void handle_option(uint8_t command, uint8_t option);
+  void handle_subnegotiation();
+  void handle_com_port(uint8_t command, std::span<const uint8_t> value);
+
+  void drain_uart();
+  void apply_baud_rate(uint32_t baud_rate);
+  void apply_format(const line_settings_t& settings);
+  void purge(uint8_t target);
+
+  esp_err_t send_raw(std::span<const uint8_t> data);
+  esp_err_t send_com_port(uint8_t command, std::span<const uint8_t> value);
+  esp_err_t send_escaped(int socket, const uint8_t* data, size_t length);
+  void send_control();
+
+  void capture();
+  void pump();
+  void wake_pump();
+
+  static int option_index(uint8_t option);
+
+  static void capture_entry(void* arg) {
+    auto* server = static_cast<Rfc2217Server*>(arg);
+    server->capture();
+  };
+
+  static void pump_entry(void* arg) {
+    auto* server = static_cast<Rfc2217Server*>(arg);
+    server->pump();
+  };
+};
+
+esp_err_t start_rfc2217_server();
+
+}  // namespace rfc2217
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+namespace memory {
+
+// Sequence lock around a small trivially copyable value: readers take a
+// consistent copy without locking, allocating or blocking the writer, and
+// simply retry when a store overlapped their copy. The value lives in
+// relaxed atomic words, so a torn read is detected, never undefined.
+//
+// Stores must be serialised by the caller. A store keeps the scheduler
+// suspended for its few word writes, so a reader preempting it on the same
+// core can not spin on an odd sequence forever.
+template <typename T>
+class Seqlock {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  // zero bytes until the first store
+  Seqlock() = default;
+
+  T load() const {
+    uint32_t words[WORDS];
+    uint32_t sequence;
+    do {
+      sequence = sequence_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < WORDS; i++) {
+        words[i] = words_[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) ||
+             sequence != sequence_.load(std::memory_order_relaxed));
+
+    T value;
+    memcpy(&value, words, sizeof(value));
+    return value;
+  }
+
+  void store(const T& value) {
+    uint32_t words[WORDS]{};
+    memcpy(words, &value, sizeof(value));
+
+    vTaskSuspendAll();
+    uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; i++) {
+      words_[i].store(words[i], std::memory_order_relaxed);
+    }
+    sequence_.store(sequence + 2, std::memory_order_release);
+    xTaskResumeAll();
+  }
+
+  Seqlock(const Seqlock&) = delete;
+  Seqlock& operator=(const Seqlock&) = delete;
+
+ private:
+  static constexpr size_t WORDS = (sizeof(T) + 3) / 4;
+
+  std::atomic<uint32_t> sequence_{0};
+  std::atomic<uint32_t> words_[WORDS]{};
+};
+
+}  // namespace memory
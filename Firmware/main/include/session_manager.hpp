@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "esp_log.h"
+#include "spsc_ring.hpp"
+
+namespace session {
+
+// Physical resources a client leases; each is arbitrated on its own, so a
+// console on TARGET_UART never waits for SWD
+enum resource_t : uint8_t {
+  RESOURCE_SWD,          // SWCLK/SWDIO (or the JTAG pins) and nRESET
+  RESOURCE_TARGET_UART,  // The RFC2217 UART
+  RESOURCE_SWO_UART,     // The SWO capture UART
+  RESOURCE_USB_PORT,     // The USB host port and its device
+  RESOURCE_COUNT,
+};
+
+enum client_t : uint8_t {
+  CLIENT_NONE,
+  CLIENT_DAP,      // elaphureLink / CMSIS-DAP host
+  CLIENT_FLASH,    // Flash jobs
+  CLIENT_RFC2217,  // Serial console
+  CLIENT_SWO,      // SWO capture
+  CLIENT_USBIP,    // USB/IP import
+  CLIENT_BENCH,    // Benchmark workloads
+  CLIENT_COUNT,
+};
+
+enum class grant_t : uint8_t {
+  DENIED,       // Another client is using the resource, retry later
+  KEPT,         // This client was the last to use it, nothing changed
+  GRANTED,      // Unused since boot, or only by this client before
+  HANDED_OVER,  // Another client used it since, restore any line state
+};
+
+// A client that keeps the lines configured between its operations. When
+// another client takes the idle lease over, on_preempted() runs on the
+// taker's task before it touches the resource, so the holder can save the
+// target-side state it will need back.
+class Lessee {
+ public:
+  virtual ~Lessee() = default;
+  virtual void on_preempted(resource_t resource) = 0;
+};
+
+// Lease table over the probe's physical resources. A lease is one atomic
+// word per resource, holding the holder, the last holder and a busy bit:
+//
+//   begin()    marks the resource busy for one operation, taking it over
+//              when its holder is idle; one compare-and-swap, never a lock
+//   end()      keeps the lease but lets others take it over
+//   release()  gives it up, for a client that is done with the target
+//
+// A DAP host therefore leases the lines per command batch and a flash job
+// per job: the job slips in between two batches, and the next batch finds
+// the lines handed back, so both tools stay connected. Nobody waits inside
+// the manager; a denied client retries from its own poll loop.
+class SessionManager {
+ public:
+  static SessionManager& get_instance();
+
+  void register_lessee(client_t client, Lessee& lessee);
+
+  grant_t begin(resource_t resource, client_t client);
+  void end(resource_t resource, client_t client);
+  void release(resource_t resource, client_t client);
+
+  client_t holder(resource_t resource) const;
+
+  SessionManager(const SessionManager&) = delete;
+  SessionManager& operator=(const SessionManager&) = delete;
+
+ private:
+  SessionManager() = default;
+  ~SessionManager() = default;
+
+  static constexpr const char* TAG = "session_manager";
+
+  // holder in bits 0-7, last holder in bits 8-15
+  static constexpr uint32_t BUSY = 1 << 16;
+
+  static client_t holder_of(uint32_t state) {
+    return static_cast<client_t>(state & 0xff);
+  }
+  static client_t last_of(uint32_t state) {
+    return static_cast<client_t>((state >> 8) & 0xff);
+  }
+  static uint32_t make_state(client_t holder, client_t last, bool busy) {
+    return holder | last << 8 | (busy ? BUSY : 0);
+  }
+
+  // the lines are taken from both cores, keep each lease on its own line
+  struct alignas(memory::CACHE_LINE_SIZE) lease_word_t {
+    std::atomic<uint32_t> state{0};
+  };
+
+  std::array<lease_word_t, RESOURCE_COUNT> leases_{};
+  std::array<std::atomic<Lessee*>, CLIENT_COUNT> lessees_{};
+};
+
+// Shorthand for the one manager
+inline SessionManager& leases() {
+  return SessionManager::get_instance();
+}
+
+}  // namespace session
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+namespace controller {
+
+// Typed key/value settings on top of NvsController. Every entry of the NVS
+// partition is loaded into RAM at boot and reads never touch flash. Writes
+// only mark the cached entry dirty, and unchanged values are not even
+// that; a timer then writes all dirty keys back in one pass with one
+// nvs_commit per namespace. Bursts of changes therefore cost one flash
+// write each, and the erases that stall both cores happen on the esp_timer
+// task rather than in the caller.
+class SettingsStore {
+ public:
+  static SettingsStore& get_instance();
+
+  esp_err_t init();
+
+  // ESP_ERR_NVS_NOT_FOUND when the key is unset, ESP_ERR_NVS_TYPE_MISMATCH
+  // when it holds another type
+  esp_err_t get_u32(const char* name_space, const char* key, uint32_t& value);
+  esp_err_t set_u32(const char* name_space, const char* key, uint32_t value);
+  esp_err_t get_i32(const char* name_space, const char* key, int32_t& value);
+  esp_err_t set_i32(const char* name_space, const char* key, int32_t value);
+
+  // size is that of value, terminator included
+  esp_err_t get_string(const char* name_space,
+                       const char* key,
+                       char* value,
+                       size_t size);
+  esp_err_t set_string(const char* name_space,
+                       const char* key,
+                       const char* value);
+
+  // Exactly length bytes, ESP_ERR_NVS_INVALID_LENGTH for another size
+  esp_err_t get_blob(const char* name_space,
+                     const char* key,
+                     void* value,
+                     size_t length);
+  esp_err_t set_blob(const char* name_space,
+                     const char* key,
+                     const void* value,
+                     size_t length);
+
+  esp_err_t erase(const char* name_space, const char* key);
+
+  // Writes every dirty key now instead of after the flush delay
+  esp_err_t flush();
+
+  SettingsStore(const SettingsStore&) = delete;
+  SettingsStore& operator=(const SettingsStore&) = delete;
+
+ private:
+  SettingsStore() = default;
+  ~SettingsStore();
+
+  static constexpr const char* TAG = "settings_store";
+  static constexpr size_t MAX_ENTRIES = CONFIG_FLUIDITY_SETTINGS_MAX_ENTRIES;
+  static constexpr size_t MAX_VALUE_SIZE =
+      CONFIG_FLUIDITY_SETTINGS_MAX_VALUE_SIZE;
+  static constexpr uint64_t FLUSH_DELAY_US =
+      CONFIG_FLUIDITY_SETTINGS_FLUSH_DELAY_MS * 1000ULL;
+  // a failing flush is retried with a doubling delay up to this
+  static constexpr uint64_t MAX_RETRY_DELAY_US = 60 * 1000000ULL;
+
+  struct entry_t {
+    char name_space[NVS_NS_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+    uint16_t length;   // Bytes of value in use
+    uint32_t version;  // Bumped by every change
+    bool used;
+    bool dirty;        // Differs from flash
+    bool erased;       // Dirty because it is to be erased
+    bool retyped;      // Flash holds it with another type
+    alignas(4) uint8_t value[MAX_VALUE_SIZE];
+  };
+
+  std::mutex mutex_;        // Guards entries_
+  std::mutex flush_mutex_;  // One flush at a time, guards pending_
+  bool loaded_{false};
+  std::array<entry_t, MAX_ENTRIES> entries_{};
+  std::array<entry_t, MAX_ENTRIES> pending_{};  // Dirty copies being written
+  esp_timer_handle_t flush_timer_{nullptr};
+  uint64_t retry_delay_us_{FLUSH_DELAY_US};  // Guarded by flush_mutex_
+
+  entry_t* find(const char* name_space, const char* key);
+  void load_entry(const nvs_entry_info_t& info);
+  void schedule_retry(esp_err_t error);
+  esp_err_t read(const char* name_space,
+                 const char* key,
+                 nvs_type_t type,
+                 void* value,
+                 size_t& length);
+  esp_err_t write(const char* name_space,
+                  const char* key,
+                  nvs_type_t type,
+                  const void* value,
+                  size_t length);
+  static esp_err_t store(nvs_handle_t handle, const entry_t& entry);
+
+  static void flush_timer_callback(void* arg) {
+    auto* store = static_cast<SettingsStore*>(arg);
+    store->flush();
+  };
+};
+
+esp_err_t ensure_settings();
+
+}  // namespace controller
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+namespace memory {
+
+// Largest data cache line of the S3; indices owned by different cores keep
+// at least this far apart so that they never share a line
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Index half of the ring below, shared by SpscRing and SpscBuffer, which
+// own the slots and pass their power of two capacity to every call. Indices
+// run freely and wrap through the capacity; each side keeps a private copy
+// of the other's index and only reloads it when the ring looks full (or
+// empty), so the shared lines are touched once per batch rather than once
+// per element.
+class SpscIndices {
+ public:
+  SpscIndices() = default;
+
+  // Producer: offset of the contiguous free room, count trimmed to it
+  size_t reserve(size_t capacity, size_t& count) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (capacity - (head - cached_tail_) < count) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+
+    size_t offset = head & (capacity - 1);
+    size_t free = capacity - (head - cached_tail_);
+    count = std::min({count, free, capacity - offset});
+    return offset;
+  }
+
+  // Producer: publishes the first count elements of the last reservation
+  void commit(size_t count) {
+    head_.store(head_.load(std::memory_order_relaxed) + count,
+                std::memory_order_release);
+  }
+
+  // Consumer: offset of the contiguous readable elements, count trimmed
+  size_t peek(size_t capacity, size_t& count) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (cached_head_ - tail < count) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+    }
+
+    size_t offset = tail & (capacity - 1);
+    count = std::min({count, cached_head_ - tail, capacity - offset});
+    return offset;
+  }
+
+  // Consumer: hands the first count peeked elements back to the producer
+  void consume(size_t count) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + count,
+                std::memory_order_release);
+  }
+
+  // Either side; exact for the calling side, a snapshot for the other
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+  SpscIndices(const SpscIndices&) = delete;
+  SpscIndices& operator=(const SpscIndices&) = delete;
+
+ private:
+  // producer line: its index and its view of the consumer
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> head_{0};
+  size_t cached_tail_{0};
+
+  // consumer line
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail_{0};
+  size_t cached_head_{0};
+};
+
+// Lock-free ring between exactly one producer and one consumer, which may be
+// different cores or an ISR, over SpscIndices.
+//
+// Besides single elements, both sides can work on contiguous regions in
+// place: the producer reserve()s room, fills it and commit()s it, the
+// consumer peek()s at what is readable and consume()s it. A region never
+// wraps, so a full reservation may take two calls around the end.
+template <typename T, size_t Capacity>
+class SpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  static constexpr size_t CAPACITY = Capacity;
+
+  SpscRing() = default;
+
+  // Producer: copies value in, false when the ring is full
+  bool try_push(const T& value) {
+    std::span<T> region = reserve(1);
+    if (region.empty()) {
+      return false;
+    }
+    region[0] = value;
+    commit(1);
+    return true;
+  }
+
+  // Producer: contiguous free room, up to count elements
+  std::span<T> reserve(size_t count = Capacity) {
+    size_t offset = indices_.reserve(Capacity, count);
+    return std::span<T>(slots_ + offset, count);
+  }
+
+  // Producer: publishes the first count elements of the last reservation
+  void commit(size_t count) { indices_.commit(count); }
+
+  // Consumer: copies the oldest element out, false when the ring is empty
+  bool try_pop(T& value) {
+    std::span<T> region = peek(1);
+    if (region.empty()) {
+      return false;
+    }
+    value = region[0];
+    consume(1);
+    return true;
+  }
+
+  // Consumer: contiguous readable elements, up to count
+  std::span<T> peek(size_t count = Capacity) {
+    size_t offset = indices_.peek(Capacity, count);
+    return std::span<T>(slots_ + offset, count);
+  }
+
+  // Consumer: hands the first count peeked elements back to the producer
+  void consume(size_t count) { indices_.consume(count); }
+
+  // Either side; exact for the calling side, a snapshot for the other
+  size_t size() const { return indices_.size(); }
+  bool empty() const { return size() == 0; }
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+ private:
+  SpscIndices indices_;
+  alignas(CACHE_LINE_SIZE) T slots_[Capacity]{};
+};
+
+// SpscRing over storage its owner provides, for rings sized at run time or
+// too large for internal RAM, such as a pool block in PSRAM. The same
+// region protocol applies; the capacity must be a power of two.
+template <typename T>
+class SpscBuffer {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  SpscBuffer() = default;
+
+  // Before either side runs
+  void attach(T* storage, size_t capacity) {
+    slots_ = storage;
+    capacity_ = capacity;
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  // Producer: contiguous free room, up to count elements
+  std::span<T> reserve(size_t count) {
+    size_t offset = indices_.reserve(capacity_, count);
+    return std::span<T>(slots_ + offset, count);
+  }
+
+  void commit(size_t count) { indices_.commit(count); }
+
+  // Consumer: contiguous readable elements, up to count
+  std::span<T> peek(size_t count = SIZE_MAX) {
+    size_t offset = indices_.peek(capacity_, count);
+    return std::span<T>(slots_ + offset, count);
+  }
+
+  void consume(size_t count) { indices_.consume(count); }
+
+  size_t size() const { return indices_.size(); }
+  bool empty() const { return size() == 0; }
+
+  SpscBuffer(const SpscBuffer&) = delete;
+  SpscBuffer& operator=(const SpscBuffer&) = delete;
+
+ private:
+  SpscIndices indices_;
+  T* slots_{nullptr};
+  size_t capacity_{0};
+};
+
+}  // namespace memory
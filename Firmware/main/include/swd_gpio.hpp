@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "hal/gpio_ll.h"
+#include "sdkconfig.h"
+#include "dap_phy.hpp"
+
+namespace dap {
+
+// SWD bit-banged on three GPIOs through the GPIO LL registers, so a bit
+// costs a few register writes and no driver call. The clock is paced by the
+// CPU cycle counter; at the highest setting it runs as fast as the loop.
+class GpioSwdPhy : public DapPhy {
+ public:
+  static GpioSwdPhy& get_instance();
+
+  esp_err_t init() override;
+
+  bool connect(uint8_t port) override;
+  void disconnect() override;
+
+  void set_clock(uint32_t frequency) override;
+  void configure_swd(const swd_config_t& config) override;
+
+  void swj_sequence(size_t bits, const uint8_t* data) override;
+  void swd_sequence(size_t bits, const uint8_t* out, uint8_t* in) override;
+  uint8_t swd_transfer(uint8_t request, uint32_t& data) override;
+
+  uint8_t swj_pins(uint8_t output, uint8_t select) override;
+
+  GpioSwdPhy(const GpioSwdPhy&) = delete;
+  GpioSwdPhy& operator=(const GpioSwdPhy&) = delete;
+
+ private:
+  GpioSwdPhy() = default;
+  ~GpioSwdPhy() = default;
+
+  static constexpr const char* TAG = "swd_gpio";
+  static constexpr int SWCLK = CONFIG_FLUIDITY_DAP_SWCLK_PIN;
+  static constexpr int SWDIO = CONFIG_FLUIDITY_DAP_SWDIO_PIN;
+  static constexpr int NRESET = CONFIG_FLUIDITY_DAP_NRESET_PIN;  // -1: none
+
+  gpio_dev_t* hw_{GPIO_LL_GET_HW(GPIO_PORT_0)};
+  uint32_t half_period_{0};  // CPU cycles per clock phase, 0: no pacing
+  swd_config_t config_{};
+
+  void delay() const;
+  void write_bit(uint32_t bit);
+  uint32_t read_bit();
+  void write_bits(uint32_t value, size_t bits);
+  uint32_t read_bits(size_t bits);
+  void clock_cycles(size_t cycles);
+  void set_swdio_output(bool enable);
+};
+
+}  // namespace dap
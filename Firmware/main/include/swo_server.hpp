@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "driver/uart.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "tcp_server_unit.hpp"
+
+namespace swo {
+
+// Precedes every batch on the stream, little-endian
+struct swo_frame_header_t {
+  uint16_t length;     // Raw SWO bytes that follow
+  uint8_t flags;       // FRAME_*
+  uint8_t reserved;
+  uint32_t timestamp;  // esp_timer microseconds at the last byte, low word
+};
+
+constexpr uint8_t FRAME_OVERRUN = 1 << 0;  // Bytes were lost before these
+
+// SWO capture in UART (NRZ) mode with a TCP stream of the raw ITM/DWT bytes;
+// decoding is left to the host. The target's trace port is sampled by a
+// UART whose driver interrupt moves the FIFO into a ring buffer, and a
+// capture task cuts that ring into large frames, one per full batch or per
+// batch interval, each stamped once and sent with one write. The S3's only
+// UHCI DMA controller belongs to the RFC2217 UART, hence the interrupt path.
+//
+// Capture runs from start() at the configured rate; the DAP engine retunes,
+// stops and starts it through DAP_SWO_*, with the stream as the trace
+// transport.
+class SwoServer : public server::TcpHandler {
+ public:
+  static SwoServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  // Capture control, from any task
+  uint32_t set_baud_rate(uint32_t baud_rate);  // Rate set, 0 on failure
+  void set_capturing(bool capturing);
+  bool is_capturing() const {
+    return capturing_.load(std::memory_order_acquire);
+  }
+  // Bytes received and not yet framed
+  size_t pending() const;
+  // Whether bytes were lost since the last call
+  bool take_overrun() {
+    return overrun_.exchange(false, std::memory_order_acq_rel);
+  }
+
+  static constexpr size_t BUFFER_SIZE = CONFIG_FLUIDITY_SWO_BUFFER_SIZE;
+
+  esp_err_t on_connect(server::connection_t& connection) override;
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+  void on_disconnect(server::connection_t& connection) override;
+
+  SwoServer(const SwoServer&) = delete;
+  SwoServer& operator=(const SwoServer&) = delete;
+
+ private:
+  SwoServer();
+  ~SwoServer() = default;
+
+  static constexpr const char* TAG = "swo_server";
+  static constexpr uart_port_t UART = CONFIG_FLUIDITY_SWO_UART_NUM;
+  static constexpr int PIN = CONFIG_FLUIDITY_SWO_PIN;
+  static constexpr size_t FRAME_SIZE = CONFIG_FLUIDITY_SWO_FRAME_SIZE;
+  static constexpr uint32_t BATCH_MS = CONFIG_FLUIDITY_SWO_BATCH_MS;
+  static constexpr size_t EVENT_QUEUE_SIZE = 16;
+
+  static_assert(FRAME_SIZE <= UINT16_MAX);
+
+  server::TcpServerUnit unit_;
+  TaskHandle_t capture_task_{nullptr};
+  QueueHandle_t events_{nullptr};
+
+  std::atomic<int> socket_{-1};        // Stream client, -1 when none
+  std::atomic<bool> sending_{false};   // Capture task is writing to socket_
+  std::atomic<bool> capturing_{false};
+  std::atomic<bool> overrun_{false};   // For DAP_SWO_Status
+  bool frame_overrun_{false};          // For the next frame, capture task
+
+  // header and payload of the frame being cut, capture task only
+  uint8_t frame_[sizeof(swo_frame_header_t) + FRAME_SIZE]{};
+
+  // undoes a failed start: deletes the driver and gives up the lease
+  void release_uart();
+  void check_events();
+  void send_frame(size_t length);
+  void capture();
+
+  static void capture_entry(void* arg) {
+    auto* server = static_cast<SwoServer*>(arg);
+    server->capture();
+  };
+};
+
+esp_err_t start_swo_server();
+
+}  // namespace swo
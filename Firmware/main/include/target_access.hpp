@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "dap_defs.hpp"
+#include "dap_phy.hpp"
+
+namespace dap {
+
+// Cortex-M debug registers
+constexpr uint32_t DHCSR = 0xe000edf0;  // Halting control and status
+constexpr uint32_t DCRSR = 0xe000edf4;  // Core register selector
+constexpr uint32_t DCRDR = 0xe000edf8;  // Core register data
+constexpr uint32_t AIRCR = 0xe000ed0c;  // Application interrupt and reset
+
+constexpr uint32_t DHCSR_DBGKEY = 0xa05f0000;
+constexpr uint32_t DHCSR_C_DEBUGEN = 1 << 0;
+constexpr uint32_t DHCSR_C_HALT = 1 << 1;
+constexpr uint32_t DHCSR_C_MASKINTS = 1 << 3;
+constexpr uint32_t DHCSR_S_REGRDY = 1 << 16;
+constexpr uint32_t DHCSR_S_HALT = 1 << 17;
+constexpr uint32_t AIRCR_SYSRESETREQ = 0x05fa0004;
+
+// Core registers as DCRSR selects them
+enum core_register : uint8_t {
+  REG_R0 = 0,
+  REG_R9 = 9,
+  REG_SP = 13,
+  REG_LR = 14,
+  REG_PC = 15,
+  REG_XPSR = 16,
+};
+
+// The probe's own debugger for jobs that run without the host: ADIv5 over
+// SWD to the first MEM-AP, word accesses through TAR/DRW, and Cortex-M halt,
+// resume and core register access. Memory transfers stream back to back;
+// reads are posted, so N words cost N + 1 packets, and TAR is only written
+// again where its auto-increment wraps.
+//
+// The caller holds the SWD lease and is the only task using the PHY.
+class TargetAccess {
+ public:
+  explicit TargetAccess(DapPhy& phy);
+
+  // SWD line reset, DP power-up and MEM-AP setup, then debug enabled
+  esp_err_t connect(uint32_t clock);
+  void disconnect();
+
+  esp_err_t read_word(uint32_t address, uint32_t& value);
+  esp_err_t write_word(uint32_t address, uint32_t value);
+
+  // Word aligned address and length
+  esp_err_t read_memory(uint32_t address, uint8_t* data, size_t length);
+  esp_err_t write_memory(uint32_t address, const uint8_t* data,
+                         size_t length);
+
+  esp_err_t halt();
+  // Runs on with interrupts masked, as for a flash algorithm call
+  esp_err_t resume_masked();
+  esp_err_t is_halted(bool& halted);
+
+  esp_err_t read_core_register(uint8_t reg, uint32_t& value);
+  esp_err_t write_core_register(uint8_t reg, uint32_t value);
+
+  // Releases the core from debug and resets it through AIRCR
+  esp_err_t reset_and_run();
+
+  TargetAccess(const TargetAccess&) = delete;
+  TargetAccess& operator=(const TargetAccess&) = delete;
+
+ private:
+  static constexpr const char* TAG = "target_access";
+  static constexpr uint16_t WAIT_RETRY = 1000;
+  // TAR auto-increment is only guaranteed inside this many bytes
+  static constexpr uint32_t TAR_WRAP = 1024;
+  // 32-bit, single increment, master type debug
+  static constexpr uint32_t CSW_VALUE = 0x23000052;
+
+  DapPhy& phy_;
+  bool connected_{false};
+
+  uint8_t transfer(uint8_t request, uint32_t& data);
+  esp_err_t check(uint8_t ack);
+
+  esp_err_t read_dp(uint8_t reg, uint32_t& value);
+  esp_err_t write_dp(uint8_t reg, uint32_t value);
+  esp_err_t write_ap(uint8_t reg, uint32_t value);
+  esp_err_t wait_register_ready();
+};
+
+}  // namespace dap
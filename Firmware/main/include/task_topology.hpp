@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+namespace topology {
+
+// Where a task runs and with what
+struct task_config_t {
+  BaseType_t core_id;    // Core the task is pinned to
+  UBaseType_t priority;  // FreeRTOS priority on that core
+  uint32_t stack_size;   // Stack size in bytes
+};
+
+// Core 0 carries the network: the Wi-Fi driver, lwIP's tcpip thread, the
+// default event loop, esp_timer and app_main are pinned there through
+// sdkconfig.defaults. Every task that drives a target or a USB device runs
+// on the engine core instead, so radio housekeeping never preempts a SWD
+// packet or a UART drain. Sockets cross between the two through lwIP's own
+// mailbox; received UART data reaches its task through the lock-free chunk
+// ring of UartDma.
+constexpr BaseType_t NETWORK_CORE = 0;
+#if CONFIG_FREERTOS_UNICORE
+constexpr BaseType_t ENGINE_CORE = 0;
+#else
+constexpr BaseType_t ENGINE_CORE = CONFIG_FLUIDITY_ENGINE_CORE;
+#endif
+
+// USB host library daemon and client event tasks
+constexpr task_config_t USB_HOST{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_USB_HOST_TASK_PRIORITY,
+    CONFIG_FLUIDITY_USB_HOST_TASK_STACK_SIZE,
+};
+
+// Reads DAP commands and runs them against the PHY
+constexpr task_config_t DAP_SERVER{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_DAP_TASK_PRIORITY,
+    CONFIG_FLUIDITY_DAP_TASK_STACK_SIZE,
+};
+
+// Moves received UART data from the DMA blocks into the RFC2217 backlog
+constexpr task_config_t RFC2217_CAPTURE{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_RFC2217_CAPTURE_PRIORITY,
+    CONFIG_FLUIDITY_RFC2217_CAPTURE_STACK_SIZE,
+};
+
+// Moves the RFC2217 backlog to the client
+constexpr task_config_t RFC2217_PUMP{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_RFC2217_PUMP_PRIORITY,
+    CONFIG_FLUIDITY_RFC2217_PUMP_STACK_SIZE,
+};
+
+// Reads the RFC2217 client, queues its data to the UART
+constexpr task_config_t RFC2217_SERVER{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_RFC2217_TASK_PRIORITY,
+    CONFIG_FLUIDITY_RFC2217_TASK_STACK_SIZE,
+};
+
+// Reads USB/IP commands and submits their URBs
+constexpr task_config_t USBIP_SERVER{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_USBIP_TASK_PRIORITY,
+    CONFIG_FLUIDITY_USBIP_TASK_STACK_SIZE,
+};
+
+// Runs flash jobs on the debug port
+constexpr task_config_t FLASH_SERVER{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_FLASH_TASK_PRIORITY,
+    CONFIG_FLUIDITY_FLASH_TASK_STACK_SIZE,
+};
+
+// Cuts SWO frames and sends them to the stream client
+constexpr task_config_t SWO_CAPTURE{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_SWO_CAPTURE_PRIORITY,
+    CONFIG_FLUIDITY_SWO_CAPTURE_STACK_SIZE,
+};
+
+// Accepts the SWO stream client
+constexpr task_config_t SWO_SERVER{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_SWO_SERVER_PRIORITY,
+    CONFIG_FLUIDITY_SWO_SERVER_STACK_SIZE,
+};
+
+// Renders metrics for a scrape
+constexpr task_config_t METRICS_SERVER{
+    NETWORK_CORE,
+    CONFIG_FLUIDITY_METRICS_TASK_PRIORITY,
+    CONFIG_FLUIDITY_METRICS_TASK_STACK_SIZE,
+};
+
+// Runs the benchmark workloads
+constexpr task_config_t BENCH_SERVER{
+    ENGINE_CORE,
+    CONFIG_FLUIDITY_BENCH_TASK_PRIORITY,
+    CONFIG_FLUIDITY_BENCH_TASK_STACK_SIZE,
+};
+
+// Writes firmware updates to the spare slot
+constexpr task_config_t OTA_SERVER{
+    NETWORK_CORE,
+    CONFIG_FLUIDITY_OTA_TASK_PRIORITY,
+    CONFIG_FLUIDITY_OTA_TASK_STACK_SIZE,
+};
+
+// Prints deferred log lines
+constexpr task_config_t LOG_DRAIN{
+    NETWORK_CORE,
+    CONFIG_FLUIDITY_LOG_DRAIN_PRIORITY,
+    CONFIG_FLUIDITY_LOG_DRAIN_STACK_SIZE,
+};
+
+// Moves staged trace chunks to the trace partition
+constexpr task_config_t TRACE_WRITER{
+    NETWORK_CORE,
+    CONFIG_FLUIDITY_TRACE_WRITER_PRIORITY,
+    CONFIG_FLUIDITY_TRACE_WRITER_STACK_SIZE,
+};
+
+// Streams the trace partition to a readout client
+constexpr task_config_t TRACE_SERVER{
+    NETWORK_CORE,
+    CONFIG_FLUIDITY_TRACE_SERVER_PRIORITY,
+    CONFIG_FLUIDITY_TRACE_SERVER_STACK_SIZE,
+};
+
+}  // namespace topology
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "buffer_pool.hpp"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+
+namespace server {
+
+// State of one accepted client, owned by the server unit. The receive buffer
+// is taken from the buffer pool once when the unit starts and reused for
+// every connection that lands in this slot.
+struct connection_t {
+  int socket{-1};               // Client socket, -1 when the slot is free
+  uint8_t* rx_buffer{nullptr};  // Per-connection receive buffer
+  size_t rx_length{0};          // Bytes pending in rx_buffer
+  void* context{nullptr};       // Handler-owned per-connection state
+
+  // Set by the handler when it left complete frames unconsumed, e.g. under
+  // backpressure; they are offered again without waiting for new data
+  bool deferred{false};
+};
+
+class TcpHandler {
+ public:
+  // Returned by on_receive to drop the connection
+  static constexpr size_t CLOSE_CONNECTION = SIZE_MAX;
+
+  virtual ~TcpHandler() = default;
+
+  virtual esp_err_t on_connect(connection_t& connection) { return ESP_OK; }
+
+  // Called with every byte pending in the connection's receive buffer. Return
+  // the number of bytes consumed from the front of data; the unconsumed tail
+  // (e.g. a partial frame) is kept and handed over again with the next read.
+  virtual size_t on_receive(connection_t& connection,
+                            std::span<const uint8_t> data) = 0;
+
+  virtual void on_disconnect(connection_t& connection) {}
+};
+
+struct tcp_server_config_t {
+  const char* name;            // Task name
+  uint16_t port;               // Listening port
+  size_t max_clients;          // Clamped to CONFIG_FLUIDITY_TCP_MAX_CLIENTS
+  size_t rx_buffer_size;       // Receive buffer size of each connection
+  memory::region_t rx_region;  // Memory the receive buffers are placed in
+  uint32_t stack_size;         // Stack size of the server task
+  UBaseType_t priority;        // Priority of the server task
+  BaseType_t core_id;          // Core of the server task, or tskNO_AFFINITY
+};
+
+// One FreeRTOS task per listening port, multiplexing every client socket of
+// that port with select(). The unit follows the network link: it listens on
+// every interface from the moment one has an IP, drops its clients and
+// listener when the last link is lost and opens them again once one is
+// back.
+class TcpServerUnit {
+ public:
+  TcpServerUnit(const tcp_server_config_t& config, TcpHandler& handler);
+  ~TcpServerUnit();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  bool is_running() const;
+
+  static esp_err_t send_all(int socket, const void* data, size_t length);
+
+  // Gathers every vector into as few segments as the stack allows. The
+  // vectors are advanced in place when a write comes back short.
+  static esp_err_t send_vectored(int socket, iovec* vectors, size_t count);
+
+  TcpServerUnit(const TcpServerUnit&) = delete;
+  TcpServerUnit& operator=(const TcpServerUnit&) = delete;
+
+ private:
+  static constexpr const char* TAG = "tcp_server_unit";
+  static constexpr size_t MAX_CLIENTS = CONFIG_FLUIDITY_TCP_MAX_CLIENTS;
+
+  tcp_server_config_t config_;
+  TcpHandler& handler_;
+
+  std::atomic<bool> running_{false};
+  TaskHandle_t task_{nullptr};
+  SemaphoreHandle_t stopped_{nullptr};
+
+  std::atomic<bool> link_up_{false};
+  SemaphoreHandle_t link_changed_{nullptr};  // Wakes a paused task
+  bool subscribed_{false};
+
+  int listen_socket_{-1};
+  // kept across restarts, a slot's buffer serves every client it takes
+  std::array<uint8_t*, MAX_CLIENTS> rx_buffers_{};
+  std::array<connection_t, MAX_CLIENTS> connections_{};
+
+  esp_err_t open_listener();
+  void close_listener();
+  bool wait_for_link();
+  void run();
+  void accept_client();
+  void service_client(connection_t& connection);
+  void dispatch(connection_t& connection);
+  void close_client(connection_t& connection);
+  void close_all();
+
+  static void task_entry(void* arg) {
+    auto* unit = static_cast<TcpServerUnit*>(arg);
+    unit->run();
+  };
+
+  static void link_callback(bool up, void* arg) {
+    auto* unit = static_cast<TcpServerUnit*>(arg);
+    unit->link_up_.store(up, std::memory_order_release);
+    xSemaphoreGive(unit->link_changed_);
+  };
+};
+
+}  // namespace server
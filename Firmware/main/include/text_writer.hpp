@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+
+namespace text {
+
+// snprintf onto the end of a fixed buffer, dropping what does not fit; the
+// buffer always stays terminated
+class TextWriter {
+ public:
+  TextWriter(char* buffer, size_t size, size_t length = 0)
+      : buffer_(buffer), size_(size), length_(length) {}
+
+  __attribute__((format(printf, 2, 3))) void print(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprint(format, args);
+    va_end(args);
+  }
+
+  void vprint(const char* format, va_list args) {
+    if (length_ + 1 >= size_) {
+      return;
+    }
+    int written = vsnprintf(buffer_ + length_, size_ - length_, format, args);
+    if (written > 0) {
+      length_ = std::min(length_ + written, size_ - 1);
+    }
+  }
+
+  size_t length() const { return length_; }
+
+ private:
+  char* buffer_;
+  size_t size_;
+  size_t length_;
+};
+
+}  // namespace text
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "spsc_ring.hpp"
+
+namespace trace {
+
+enum stream_t : uint8_t {
+  STREAM_UART_RX = 0,  // Target UART, as received
+  STREAM_SWO = 1,      // SWO/ITM trace port
+};
+
+constexpr uint32_t SEGMENT_MAGIC = 0x31435254;  // "TRC1"
+constexpr size_t SEGMENT_SIZE = 64 * 1024;      // One erase block, one page
+constexpr uint16_t RECORD_END = 0xffff;         // Length of erased flash
+
+// Opens every segment, both on flash and in the readout stream
+struct segment_header_t {
+  uint32_t magic;     // SEGMENT_MAGIC
+  uint32_t sequence;  // One more than the previous segment's
+  uint32_t dropped;   // Bytes lost to a full staging ring before it
+  uint32_t length;    // Record bytes that follow; erased on flash
+};
+
+// Precedes every record, the payload follows unaligned
+struct record_header_t {
+  uint16_t length;     // Payload bytes, RECORD_END past the last record
+  uint8_t stream;      // stream_t
+  uint8_t reserved;
+  uint32_t timestamp;  // esp_timer microseconds, low word
+};
+
+// Log-structured capture into the "trace" data partition. Appenders copy
+// records into PSRAM chunks; the writer task puts every full chunk, and the
+// partial one after a quiet flush interval, at the end of the current
+// segment. Segments take the partition's 64 KiB blocks round robin and each
+// block is erased just before it is opened, so flash only sees sequential
+// writes and the oldest segment goes when the ring wraps.
+class TraceRecorder {
+ public:
+  static TraceRecorder& get_instance();
+
+  esp_err_t init();
+  bool is_ok() const { return ok_.load(std::memory_order_acquire); }
+
+  // Any task. Payloads longer than one record are split; false when the
+  // staging chunks were exhausted and (part of) it was dropped.
+  bool append(stream_t stream, const void* data, size_t length);
+
+  const esp_partition_t* get_partition() const { return partition_; }
+
+  // Sequences of the oldest and the newest segment, false while empty. The
+  // oldest may be overwritten at any time, readers check the header.
+  bool get_range(uint32_t& first, uint32_t& last) const;
+  // Partition offset of the block holding sequence, if it is in range
+  bool locate(uint32_t sequence, size_t& offset) const;
+
+  TraceRecorder(const TraceRecorder&) = delete;
+  TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+ private:
+  TraceRecorder() = default;
+  ~TraceRecorder() = default;
+
+  static constexpr const char* TAG = "trace_recorder";
+  static constexpr size_t CHUNK_SIZE = CONFIG_FLUIDITY_TRACE_CHUNK_SIZE;
+  static constexpr size_t CHUNK_COUNT = CONFIG_FLUIDITY_TRACE_CHUNK_COUNT;
+  static constexpr uint32_t FLUSH_INTERVAL_MS =
+      CONFIG_FLUIDITY_TRACE_FLUSH_INTERVAL_MS;
+  static constexpr size_t MAX_PAYLOAD = CHUNK_SIZE - sizeof(record_header_t);
+
+  // a chunk always fits into an empty segment
+  static_assert(CHUNK_SIZE <= SEGMENT_SIZE - sizeof(segment_header_t));
+
+  struct chunk_t {
+    uint8_t* data;  // CHUNK_SIZE bytes of PSRAM
+    size_t length;  // Bytes of whole records
+  };
+
+  const esp_partition_t* partition_{nullptr};
+  size_t block_count_{0};
+  std::atomic<bool> ok_{false};
+  TaskHandle_t writer_task_{nullptr};
+
+  // appender side, under mutex_
+  std::mutex mutex_;
+  chunk_t chunks_[CHUNK_COUNT]{};
+  int filling_{-1};  // Chunk being appended to, -1: none
+  std::atomic<uint32_t> dropped_{0};
+
+  // chunk indices to the writer and back; the producer side of full_ and
+  // the consumer side of free_ are serialised by mutex_
+  memory::SpscRing<uint8_t, std::bit_ceil(CHUNK_COUNT)> full_;
+  memory::SpscRing<uint8_t, std::bit_ceil(CHUNK_COUNT)> free_;
+
+  // writer side; offset_ 0 means no segment is open
+  size_t block_{0};
+  size_t offset_{0};
+  uint32_t sequence_{0};  // Of the next segment to open
+
+  // published range: stored_ segments up to sequence last_
+  std::atomic<uint32_t> last_{0};
+  std::atomic<size_t> last_block_{0};
+  std::atomic<size_t> stored_{0};
+
+  void recover();
+  void flush_partial();
+  void write_chunk(const chunk_t& chunk);
+  esp_err_t open_segment();
+  void run();
+
+  static void writer_entry(void* arg) {
+    auto* recorder = static_cast<TraceRecorder*>(arg);
+    recorder->run();
+  };
+};
+
+esp_err_t start_trace_recorder();
+
+// Shorthand for the capture hooks
+inline bool record(stream_t stream, const void* data, size_t length) {
+  return TraceRecorder::get_instance().append(stream, data, length);
+}
+
+}  // namespace trace
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "tcp_server_unit.hpp"
+#include "trace_recorder.hpp"
+
+namespace trace {
+
+// Dumps the trace partition to whoever connects, oldest segment first, and
+// closes once the newest has gone out, so `nc probe 3242 > trace.bin` is a
+// complete readout. Every segment is memory-mapped and its records are sent
+// straight from the flash cache; only the header is rewritten on the way,
+// with the length of the records actually present.
+class TraceServer : public server::TcpHandler {
+ public:
+  static TraceServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  esp_err_t on_connect(server::connection_t& connection) override;
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+
+  TraceServer(const TraceServer&) = delete;
+  TraceServer& operator=(const TraceServer&) = delete;
+
+ private:
+  TraceServer();
+  ~TraceServer() = default;
+
+  static constexpr const char* TAG = "trace_server";
+
+  server::TcpServerUnit unit_;
+
+  // segments still to send, next_ to last_
+  uint32_t next_{0};
+  uint32_t last_{0};
+
+  esp_err_t send_segment(int socket, uint32_t sequence);
+};
+
+esp_err_t start_trace_server();
+
+}  // namespace trace
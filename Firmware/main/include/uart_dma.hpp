@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "driver/uart.h"
+#include "driver/uhci.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "spsc_ring.hpp"
+
+namespace serial {
+
+struct uart_dma_config_t {
+  uart_port_t port;    // UART the UHCI controller is bound to
+  int tx_pin;          // GPIO of TXD
+  int rx_pin;          // GPIO of RXD
+  uint32_t baud_rate;  // Initial baud rate, 8N1
+};
+
+// Bytes received into one of the DMA blocks, valid until released
+struct rx_chunk_t {
+  const uint8_t* data;
+  size_t length;
+  uint8_t block;  // Block the bytes live in
+  bool last;      // The block is full, releasing this chunk recycles it
+};
+
+// UART moved by UHCI/GDMA in both directions, so the CPU never touches the
+// FIFO. Reception fills a ring of DMA blocks, one armed at a time and the
+// next armed from the EOF callback of a full block; every EOF (line idle or
+// a full block) publishes the new bytes as a chunk that the consumer copies
+// out of the block before releasing it. Transmission takes whole blocks
+// that the DMA hands back when done.
+//
+// receive()/release() belong to a single consumer task, acquire_tx() and
+// transmit() to a single producer task.
+class UartDma {
+ public:
+  static constexpr size_t RX_BLOCKS = CONFIG_FLUIDITY_RFC2217_RX_BLOCKS;
+  static constexpr size_t RX_BLOCK_SIZE = CONFIG_FLUIDITY_RFC2217_RX_BLOCK_SIZE;
+  static constexpr size_t TX_BLOCKS = CONFIG_FLUIDITY_RFC2217_TX_BLOCKS;
+  static constexpr size_t TX_BLOCK_SIZE = CONFIG_FLUIDITY_RFC2217_TX_BLOCK_SIZE;
+
+  UartDma() = default;
+  ~UartDma();
+
+  esp_err_t init(const uart_dma_config_t& config);
+
+  // Next received chunk, waiting up to timeout (or a wake_receiver()) for one
+  bool receive(rx_chunk_t& chunk, TickType_t timeout);
+  void release(const rx_chunk_t& chunk);
+
+  // Free TX block of TX_BLOCK_SIZE bytes, or nullptr while all are queued
+  uint8_t* acquire_tx();
+  // Queues length bytes of block; the block returns to the pool once sent
+  esp_err_t transmit(uint8_t* block, size_t length);
+
+  // Line changes apply to the running port; rings and queued chunks stay
+  esp_err_t set_baud_rate(uint32_t baud_rate);
+  esp_err_t set_format(uart_word_length_t data_bits,
+                       uart_parity_t parity,
+                       uart_stop_bits_t stop_bits);
+  // Rate the divider actually produces
+  uint32_t baud_rate() const;
+
+  // Waits until every transmitted block, and the FIFO, has left the wire
+  esp_err_t wait_tx_done(TickType_t timeout);
+  // Drops the chunks received so far, at the consumer's next receive()
+  void purge_rx();
+  // Makes a waiting receive() return false at once, from any task
+  void wake_receiver();
+
+  // Times reception had no free block to continue in
+  size_t overruns() const;
+  // RX blocks armed or holding bytes the consumer has not released
+  size_t rx_blocks_busy() const;
+
+  UartDma(const UartDma&) = delete;
+  UartDma& operator=(const UartDma&) = delete;
+
+ private:
+  static constexpr const char* TAG = "uart_dma";
+  static constexpr size_t CHUNK_QUEUE_SIZE = 64;
+
+  static_assert(RX_BLOCKS <= 32 && TX_BLOCKS <= 32, "one bit per block");
+
+  uhci_controller_handle_t controller_{nullptr};
+  uart_port_t port_{};
+
+  uint8_t* rx_blocks_{nullptr};
+  uint8_t* tx_blocks_{nullptr};
+
+  std::atomic<uint32_t> rx_busy_{0};  // Armed or not yet consumed
+  std::atomic<uint32_t> tx_free_{0};
+  std::atomic<size_t> armed_{0};      // Block the DMA currently fills
+  std::atomic<bool> rx_stalled_{false};
+  std::atomic<bool> rx_purge_{false};
+
+  // chunks published by the RX callback to the consumer
+  memory::SpscRing<rx_chunk_t, CHUNK_QUEUE_SIZE> chunks_;
+  SemaphoreHandle_t rx_ready_{nullptr};
+  std::atomic<bool> woken_{false};
+
+  std::atomic<size_t> overruns_{0};
+
+  // arms the block after the current one if reception is stalled on it
+  void arm_next(bool from_isr);
+  void drop_chunks();
+  bool on_rx(const uhci_rx_event_data_t* event);
+  bool on_tx_done(const uhci_tx_done_event_data_t* event);
+
+  static bool rx_callback(uhci_controller_handle_t controller,
+                          const uhci_rx_event_data_t* event,
+                          void* arg) {
+    return static_cast<UartDma*>(arg)->on_rx(event);
+  };
+
+  static bool tx_callback(uhci_controller_handle_t controller,
+                          const uhci_tx_done_event_data_t* event,
+                          void* arg) {
+    return static_cast<UartDma*>(arg)->on_tx_done(event);
+  };
+};
+
+}  // namespace serial
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+#include "urb_table.hpp"
+#include "usbip_defs.hpp"
+
+namespace usbip {
+
+// number_of_packets of a URB that is not isochronous
+constexpr uint32_t NON_ISO_PACKETS = 0xffffffff;
+
+// An in-flight CMD_SUBMIT, in host byte order
+struct urb_t {
+  uint32_t seq_num;
+  uint32_t device_id;
+  xfer_direction_t direction;
+  uint32_t endpoint;
+  uint32_t transfer_flags;
+  uint32_t transfer_buffer_length;
+  uint32_t start_frame;
+  uint32_t number_of_packets;
+  uint32_t interval;
+  uint8_t setup[8];  // Raw setup packet, already in USB (little-endian) order
+  void* transfer;    // Backend transfer carrying this URB
+  uint32_t started;  // metrics::now() at CMD_SUBMIT
+  bool unlinked;     // CMD_UNLINK accepted, RET_SUBMIT is suppressed
+};
+
+// Result of one URB as reported by the backend. The spans are sent without
+// copying, so they must stay valid until the next UrbEngine::flush().
+struct urb_completion_t {
+  int32_t status{0};                           // URB_STATUS_*
+  uint32_t actual_length{0};                   // Bytes transferred
+  uint32_t error_count{0};                     // Failed ISO packets
+  std::span<const uint8_t> data{};             // IN payload
+  std::span<const uint8_t> iso_descriptors{};  // Already in wire order
+};
+
+class UrbEngine;
+
+// Device side of the pipeline. submit() hands the URB to the hardware and
+// returns at once; the backend reports every URB back through
+// UrbEngine::complete, in whatever order the endpoints finish.
+class UrbBackend {
+ public:
+  virtual ~UrbBackend() = default;
+
+  virtual esp_err_t submit(UrbEngine& engine,
+                           urb_t& urb,
+                           std::span<const uint8_t> out_data,
+                           std::span<const uint8_t> iso_descriptors) = 0;
+
+  // Best effort cancel; a cancelled URB still completes through the engine
+  virtual esp_err_t unlink(urb_t& urb) = 0;
+};
+
+// Transmission stage of one imported device. CMD_SUBMITs are pipelined: each
+// one is parked in a seq_num-keyed table and forwarded to the backend without
+// waiting for the previous one. Replies are queued as completions arrive and
+// go out together, header, payload and ISO descriptors gathered into a single
+// vectored write per flush().
+class UrbEngine {
+ public:
+  static constexpr size_t MAX_IN_FLIGHT =
+      CONFIG_FLUIDITY_USBIP_MAX_INFLIGHT_URBS;
+
+  // Returned by handle() when the stream is malformed
+  static constexpr size_t PROTOCOL_ERROR = SIZE_MAX;
+
+  explicit UrbEngine(UrbBackend& backend);
+  ~UrbEngine();
+
+  esp_err_t attach(int socket);
+  void detach();
+  bool is_attached() const;
+
+  // Consumes complete CMD_SUBMIT / CMD_UNLINK frames from the front of data.
+  // When every slot is in flight it stops early, leaves the frame in place
+  // and sets deferred so the caller offers it again once a URB completes.
+  size_t handle(std::span<const uint8_t> data, bool& deferred);
+
+  // Called by the backend from its own task when a transfer finishes; the
+  // RET_SUBMIT is queued until the backend calls flush() after its burst
+  void complete(uint32_t seq_num, const urb_completion_t& completion);
+
+  // Sends every queued reply; completion data may be reused once it returns
+  void flush();
+
+  size_t in_flight() const;
+
+  UrbEngine(const UrbEngine&) = delete;
+  UrbEngine& operator=(const UrbEngine&) = delete;
+
+ private:
+  static constexpr const char* TAG = "urb_engine";
+  static constexpr size_t HEADER_SIZE = sizeof(cmd_submit_t);
+
+  // every in-flight URB plus as many RET_UNLINKs; a full batch flushes early
+  static constexpr size_t MAX_BATCH = MAX_IN_FLIGHT * 2;
+
+  struct tx_batch_t {
+    uint8_t headers[MAX_BATCH][HEADER_SIZE];  // Encoded RET_* headers
+    iovec vectors[MAX_BATCH * 3];             // Header, payload, descriptors
+    size_t count;
+    size_t vector_count;
+  };
+
+  UrbBackend& backend_;
+  std::atomic<int> socket_{-1};
+
+  mutable std::mutex table_mutex_;
+  std::mutex tx_mutex_;
+  UrbTable<urb_t, MAX_IN_FLIGHT> in_flight_;
+  tx_batch_t batch_{};  // Guarded by tx_mutex_
+
+  enum class submit_t {
+    ACCEPTED,  // Forwarded, or answered with an error RET_SUBMIT
+    DEFERRED,  // Every slot is in flight, offer the frame again
+    REJECTED,  // The stream can not be trusted any more
+  };
+
+  size_t frame_size(const cmd_submit_t& command) const;
+  submit_t handle_submit(const cmd_submit_t& command,
+                         std::span<const uint8_t> frame);
+  void handle_unlink(std::span<const uint8_t> frame);
+
+  void queue_ret_submit(const urb_t& urb, const urb_completion_t& completion);
+  void queue_ret_unlink(uint32_t seq_num, int32_t status);
+
+  uint8_t* reserve_header_locked();
+  void push_vector_locked(const void* data, size_t length);
+  void flush_locked();
+};
+
+}  // namespace usbip
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+namespace usbip {
+
+// Fixed-size open-addressing table keyed by USB/IP seq_num. Linear probing
+// with backward-shift deletion keeps probe chains short without tombstones,
+// so insert, find and erase stay O(1) however long the session runs.
+template <typename T, size_t MaxEntries>
+class UrbTable {
+ public:
+  // twice the entry bound keeps the load factor at or below 0.5
+  static constexpr size_t CAPACITY = std::bit_ceil(MaxEntries * 2);
+
+  // Returns nullptr when the table is full or seq_num is already present
+  T* insert(uint32_t seq_num) {
+    if (size_ >= MaxEntries) {
+      return nullptr;
+    }
+
+    size_t index = home(seq_num);
+    while (slots_[index].used) {
+      if (slots_[index].seq_num == seq_num) {
+        return nullptr;
+      }
+      index = (index + 1) & MASK;
+    }
+
+    slots_[index].used = true;
+    slots_[index].seq_num = seq_num;
+    slots_[index].value = T{};
+    size_++;
+    return &slots_[index].value;
+  }
+
+  T* find(uint32_t seq_num) {
+    size_t index = locate(seq_num);
+    return index == CAPACITY ? nullptr : &slots_[index].value;
+  }
+
+  bool erase(uint32_t seq_num) {
+    size_t hole = locate(seq_num);
+    if (hole == CAPACITY) {
+      return false;
+    }
+
+    slots_[hole].used = false;
+    size_--;
+
+    // pull every displaced follower back so lookups never cross a gap
+    size_t index = hole;
+    while (true) {
+      index = (index + 1) & MASK;
+      if (!slots_[index].used) {
+        break;
+      }
+
+      size_t ideal = home(slots_[index].seq_num);
+      bool reachable = hole <= index ? (hole < ideal && ideal <= index)
+                                     : (hole < ideal || ideal <= index);
+      if (!reachable) {
+        slots_[hole] = slots_[index];
+        slots_[index].used = false;
+        hole = index;
+      }
+    }
+
+    return true;
+  }
+
+  // Visits every entry; the callback must not insert or erase
+  template <typename Fn>
+  void for_each(Fn&& fn) {
+    for (auto& slot : slots_) {
+      if (slot.used) {
+        fn(slot.seq_num, slot.value);
+      }
+    }
+  }
+
+  void clear() {
+    for (auto& slot : slots_) {
+      slot.used = false;
+    }
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ >= MaxEntries; }
+
+ private:
+  static constexpr size_t MASK = CAPACITY - 1;
+
+  struct slot_t {
+    bool used;
+    uint32_t seq_num;
+    T value;
+  };
+
+  std::array<slot_t, CAPACITY> slots_{};
+  size_t size_{0};
+
+  // Fibonacci hashing spreads sequential seq_nums over the whole table
+  static size_t home(uint32_t seq_num) {
+    return static_cast<uint32_t>(seq_num * 2654435769u) >>
+           (32 - std::countr_zero(CAPACITY));
+  }
+
+  size_t locate(uint32_t seq_num) const {
+    size_t index = home(seq_num);
+    while (slots_[index].used) {
+      if (slots_[index].seq_num == seq_num) {
+        return index;
+      }
+      index = (index + 1) & MASK;
+    }
+    return CAPACITY;
+  }
+};
+
+}  // namespace usbip
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "urb_engine.hpp"
+#include "usb/usb_host.h"
+#include "usbip_defs.hpp"
+
+namespace usbip {
+
+// Snapshot of the attached device, taken once when it is enumerated
+struct exported_device_t {
+  uint8_t address;                 // Device address on the bus
+  usb_speed_t speed;               // Negotiated speed
+  usb_device_desc_t descriptor;    // Device descriptor
+  uint8_t configuration_value;     // bConfigurationValue of the active config
+  uint8_t interface_count;         // Interfaces of the active config
+  device_interface_t interfaces[CONFIG_FLUIDITY_USBIP_MAX_INTERFACES];
+};
+
+// Bridges URBs to the ESP-IDF USB host library on the OTG port. Transfers are
+// preallocated once, so a submit only fills a free transfer and queues it.
+// Isochronous endpoints get a ring of their own, shaped to the packet count
+// their driver uses, so a stream never allocates per URB.
+class UsbHostBackend : public UrbBackend {
+ public:
+  static constexpr uint32_t BUS_NUM = 1;
+  static constexpr size_t MAX_DEVICES = 1;
+
+  static UsbHostBackend& get_instance();
+
+  esp_err_t init();
+
+  bool has_device() const;
+  bool get_device(exported_device_t& device) const;
+
+  // Bumped whenever a device is opened or closed
+  uint32_t generation() const;
+
+  esp_err_t submit(UrbEngine& engine,
+                   urb_t& urb,
+                   std::span<const uint8_t> out_data,
+                   std::span<const uint8_t> iso_descriptors) override;
+  esp_err_t unlink(urb_t& urb) override;
+
+  UsbHostBackend(const UsbHostBackend&) = delete;
+  UsbHostBackend& operator=(const UsbHostBackend&) = delete;
+
+ private:
+  UsbHostBackend() = default;
+  ~UsbHostBackend() = default;
+
+  static constexpr const char* TAG = "usb_host_backend";
+  static constexpr size_t SETUP_SIZE = 8;
+
+  static constexpr size_t ISO_ENDPOINTS = CONFIG_FLUIDITY_USBIP_ISO_ENDPOINTS;
+  static constexpr size_t ISO_RING_DEPTH =
+      CONFIG_FLUIDITY_USBIP_ISO_RING_DEPTH;
+  static constexpr size_t ISO_MAX_PACKETS =
+      CONFIG_FLUIDITY_USBIP_ISO_MAX_PACKETS;
+  static constexpr size_t ISO_BUFFER_SIZE =
+      CONFIG_FLUIDITY_USBIP_ISO_BUFFER_SIZE;
+
+  struct transfer_slot_t {
+    usb_transfer_t* transfer;
+    UrbEngine* engine;
+    uint32_t seq_num;
+    xfer_direction_t direction;
+    uint32_t length;        // transfer_buffer_length requested by the URB
+    uint32_t packet_count;  // ISO packets in flight, 0 for other endpoints
+    iso_packet_descriptor_t* iso;  // Descriptors of an ISO ring slot
+    bool busy;
+    bool unlinked;  // The URB itself was unlinked, not a sibling of it
+  };
+
+  // Transfers of one isochronous endpoint. They complete in submission
+  // order, so the next free transfer is always the one after the last used.
+  struct iso_ring_t {
+    uint8_t address;       // Endpoint address, 0 when the ring is unused
+    size_t packet_bytes;   // Largest packet of any alternate, mult included
+    size_t packet_count;   // Packets per transfer the ring is shaped for
+    size_t buffer_size;    // Data buffer of each transfer
+    size_t next;           // Next transfer to hand out
+    std::array<transfer_slot_t, ISO_RING_DEPTH> slots;
+    iso_packet_descriptor_t descriptors[ISO_RING_DEPTH][ISO_MAX_PACKETS];
+  };
+
+  mutable std::mutex mutex_;
+  std::atomic<bool> initialized_{false};
+  std::atomic<bool> device_ready_{false};
+  std::atomic<uint32_t> generation_{0};
+
+  usb_host_client_handle_t client_{nullptr};
+  usb_device_handle_t device_{nullptr};
+  exported_device_t exported_{};
+  uint16_t max_packet_size_[2][16]{};  // [direction][endpoint number]
+
+  std::array<transfer_slot_t, UrbEngine::MAX_IN_FLIGHT> slots_{};
+  std::array<iso_ring_t, ISO_ENDPOINTS> iso_rings_{};
+
+  // finished in the current event pass, touched by the client task only;
+  // every transfer can complete in the same pass, ISO rings included
+  static constexpr size_t MAX_COMPLETED =
+      UrbEngine::MAX_IN_FLIGHT + ISO_ENDPOINTS * ISO_RING_DEPTH;
+  std::array<transfer_slot_t*, MAX_COMPLETED> completed_{};
+  size_t completed_count_{0};
+
+  void open_device(uint8_t address);
+  void close_device();
+  void claim_interfaces(const usb_config_desc_t* config);
+  void scan_endpoints(const usb_config_desc_t* config,
+                      const usb_intf_desc_t* interface,
+                      int offset);
+  void register_iso_endpoint(uint8_t address, size_t packet_bytes);
+
+  transfer_slot_t* acquire_slot();
+  void release_slot(transfer_slot_t& slot);
+  esp_err_t queue_transfer(UrbEngine& engine,
+                           urb_t& urb,
+                           transfer_slot_t& slot,
+                           bool control);
+
+  iso_ring_t* find_iso_ring(uint8_t address);
+  esp_err_t shape_iso_ring(iso_ring_t& ring, size_t packet_count);
+  esp_err_t submit_iso(UrbEngine& engine,
+                       urb_t& urb,
+                       uint8_t address,
+                       std::span<const uint8_t> out_data,
+                       std::span<const uint8_t> iso_descriptors);
+
+  bool intercept_control(UrbEngine& engine, const urb_t& urb);
+  void finish(usb_transfer_t* transfer);
+  bool requeue(transfer_slot_t& slot);
+  void finish_iso(transfer_slot_t& slot, urb_completion_t& completion);
+  void flush_completions();
+
+  static int32_t to_urb_status(usb_transfer_status_t status);
+
+  static void daemon_task(void* arg);
+  static void client_task(void* arg);
+
+  static void client_event_callback(const usb_host_client_event_msg_t* msg,
+                                    void* arg) {
+    auto* backend = static_cast<UsbHostBackend*>(arg);
+    if (msg->event == USB_HOST_CLIENT_EVENT_NEW_DEV) {
+      backend->open_device(msg->new_dev.address);
+    } else if (msg->event == USB_HOST_CLIENT_EVENT_DEV_GONE) {
+      backend->close_device();
+    }
+  };
+
+  static void transfer_callback(usb_transfer_t* transfer) {
+    get_instance().finish(transfer);
+  };
+};
+
+}  // namespace usbip
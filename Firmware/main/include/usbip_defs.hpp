@@ -27,6 +27,7 @@ enum device_speed : uint32_t {
   UNKNOWN_SPEED = 0,
   LOW_SPEED = 1,
   FULL_SPEED = 2,
+  HIGH_SPEED = 3,
 };
 
 struct device_interface_t {
@@ -63,11 +64,11 @@ struct op_req_devlist_t {
   op_header_t header;  // OP_REQ_DEVLIST only contain the header
 };
 
+// Fixed part of OP_REP_DEVLIST. It is followed by exported_count device
+// descriptors, each trailed by its interface_num device interfaces.
 struct op_rep_devlist_t {
   op_header_t header;
-  uint32_t exported_count;           // Number of exported devices
-  device_descriptor_t descriptor;    // Device descriptor
-  device_interface_t interfaces[4];  // Device interfaces (limited to 4 now)
+  uint32_t exported_count;  // Number of exported devices
 };
 
 struct op_req_import_t {
@@ -96,6 +97,20 @@ enum xfer_direction_t : uint32_t {
   IN = 1,   // USBIP_DIR_IN
 };
 
+// URB status is a negated Linux errno, which differs from newlib's numbering
+enum urb_status : int32_t {
+  URB_STATUS_OK = 0,
+  URB_STATUS_NOENT = -2,        // -ENOENT, URB was unlinked synchronously
+  URB_STATUS_NOMEM = -12,       // -ENOMEM
+  URB_STATUS_NODEV = -19,       // -ENODEV, device is gone
+  URB_STATUS_INVAL = -22,       // -EINVAL
+  URB_STATUS_PIPE = -32,        // -EPIPE, endpoint stalled
+  URB_STATUS_TIME = -62,        // -ETIME
+  URB_STATUS_PROTO = -71,       // -EPROTO
+  URB_STATUS_OVERFLOW = -75,    // -EOVERFLOW
+  URB_STATUS_CONNRESET = -104,  // -ECONNRESET, URB was unlinked
+};
+
 struct xfer_header_t {
   xfer_command_t command;
   uint32_t seq_num;            // Sequential number that identifies reqs & reps
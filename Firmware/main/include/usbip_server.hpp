@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <span>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "descriptor_cache.hpp"
+#include "tcp_server_unit.hpp"
+#include "urb_engine.hpp"
+#include "usb_host_backend.hpp"
+#include "usbip_defs.hpp"
+
+namespace usbip {
+
+// USB/IP server on top of tcp_server_unit. A connection starts in the
+// operation stage (list & import) and, once OP_REQ_IMPORT succeeds, streams
+// URB traffic through the device's UrbEngine.
+class UsbipServer : public server::TcpHandler {
+ public:
+  static UsbipServer& get_instance();
+
+  esp_err_t start();
+  esp_err_t stop();
+
+  esp_err_t on_connect(server::connection_t& connection) override;
+  size_t on_receive(server::connection_t& connection,
+                    std::span<const uint8_t> data) override;
+  void on_disconnect(server::connection_t& connection) override;
+
+  UsbipServer(const UsbipServer&) = delete;
+  UsbipServer& operator=(const UsbipServer&) = delete;
+
+ private:
+  UsbipServer();
+  ~UsbipServer() = default;
+
+  static constexpr const char* TAG = "usbip_server";
+
+  enum class stage_t {
+    OPERATION,     // Waiting for OP_REQ_DEVLIST / OP_REQ_IMPORT
+    TRANSMISSION,  // Device imported, URB traffic
+  };
+
+  struct session_t {
+    bool used;
+    stage_t stage;
+  };
+
+  std::array<session_t, CONFIG_FLUIDITY_TCP_MAX_CLIENTS> sessions_{};
+  DescriptorCache cache_;
+  UrbEngine engine_;
+  server::TcpServerUnit unit_;
+
+  size_t handle_operation(server::connection_t& connection,
+                          session_t& session,
+                          std::span<const uint8_t> data);
+  esp_err_t reply_devlist(int socket);
+  esp_err_t reply_import(server::connection_t& connection,
+                         session_t& session,
+                         const char* bus_id);
+};
+
+esp_err_t start_usbip_server();
+
+}  // namespace usbip
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include "usbip_defs.hpp"
+
+// Compile-time wire layer for usbip_defs.hpp. Every struct gets a field
+// descriptor table; encode/decode walk it in one pass straight between a host
+// struct and a (possibly unaligned) socket buffer, and to_wire/from_wire swap
+// an aligned struct in place. Byte arrays and the setup packet are copied
+// verbatim, everything else is big-endian on the wire.
+namespace usbip::wire {
+
+template <typename T>
+constexpr T byteswap(T value) {
+  if constexpr (std::is_enum_v<T>) {
+    using U = std::underlying_type_t<T>;
+    return static_cast<T>(byteswap(static_cast<U>(value)));
+  } else if constexpr (sizeof(T) == 1) {
+    return value;
+  } else {
+    using U = std::make_unsigned_t<T>;
+#if __cpp_lib_byteswap
+    return static_cast<T>(std::byteswap(static_cast<U>(value)));
+#else
+    if constexpr (sizeof(T) == 2) {
+      return static_cast<T>(__builtin_bswap16(static_cast<U>(value)));
+    } else if constexpr (sizeof(T) == 4) {
+      return static_cast<T>(__builtin_bswap32(static_cast<U>(value)));
+    } else {
+      return static_cast<T>(__builtin_bswap64(static_cast<U>(value)));
+    }
+#endif
+  }
+}
+
+template <typename T>
+constexpr T to_big_endian(T value) {
+  if constexpr (std::endian::native == std::endian::big) {
+    return value;
+  } else {
+    return byteswap(value);
+  }
+}
+
+template <typename T>
+struct layout;
+
+template <typename T>
+void encode(const T& value, uint8_t* destination);
+
+template <typename T>
+void decode(const uint8_t* source, T& value);
+
+template <typename T>
+void to_wire(T& value);
+
+template <typename>
+struct member_traits;
+
+template <typename C, typename M>
+struct member_traits<M C::*> {
+  using member_type = M;
+};
+
+enum class kind_t {
+  SCALAR,  // Integer or enum, byte-swapped
+  RAW,     // Byte array or opaque field, copied verbatim
+  NESTED,  // Struct with its own layout
+};
+
+template <auto Member, size_t Offset, kind_t Kind>
+struct field_t {
+  using member_type = typename member_traits<decltype(Member)>::member_type;
+  static constexpr size_t OFFSET = Offset;
+  static constexpr size_t SIZE = sizeof(member_type);
+
+  template <typename T>
+  static void encode(const T& value, uint8_t* destination) {
+    if constexpr (Kind == kind_t::NESTED) {
+      wire::encode(value.*Member, destination + Offset);
+    } else if constexpr (Kind == kind_t::SCALAR) {
+      member_type field = to_big_endian(value.*Member);
+      memcpy(destination + Offset, &field, SIZE);
+    } else {
+      memcpy(destination + Offset, &(value.*Member), SIZE);
+    }
+  }
+
+  template <typename T>
+  static void decode(const uint8_t* source, T& value) {
+    if constexpr (Kind == kind_t::NESTED) {
+      wire::decode(source + Offset, value.*Member);
+    } else if constexpr (Kind == kind_t::SCALAR) {
+      member_type field;
+      memcpy(&field, source + Offset, SIZE);
+      value.*Member = to_big_endian(field);
+    } else {
+      memcpy(&(value.*Member), source + Offset, SIZE);
+    }
+  }
+
+  template <typename T>
+  static void swap(T& value) {
+    if constexpr (Kind == kind_t::NESTED) {
+      wire::to_wire(value.*Member);
+    } else if constexpr (Kind == kind_t::SCALAR) {
+      value.*Member = to_big_endian(value.*Member);
+    }
+  }
+};
+
+template <auto Member, size_t Offset>
+using scalar = field_t<Member, Offset, kind_t::SCALAR>;
+
+template <auto Member, size_t Offset>
+using raw = field_t<Member, Offset, kind_t::RAW>;
+
+template <auto Member, size_t Offset>
+using nested = field_t<Member, Offset, kind_t::NESTED>;
+
+// A layout must describe every byte of the struct: a gap would be padding
+// the compiler inserted, which the wire format does not have.
+template <typename T>
+consteval bool covers_struct() {
+  return []<typename... F>(std::tuple<F...>*) {
+    size_t offset = 0;
+    bool contiguous = ((F::OFFSET == offset ? (offset += F::SIZE, true)
+                                            : false) && ...);
+    return contiguous && offset == sizeof(T);
+  }(static_cast<typename layout<T>::fields*>(nullptr));
+}
+
+// Encodes value into the wire image at destination, which may be unaligned
+template <typename T>
+void encode(const T& value, uint8_t* destination) {
+  static_assert(covers_struct<T>(), "layout does not match the struct");
+  [&]<typename... F>(std::tuple<F...>*) {
+    (F::encode(value, destination), ...);
+  }(static_cast<typename layout<T>::fields*>(nullptr));
+}
+
+// Decodes the wire image at source, which may be unaligned, into value
+template <typename T>
+void decode(const uint8_t* source, T& value) {
+  static_assert(covers_struct<T>(), "layout does not match the struct");
+  [&]<typename... F>(std::tuple<F...>*) {
+    (F::decode(source, value), ...);
+  }(static_cast<typename layout<T>::fields*>(nullptr));
+}
+
+// Converts an aligned struct between host and wire order in place
+template <typename T>
+void to_wire(T& value) {
+  static_assert(covers_struct<T>(), "layout does not match the struct");
+  [&]<typename... F>(std::tuple<F...>*) {
+    (F::swap(value), ...);
+  }(static_cast<typename layout<T>::fields*>(nullptr));
+}
+
+template <typename T>
+void from_wire(T& value) {
+  to_wire(value);
+}
+
+// Writes wire images back to back into a caller-owned buffer. When the next
+// one does not fit, the buffered bytes are handed to flush first, so a reply
+// of any length streams through one small block.
+template <typename Flush>
+class StreamEncoder {
+ public:
+  StreamEncoder(std::span<uint8_t> buffer, Flush flush)
+      : buffer_(buffer), flush_(flush) {}
+
+  // Builds a T in host order with fill and appends its wire image. When the
+  // write position is aligned for T it is built right in the buffer and
+  // swapped in place, otherwise on the stack and encoded across.
+  template <typename T, typename Fill>
+  bool emplace(Fill fill) {
+    if (!reserve(sizeof(T))) {
+      return false;
+    }
+
+    uint8_t* destination = buffer_.data() + length_;
+    if (reinterpret_cast<uintptr_t>(destination) % alignof(T) == 0) {
+      T* value = new (destination) T{};
+      fill(*value);
+      to_wire(*value);
+    } else {
+      T value{};
+      fill(value);
+      encode(value, destination);
+    }
+
+    length_ += sizeof(T);
+    return true;
+  }
+
+  template <typename T>
+  bool put(const T& value) {
+    return emplace<T>([&](T& slot) { slot = value; });
+  }
+
+  // Hands over whatever is still buffered
+  bool finish() { return drain(); }
+
+  // Bytes buffered since the last flush
+  size_t size() const { return length_; }
+
+ private:
+  std::span<uint8_t> buffer_;
+  Flush flush_;
+  size_t length_{0};
+
+  bool reserve(size_t size) {
+    if (length_ + size <= buffer_.size()) {
+      return true;
+    }
+    return drain() && size <= buffer_.size();
+  }
+
+  bool drain() {
+    if (length_ == 0) {
+      return true;
+    }
+
+    bool ok = flush_(std::span<const uint8_t>(buffer_.data(), length_));
+    length_ = 0;
+    return ok;
+  }
+};
+
+/* ------------------------------------------------------------------------- */
+/* Operation Stage (list & import)                                           */
+/* ------------------------------------------------------------------------- */
+
+template <>
+struct layout<device_interface_t> {
+  using S = device_interface_t;
+  using fields = std::tuple<raw<&S::interface_class, 0>,
+                            raw<&S::interface_subclass, 1>,
+                            raw<&S::interface_protocol, 2>,
+                            raw<&S::padding, 3>>;
+};
+
+template <>
+struct layout<op_header_t> {
+  using S = op_header_t;
+  using fields = std::tuple<scalar<&S::version, 0>,
+                            scalar<&S::code, 2>,
+                            scalar<&S::status, 4>>;
+};
+
+template <>
+struct layout<device_descriptor_t> {
+  using S = device_descriptor_t;
+  using fields = std::tuple<raw<&S::path, 0>,
+                            raw<&S::bus_id, 256>,
+                            scalar<&S::bus_num, 288>,
+                            scalar<&S::dev_num, 292>,
+                            scalar<&S::speed, 296>,
+                            scalar<&S::vendor_id, 300>,
+                            scalar<&S::product_id, 302>,
+                            scalar<&S::device_bcd, 304>,
+                            raw<&S::device_class, 306>,
+                            raw<&S::device_subclass, 307>,
+                            raw<&S::device_protocol, 308>,
+                            raw<&S::configuration_value, 309>,
+                            raw<&S::configuration_num, 310>,
+                            raw<&S::interface_num, 311>>;
+};
+
+template <>
+struct layout<op_req_devlist_t> {
+  using S = op_req_devlist_t;
+  using fields = std::tuple<nested<&S::header, 0>>;
+};
+
+template <>
+struct layout<op_rep_devlist_t> {
+  using S = op_rep_devlist_t;
+  using fields = std::tuple<nested<&S::header, 0>,
+                            scalar<&S::exported_count, 8>>;
+};
+
+template <>
+struct layout<op_req_import_t> {
+  using S = op_req_import_t;
+  using fields = std::tuple<nested<&S::header, 0>, raw<&S::bus_id, 8>>;
+};
+
+template <>
+struct layout<op_rep_import_t> {
+  using S = op_rep_import_t;
+  using fields = std::tuple<nested<&S::header, 0>, nested<&S::descriptor, 8>>;
+};
+
+/* ------------------------------------------------------------------------- */
+/* Transmission Stage (urb traffic)                                          */
+/* ------------------------------------------------------------------------- */
+
+template <>
+struct layout<xfer_header_t> {
+  using S = xfer_header_t;
+  using fields = std::tuple<scalar<&S::command, 0>,
+                            scalar<&S::seq_num, 4>,
+                            scalar<&S::device_id, 8>,
+                            scalar<&S::direction, 12>,
+                            scalar<&S::endpoint, 16>>;
+};
+
+template <>
+struct layout<iso_packet_descriptor_t> {
+  using S = iso_packet_descriptor_t;
+  using fields = std::tuple<scalar<&S::offset, 0>,
+                            scalar<&S::length, 4>,
+                            scalar<&S::actual_length, 8>,
+                            scalar<&S::status, 12>>;
+};
+
+template <>
+struct layout<cmd_submit_t> {
+  using S = cmd_submit_t;
+  using fields = std::tuple<nested<&S::header, 0>,
+                            scalar<&S::transfer_flags, 20>,
+                            scalar<&S::transfer_buffer_length, 24>,
+                            scalar<&S::start_frame, 28>,
+                            scalar<&S::number_of_packets, 32>,
+                            scalar<&S::interval, 36>,
+                            raw<&S::setup, 40>>;
+};
+
+template <>
+struct layout<ret_submit_t> {
+  using S = ret_submit_t;
+  using fields = std::tuple<nested<&S::header, 0>,
+                            scalar<&S::status, 20>,
+                            scalar<&S::actual_length, 24>,
+                            scalar<&S::start_frame, 28>,
+                            scalar<&S::number_of_packets, 32>,
+                            scalar<&S::error_count, 36>,
+                            raw<&S::padding, 40>>;
+};
+
+template <>
+struct layout<cmd_unlink_t> {
+  using S = cmd_unlink_t;
+  using fields = std::tuple<nested<&S::header, 0>,
+                            scalar<&S::unlink_seqnum, 20>,
+                            raw<&S::padding, 24>>;
+};
+
+template <>
+struct layout<ret_unlink_t> {
+  using S = ret_unlink_t;
+  using fields = std::tuple<nested<&S::header, 0>,
+                            scalar<&S::status, 20>,
+                            raw<&S::padding, 24>>;
+};
+
+// sizes from https://docs.kernel.org/usb/usbip_protocol.html
+static_assert(sizeof(op_header_t) == 8);
+static_assert(sizeof(op_rep_devlist_t) == 12);
+static_assert(sizeof(device_descriptor_t) == 312);
+static_assert(sizeof(op_req_import_t) == 40);
+static_assert(sizeof(op_rep_import_t) == 320);
+static_assert(sizeof(xfer_header_t) == 20);
+static_assert(sizeof(iso_packet_descriptor_t) == 16);
+static_assert(sizeof(cmd_submit_t) == 48);
+static_assert(sizeof(ret_submit_t) == 48);
+static_assert(sizeof(cmd_unlink_t) == 48);
+static_assert(sizeof(ret_unlink_t) == 48);
+
+// in-place conversion relies on the host layout being the wire layout
+static_assert(offsetof(device_descriptor_t, speed) == 296);
+static_assert(offsetof(device_descriptor_t, interface_num) == 311);
+static_assert(offsetof(cmd_submit_t, setup) == 40);
+static_assert(offsetof(ret_submit_t, padding) == 40);
+static_assert(offsetof(cmd_unlink_t, unlink_seqnum) == 20);
+
+}  // namespace usbip::wire
@@ -1,14 +1,19 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <mutex>
 #include "esp_err.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "sdkconfig.h"
+#include "link_notifier.hpp"
 #include "nvs_controller.hpp"
+#include "seqlock.hpp"
 
 namespace controller {
 
@@ -16,7 +21,7 @@ enum connection_state {
   DISCONNECTED,   // Not connected to any network
   CONNECTING,     // Attempt to connect a network
   CONNECTED,      // Successfully connected with IP
-  FAILED,         // Connection failed after maximum retries
+  FAILED,         // Connection failed, retrying after a backoff
   UNINITIALIZED,  // STA is not initialized
 };
 
@@ -29,6 +34,15 @@ enum connection_error {
   UNKNOWN_ERROR,          // Unknown connection error
 };
 
+// Snapshot of the station link, for status queries
+struct link_info_t {
+  char ssid[33];     // Network being joined, empty when there is none
+  char ip[16];       // Dotted quad, empty without an IP
+  uint8_t bssid[6];  // AP the station is associated with
+  uint8_t channel;   // 0 without a link
+  int8_t rssi;       // dBm as of the last refresh, 0 without a link
+};
+
 class WifiController {
  public:
   static WifiController& get_instance();
@@ -37,9 +51,25 @@ class WifiController {
   esp_err_t connect(const char* ssid, const char* password);
   esp_err_t disconnect();
 
+  // Blocks until the station has an IP, ESP_ERR_TIMEOUT when it has none
+  // after timeout (reconnect attempts carry on in the background)
+  esp_err_t wait_connected(TickType_t timeout);
+
+  // Station link only; servers follow NetworkManager, which covers every
+  // interface
+  esp_err_t subscribe(link_callback_t callback, void* arg);
+  void unsubscribe(link_callback_t callback, void* arg);
+
+  // nullptr until init_sta()
+  esp_netif_t* get_netif() const;
+
   connection_state get_connection_state();
   connection_error get_last_error();
 
+  // Consistent copy of the link state; never locks or allocates, so it may
+  // be polled freely while the link flaps
+  link_info_t get_link_info() const;
+
   WifiController(const WifiController&) = delete;
   WifiController& operator=(const WifiController&) = delete;
 
@@ -50,6 +80,30 @@ class WifiController {
   static constexpr const char* TAG = "wifi_controller";
   static constexpr EventBits_t WIFI_CONNECTED_BIT = BIT0;
   static constexpr EventBits_t WIFI_FAIL_BIT = BIT1;
+  static constexpr uint64_t RSSI_REFRESH_US = 1000 * 1000;
+  static constexpr const char* NVS_NAMESPACE = "wifi";
+  static constexpr const char* LINK_CACHE_KEY = "link";
+  static constexpr uint32_t BACKOFF_MIN_MS =
+      CONFIG_FLUIDITY_WIFI_BACKOFF_MIN_MS;
+  static constexpr uint32_t BACKOFF_MAX_MS =
+      CONFIG_FLUIDITY_WIFI_BACKOFF_MAX_MS;
+
+  // Last AP the station got an IP from, kept in the settings store for the
+  // next boot
+  struct link_cache_t {
+    uint32_t secret_hash;  // Of the SSID and passphrase it belongs to
+    uint8_t bssid[6];
+    uint8_t channel;       // 0: no AP known yet
+    uint8_t pmk_valid;     // The AP accepts the PMK for the passphrase
+    uint8_t pmk[32];       // WPA2 PSK, spares the PBKDF2 on every boot
+  };
+
+  // How the next association is tried
+  enum class attempt_t {
+    CACHED,      // Cached BSSID and channel with the PMK, no scan
+    SCAN,        // Every channel with the PMK
+    PASSPHRASE,  // Every channel with the passphrase (WPA3, stale PMK)
+  };
 
   mutable std::mutex mutex_;
   EventGroupHandle_t wifi_event_group_{nullptr};
@@ -58,12 +112,45 @@ class WifiController {
   std::atomic<connection_error> last_error_{connection_error::NONE};
   uint32_t retry_num_{0};
 
-  std::atomic<char*> current_ssid_{nullptr};
-  std::atomic<char*> ip_address_{nullptr};
+  // credentials and link cache, written by connect() before the station
+  // starts and afterwards only from the event loop
+  char ssid_[33]{};
+  char passphrase_[65]{};
+  link_cache_t cache_{};
+  bool cache_valid_{false};  // cache_ names an AP to go to directly
+  attempt_t attempt_{attempt_t::PASSPHRASE};
+  std::atomic<bool> auto_reconnect_{false};
+  esp_timer_handle_t retry_timer_{nullptr};
+
+  LinkNotifier link_;
+  esp_netif_t* netif_{nullptr};
+
+  // written from connect(), disconnect(), the event loop and the RSSI
+  // timer, serialised by link_info_mutex_; read by anyone without a lock
+  memory::Seqlock<link_info_t> link_info_;
+  std::mutex link_info_mutex_;
+  esp_timer_handle_t rssi_timer_{nullptr};
 
   void set_connection_error(connection_error error);
 
+  esp_err_t disconnect_locked();
   esp_err_t setup_netif_and_event_group();
+  esp_err_t apply_link_profile();
+
+  void prepare_link_cache();
+  void remember_ap(const wifi_ap_record_t& ap);
+  attempt_t scan_attempt() const;
+  esp_err_t configure_attempt(attempt_t attempt);
+  void schedule_retry();
+
+  template <typename F>
+  void update_link_info(F&& change) {
+    std::lock_guard<std::mutex> lock(link_info_mutex_);
+    link_info_t info = link_info_.load();
+    change(info);
+    link_info_.store(info);
+  }
+
   bool validate_credentials(const char* ssid, const char* password);
   void handle_wifi_event(int32_t event_id, void* event_data);
   void handle_ip_event(int32_t event_id, void* event_data);
@@ -76,6 +163,24 @@ class WifiController {
     controller->handle_wifi_event(event_id, event_data);
   };
 
+  static void retry_timer_callback(void* arg) {
+    auto* controller = static_cast<WifiController*>(arg);
+    if (controller->auto_reconnect_.load(std::memory_order_acquire)) {
+      controller->state_.store(connection_state::CONNECTING,
+                               std::memory_order_release);
+      esp_wifi_connect();
+    }
+  };
+
+  static void rssi_timer_callback(void* arg) {
+    auto* controller = static_cast<WifiController*>(arg);
+    wifi_ap_record_t ap{};
+    if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+      controller->update_link_info(
+          [&](link_info_t& info) { info.rssi = ap.rssi; });
+    }
+  };
+
   static void ip_event_handler(void* arg,
                                esp_event_base_t event_base,
                                int32_t event_id,
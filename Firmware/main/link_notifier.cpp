@@ -0,0 +1,51 @@
+#include "link_notifier.hpp"
+
+namespace controller {
+
+esp_err_t LinkNotifier::subscribe(link_callback_t callback, void* arg) {
+  if (callback == nullptr) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (subscriber_t& subscriber : subscribers_) {
+    if (subscriber.callback == nullptr) {
+      subscriber = subscriber_t{callback, arg};
+      callback(up_, arg);
+      return ESP_OK;
+    }
+  }
+
+  ESP_LOGE(TAG, "No free link subscriber slot");
+  return ESP_ERR_NO_MEM;
+}
+
+void LinkNotifier::unsubscribe(link_callback_t callback, void* arg) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (subscriber_t& subscriber : subscribers_) {
+    if (subscriber.callback == callback && subscriber.arg == arg) {
+      subscriber = subscriber_t{};
+    }
+  }
+}
+
+void LinkNotifier::notify(bool up) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (up_ == up) {
+    return;
+  }
+
+  up_ = up;
+  for (const subscriber_t& subscriber : subscribers_) {
+    if (subscriber.callback != nullptr) {
+      subscriber.callback(up, subscriber.arg);
+    }
+  }
+}
+
+bool LinkNotifier::is_up() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return up_;
+}
+
+}  // namespace controller
@@ -1,20 +1,58 @@
+#include "bench_server.hpp"
+#include "buffer_pool.hpp"
+#include "deferred_log.hpp"
+#include "elaphurelink_server.hpp"
+#include "eth_controller.hpp"
+#include "flash_server.hpp"
+#include "metrics_server.hpp"
+#include "network_manager.hpp"
 #include "nvs_controller.hpp"
+#include "ota_server.hpp"
+#include "rfc2217_server.hpp"
 #include "sdkconfig.h"
+#include "settings_store.hpp"
+#include "swo_server.hpp"
+#include "trace_recorder.hpp"
+#include "trace_server.hpp"
+#include "usbip_server.hpp"
 #include "wifi_controller.hpp"
 
-// #define HTTP_RESPONSE            \
-//   "HTTP/1.1 200 OK\r\n"          \
-//   "Content-Type: text/plain\r\n" \
-//   "Content-Length: 11\r\n"       \
-//   "\r\n"                         \
-//   "Hello World"
-
-// auto simple_handler = [](const char* data, size_t length, int client_socket)
-// {
-//   return HTTP_RESPONSE;
-// };
-
 extern "C" void app_main() {
+#if CONFIG_FLUIDITY_LOG_DEFERRED
+  logging::start_deferred_log();
+#endif
   controller::ensure_nvs();
+  controller::ensure_settings();
+  memory::ensure_buffer_pool();
+#if CONFIG_FLUIDITY_TRACE
+  trace::start_trace_recorder();
+#endif
+  controller::ensure_network();
+#if CONFIG_FLUIDITY_ETH_W5500
+  controller::start_ethernet();
+#endif
   controller::wifi_connect(CONFIG_WIFI_SSID, CONFIG_WIFI_PASSWORD);
+#if CONFIG_FLUIDITY_BENCH
+  bench::start_bench_server();
+  return;
+#endif
+  dap::start_elaphurelink_server();
+#if CONFIG_FLUIDITY_FLASH
+  flash::start_flash_server();
+#endif
+  usbip::start_usbip_server();
+  rfc2217::start_rfc2217_server();
+#if CONFIG_FLUIDITY_SWO
+  swo::start_swo_server();
+#endif
+#if CONFIG_FLUIDITY_TRACE
+  trace::start_trace_server();
+#endif
+#if CONFIG_FLUIDITY_METRICS
+  metrics::start_metrics_server();
+#endif
+#if CONFIG_FLUIDITY_OTA
+  // last, so a confirmed image has brought every service up
+  ota::start_ota_server();
+#endif
 }
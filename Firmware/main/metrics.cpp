@@ -0,0 +1,149 @@
+#include "metrics.hpp"
+
+#include "esp_heap_caps.h"
+#include "text_writer.hpp"
+#include "wifi_controller.hpp"
+
+namespace metrics {
+
+namespace {
+
+using text::TextWriter;
+
+constexpr const char* COUNTER_NAMES[COUNTER_COUNT] = {
+    "fluidity_dap_commands_total",     "fluidity_urb_submits_total",
+    "fluidity_urb_errors_total",       "fluidity_rfc2217_rx_bytes_total",
+    "fluidity_rfc2217_tx_bytes_total", "fluidity_swo_bytes_total",
+    "fluidity_wifi_reconnects_total",  "fluidity_lease_handoffs_total",
+    "fluidity_rfc2217_rx_dropped_bytes_total",
+};
+
+constexpr const char* HISTOGRAM_NAMES[HISTOGRAM_COUNT] = {
+    "fluidity_dap_command_microseconds",
+    "fluidity_urb_microseconds",
+    "fluidity_rfc2217_send_microseconds",
+};
+
+constexpr const char* GAUGE_NAMES[GAUGE_COUNT] = {
+    "fluidity_urbs_in_flight",
+    "fluidity_rfc2217_rx_blocks",
+    "fluidity_rfc2217_backlog_bytes",
+    "fluidity_swo_buffered_bytes",
+};
+
+struct heap_region_t {
+  const char* name;
+  uint32_t caps;
+};
+
+constexpr heap_region_t HEAP_REGIONS[] = {
+    {"internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+#if CONFIG_SPIRAM
+    {"psram", MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT},
+#endif
+};
+
+void print_heap(TextWriter& out, const char* name, size_t (*read)(uint32_t)) {
+  out.print("# TYPE %s gauge\n", name);
+  for (const heap_region_t& region : HEAP_REGIONS) {
+    out.print("%s{region=\"%s\"} %u\n", name, region.name,
+              static_cast<unsigned>(read(region.caps)));
+  }
+}
+
+}  // namespace
+
+Metrics& Metrics::get_instance() {
+  static Metrics instance;
+  return instance;
+}
+
+void Metrics::level(gauge_t gauge, uint32_t value) {
+  gauge_value_t& entry = gauges_[gauge];
+  entry.value.store(value, std::memory_order_relaxed);
+
+  uint32_t peak = entry.peak.load(std::memory_order_relaxed);
+  while (value > peak && !entry.peak.compare_exchange_weak(
+                             peak, value, std::memory_order_relaxed)) {
+  }
+}
+
+size_t Metrics::render(char* buffer, size_t size) const {
+  TextWriter out(buffer, size);
+
+  out.print("# TYPE fluidity_uptime_seconds gauge\n");
+  out.print("fluidity_uptime_seconds %llu\n",
+            static_cast<unsigned long long>(esp_timer_get_time() / 1000000));
+
+  for (size_t i = 0; i < COUNTER_COUNT; i++) {
+    out.print("# TYPE %s counter\n", COUNTER_NAMES[i]);
+    for (size_t core = 0; core < portNUM_PROCESSORS; core++) {
+      out.print("%s{core=\"%u\"} %llu\n", COUNTER_NAMES[i],
+                static_cast<unsigned>(core),
+                static_cast<unsigned long long>(
+                    cores_[core].counters[i].load(std::memory_order_relaxed)));
+    }
+  }
+
+  for (size_t i = 0; i < HISTOGRAM_COUNT; i++) {
+    uint64_t buckets[BUCKET_COUNT]{};
+    uint64_t sum = 0;
+    size_t used = 0;  // Buckets up to the last non-empty one
+    for (const core_t& core : cores_) {
+      for (size_t b = 0; b < BUCKET_COUNT; b++) {
+        buckets[b] += core.buckets[i][b].load(std::memory_order_relaxed);
+        used = buckets[b] != 0 ? b + 1 : used;
+      }
+      sum += core.sums[i].load(std::memory_order_relaxed);
+    }
+
+    // cumulative, as Prometheus wants it; the last bucket is +Inf
+    out.print("# TYPE %s histogram\n", HISTOGRAM_NAMES[i]);
+    uint64_t total = 0;
+    for (size_t b = 0; b < BUCKET_COUNT - 1; b++) {
+      total += buckets[b];
+      if (b < used) {
+        out.print("%s_bucket{le=\"%lu\"} %llu\n", HISTOGRAM_NAMES[i],
+                  static_cast<unsigned long>((1ul << b) - 1),
+                  static_cast<unsigned long long>(total));
+      }
+    }
+    total += buckets[BUCKET_COUNT - 1];
+    out.print("%s_bucket{le=\"+Inf\"} %llu\n", HISTOGRAM_NAMES[i],
+              static_cast<unsigned long long>(total));
+    out.print("%s_sum %llu\n", HISTOGRAM_NAMES[i],
+              static_cast<unsigned long long>(sum));
+    out.print("%s_count %llu\n", HISTOGRAM_NAMES[i],
+              static_cast<unsigned long long>(total));
+  }
+
+  for (size_t i = 0; i < GAUGE_COUNT; i++) {
+    out.print("# TYPE %s gauge\n", GAUGE_NAMES[i]);
+    out.print("%s %lu\n", GAUGE_NAMES[i],
+              static_cast<unsigned long>(
+                  gauges_[i].value.load(std::memory_order_relaxed)));
+    out.print("# TYPE %s_peak gauge\n", GAUGE_NAMES[i]);
+    out.print("%s_peak %lu\n", GAUGE_NAMES[i],
+              static_cast<unsigned long>(
+                  gauges_[i].peak.load(std::memory_order_relaxed)));
+  }
+
+  print_heap(out, "fluidity_heap_free_bytes", heap_caps_get_free_size);
+  print_heap(out, "fluidity_heap_min_free_bytes",
+             heap_caps_get_minimum_free_size);
+  print_heap(out, "fluidity_heap_largest_block_bytes",
+             heap_caps_get_largest_free_block);
+
+  controller::link_info_t link =
+      controller::WifiController::get_instance().get_link_info();
+  if (link.channel != 0) {
+    out.print("# TYPE fluidity_wifi_rssi_dbm gauge\n");
+    out.print("fluidity_wifi_rssi_dbm %d\n", link.rssi);
+    out.print("# TYPE fluidity_wifi_channel gauge\n");
+    out.print("fluidity_wifi_channel %u\n", link.channel);
+  }
+
+  return out.length();
+}
+
+}  // namespace metrics
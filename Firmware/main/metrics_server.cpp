@@ -0,0 +1,82 @@
+#include "metrics_server.hpp"
+
+#include <cstdio>
+#include <string_view>
+#include "buffer_pool.hpp"
+#include "esp_heap_caps.h"
+#include "task_topology.hpp"
+
+namespace metrics {
+
+MetricsServer& MetricsServer::get_instance() {
+  static MetricsServer instance;
+  return instance;
+}
+
+MetricsServer::MetricsServer()
+    : unit_(
+          server::tcp_server_config_t{
+              .name = "metrics_server",
+              .port = CONFIG_FLUIDITY_METRICS_PORT,
+              .max_clients = 2,
+              // only the request head is looked at
+              .rx_buffer_size = RX_BUFFER_SIZE,
+              .rx_region = memory::region_t::INTERNAL,
+              .stack_size = topology::METRICS_SERVER.stack_size,
+              .priority = topology::METRICS_SERVER.priority,
+              .core_id = topology::METRICS_SERVER.core_id,
+          },
+          *this) {}
+
+esp_err_t MetricsServer::start() {
+  if (text_ == nullptr) {
+    text_ = static_cast<char*>(heap_caps_malloc(
+        TEXT_SIZE, memory::region_caps(memory::region_t::PSRAM)));
+    if (text_ == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate the exposition buffer");
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  return unit_.start();
+}
+
+esp_err_t MetricsServer::stop() {
+  return unit_.stop();
+}
+
+size_t MetricsServer::on_receive(server::connection_t& connection,
+                                 std::span<const uint8_t> data) {
+  // the whole head first, so the close does not reset unread bytes
+  std::string_view request(reinterpret_cast<const char*>(data.data()),
+                           data.size());
+  if (request.find("\r\n\r\n") == std::string_view::npos &&
+      request.find("\n\n") == std::string_view::npos &&
+      data.size() < RX_BUFFER_SIZE) {
+    return 0;
+  }
+
+  size_t length = Metrics::get_instance().render(text_, TEXT_SIZE);
+  char head[128];
+  int head_length = snprintf(head, sizeof(head),
+                             "HTTP/1.0 200 OK\r\n"
+                             "Content-Type: text/plain; version=0.0.4\r\n"
+                             "Content-Length: %u\r\n\r\n",
+                             static_cast<unsigned>(length));
+
+  iovec vectors[2] = {
+      {.iov_base = head, .iov_len = static_cast<size_t>(head_length)},
+      {.iov_base = text_, .iov_len = length},
+  };
+  if (server::TcpServerUnit::send_vectored(connection.socket, vectors, 2) !=
+      ESP_OK) {
+    ESP_LOGW(TAG, "Failed to send metrics");
+  }
+  return CLOSE_CONNECTION;
+}
+
+esp_err_t start_metrics_server() {
+  return MetricsServer::get_instance().start();
+}
+
+}  // namespace metrics
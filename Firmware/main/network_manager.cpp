@@ -0,0 +1,91 @@
+#include "network_manager.hpp"
+#include "esp_event.h"
+#include "eth_controller.hpp"
+#include "wifi_controller.hpp"
+
+namespace controller {
+
+NetworkManager& NetworkManager::get_instance() {
+  static NetworkManager instance;
+  return instance;
+}
+
+esp_err_t NetworkManager::init() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (initialized_) {
+      return ESP_OK;
+    }
+
+    esp_err_t ret = esp_netif_init();
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to initialize esp_netif: %s",
+               esp_err_to_name(ret));
+      return ret;
+    }
+
+    ret = esp_event_loop_create_default();
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+      ESP_LOGE(TAG, "Failed to create event loop: %s", esp_err_to_name(ret));
+      return ret;
+    }
+
+    initialized_ = true;
+  }
+
+  // outside the lock: each controller reports its state right away, and
+  // the callbacks take the lock under the controller's own
+  ESP_ERROR_CHECK(WifiController::get_instance().subscribe(&wifi_link, this));
+  ESP_ERROR_CHECK(
+      EthController::get_instance().subscribe(&ethernet_link, this));
+
+  ESP_LOGI(TAG, "Network stack initialized");
+  return ESP_OK;
+}
+
+esp_err_t NetworkManager::subscribe(link_callback_t callback, void* arg) {
+  return link_.subscribe(callback, arg);
+}
+
+void NetworkManager::unsubscribe(link_callback_t callback, void* arg) {
+  link_.unsubscribe(callback, arg);
+}
+
+interface_t NetworkManager::get_active_interface() const {
+  return active_.load(std::memory_order_acquire);
+}
+
+void NetworkManager::select_path() {
+  interface_t preferred = ethernet_up_ ? interface_t::ETHERNET
+                          : wifi_up_   ? interface_t::WIFI
+                                       : interface_t::NONE;
+  if (preferred == active_.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  // the default netif carries the default route, the wired link wins
+  // because its latency does not depend on the RF environment
+  esp_netif_t* netif = nullptr;
+  if (preferred == interface_t::ETHERNET) {
+    netif = EthController::get_instance().get_netif();
+  } else if (preferred == interface_t::WIFI) {
+    netif = WifiController::get_instance().get_netif();
+  }
+  if (netif != nullptr) {
+    esp_netif_set_default_netif(netif);
+  }
+
+  active_.store(preferred, std::memory_order_release);
+  ESP_LOGI(TAG, "Active path: %s",
+           preferred == interface_t::ETHERNET ? "Ethernet"
+           : preferred == interface_t::WIFI   ? "Wi-Fi"
+                                              : "none");
+  link_.notify(preferred != interface_t::NONE);
+}
+
+esp_err_t ensure_network() {
+  return NetworkManager::get_instance().init();
+}
+
+}  // namespace controller
@@ -0,0 +1,411 @@
+#include "ota_server.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "esp_random.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/md.h"
+#include "task_topology.hpp"
+
+namespace ota {
+
+OtaServer& OtaServer::get_instance() {
+  static OtaServer instance;
+  return instance;
+}
+
+OtaServer::OtaServer()
+    : unit_(
+          server::tcp_server_config_t{
+              .name = "ota_server",
+              .port = CONFIG_FLUIDITY_OTA_PORT,
+              // one image at a time
+              .max_clients = 1,
+              // chunks go to flash straight from here
+              .rx_buffer_size = RX_BUFFER_SIZE,
+              .rx_region = memory::region_t::INTERNAL,
+              .stack_size = topology::OTA_SERVER.stack_size,
+              .priority = topology::OTA_SERVER.priority,
+              .core_id = topology::OTA_SERVER.core_id,
+          },
+          *this) {}
+
+esp_err_t OtaServer::start() {
+  esp_err_t ret = arm_probation();
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to arm the confirm timer: %s",
+             esp_err_to_name(ret));
+    return ret;
+  }
+
+  if (esp_ota_get_next_update_partition(nullptr) == nullptr) {
+    ESP_LOGW(TAG, "No update slot in the partition table");
+  }
+  return unit_.start();
+}
+
+esp_err_t OtaServer::stop() {
+  return unit_.stop();
+}
+
+esp_err_t OtaServer::arm_probation() {
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(running, &state) != ESP_OK ||
+      state != ESP_OTA_IMG_PENDING_VERIFY) {
+    return ESP_OK;
+  }
+
+  if (confirm_timer_ == nullptr) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = &confirm_timer_callback,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ota_confirm",
+        .skip_unhandled_events = true,
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &confirm_timer_);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+  }
+  if (esp_timer_is_active(confirm_timer_)) {
+    return ESP_OK;
+  }
+
+  ESP_LOGW(TAG, "Image in %s is on probation, confirm it within %u s",
+           running->label,
+           static_cast<unsigned>(CONFIG_FLUIDITY_OTA_CONFIRM_TIMEOUT));
+  return esp_timer_start_once(confirm_timer_, CONFIRM_TIMEOUT_US);
+}
+
+esp_err_t OtaServer::on_connect(server::connection_t& connection) {
+  remaining_ = 0;
+  status_ = OTA_OK;
+  challenged_ = false;
+  return ESP_OK;
+}
+
+size_t OtaServer::on_receive(server::connection_t& connection,
+                             std::span<const uint8_t> data) {
+  size_t consumed = 0;
+
+  while (consumed < data.size()) {
+    std::span<const uint8_t> rest = data.subspan(consumed);
+    if (remaining_ > 0) {
+      consumed += stream(connection.socket, rest);
+      continue;
+    }
+
+    if (rest.size() < sizeof(ota_request_t)) {
+      break;
+    }
+    ota_request_t request;
+    memcpy(&request, rest.data(), sizeof(request));
+
+    size_t length = handle(connection.socket, request,
+                           rest.subspan(sizeof(request)));
+    if (length == CLOSE_CONNECTION) {
+      return CLOSE_CONNECTION;
+    }
+    if (length == 0) {
+      break;
+    }
+    consumed += length;
+  }
+  return consumed;
+}
+
+void OtaServer::on_disconnect(server::connection_t& connection) {
+  // a torn image never becomes bootable
+  abort_write();
+  remaining_ = 0;
+}
+
+size_t OtaServer::handle(int socket, const ota_request_t& request,
+                         std::span<const uint8_t> payload) {
+  switch (request.command) {
+    case OTA_WRITE: {
+      if (request.length < sizeof(ota_write_t)) {
+        respond(socket, request.command, OTA_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < sizeof(ota_write_t)) {
+        return 0;
+      }
+
+      ota_write_t write;
+      memcpy(&write, payload.data(), sizeof(write));
+      uint32_t length = request.length - sizeof(write);
+
+      // nothing of an unsigned image is taken in
+      if (!authenticate(request.command, write.digest, write.signature)) {
+        respond(socket, request.command, OTA_ERROR_AUTH, 0);
+        return CLOSE_CONNECTION;
+      }
+
+      // a failed start still takes the image off the stream
+      status_ = begin_write(write, length);
+      remaining_ = length;
+      if (remaining_ == 0) {
+        finish_write(socket);
+      }
+      return sizeof(request) + sizeof(write);
+    }
+
+    case OTA_REBOOT: {
+      if (request.length != sizeof(ota_auth_t)) {
+        respond(socket, request.command, OTA_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < sizeof(ota_auth_t)) {
+        return 0;
+      }
+      if (!authenticate(request.command, {}, payload.data())) {
+        respond(socket, request.command, OTA_ERROR_AUTH, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (!staged_) {
+        return respond(socket, request.command, OTA_ERROR_REQUEST, 0) ==
+                       ESP_OK
+                   ? sizeof(request) + sizeof(ota_auth_t)
+                   : CLOSE_CONNECTION;
+      }
+
+      ESP_LOGI(TAG, "Rebooting into %s", slot_->label);
+      respond(socket, request.command, OTA_OK, 0);
+      vTaskDelay(pdMS_TO_TICKS(REBOOT_DELAY_MS));
+      esp_restart();
+      return CLOSE_CONNECTION;
+    }
+
+    case OTA_CONFIRM: {
+      if (request.length != sizeof(ota_auth_t)) {
+        respond(socket, request.command, OTA_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+      if (payload.size() < sizeof(ota_auth_t)) {
+        return 0;
+      }
+      if (!authenticate(request.command, {}, payload.data())) {
+        respond(socket, request.command, OTA_ERROR_AUTH, 0);
+        return CLOSE_CONNECTION;
+      }
+
+      esp_ota_img_states_t state;
+      bool pending = esp_ota_get_state_partition(
+                         esp_ota_get_running_partition(), &state) == ESP_OK &&
+                     state == ESP_OTA_IMG_PENDING_VERIFY;
+      ota_status status = OTA_OK;
+      if (pending) {
+        if (esp_ota_mark_app_valid_cancel_rollback() != ESP_OK) {
+          status = OTA_ERROR_FLASH;
+        } else {
+          if (confirm_timer_ != nullptr &&
+              esp_timer_is_active(confirm_timer_)) {
+            esp_timer_stop(confirm_timer_);
+          }
+          ESP_LOGI(TAG, "Running image confirmed");
+        }
+      }
+      return respond(socket, request.command, status, pending ? 1 : 0) ==
+                     ESP_OK
+                 ? sizeof(request) + sizeof(ota_auth_t)
+                 : CLOSE_CONNECTION;
+    }
+
+    case OTA_CHALLENGE: {
+      if (request.length != 0) {
+        respond(socket, request.command, OTA_ERROR_REQUEST, 0);
+        return CLOSE_CONNECTION;
+      }
+
+      esp_fill_random(challenge_.nonce, sizeof(challenge_.nonce));
+      challenged_ = true;
+      if (respond(socket, request.command, OTA_OK, sizeof(challenge_)) !=
+              ESP_OK ||
+          server::TcpServerUnit::send_all(socket, &challenge_,
+                                          sizeof(challenge_)) != ESP_OK) {
+        return CLOSE_CONNECTION;
+      }
+      return sizeof(request);
+    }
+
+    default:
+      // the payload length can not be trusted either
+      ESP_LOGW(TAG, "Unknown OTA command 0x%02x", request.command);
+      respond(socket, request.command, OTA_ERROR_REQUEST, 0);
+      return CLOSE_CONNECTION;
+  }
+}
+
+bool OtaServer::authenticate(uint8_t command,
+                             std::span<const uint8_t> subject,
+                             const uint8_t* signature) {
+  static constexpr const char KEY[] = CONFIG_FLUIDITY_OTA_KEY;
+  if (sizeof(KEY) == 1) {
+    ESP_LOGW(TAG, "No update key set, refusing command 0x%02x", command);
+    return false;
+  }
+  // each nonce signs a single request
+  if (!challenged_) {
+    ESP_LOGW(TAG, "Command 0x%02x without a challenge", command);
+    return false;
+  }
+  challenged_ = false;
+
+  uint8_t message[sizeof(challenge_.nonce) + 1 + sizeof(ota_write_t::digest)];
+  size_t length = sizeof(challenge_.nonce);
+  memcpy(message, challenge_.nonce, length);
+  message[length++] = command;
+  subject = subject.first(std::min(subject.size(), sizeof(message) - length));
+  memcpy(message + length, subject.data(), subject.size());
+  length += subject.size();
+
+  uint8_t expected[32];
+  int ret = mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                            reinterpret_cast<const uint8_t*>(KEY),
+                            sizeof(KEY) - 1, message, length, expected);
+  if (ret != 0) {
+    ESP_LOGE(TAG, "Failed to check the signature: %d", ret);
+    return false;
+  }
+
+  // the comparison takes as long wherever the first wrong byte is
+  uint8_t difference = 0;
+  for (size_t i = 0; i < sizeof(expected); i++) {
+    difference |= expected[i] ^ signature[i];
+  }
+  if (difference != 0) {
+    ESP_LOGW(TAG, "Command 0x%02x is not signed with the update key",
+             command);
+    return false;
+  }
+  return true;
+}
+
+ota_status OtaServer::begin_write(const ota_write_t& write, uint32_t length) {
+  abort_write();
+  written_ = 0;
+
+  // a staged image is about to be overwritten, keep booting this one
+  if (staged_) {
+    staged_ = false;
+    esp_ota_set_boot_partition(esp_ota_get_running_partition());
+  }
+
+  slot_ = esp_ota_get_next_update_partition(nullptr);
+  if (slot_ == nullptr) {
+    ESP_LOGW(TAG, "No update slot to write to");
+    return OTA_ERROR_REQUEST;
+  }
+  if (length == 0 || length > slot_->size) {
+    ESP_LOGW(TAG, "A %lu byte image does not fit %s",
+             static_cast<unsigned long>(length), slot_->label);
+    return OTA_ERROR_SIZE;
+  }
+
+  // each sector is erased as the image reaches it, not all of them up front
+  esp_err_t ret = esp_ota_begin(slot_, OTA_WITH_SEQUENTIAL_WRITES, &handle_);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to open %s: %s", slot_->label,
+             esp_err_to_name(ret));
+    return OTA_ERROR_FLASH;
+  }
+
+  ESP_LOGI(TAG, "Writing a %lu byte image to %s",
+           static_cast<unsigned long>(length), slot_->label);
+  memcpy(digest_, write.digest, sizeof(digest_));
+  mbedtls_sha256_init(&sha_);
+  mbedtls_sha256_starts(&sha_, 0);
+  writing_ = true;
+  return OTA_OK;
+}
+
+size_t OtaServer::stream(int socket, std::span<const uint8_t> data) {
+  size_t length = std::min<size_t>(data.size(), remaining_);
+  if (status_ == OTA_OK) {
+    esp_err_t ret = esp_ota_write(handle_, data.data(), length);
+    if (ret == ESP_OK) {
+      mbedtls_sha256_update(&sha_, data.data(), length);
+      written_ += length;
+    } else {
+      ESP_LOGW(TAG, "Failed to write at %lu: %s",
+               static_cast<unsigned long>(written_), esp_err_to_name(ret));
+      status_ = ret == ESP_ERR_OTA_VALIDATE_FAILED ? OTA_ERROR_IMAGE
+                                                   : OTA_ERROR_FLASH;
+    }
+  }
+  remaining_ -= length;
+
+  if (remaining_ == 0) {
+    finish_write(socket);
+  }
+  return length;
+}
+
+void OtaServer::finish_write(int socket) {
+  if (writing_) {
+    writing_ = false;
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha_, digest);
+    mbedtls_sha256_free(&sha_);
+    if (status_ == OTA_OK && memcmp(digest, digest_, sizeof(digest)) != 0) {
+      ESP_LOGW(TAG, "Image does not match its digest");
+      status_ = OTA_ERROR_DIGEST;
+    }
+
+    if (status_ != OTA_OK) {
+      esp_ota_abort(handle_);
+    } else {
+      // reads the slot back and checks the image's own header and hash
+      esp_err_t ret = esp_ota_end(handle_);
+      if (ret == ESP_OK) {
+        ret = esp_ota_set_boot_partition(slot_);
+        status_ = ret == ESP_OK ? OTA_OK : OTA_ERROR_FLASH;
+      } else {
+        status_ = ret == ESP_ERR_OTA_VALIDATE_FAILED ? OTA_ERROR_IMAGE
+                                                     : OTA_ERROR_FLASH;
+      }
+      if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to stage the image: %s", esp_err_to_name(ret));
+      }
+      staged_ = status_ == OTA_OK;
+    }
+  }
+
+  ESP_LOGI(TAG, "Image write done: status %u",
+           static_cast<unsigned>(status_));
+  if (respond(socket, OTA_WRITE, status_, written_) != ESP_OK) {
+    // the connection goes with the next read
+    ESP_LOGW(TAG, "Failed to answer the image write");
+  }
+}
+
+void OtaServer::abort_write() {
+  if (writing_) {
+    writing_ = false;
+    mbedtls_sha256_free(&sha_);
+    esp_ota_abort(handle_);
+  }
+}
+
+esp_err_t OtaServer::respond(int socket, uint8_t command, ota_status status,
+                             uint32_t value) {
+  ota_response_t response{
+      .command = command,
+      .status = status,
+      .reserved = 0,
+      .value = value,
+  };
+  return server::TcpServerUnit::send_all(socket, &response,
+                                         sizeof(response));
+}
+
+esp_err_t start_ota_server() {
+  return OtaServer::get_instance().start();
+}
+
+}  // namespace ota
@@ -0,0 +1,782 @@
+#include "rfc2217_server.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include "buffer_pool.hpp"
+#include "deferred_log.hpp"
+#include "iac_scan.hpp"
+#include "metrics.hpp"
+#include "session_manager.hpp"
+#include "task_topology.hpp"
+#include "trace_recorder.hpp"
+
+namespace rfc2217 {
+
+namespace {
+
+constexpr char SIGNATURE_TEXT[] = "Fluidity RFC2217";
+
+// longest the UART may take to send what was queued before a line change
+constexpr TickType_t DRAIN_TIMEOUT = pdMS_TO_TICKS(1000);
+
+bool to_parity(uint8_t parity, uart_parity_t& out) {
+  switch (parity) {
+    case PARITY_NONE:
+      out = UART_PARITY_DISABLE;
+      return true;
+    case PARITY_ODD:
+      out = UART_PARITY_ODD;
+      return true;
+    case PARITY_EVEN:
+      out = UART_PARITY_EVEN;
+      return true;
+    default:
+      // MARK and SPACE have no UART equivalent
+      return false;
+  }
+}
+
+bool to_stop_bits(uint8_t stop_size, uart_stop_bits_t& out) {
+  switch (stop_size) {
+    case STOPSIZE_1:
+      out = UART_STOP_BITS_1;
+      return true;
+    case STOPSIZE_2:
+      out = UART_STOP_BITS_2;
+      return true;
+    case STOPSIZE_1_5:
+      out = UART_STOP_BITS_1_5;
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+Rfc2217Server& Rfc2217Server::get_instance() {
+  static Rfc2217Server instance;
+  return instance;
+}
+
+Rfc2217Server::Rfc2217Server()
+    : unit_(
+          server::tcp_server_config_t{
+              .name = "rfc2217_server",
+              .port = CONFIG_FLUIDITY_RFC2217_PORT,
+              // the serial port has a single owner
+              .max_clients = 1,
+              .rx_buffer_size = serial::UartDma::TX_BLOCK_SIZE,
+              .rx_region = memory::region_t::PSRAM,
+              .stack_size = topology::RFC2217_SERVER.stack_size,
+              .priority = topology::RFC2217_SERVER.priority,
+              .core_id = topology::RFC2217_SERVER.core_id,
+          },
+          *this) {
+  settings_ = line_settings_t{
+      .baud_rate = CONFIG_FLUIDITY_RFC2217_BAUD_RATE,
+      .data_size = 8,
+      .parity = PARITY_NONE,
+      .stop_size = STOPSIZE_1,
+      .flow = CONTROL_FLOW_NONE,
+  };
+}
+
+esp_err_t Rfc2217Server::start() {
+  if (pump_task_ == nullptr) {
+    // the DMA runs for good once set up, so the lease is never given back
+    if (session::leases().begin(session::RESOURCE_TARGET_UART,
+                                session::CLIENT_RFC2217) ==
+        session::grant_t::DENIED) {
+      ESP_LOGE(TAG, "Target UART is in use");
+      return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = uart_.init(serial::uart_dma_config_t{
+        .port = CONFIG_FLUIDITY_RFC2217_UART_NUM,
+        .tx_pin = CONFIG_FLUIDITY_RFC2217_TX_PIN,
+        .rx_pin = CONFIG_FLUIDITY_RFC2217_RX_PIN,
+        .baud_rate = settings_.baud_rate,
+    });
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "Serial port is unavailable");
+      return ret;
+    }
+
+    memory::BufferPool& pool = memory::BufferPool::get_instance();
+    auto* backlog = static_cast<uint8_t*>(
+        pool.allocate(BACKLOG_SIZE, memory::region_t::PSRAM));
+    if (backlog == nullptr) {
+      ESP_LOGE(TAG, "No pool block for the receive backlog");
+      return ESP_ERR_NO_MEM;
+    }
+    backlog_.attach(backlog, BACKLOG_SIZE);
+
+    if (xTaskCreatePinnedToCore(pump_entry, "rfc2217_pump",
+                                topology::RFC2217_PUMP.stack_size, this,
+                                topology::RFC2217_PUMP.priority, &pump_task_,
+                                topology::RFC2217_PUMP.core_id) != pdPASS) {
+      ESP_LOGE(TAG, "Failed to create pump task");
+      pump_task_ = nullptr;
+      return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(capture_entry, "rfc2217_capture",
+                                topology::RFC2217_CAPTURE.stack_size, this,
+                                topology::RFC2217_CAPTURE.priority,
+                                &capture_task_,
+                                topology::RFC2217_CAPTURE.core_id) != pdPASS) {
+      ESP_LOGE(TAG, "Failed to create capture task");
+      capture_task_ = nullptr;
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  return unit_.start();
+}
+
+esp_err_t Rfc2217Server::stop() {
+  return unit_.stop();
+}
+
+esp_err_t Rfc2217Server::on_connect(server::connection_t& connection) {
+  int expected = -1;
+  if (!socket_.compare_exchange_strong(expected, connection.socket,
+                                       std::memory_order_acq_rel)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // interactive traffic, every keystroke should leave at once
+  int no_delay = 1;
+  setsockopt(connection.socket, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+             sizeof(no_delay));
+
+  state_ = parse_state_t::DATA;
+  subnegotiation_length_ = 0;
+  suspended_.store(false, std::memory_order_release);
+
+  negotiate();
+  ESP_LOGI(TAG, "Serial port claimed by socket %d", connection.socket);
+  return ESP_OK;
+}
+
+size_t Rfc2217Server::on_receive(server::connection_t& connection,
+                                 std::span<const uint8_t> data) {
+  bool deferred = false;
+  size_t consumed = parse(data, deferred);
+  connection.deferred = deferred;
+  return consumed;
+}
+
+void Rfc2217Server::on_disconnect(server::connection_t& connection) {
+  if (socket_.load(std::memory_order_acquire) != connection.socket) {
+    return;
+  }
+
+  flush_uart();
+
+  // the socket closes once this returns: wait out a send the pump already
+  // started on it, and let the pump drop the replies still queued. A send
+  // blocked on a stalled client fails once the socket is shut down.
+  socket_.store(-1, std::memory_order_seq_cst);
+  shutdown(connection.socket, SHUT_RDWR);
+  wake_pump();
+  TickType_t start = xTaskGetTickCount();
+  while (sending_.load(std::memory_order_seq_cst) || !control_.empty()) {
+    if (xTaskGetTickCount() - start > DISCONNECT_TIMEOUT) {
+      ESP_LOGW(TAG, "Pump did not leave the closed socket");
+      break;
+    }
+    vTaskDelay(1);
+  }
+  suspended_.store(false, std::memory_order_release);
+  ESP_LOGI(TAG, "Serial port released");
+}
+
+size_t Rfc2217Server::parse(std::span<const uint8_t> data, bool& deferred) {
+  size_t i = 0;
+
+  while (i < data.size()) {
+    if (state_ == parse_state_t::DATA) {
+      // everything up to the next IAC is payload and goes out as one copy
+      size_t run = find_iac(data.data() + i, data.size() - i);
+      if (run > 0) {
+        size_t written = write_uart(data.subspan(i, run));
+        i += written;
+        if (written < run) {
+          deferred = true;
+          break;
+        }
+        continue;
+      }
+
+      state_ = parse_state_t::COMMAND;
+      i++;
+      continue;
+    }
+
+    uint8_t byte = data[i++];
+    switch (state_) {
+      case parse_state_t::COMMAND:
+        if (byte == IAC) {
+          // escaped 0xff data byte
+          if (write_uart(data.subspan(i - 1, 1)) == 0) {
+            i--;
+            deferred = true;
+            flush_uart();
+            return i;
+          }
+          state_ = parse_state_t::DATA;
+        } else if (byte == SB) {
+          subnegotiation_length_ = 0;
+          state_ = parse_state_t::SUBNEGOTIATION;
+        } else if (byte >= WILL && byte <= DONT) {
+          command_ = byte;
+          state_ = parse_state_t::OPTION;
+        } else {
+          // NOP, GA, AYT and friends carry nothing for a serial port
+          state_ = parse_state_t::DATA;
+        }
+        break;
+
+      case parse_state_t::OPTION:
+        handle_option(command_, byte);
+        state_ = parse_state_t::DATA;
+        break;
+
+      case parse_state_t::SUBNEGOTIATION:
+        if (byte == IAC) {
+          state_ = parse_state_t::SUBNEGOTIATION_IAC;
+        } else if (subnegotiation_length_ < SUBNEGOTIATION_SIZE) {
+          subnegotiation_[subnegotiation_length_++] = byte;
+        }
+        break;
+
+      case parse_state_t::SUBNEGOTIATION_IAC:
+        if (byte == SE) {
+          handle_subnegotiation();
+          state_ = parse_state_t::DATA;
+          break;
+        }
+        // IAC IAC is an escaped 0xff inside the parameters
+        if (subnegotiation_length_ < SUBNEGOTIATION_SIZE) {
+          subnegotiation_[subnegotiation_length_++] = byte;
+        }
+        state_ = parse_state_t::SUBNEGOTIATION;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  flush_uart();
+  return i;
+}
+
+size_t Rfc2217Server::write_uart(std::span<const uint8_t> data) {
+  size_t written = 0;
+
+  while (written < data.size()) {
+    if (tx_block_ == nullptr) {
+      tx_block_ = uart_.acquire_tx();
+      tx_length_ = 0;
+      if (tx_block_ == nullptr) {
+        break;
+      }
+    }
+
+    size_t count = std::min(data.size() - written,
+                            serial::UartDma::TX_BLOCK_SIZE - tx_length_);
+    memcpy(tx_block_ + tx_length_, data.data() + written, count);
+    tx_length_ += count;
+    written += count;
+    metrics::count(metrics::RFC2217_TX_BYTES, count);
+
+    if (tx_length_ == serial::UartDma::TX_BLOCK_SIZE) {
+      flush_uart();
+    }
+  }
+
+  return written;
+}
+
+void Rfc2217Server::flush_uart() {
+  if (tx_block_ == nullptr) {
+    return;
+  }
+
+  uart_.transmit(tx_block_, tx_length_);
+  tx_block_ = nullptr;
+  tx_length_ = 0;
+}
+
+void Rfc2217Server::negotiate() {
+  // offer everything up front; the answers then only confirm
+  static constexpr uint8_t OFFER[] = {
+      IAC, WILL, OPTION_BINARY,            IAC, DO, OPTION_BINARY,
+      IAC, WILL, OPTION_SUPPRESS_GO_AHEAD, IAC, DO, OPTION_SUPPRESS_GO_AHEAD,
+      IAC, WILL, OPTION_COM_PORT,
+  };
+
+  for (size_t i = 0; i < OPTION_COUNT; i++) {
+    local_options_[i] = true;
+    remote_options_[i] = false;
+  }
+  remote_options_[option_index(OPTION_BINARY)] = true;
+  remote_options_[option_index(OPTION_SUPPRESS_GO_AHEAD)] = true;
+
+  send_raw(OFFER);
+}
+
+void Rfc2217Server::handle_option(uint8_t command, uint8_t option) {
+  int index = option_index(option);
+  uint8_t reply[] = {IAC, 0, option};
+
+  // answer only on a state change, so neither side loops (RFC 854)
+  switch (command) {
+    case WILL:
+      if (index < 0) {
+        reply[1] = DONT;
+      } else if (!remote_options_[index]) {
+        remote_options_[index] = true;
+        reply[1] = DO;
+      } else {
+        return;
+      }
+      break;
+
+    case WONT:
+      if (index < 0 || !remote_options_[index]) {
+        return;
+      }
+      remote_options_[index] = false;
+      reply[1] = DONT;
+      break;
+
+    case DO:
+      if (index < 0) {
+        reply[1] = WONT;
+      } else if (!local_options_[index]) {
+        local_options_[index] = true;
+        reply[1] = WILL;
+      } else {
+        return;
+      }
+      break;
+
+    case DONT:
+      if (index < 0 || !local_options_[index]) {
+        return;
+      }
+      local_options_[index] = false;
+      reply[1] = WONT;
+      break;
+
+    default:
+      return;
+  }
+
+  send_raw(reply);
+}
+
+void Rfc2217Server::handle_subnegotiation() {
+  if (subnegotiation_length_ < 2 || subnegotiation_[0] != OPTION_COM_PORT) {
+    return;
+  }
+
+  handle_com_port(subnegotiation_[1],
+                  std::span<const uint8_t>(subnegotiation_ + 2,
+                                           subnegotiation_length_ - 2));
+}
+
+void Rfc2217Server::handle_com_port(uint8_t command,
+                                    std::span<const uint8_t> value) {
+  // line requests are answered with the setting in effect afterwards
+  switch (command) {
+    case SIGNATURE:
+      send_com_port(SIGNATURE,
+                    std::span<const uint8_t>(
+                        reinterpret_cast<const uint8_t*>(SIGNATURE_TEXT),
+                        sizeof(SIGNATURE_TEXT) - 1));
+      break;
+
+    case SET_BAUDRATE: {
+      if (value.size() < 4) {
+        return;
+      }
+      uint32_t baud_rate = static_cast<uint32_t>(value[0]) << 24 |
+                           static_cast<uint32_t>(value[1]) << 16 |
+                           static_cast<uint32_t>(value[2]) << 8 | value[3];
+      if (baud_rate != 0) {
+        apply_baud_rate(baud_rate);
+      }
+      baud_rate = settings_.baud_rate;
+      uint8_t reply[] = {
+          static_cast<uint8_t>(baud_rate >> 24),
+          static_cast<uint8_t>(baud_rate >> 16),
+          static_cast<uint8_t>(baud_rate >> 8),
+          static_cast<uint8_t>(baud_rate),
+      };
+      send_com_port(SET_BAUDRATE, reply);
+      break;
+    }
+
+    case SET_DATASIZE:
+      if (!value.empty() && value[0] >= 5 && value[0] <= 8) {
+        line_settings_t settings = settings_;
+        settings.data_size = value[0];
+        apply_format(settings);
+      }
+      send_com_port(SET_DATASIZE,
+                    std::span<const uint8_t>(&settings_.data_size, 1));
+      break;
+
+    case SET_PARITY:
+      if (!value.empty() && value[0] != PARITY_REQUEST) {
+        line_settings_t settings = settings_;
+        settings.parity = value[0];
+        apply_format(settings);
+      }
+      send_com_port(SET_PARITY, std::span<const uint8_t>(&settings_.parity, 1));
+      break;
+
+    case SET_STOPSIZE:
+      if (!value.empty() && value[0] != STOPSIZE_REQUEST) {
+        line_settings_t settings = settings_;
+        settings.stop_size = value[0];
+        apply_format(settings);
+      }
+      send_com_port(SET_STOPSIZE,
+                    std::span<const uint8_t>(&settings_.stop_size, 1));
+      break;
+
+    case SET_CONTROL: {
+      if (value.empty()) {
+        return;
+      }
+      uint8_t reply = value[0];
+      if (reply <= CONTROL_FLOW_HARDWARE) {
+        reply = settings_.flow;
+      } else if (reply == CONTROL_BREAK_REQUEST) {
+        reply = CONTROL_BREAK_OFF;
+      } else if (reply == CONTROL_DTR_REQUEST) {
+        reply = CONTROL_DTR_ON;
+      } else if (reply == CONTROL_RTS_REQUEST) {
+        reply = CONTROL_RTS_ON;
+      }
+      send_com_port(SET_CONTROL, std::span<const uint8_t>(&reply, 1));
+      break;
+    }
+
+    case FLOWCONTROL_SUSPEND:
+      suspended_.store(true, std::memory_order_release);
+      send_com_port(FLOWCONTROL_SUSPEND, {});
+      break;
+
+    case FLOWCONTROL_RESUME:
+      suspended_.store(false, std::memory_order_release);
+      send_com_port(FLOWCONTROL_RESUME, {});
+      break;
+
+    case SET_LINESTATE_MASK:
+      if (!value.empty()) {
+        linestate_mask_ = value[0];
+        send_com_port(SET_LINESTATE_MASK,
+                      std::span<const uint8_t>(&linestate_mask_, 1));
+      }
+      break;
+
+    case SET_MODEMSTATE_MASK:
+      if (!value.empty()) {
+        modemstate_mask_ = value[0];
+        send_com_port(SET_MODEMSTATE_MASK,
+                      std::span<const uint8_t>(&modemstate_mask_, 1));
+      }
+      break;
+
+    case PURGE_DATA:
+      if (!value.empty()) {
+        purge(value[0]);
+        send_com_port(PURGE_DATA, value.first(1));
+      }
+      break;
+
+    default:
+      FLOG_W(SERIAL, TAG, "Unsupported COM-PORT-OPTION command %u",
+             command);
+      break;
+  }
+}
+
+void Rfc2217Server::drain_uart() {
+  // data that came before the change still goes out with the old settings
+  flush_uart();
+  if (uart_.wait_tx_done(DRAIN_TIMEOUT) != ESP_OK) {
+    FLOG_W(SERIAL, TAG, "Line change before the UART drained");
+  }
+}
+
+void Rfc2217Server::apply_baud_rate(uint32_t baud_rate) {
+  if (baud_rate == settings_.baud_rate) {
+    return;
+  }
+
+  drain_uart();
+  if (uart_.set_baud_rate(baud_rate) == ESP_OK) {
+    // report the rate the divider really produces
+    settings_.baud_rate = uart_.baud_rate();
+    ESP_LOGI(TAG, "Baud rate %lu",
+             static_cast<unsigned long>(settings_.baud_rate));
+  }
+}
+
+void Rfc2217Server::apply_format(const line_settings_t& settings) {
+  uart_parity_t parity;
+  uart_stop_bits_t stop_bits;
+  if (!to_parity(settings.parity, parity) ||
+      !to_stop_bits(settings.stop_size, stop_bits)) {
+    return;
+  }
+
+  auto data_bits = static_cast<uart_word_length_t>(
+      UART_DATA_5_BITS + (settings.data_size - 5));
+
+  drain_uart();
+  if (uart_.set_format(data_bits, parity, stop_bits) == ESP_OK) {
+    settings_ = settings;
+  }
+}
+
+void Rfc2217Server::purge(uint8_t target) {
+  if (target == PURGE_RX || target == PURGE_BOTH) {
+    uart_.purge_rx();
+    purge_backlog_.store(true, std::memory_order_release);
+    wake_pump();
+  }
+  // blocks already handed to the DMA cannot be recalled, the one still
+  // being filled is dropped
+  if ((target == PURGE_TX || target == PURGE_BOTH) && tx_block_ != nullptr) {
+    uart_.transmit(tx_block_, 0);
+    tx_block_ = nullptr;
+    tx_length_ = 0;
+  }
+}
+
+esp_err_t Rfc2217Server::send_raw(std::span<const uint8_t> data) {
+  if (socket_.load(std::memory_order_acquire) < 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // all or nothing, half a telnet command would derail the client
+  if (CONTROL_RING_SIZE - control_.size() < data.size()) {
+    FLOG_W(SERIAL, TAG, "Reply ring full, dropping %zu bytes",
+           data.size());
+    return ESP_ERR_NO_MEM;
+  }
+
+  size_t queued = 0;
+  while (queued < data.size()) {
+    std::span<uint8_t> region = control_.reserve(data.size() - queued);
+    memcpy(region.data(), data.data() + queued, region.size());
+    control_.commit(region.size());
+    queued += region.size();
+  }
+
+  wake_pump();
+  return ESP_OK;
+}
+
+esp_err_t Rfc2217Server::send_com_port(uint8_t command,
+                                       std::span<const uint8_t> value) {
+  uint8_t message[6 + 2 * SUBNEGOTIATION_SIZE];
+  size_t length = 0;
+
+  message[length++] = IAC;
+  message[length++] = SB;
+  message[length++] = OPTION_COM_PORT;
+  message[length++] = command + SERVER_OFFSET;
+  size_t count = std::min(value.size(), SUBNEGOTIATION_SIZE);
+  for (uint8_t byte : value.first(count)) {
+    message[length++] = byte;
+    if (byte == IAC) {
+      message[length++] = IAC;
+    }
+  }
+  message[length++] = IAC;
+  message[length++] = SE;
+
+  return send_raw(std::span<const uint8_t>(message, length));
+}
+
+esp_err_t Rfc2217Server::send_escaped(int socket,
+                                      const uint8_t* data,
+                                      size_t length) {
+  iovec vectors[MAX_VECTORS];
+  size_t count = 0;
+  size_t start = 0;  // The next vector begins here
+  size_t scan = 0;   // The next IAC search begins here
+
+  auto push = [&](size_t end) -> esp_err_t {
+    vectors[count].iov_base = const_cast<uint8_t*>(data + start);
+    vectors[count].iov_len = end - start;
+    count++;
+    if (count < MAX_VECTORS) {
+      return ESP_OK;
+    }
+    count = 0;
+    return server::TcpServerUnit::send_vectored(socket, vectors, MAX_VECTORS);
+  };
+
+  // each IAC ends one vector and starts the next, so it goes out twice
+  // without a byte of the block being copied
+  while (scan < length) {
+    size_t hit = scan + find_iac(data + scan, length - scan);
+    if (hit == length) {
+      break;
+    }
+
+    if (push(hit + 1) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    start = hit;
+    scan = hit + 1;
+  }
+
+  if (push(length) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  return count == 0 ? ESP_OK
+                    : server::TcpServerUnit::send_vectored(socket, vectors,
+                                                           count);
+}
+
+void Rfc2217Server::send_control() {
+  // pairs with on_disconnect(): either it sees sending_, or this sees -1
+  sending_.store(true, std::memory_order_seq_cst);
+  int socket = socket_.load(std::memory_order_seq_cst);
+
+  // without a client the replies are dropped
+  for (auto region = control_.peek(); !region.empty();
+       region = control_.peek()) {
+    if (socket >= 0 && server::TcpServerUnit::send_all(
+                           socket, region.data(), region.size()) != ESP_OK) {
+      socket = -1;
+    }
+    control_.consume(region.size());
+  }
+
+  sending_.store(false, std::memory_order_release);
+}
+
+void Rfc2217Server::capture() {
+  serial::rx_chunk_t chunk;
+
+  // never waits on the network, so the DMA blocks are always handed back
+  while (true) {
+    if (!uart_.receive(chunk, portMAX_DELAY)) {
+      continue;
+    }
+    metrics::level(metrics::GAUGE_RFC2217_RX_BLOCKS, uart_.rx_blocks_busy());
+
+    if (chunk.length > 0) {
+#if CONFIG_FLUIDITY_TRACE_UART
+      // recorded as it arrives, whether a client takes it or not
+      trace::record(trace::STREAM_UART_RX, chunk.data, chunk.length);
+#endif
+
+      size_t stored = 0;
+      while (stored < chunk.length) {
+        std::span<uint8_t> region = backlog_.reserve(chunk.length - stored);
+        if (region.empty()) {
+          break;
+        }
+        memcpy(region.data(), chunk.data + stored, region.size());
+        backlog_.commit(region.size());
+        stored += region.size();
+      }
+
+      // the client fell a whole backlog behind
+      if (stored < chunk.length) {
+        metrics::count(metrics::RFC2217_RX_DROPPED, chunk.length - stored);
+        FLOG_W(SERIAL, TAG, "Backlog full, dropped %zu bytes",
+               chunk.length - stored);
+      }
+      metrics::level(metrics::GAUGE_RFC2217_BACKLOG, backlog_.size());
+      wake_pump();
+    }
+
+    uart_.release(chunk);
+  }
+}
+
+void Rfc2217Server::pump() {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    send_control();
+
+    while (true) {
+      if (purge_backlog_.exchange(false, std::memory_order_acq_rel)) {
+        for (auto region = backlog_.peek(); !region.empty();
+             region = backlog_.peek()) {
+          backlog_.consume(region.size());
+        }
+      }
+
+      // the client asked for a pause; the backlog holds what arrives
+      // meanwhile and FLOWCONTROL-RESUME wakes the pump again
+      if (suspended_.load(std::memory_order_acquire) &&
+          socket_.load(std::memory_order_acquire) >= 0) {
+        break;
+      }
+
+      std::span<uint8_t> region = backlog_.peek();
+      if (region.empty()) {
+        break;
+      }
+
+      metrics::count(metrics::RFC2217_RX_BYTES, region.size());
+
+      sending_.store(true, std::memory_order_seq_cst);
+      int socket = socket_.load(std::memory_order_seq_cst);
+      uint32_t start = metrics::now();
+      if (socket >= 0 &&
+          send_escaped(socket, region.data(), region.size()) != ESP_OK) {
+        FLOG_W(SERIAL, TAG, "Failed to forward %zu bytes: errno %d",
+               region.size(), errno);
+      }
+      if (socket >= 0) {
+        metrics::observe(metrics::HIST_RFC2217_SEND, start);
+      }
+      sending_.store(false, std::memory_order_release);
+
+      backlog_.consume(region.size());
+      metrics::level(metrics::GAUGE_RFC2217_BACKLOG, backlog_.size());
+      send_control();
+    }
+  }
+}
+
+void Rfc2217Server::wake_pump() {
+  if (pump_task_ != nullptr) {
+    xTaskNotifyGive(pump_task_);
+  }
+}
+
+int Rfc2217Server::option_index(uint8_t option) {
+  switch (option) {
+    case OPTION_BINARY:
+      return 0;
+    case OPTION_SUPPRESS_GO_AHEAD:
+      return 1;
+    case OPTION_COM_PORT:
+      return 2;
+    default:
+      return -1;
+  }
+}
+
+esp_err_t start_rfc2217_server() {
+  return Rfc2217Server::get_instance().start();
+}
+
+}  // namespace rfc2217
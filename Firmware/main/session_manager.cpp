@@ -0,0 +1,98 @@
+#include "session_manager.hpp"
+
+#include "metrics.hpp"
+
+namespace session {
+
+namespace {
+
+constexpr const char* RESOURCE_NAMES[RESOURCE_COUNT] = {
+    "SWD",
+    "target UART",
+    "SWO UART",
+    "USB port",
+};
+
+constexpr const char* CLIENT_NAMES[CLIENT_COUNT] = {
+    "none", "DAP", "flash", "RFC2217", "SWO", "USB/IP", "bench",
+};
+
+}  // namespace
+
+SessionManager& SessionManager::get_instance() {
+  static SessionManager instance;
+  return instance;
+}
+
+void SessionManager::register_lessee(client_t client, Lessee& lessee) {
+  lessees_[client].store(&lessee, std::memory_order_release);
+}
+
+grant_t SessionManager::begin(resource_t resource, client_t client) {
+  std::atomic<uint32_t>& word = leases_[resource].state;
+  uint32_t state = word.load(std::memory_order_acquire);
+
+  while (true) {
+    client_t holder = holder_of(state);
+    bool busy = state & BUSY;
+    if (busy && holder != client) {
+      return grant_t::DENIED;
+    }
+
+    // the previous user is whoever configured the resource last
+    client_t previous = holder != CLIENT_NONE ? holder : last_of(state);
+    if (word.compare_exchange_weak(state, make_state(client, client, true),
+                                   std::memory_order_acq_rel,
+                                   std::memory_order_acquire)) {
+      if (previous == client) {
+        return holder == client ? grant_t::KEPT : grant_t::GRANTED;
+      }
+      if (previous == CLIENT_NONE) {
+        return grant_t::GRANTED;
+      }
+
+      // still idle in the holder's hands, so it learns before anything moves
+      Lessee* lessee = lessees_[holder].load(std::memory_order_acquire);
+      if (holder != CLIENT_NONE && lessee != nullptr) {
+        lessee->on_preempted(resource);
+      }
+      metrics::count(metrics::LEASE_HANDOFFS);
+      ESP_LOGD(TAG, "%s handed from %s to %s", RESOURCE_NAMES[resource],
+               CLIENT_NAMES[previous], CLIENT_NAMES[client]);
+      return grant_t::HANDED_OVER;
+    }
+  }
+}
+
+void SessionManager::end(resource_t resource, client_t client) {
+  std::atomic<uint32_t>& word = leases_[resource].state;
+  uint32_t state = word.load(std::memory_order_relaxed);
+
+  // nobody else writes a busy lease, so this is the holder's own store
+  if (holder_of(state) != client || !(state & BUSY)) {
+    ESP_LOGW(TAG, "%s ended %s it is not using", CLIENT_NAMES[client],
+             RESOURCE_NAMES[resource]);
+    return;
+  }
+  word.store(state & ~BUSY, std::memory_order_release);
+}
+
+void SessionManager::release(resource_t resource, client_t client) {
+  std::atomic<uint32_t>& word = leases_[resource].state;
+  uint32_t state = word.load(std::memory_order_relaxed);
+
+  while (holder_of(state) == client) {
+    if (word.compare_exchange_weak(state,
+                                   make_state(CLIENT_NONE, client, false),
+                                   std::memory_order_release,
+                                   std::memory_order_relaxed)) {
+      return;
+    }
+  }
+}
+
+client_t SessionManager::holder(resource_t resource) const {
+  return holder_of(leases_[resource].state.load(std::memory_order_acquire));
+}
+
+}  // namespace session
@@ -0,0 +1,502 @@
+#include "settings_store.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include "nvs_controller.hpp"
+
+namespace controller {
+
+namespace {
+
+// kept by ESP-IDF components themselves, never read through the store
+constexpr const char* SYSTEM_NAMESPACES[] = {"nvs.net80211", "phy"};
+
+bool is_system_namespace(const char* name_space) {
+  for (const char* system : SYSTEM_NAMESPACES) {
+    if (strcmp(name_space, system) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+SettingsStore& SettingsStore::get_instance() {
+  static SettingsStore instance;
+  return instance;
+}
+
+esp_err_t SettingsStore::init() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (loaded_) {
+    return ESP_OK;
+  }
+
+  esp_err_t ret = ensure_nvs();
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  const esp_timer_create_args_t timer_args = {
+      .callback = &flush_timer_callback,
+      .arg = this,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "settings_flush",
+      .skip_unhandled_events = true,
+  };
+  ret = esp_timer_create(&timer_args, &flush_timer_);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  nvs_iterator_t iterator = nullptr;
+  ret = nvs_entry_find(NVS_DEFAULT_PART_NAME, nullptr, NVS_TYPE_ANY,
+                       &iterator);
+  while (ret == ESP_OK) {
+    nvs_entry_info_t info;
+    nvs_entry_info(iterator, &info);
+    load_entry(info);
+    ret = nvs_entry_next(&iterator);
+  }
+  nvs_release_iterator(iterator);
+
+  if (ret != ESP_ERR_NVS_NOT_FOUND) {
+    ESP_LOGE(TAG, "Failed to iterate NVS: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  size_t count = 0;
+  for (const entry_t& entry : entries_) {
+    count += entry.used;
+  }
+
+  loaded_ = true;
+  ESP_LOGI(TAG, "Loaded %zu settings", count);
+  return ESP_OK;
+}
+
+esp_err_t SettingsStore::get_u32(const char* name_space,
+                                 const char* key,
+                                 uint32_t& value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!loaded_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  entry_t* entry = find(name_space, key);
+  if (entry == nullptr || entry->erased) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+
+  // narrower unsigned keys written elsewhere read back just as well
+  switch (entry->type) {
+    case NVS_TYPE_U8:
+      value = entry->value[0];
+      return ESP_OK;
+    case NVS_TYPE_U16: {
+      uint16_t narrow;
+      memcpy(&narrow, entry->value, sizeof(narrow));
+      value = narrow;
+      return ESP_OK;
+    }
+    case NVS_TYPE_U32:
+      memcpy(&value, entry->value, sizeof(value));
+      return ESP_OK;
+    default:
+      return ESP_ERR_NVS_TYPE_MISMATCH;
+  }
+}
+
+esp_err_t SettingsStore::set_u32(const char* name_space,
+                                 const char* key,
+                                 uint32_t value) {
+  return write(name_space, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t SettingsStore::get_i32(const char* name_space,
+                                 const char* key,
+                                 int32_t& value) {
+  size_t length = sizeof(value);
+  return read(name_space, key, NVS_TYPE_I32, &value, length);
+}
+
+esp_err_t SettingsStore::set_i32(const char* name_space,
+                                 const char* key,
+                                 int32_t value) {
+  return write(name_space, key, NVS_TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t SettingsStore::get_string(const char* name_space,
+                                    const char* key,
+                                    char* value,
+                                    size_t size) {
+  return read(name_space, key, NVS_TYPE_STR, value, size);
+}
+
+esp_err_t SettingsStore::set_string(const char* name_space,
+                                    const char* key,
+                                    const char* value) {
+  return write(name_space, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t SettingsStore::get_blob(const char* name_space,
+                                  const char* key,
+                                  void* value,
+                                  size_t length) {
+  size_t stored = length;
+  esp_err_t ret = read(name_space, key, NVS_TYPE_BLOB, value, stored);
+  if (ret == ESP_OK && stored != length) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+  return ret;
+}
+
+esp_err_t SettingsStore::set_blob(const char* name_space,
+                                  const char* key,
+                                  const void* value,
+                                  size_t length) {
+  return write(name_space, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t SettingsStore::erase(const char* name_space, const char* key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!loaded_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  entry_t* entry = find(name_space, key);
+  if (entry == nullptr || entry->erased) {
+    return ESP_OK;
+  }
+
+  // the slot is freed once the erase has reached flash
+  entry->erased = true;
+  entry->dirty = true;
+  entry->version++;
+  if (!esp_timer_is_active(flush_timer_)) {
+    esp_timer_start_once(flush_timer_, FLUSH_DELAY_US);
+  }
+  return ESP_OK;
+}
+
+esp_err_t SettingsStore::flush() {
+  std::lock_guard<std::mutex> flush_lock(flush_mutex_);
+
+  // copy the dirty entries out, so that readers never wait for flash
+  size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const entry_t& entry : entries_) {
+      if (entry.used && entry.dirty) {
+        pending_[count++] = entry;
+      }
+    }
+  }
+
+  if (count == 0) {
+    return ESP_OK;
+  }
+
+  // one handle and one commit per namespace
+  std::bitset<MAX_ENTRIES> handled;
+  std::bitset<MAX_ENTRIES> written;
+  esp_err_t result = ESP_OK;
+  for (size_t i = 0; i < count; i++) {
+    if (handled[i]) {
+      continue;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(pending_[i].name_space, NVS_READWRITE, &handle);
+    std::bitset<MAX_ENTRIES> batch;
+    for (size_t j = i; j < count; j++) {
+      if (handled[j] ||
+          strcmp(pending_[j].name_space, pending_[i].name_space) != 0) {
+        continue;
+      }
+      handled[j] = true;
+      if (ret == ESP_OK) {
+        esp_err_t stored = store(handle, pending_[j]);
+        if (stored == ESP_OK) {
+          batch[j] = true;
+        } else {
+          ESP_LOGW(TAG, "Failed to write %s/%s: %s", pending_[j].name_space,
+                   pending_[j].key, esp_err_to_name(stored));
+          result = stored;
+        }
+      }
+    }
+
+    if (ret == ESP_OK) {
+      ret = nvs_commit(handle);
+      nvs_close(handle);
+    }
+    if (ret == ESP_OK) {
+      written |= batch;
+    } else {
+      ESP_LOGE(TAG, "Failed to commit %s: %s", pending_[i].name_space,
+               esp_err_to_name(ret));
+      result = ret;
+    }
+  }
+
+  // entries changed again meanwhile stay dirty for the next flush
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < count; i++) {
+    entry_t* entry = find(pending_[i].name_space, pending_[i].key);
+    if (!written[i] || entry == nullptr ||
+        entry->version != pending_[i].version) {
+      continue;
+    }
+    if (entry->erased) {
+      *entry = entry_t{};
+    } else {
+      entry->dirty = false;
+      entry->retyped = false;
+    }
+  }
+
+  ESP_LOGD(TAG, "Flushed %zu settings", written.count());
+  if (result == ESP_OK) {
+    retry_delay_us_ = FLUSH_DELAY_US;
+  } else {
+    schedule_retry(result);
+  }
+  return result;
+}
+
+void SettingsStore::schedule_retry(esp_err_t error) {
+  // a change made meanwhile already armed the timer
+  if (flush_timer_ == nullptr || esp_timer_is_active(flush_timer_)) {
+    return;
+  }
+
+  ESP_LOGW(TAG, "Flush failed (%s), retrying in %llu ms",
+           esp_err_to_name(error),
+           static_cast<unsigned long long>(retry_delay_us_ / 1000));
+  esp_timer_start_once(flush_timer_, retry_delay_us_);
+  retry_delay_us_ = std::min(retry_delay_us_ * 2, MAX_RETRY_DELAY_US);
+}
+
+SettingsStore::entry_t* SettingsStore::find(const char* name_space,
+                                            const char* key) {
+  for (entry_t& entry : entries_) {
+    if (entry.used && strcmp(entry.key, key) == 0 &&
+        strcmp(entry.name_space, name_space) == 0) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+void SettingsStore::load_entry(const nvs_entry_info_t& info) {
+  if (is_system_namespace(info.namespace_name)) {
+    return;
+  }
+
+  entry_t* entry = nullptr;
+  for (entry_t& candidate : entries_) {
+    if (!candidate.used) {
+      entry = &candidate;
+      break;
+    }
+  }
+  if (entry == nullptr) {
+    ESP_LOGW(TAG, "No slot left for %s/%s", info.namespace_name, info.key);
+    return;
+  }
+
+  nvs_handle_t handle;
+  if (nvs_open(info.namespace_name, NVS_READONLY, &handle) != ESP_OK) {
+    return;
+  }
+
+  size_t length = MAX_VALUE_SIZE;
+  esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+  switch (info.type) {
+    case NVS_TYPE_U8:
+      length = sizeof(uint8_t);
+      ret = nvs_get_u8(handle, info.key, entry->value);
+      break;
+    case NVS_TYPE_U16:
+      length = sizeof(uint16_t);
+      ret = nvs_get_u16(handle, info.key,
+                        reinterpret_cast<uint16_t*>(entry->value));
+      break;
+    case NVS_TYPE_U32:
+      length = sizeof(uint32_t);
+      ret = nvs_get_u32(handle, info.key,
+                        reinterpret_cast<uint32_t*>(entry->value));
+      break;
+    case NVS_TYPE_I32:
+      length = sizeof(int32_t);
+      ret = nvs_get_i32(handle, info.key,
+                        reinterpret_cast<int32_t*>(entry->value));
+      break;
+    case NVS_TYPE_STR:
+      ret = nvs_get_str(handle, info.key,
+                        reinterpret_cast<char*>(entry->value), &length);
+      break;
+    case NVS_TYPE_BLOB:
+      ret = nvs_get_blob(handle, info.key, entry->value, &length);
+      break;
+    default:
+      break;
+  }
+  nvs_close(handle);
+
+  if (ret != ESP_OK) {
+    // too large for a slot, or a type the store has no accessor for
+    ESP_LOGW(TAG, "Not caching %s/%s: %s", info.namespace_name, info.key,
+             esp_err_to_name(ret));
+    *entry = entry_t{};
+    return;
+  }
+
+  strlcpy(entry->name_space, info.namespace_name, sizeof(entry->name_space));
+  strlcpy(entry->key, info.key, sizeof(entry->key));
+  entry->type = info.type;
+  entry->length = length;
+  entry->used = true;
+}
+
+esp_err_t SettingsStore::read(const char* name_space,
+                              const char* key,
+                              nvs_type_t type,
+                              void* value,
+                              size_t& length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!loaded_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  entry_t* entry = find(name_space, key);
+  if (entry == nullptr || entry->erased) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  if (entry->type != type) {
+    return ESP_ERR_NVS_TYPE_MISMATCH;
+  }
+  if (entry->length > length) {
+    return ESP_ERR_NVS_INVALID_LENGTH;
+  }
+
+  memcpy(value, entry->value, entry->length);
+  length = entry->length;
+  return ESP_OK;
+}
+
+esp_err_t SettingsStore::write(const char* name_space,
+                               const char* key,
+                               nvs_type_t type,
+                               const void* value,
+                               size_t length) {
+  if (strlen(name_space) >= NVS_NS_NAME_MAX_SIZE ||
+      strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+    return ESP_ERR_NVS_KEY_TOO_LONG;
+  }
+  if (length > MAX_VALUE_SIZE) {
+    return ESP_ERR_NVS_VALUE_TOO_LONG;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!loaded_) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  entry_t* entry = find(name_space, key);
+  if (entry != nullptr && !entry->erased && entry->type == type &&
+      entry->length == length && memcmp(entry->value, value, length) == 0) {
+    // rewriting what is stored costs nothing
+    return ESP_OK;
+  }
+
+  if (entry == nullptr) {
+    for (entry_t& candidate : entries_) {
+      if (!candidate.used) {
+        entry = &candidate;
+        break;
+      }
+    }
+    if (entry == nullptr) {
+      ESP_LOGE(TAG, "No slot left for %s/%s", name_space, key);
+      return ESP_ERR_NO_MEM;
+    }
+    *entry = entry_t{};
+    strlcpy(entry->name_space, name_space, sizeof(entry->name_space));
+    strlcpy(entry->key, key, sizeof(entry->key));
+    entry->type = type;
+    entry->used = true;
+  }
+
+  entry->retyped |= entry->type != type;
+  entry->type = type;
+  entry->length = length;
+  memcpy(entry->value, value, length);
+  entry->erased = false;
+  entry->dirty = true;
+  entry->version++;
+
+  // the first change of a burst arms the timer, later ones ride along
+  if (!esp_timer_is_active(flush_timer_)) {
+    esp_timer_start_once(flush_timer_, FLUSH_DELAY_US);
+  }
+  return ESP_OK;
+}
+
+esp_err_t SettingsStore::store(nvs_handle_t handle, const entry_t& entry) {
+  if (entry.erased || entry.retyped) {
+    esp_err_t ret = nvs_erase_key(handle, entry.key);
+    if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND) {
+      return ret;
+    }
+    if (entry.erased) {
+      return ESP_OK;
+    }
+  }
+
+  const uint8_t* value = entry.value;
+  switch (entry.type) {
+    case NVS_TYPE_U8:
+      return nvs_set_u8(handle, entry.key, value[0]);
+    case NVS_TYPE_U16:
+      return nvs_set_u16(handle, entry.key,
+                         *reinterpret_cast<const uint16_t*>(value));
+    case NVS_TYPE_U32:
+      return nvs_set_u32(handle, entry.key,
+                         *reinterpret_cast<const uint32_t*>(value));
+    case NVS_TYPE_I32:
+      return nvs_set_i32(handle, entry.key,
+                         *reinterpret_cast<const int32_t*>(value));
+    case NVS_TYPE_STR:
+      return nvs_set_str(handle, entry.key,
+                         reinterpret_cast<const char*>(value));
+    case NVS_TYPE_BLOB:
+      return nvs_set_blob(handle, entry.key, value, entry.length);
+    default:
+      return ESP_ERR_NOT_SUPPORTED;
+  }
+}
+
+SettingsStore::~SettingsStore() {
+  flush();
+
+  if (flush_timer_) {
+    // a failed flush may have armed a retry
+    esp_timer_stop(flush_timer_);
+    esp_timer_delete(flush_timer_);
+  }
+}
+
+esp_err_t ensure_settings() {
+  return SettingsStore::get_instance().init();
+}
+
+}  // namespace controller
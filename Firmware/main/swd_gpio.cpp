@@ -0,0 +1,241 @@
+#include "swd_gpio.hpp"
+
+#include "dap_defs.hpp"
+#include "dap_sequences.hpp"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+
+namespace dap {
+
+namespace {
+
+constexpr uint32_t CPU_FREQUENCY = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000;
+
+// cycles one clock phase spends in register writes before any pacing
+constexpr uint32_t PHASE_OVERHEAD = 12;
+
+// data and parity bits clocked through when a transfer is not answered OK
+constexpr size_t DATA_PHASE_BITS = 33;
+
+}  // namespace
+
+GpioSwdPhy& GpioSwdPhy::get_instance() {
+  static GpioSwdPhy instance;
+  return instance;
+}
+
+esp_err_t GpioSwdPhy::init() {
+  gpio_config_t io_config{};
+  io_config.pin_bit_mask = (1ULL << SWCLK) | (1ULL << SWDIO);
+  // input stays enabled so DAP_SWJ_Pins can read the lines back
+  io_config.mode = GPIO_MODE_INPUT_OUTPUT;
+  io_config.pull_up_en = GPIO_PULLUP_ENABLE;
+  io_config.pull_down_en = GPIO_PULLDOWN_DISABLE;
+  io_config.intr_type = GPIO_INTR_DISABLE;
+
+  esp_err_t ret = gpio_config(&io_config);
+  if (ret == ESP_OK && NRESET >= 0) {
+    io_config.pin_bit_mask = 1ULL << NRESET;
+    io_config.mode = GPIO_MODE_INPUT_OUTPUT_OD;
+    ret = gpio_config(&io_config);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to configure SWD pins: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  if (NRESET >= 0) {
+    gpio_ll_set_level(hw_, NRESET, 1);
+  }
+  disconnect();
+  set_clock(1000000);
+
+  ESP_LOGI(TAG, "SWD on GPIO%d (SWCLK) and GPIO%d (SWDIO)", SWCLK, SWDIO);
+  return ESP_OK;
+}
+
+bool GpioSwdPhy::connect(uint8_t port) {
+  if (port != PORT_SWD) {
+    return false;
+  }
+
+  gpio_ll_set_level(hw_, SWCLK, 1);
+  gpio_ll_set_level(hw_, SWDIO, 1);
+  gpio_ll_output_enable(hw_, SWCLK);
+  gpio_ll_output_enable(hw_, SWDIO);
+  return true;
+}
+
+void GpioSwdPhy::disconnect() {
+  gpio_ll_output_disable(hw_, SWCLK);
+  gpio_ll_output_disable(hw_, SWDIO);
+}
+
+void GpioSwdPhy::set_clock(uint32_t frequency) {
+  if (frequency == 0) {
+    return;
+  }
+
+  uint32_t half_period = CPU_FREQUENCY / (2 * frequency);
+  half_period_ = half_period > PHASE_OVERHEAD ? half_period - PHASE_OVERHEAD
+                                              : 0;
+}
+
+void GpioSwdPhy::configure_swd(const swd_config_t& config) {
+  config_ = config;
+}
+
+void GpioSwdPhy::swj_sequence(size_t bits, const uint8_t* data) {
+  for (size_t i = 0; i < bits; i++) {
+    write_bit((data[i / 8] >> (i % 8)) & 1);
+  }
+}
+
+void GpioSwdPhy::swd_sequence(size_t bits, const uint8_t* out, uint8_t* in) {
+  if (out != nullptr) {
+    swj_sequence(bits, out);
+    return;
+  }
+
+  set_swdio_output(false);
+  for (size_t i = 0; i < bits; i += 8) {
+    size_t count = bits - i < 8 ? bits - i : 8;
+    in[i / 8] = static_cast<uint8_t>(read_bits(count));
+  }
+  set_swdio_output(true);
+}
+
+IRAM_ATTR uint8_t GpioSwdPhy::swd_transfer(uint8_t request, uint32_t& data) {
+  bool read = request & TRANSFER_RNW;
+
+  write_bits(REQUEST_HEADERS[request & 0x0f], 8);
+
+  set_swdio_output(false);
+  clock_cycles(config_.turnaround);
+  uint8_t ack = static_cast<uint8_t>(read_bits(3));
+
+  if (ack == TRANSFER_OK) {
+    if (read) {
+      uint32_t value = read_bits(32);
+      uint32_t value_parity = read_bit();
+      clock_cycles(config_.turnaround);
+      set_swdio_output(true);
+      if (parity32(value) != value_parity) {
+        ack = TRANSFER_ERROR;
+      }
+      data = value;
+    } else {
+      clock_cycles(config_.turnaround);
+      set_swdio_output(true);
+      write_bits(data, 32);
+      write_bit(parity32(data));
+    }
+
+    for (size_t i = 0; i < config_.idle_cycles; i++) {
+      write_bit(0);
+    }
+    gpio_ll_set_level(hw_, SWDIO, 1);
+    return ack;
+  }
+
+  if (ack == TRANSFER_WAIT || ack == TRANSFER_FAULT) {
+    if (config_.data_phase && read) {
+      clock_cycles(DATA_PHASE_BITS);
+    }
+    clock_cycles(config_.turnaround);
+    set_swdio_output(true);
+    if (config_.data_phase && !read) {
+      write_bits(0, 32);
+      write_bit(0);
+    }
+    gpio_ll_set_level(hw_, SWDIO, 1);
+    return ack;
+  }
+
+  // no ACK or a garbled one, let the target drop back to idle
+  clock_cycles(config_.turnaround + DATA_PHASE_BITS);
+  set_swdio_output(true);
+  gpio_ll_set_level(hw_, SWDIO, 1);
+  return ack;
+}
+
+uint8_t GpioSwdPhy::swj_pins(uint8_t output, uint8_t select) {
+  if (select & (1 << PIN_SWCLK_TCK)) {
+    gpio_ll_set_level(hw_, SWCLK, (output >> PIN_SWCLK_TCK) & 1);
+  }
+  if (select & (1 << PIN_SWDIO_TMS)) {
+    gpio_ll_set_level(hw_, SWDIO, (output >> PIN_SWDIO_TMS) & 1);
+  }
+  if (NRESET >= 0 && (select & (1 << PIN_NRESET))) {
+    // open drain, a one releases the line to the target's pull-up
+    gpio_ll_set_level(hw_, NRESET, (output >> PIN_NRESET) & 1);
+  }
+
+  uint8_t levels = gpio_ll_get_level(hw_, SWCLK) << PIN_SWCLK_TCK |
+                   gpio_ll_get_level(hw_, SWDIO) << PIN_SWDIO_TMS;
+  if (NRESET >= 0) {
+    levels |= gpio_ll_get_level(hw_, NRESET) << PIN_NRESET;
+  }
+  return levels;
+}
+
+void GpioSwdPhy::delay() const {
+  if (half_period_ == 0) {
+    return;
+  }
+
+  uint32_t start = esp_cpu_get_cycle_count();
+  while (esp_cpu_get_cycle_count() - start < half_period_) {
+  }
+}
+
+// the host changes SWDIO while SWCLK is low, the target samples on the rise
+void GpioSwdPhy::write_bit(uint32_t bit) {
+  gpio_ll_set_level(hw_, SWDIO, bit);
+  gpio_ll_set_level(hw_, SWCLK, 0);
+  delay();
+  gpio_ll_set_level(hw_, SWCLK, 1);
+  delay();
+}
+
+uint32_t GpioSwdPhy::read_bit() {
+  gpio_ll_set_level(hw_, SWCLK, 0);
+  delay();
+  uint32_t bit = gpio_ll_get_level(hw_, SWDIO);
+  gpio_ll_set_level(hw_, SWCLK, 1);
+  delay();
+  return bit;
+}
+
+void GpioSwdPhy::write_bits(uint32_t value, size_t bits) {
+  for (size_t i = 0; i < bits; i++) {
+    write_bit((value >> i) & 1);
+  }
+}
+
+uint32_t GpioSwdPhy::read_bits(size_t bits) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bits; i++) {
+    value |= read_bit() << i;
+  }
+  return value;
+}
+
+void GpioSwdPhy::clock_cycles(size_t cycles) {
+  for (size_t i = 0; i < cycles; i++) {
+    gpio_ll_set_level(hw_, SWCLK, 0);
+    delay();
+    gpio_ll_set_level(hw_, SWCLK, 1);
+    delay();
+  }
+}
+
+void GpioSwdPhy::set_swdio_output(bool enable) {
+  if (enable) {
+    gpio_ll_output_enable(hw_, SWDIO);
+  } else {
+    gpio_ll_output_disable(hw_, SWDIO);
+  }
+}
+
+}  // namespace dap
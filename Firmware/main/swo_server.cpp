@@ -0,0 +1,239 @@
+#include "swo_server.hpp"
+
+#include <cstring>
+#include "esp_intr_alloc.h"
+#include "esp_timer.h"
+#include "deferred_log.hpp"
+#include "metrics.hpp"
+#include "session_manager.hpp"
+#include "task_topology.hpp"
+#include "trace_recorder.hpp"
+
+namespace swo {
+
+namespace {
+
+// with the handler in IRAM, flash erases of the trace writer do not hold
+// the FIFO up
+#if CONFIG_UART_ISR_IN_IRAM
+constexpr int INTR_FLAGS = ESP_INTR_FLAG_IRAM;
+#else
+constexpr int INTR_FLAGS = 0;
+#endif
+
+}  // namespace
+
+SwoServer& SwoServer::get_instance() {
+  static SwoServer instance;
+  return instance;
+}
+
+SwoServer::SwoServer()
+    : unit_(
+          server::tcp_server_config_t{
+              .name = "swo_server",
+              .port = CONFIG_FLUIDITY_SWO_PORT,
+              // the trace has one consumer
+              .max_clients = 1,
+              // nothing is read from the client
+              .rx_buffer_size = 64,
+              .rx_region = memory::region_t::INTERNAL,
+              .stack_size = topology::SWO_SERVER.stack_size,
+              .priority = topology::SWO_SERVER.priority,
+              .core_id = topology::SWO_SERVER.core_id,
+          },
+          *this) {}
+
+esp_err_t SwoServer::start() {
+  if (capture_task_ == nullptr) {
+    // capture runs from boot on, the lease is held for good
+    if (session::leases().begin(session::RESOURCE_SWO_UART,
+                                session::CLIENT_SWO) ==
+        session::grant_t::DENIED) {
+      ESP_LOGE(TAG, "SWO UART is in use");
+      return ESP_ERR_INVALID_STATE;
+    }
+    uart_config_t config{
+        .baud_rate = CONFIG_FLUIDITY_SWO_BAUD_RATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = 0,
+        .source_clk = UART_SCLK_DEFAULT,
+    };
+
+    esp_err_t ret = uart_driver_install(UART, BUFFER_SIZE, 0,
+                                        EVENT_QUEUE_SIZE, &events_,
+                                        INTR_FLAGS);
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "SWO UART is unavailable: %s", esp_err_to_name(ret));
+      session::leases().release(session::RESOURCE_SWO_UART,
+                                session::CLIENT_SWO);
+      return ret;
+    }
+    ret = uart_param_config(UART, &config);
+    if (ret == ESP_OK) {
+      ret = uart_set_pin(UART, UART_PIN_NO_CHANGE, PIN, UART_PIN_NO_CHANGE,
+                         UART_PIN_NO_CHANGE);
+    }
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "SWO UART is unavailable: %s", esp_err_to_name(ret));
+      release_uart();
+      return ret;
+    }
+
+    // fewer, fuller interrupts; the line idles between ITM packets anyway
+    uart_set_rx_full_threshold(UART, 96);
+    uart_set_rx_timeout(UART, 10);
+
+    capturing_.store(true, std::memory_order_release);
+    if (xTaskCreatePinnedToCore(capture_entry, "swo_capture",
+                                topology::SWO_CAPTURE.stack_size, this,
+                                topology::SWO_CAPTURE.priority,
+                                &capture_task_,
+                                topology::SWO_CAPTURE.core_id) != pdPASS) {
+      ESP_LOGE(TAG, "Failed to create capture task");
+      capture_task_ = nullptr;
+      capturing_.store(false, std::memory_order_release);
+      release_uart();
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  return unit_.start();
+}
+
+esp_err_t SwoServer::stop() {
+  return unit_.stop();
+}
+
+uint32_t SwoServer::set_baud_rate(uint32_t baud_rate) {
+  if (baud_rate == 0 || uart_set_baudrate(UART, baud_rate) != ESP_OK) {
+    return 0;
+  }
+
+  uint32_t actual = 0;
+  uart_get_baudrate(UART, &actual);
+  ESP_LOGI(TAG, "SWO at %lu baud", static_cast<unsigned long>(actual));
+  return actual;
+}
+
+void SwoServer::set_capturing(bool capturing) {
+  if (capturing_.exchange(capturing, std::memory_order_acq_rel) ==
+      capturing) {
+    return;
+  }
+
+  if (capturing) {
+    // bytes sampled while stopped are stale
+    uart_flush_input(UART);
+    if (capture_task_ != nullptr) {
+      xTaskNotifyGive(capture_task_);
+    }
+  }
+}
+
+size_t SwoServer::pending() const {
+  size_t length = 0;
+  uart_get_buffered_data_len(UART, &length);
+  return length;
+}
+
+esp_err_t SwoServer::on_connect(server::connection_t& connection) {
+  int expected = -1;
+  if (!socket_.compare_exchange_strong(expected, connection.socket,
+                                       std::memory_order_acq_rel)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  ESP_LOGI(TAG, "SWO stream claimed by socket %d", connection.socket);
+  return ESP_OK;
+}
+
+size_t SwoServer::on_receive(server::connection_t& connection,
+                             std::span<const uint8_t> data) {
+  return data.size();
+}
+
+void SwoServer::on_disconnect(server::connection_t& connection) {
+  if (socket_.load(std::memory_order_acquire) != connection.socket) {
+    return;
+  }
+
+  // the socket closes once this returns: wait out a frame already going
+  socket_.store(-1, std::memory_order_seq_cst);
+  while (sending_.load(std::memory_order_seq_cst)) {
+    vTaskDelay(1);
+  }
+  ESP_LOGI(TAG, "SWO stream released");
+}
+
+void SwoServer::release_uart() {
+  uart_driver_delete(UART);
+  events_ = nullptr;
+  session::leases().release(session::RESOURCE_SWO_UART, session::CLIENT_SWO);
+}
+
+void SwoServer::check_events() {
+  uart_event_t event;
+  while (xQueueReceive(events_, &event, 0) == pdTRUE) {
+    // the driver resets the FIFO or pauses reception itself
+    if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+      overrun_.store(true, std::memory_order_release);
+      frame_overrun_ = true;
+    }
+  }
+}
+
+void SwoServer::send_frame(size_t length) {
+  swo_frame_header_t header{
+      .length = static_cast<uint16_t>(length),
+      .flags = static_cast<uint8_t>(frame_overrun_ ? FRAME_OVERRUN : 0),
+      .reserved = 0,
+      .timestamp = static_cast<uint32_t>(esp_timer_get_time()),
+  };
+  memcpy(frame_, &header, sizeof(header));
+
+  // pairs with on_disconnect(): either it sees sending_, or this sees -1
+  sending_.store(true, std::memory_order_seq_cst);
+  int socket = socket_.load(std::memory_order_seq_cst);
+  if (socket >= 0 && server::TcpServerUnit::send_all(
+                         socket, frame_, sizeof(header) + length) != ESP_OK) {
+    FLOG_W(SWO, TAG, "Failed to send %zu SWO bytes: errno %d", length, errno);
+  }
+  sending_.store(false, std::memory_order_release);
+  frame_overrun_ = false;
+}
+
+void SwoServer::capture() {
+  uint8_t* payload = frame_ + sizeof(swo_frame_header_t);
+
+  while (true) {
+    if (!is_capturing()) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+
+    // returns with a full frame, or with what the batch interval brought
+    int length = uart_read_bytes(UART, payload, FRAME_SIZE,
+                                 pdMS_TO_TICKS(BATCH_MS));
+    check_events();
+    if (length <= 0) {
+      continue;
+    }
+    metrics::count(metrics::SWO_BYTES, length);
+    metrics::level(metrics::GAUGE_SWO_BUFFERED, pending());
+
+#if CONFIG_FLUIDITY_TRACE_SWO
+    trace::record(trace::STREAM_SWO, payload, length);
+#endif
+    send_frame(length);
+  }
+}
+
+esp_err_t start_swo_server() {
+  return SwoServer::get_instance().start();
+}
+
+}  // namespace swo
@@ -0,0 +1,273 @@
+#include "target_access.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "dap_sequences.hpp"
+
+namespace dap {
+
+namespace {
+
+constexpr uint8_t AP_DRW_READ =
+    uint8_t{TRANSFER_APNDP} | uint8_t{AP_DRW} | uint8_t{TRANSFER_RNW};
+constexpr uint8_t AP_DRW_WRITE = uint8_t{TRANSFER_APNDP} | uint8_t{AP_DRW};
+
+// STKCMPCLR, STKERRCLR, WDERRCLR, ORUNERRCLR
+constexpr uint32_t ABORT_CLEAR_ERRORS = 0x1e;
+// CSYSPWRUPREQ, CDBGPWRUPREQ and their ACKs
+constexpr uint32_t POWER_UP_REQUEST = 0x50000000;
+constexpr uint32_t POWER_UP_ACK = 0xa0000000;
+constexpr int POWER_UP_POLLS = 100;
+constexpr int REGISTER_POLLS = 100;
+
+}  // namespace
+
+TargetAccess::TargetAccess(DapPhy& phy) : phy_(phy) {}
+
+esp_err_t TargetAccess::connect(uint32_t clock) {
+  if (!phy_.connect(PORT_SWD)) {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  connected_ = true;
+  phy_.set_clock(clock);
+  phy_.configure_swd(swd_config_t{});
+
+  // a dormant or JTAG SWJ-DP ends up in SWD either way
+  phy_.swj_sequence(LINE_RESET.BITS, LINE_RESET.data.data());
+  phy_.swj_sequence(JTAG_TO_SWD.BITS, JTAG_TO_SWD.data.data());
+  phy_.swj_sequence(LINE_RESET.BITS, LINE_RESET.data.data());
+  phy_.swj_sequence(IDLE_CYCLES.BITS, IDLE_CYCLES.data.data());
+
+  uint32_t dpidr;
+  esp_err_t ret = read_dp(DP_DPIDR, dpidr);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "No SWD target answers");
+    return ret;
+  }
+
+  ret = write_dp(DP_ABORT, ABORT_CLEAR_ERRORS);
+  if (ret == ESP_OK) {
+    ret = write_dp(DP_SELECT, 0);
+  }
+  if (ret == ESP_OK) {
+    ret = write_dp(DP_CTRL_STAT, POWER_UP_REQUEST);
+  }
+
+  uint32_t status = 0;
+  for (int i = 0; ret == ESP_OK && i < POWER_UP_POLLS; i++) {
+    ret = read_dp(DP_CTRL_STAT, status);
+    if ((status & POWER_UP_ACK) == POWER_UP_ACK) {
+      break;
+    }
+  }
+  if (ret == ESP_OK && (status & POWER_UP_ACK) != POWER_UP_ACK) {
+    ret = ESP_ERR_TIMEOUT;
+  }
+  if (ret == ESP_OK) {
+    ret = write_ap(AP_CSW, CSW_VALUE);
+  }
+  if (ret == ESP_OK) {
+    ret = write_word(DHCSR, DHCSR_DBGKEY | DHCSR_C_DEBUGEN);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Debug port power-up failed: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  ESP_LOGI(TAG, "Target DPIDR 0x%08lx", static_cast<unsigned long>(dpidr));
+  return ESP_OK;
+}
+
+void TargetAccess::disconnect() {
+  if (connected_) {
+    phy_.disconnect();
+    connected_ = false;
+  }
+}
+
+esp_err_t TargetAccess::read_word(uint32_t address, uint32_t& value) {
+  uint8_t bytes[4];
+  esp_err_t ret = read_memory(address, bytes, sizeof(bytes));
+  memcpy(&value, bytes, sizeof(value));
+  return ret;
+}
+
+esp_err_t TargetAccess::write_word(uint32_t address, uint32_t value) {
+  uint8_t bytes[4];
+  memcpy(bytes, &value, sizeof(bytes));
+  return write_memory(address, bytes, sizeof(bytes));
+}
+
+esp_err_t TargetAccess::read_memory(uint32_t address, uint8_t* data,
+                                    size_t length) {
+  if ((address | length) & 3) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  while (length > 0) {
+    size_t run = std::min<size_t>(length, TAR_WRAP - address % TAR_WRAP);
+    esp_err_t ret = write_ap(AP_TAR, address);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+
+    // every read returns the one before it, RDBUFF the last
+    uint32_t value;
+    ret = check(transfer(AP_DRW_READ, value));
+    for (size_t offset = 4; ret == ESP_OK && offset < run; offset += 4) {
+      ret = check(transfer(AP_DRW_READ, value));
+      memcpy(data + offset - 4, &value, sizeof(value));
+    }
+    if (ret == ESP_OK) {
+      ret = read_dp(DP_RDBUFF, value);
+      memcpy(data + run - 4, &value, sizeof(value));
+    }
+    if (ret != ESP_OK) {
+      return ret;
+    }
+
+    address += run;
+    data += run;
+    length -= run;
+  }
+  return ESP_OK;
+}
+
+esp_err_t TargetAccess::write_memory(uint32_t address, const uint8_t* data,
+                                     size_t length) {
+  if ((address | length) & 3) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  while (length > 0) {
+    size_t run = std::min<size_t>(length, TAR_WRAP - address % TAR_WRAP);
+    esp_err_t ret = write_ap(AP_TAR, address);
+    for (size_t offset = 0; ret == ESP_OK && offset < run; offset += 4) {
+      uint32_t value;
+      memcpy(&value, data + offset, sizeof(value));
+      ret = check(transfer(AP_DRW_WRITE, value));
+    }
+    if (ret != ESP_OK) {
+      return ret;
+    }
+
+    address += run;
+    data += run;
+    length -= run;
+  }
+
+  // stalls until the last posted write has completed
+  uint32_t value;
+  return read_dp(DP_RDBUFF, value);
+}
+
+esp_err_t TargetAccess::halt() {
+  esp_err_t ret = write_word(
+      DHCSR, DHCSR_DBGKEY | DHCSR_C_HALT | DHCSR_C_MASKINTS | DHCSR_C_DEBUGEN);
+  for (int i = 0; ret == ESP_OK && i < REGISTER_POLLS; i++) {
+    bool halted = false;
+    ret = is_halted(halted);
+    if (halted) {
+      return ret;
+    }
+  }
+  return ret == ESP_OK ? ESP_ERR_TIMEOUT : ret;
+}
+
+esp_err_t TargetAccess::resume_masked() {
+  return write_word(DHCSR,
+                    DHCSR_DBGKEY | DHCSR_C_MASKINTS | DHCSR_C_DEBUGEN);
+}
+
+esp_err_t TargetAccess::is_halted(bool& halted) {
+  uint32_t value = 0;
+  esp_err_t ret = read_word(DHCSR, value);
+  halted = value & DHCSR_S_HALT;
+  return ret;
+}
+
+esp_err_t TargetAccess::read_core_register(uint8_t reg, uint32_t& value) {
+  esp_err_t ret = write_word(DCRSR, reg);
+  if (ret == ESP_OK) {
+    ret = wait_register_ready();
+  }
+  if (ret == ESP_OK) {
+    ret = read_word(DCRDR, value);
+  }
+  return ret;
+}
+
+esp_err_t TargetAccess::write_core_register(uint8_t reg, uint32_t value) {
+  constexpr uint32_t REGWNR = 1 << 16;
+
+  esp_err_t ret = write_word(DCRDR, value);
+  if (ret == ESP_OK) {
+    ret = write_word(DCRSR, REGWNR | reg);
+  }
+  if (ret == ESP_OK) {
+    ret = wait_register_ready();
+  }
+  return ret;
+}
+
+esp_err_t TargetAccess::reset_and_run() {
+  esp_err_t ret = write_word(DHCSR, DHCSR_DBGKEY);
+  if (ret == ESP_OK) {
+    // the reset takes the debug port down with it, no answer is expected
+    write_word(AIRCR, AIRCR_SYSRESETREQ);
+  }
+  return ret;
+}
+
+uint8_t TargetAccess::transfer(uint8_t request, uint32_t& data) {
+  uint16_t retry = WAIT_RETRY;
+  uint8_t ack;
+
+  do {
+    ack = phy_.swd_transfer(request, data);
+  } while (ack == TRANSFER_WAIT && retry-- != 0);
+
+  return ack;
+}
+
+esp_err_t TargetAccess::check(uint8_t ack) {
+  switch (ack) {
+    case TRANSFER_OK:
+      return ESP_OK;
+    case TRANSFER_WAIT:
+      return ESP_ERR_TIMEOUT;
+    case TRANSFER_FAULT: {
+      // sticky errors block every later access until cleared
+      uint32_t clear = ABORT_CLEAR_ERRORS;
+      transfer(DP_ABORT, clear);
+      return ESP_FAIL;
+    }
+    default:
+      return ESP_ERR_INVALID_RESPONSE;
+  }
+}
+
+esp_err_t TargetAccess::read_dp(uint8_t reg, uint32_t& value) {
+  return check(transfer(reg | TRANSFER_RNW, value));
+}
+
+esp_err_t TargetAccess::write_dp(uint8_t reg, uint32_t value) {
+  return check(transfer(reg, value));
+}
+
+esp_err_t TargetAccess::write_ap(uint8_t reg, uint32_t value) {
+  return check(transfer(TRANSFER_APNDP | reg, value));
+}
+
+esp_err_t TargetAccess::wait_register_ready() {
+  for (int i = 0; i < REGISTER_POLLS; i++) {
+    uint32_t value;
+    esp_err_t ret = read_word(DHCSR, value);
+    if (ret != ESP_OK || (value & DHCSR_S_REGRDY)) {
+      return ret;
+    }
+  }
+  return ESP_ERR_TIMEOUT;
+}
+
+}  // namespace dap
@@ -1 +1,422 @@
 #include "tcp_server_unit.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "lwip/sockets.h"
+#include "deferred_log.hpp"
+#include "network_manager.hpp"
+
+namespace server {
+
+TcpServerUnit::TcpServerUnit(const tcp_server_config_t& config,
+                             TcpHandler& handler)
+    : config_(config), handler_(handler) {
+  config_.max_clients = std::clamp<size_t>(config_.max_clients, 1, MAX_CLIENTS);
+  stopped_ = xSemaphoreCreateBinary();
+  link_changed_ = xSemaphoreCreateBinary();
+}
+
+esp_err_t TcpServerUnit::start() {
+  if (running_.load(std::memory_order_acquire)) {
+    ESP_LOGI(TAG, "%s is already running", config_.name);
+    return ESP_OK;
+  }
+
+  if (stopped_ == nullptr || link_changed_ == nullptr ||
+      config_.rx_buffer_size == 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // one block per slot for the whole lifetime of the unit
+  memory::BufferPool& pool = memory::BufferPool::get_instance();
+  for (size_t i = 0; i < config_.max_clients; i++) {
+    if (rx_buffers_[i] == nullptr) {
+      rx_buffers_[i] = static_cast<uint8_t*>(
+          pool.allocate_or_heap(config_.rx_buffer_size, config_.rx_region));
+    }
+    if (rx_buffers_[i] == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate receive buffers for %s", config_.name);
+      return ESP_ERR_NO_MEM;
+    }
+
+    connections_[i] = connection_t{};
+    connections_[i].rx_buffer = rx_buffers_[i];
+  }
+
+  // delivers the current link state right away
+  if (!subscribed_) {
+    esp_err_t ret = controller::NetworkManager::get_instance().subscribe(
+        &link_callback, this);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+    subscribed_ = true;
+  }
+
+  // without a link the task opens the listener once the IP is obtained
+  if (link_up_.load(std::memory_order_acquire)) {
+    esp_err_t ret = open_listener();
+    if (ret != ESP_OK) {
+      return ret;
+    }
+  }
+
+  // drop a stale signal left by a task that exited on its own
+  xSemaphoreTake(stopped_, 0);
+
+  running_.store(true, std::memory_order_release);
+  if (xTaskCreatePinnedToCore(task_entry, config_.name, config_.stack_size,
+                              this, config_.priority, &task_,
+                              config_.core_id) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create task for %s", config_.name);
+    running_.store(false, std::memory_order_release);
+    close_listener();
+    return ESP_ERR_NO_MEM;
+  }
+
+  if (listen_socket_ >= 0) {
+    ESP_LOGI(TAG, "%s listening on port %u", config_.name, config_.port);
+  } else {
+    ESP_LOGI(TAG, "%s waiting for the link", config_.name);
+  }
+  return ESP_OK;
+}
+
+esp_err_t TcpServerUnit::stop() {
+  if (!running_.exchange(false, std::memory_order_acq_rel)) {
+    return ESP_OK;
+  }
+
+  // the task notices the flag within one poll interval and cleans up itself
+  xSemaphoreTake(stopped_, portMAX_DELAY);
+  ESP_LOGI(TAG, "%s stopped", config_.name);
+  return ESP_OK;
+}
+
+bool TcpServerUnit::is_running() const {
+  return running_.load(std::memory_order_acquire);
+}
+
+esp_err_t TcpServerUnit::send_all(int socket, const void* data, size_t length) {
+  const uint8_t* cursor = static_cast<const uint8_t*>(data);
+
+  while (length > 0) {
+    ssize_t sent = send(socket, cursor, length, 0);
+    if (sent < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return ESP_FAIL;
+    }
+    cursor += sent;
+    length -= sent;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t TcpServerUnit::send_vectored(int socket,
+                                       iovec* vectors,
+                                       size_t count) {
+  while (count > 0) {
+    ssize_t sent =
+        writev(socket, vectors, std::min<size_t>(count, IOV_MAX));
+    if (sent < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      return ESP_FAIL;
+    }
+
+    // drop the vectors that went out whole, then trim the partial one
+    while (count > 0 && static_cast<size_t>(sent) >= vectors->iov_len) {
+      sent -= vectors->iov_len;
+      vectors++;
+      count--;
+    }
+    if (count > 0) {
+      vectors->iov_base = static_cast<uint8_t*>(vectors->iov_base) + sent;
+      vectors->iov_len -= sent;
+    }
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t TcpServerUnit::open_listener() {
+  listen_socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+  if (listen_socket_ < 0) {
+    ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+    return ESP_FAIL;
+  }
+
+  int reuse = 1;
+  setsockopt(listen_socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(config_.port);
+
+  if (bind(listen_socket_, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_socket_, config_.max_clients) != 0) {
+    ESP_LOGE(TAG, "Failed to listen on port %u: errno %d", config_.port,
+             errno);
+    close(listen_socket_);
+    listen_socket_ = -1;
+    return ESP_FAIL;
+  }
+
+  // accept() must never block the select loop
+  int flags = fcntl(listen_socket_, F_GETFL, 0);
+  fcntl(listen_socket_, F_SETFL, flags | O_NONBLOCK);
+  return ESP_OK;
+}
+
+void TcpServerUnit::close_listener() {
+  if (listen_socket_ >= 0) {
+    close(listen_socket_);
+    listen_socket_ = -1;
+  }
+}
+
+bool TcpServerUnit::wait_for_link() {
+  if (link_up_.load(std::memory_order_acquire)) {
+    if (listen_socket_ >= 0) {
+      return true;
+    }
+    if (open_listener() == ESP_OK) {
+      ESP_LOGI(TAG, "%s listening on port %u", config_.name, config_.port);
+      return true;
+    }
+  } else if (listen_socket_ >= 0) {
+    // the clients' sockets died with the link, no use waiting for timeouts
+    ESP_LOGI(TAG, "%s paused, link lost", config_.name);
+    close_all();
+    close_listener();
+  }
+
+  // woken at once by a link change, or one poll interval later to check
+  // whether the unit has been asked to stop
+  xSemaphoreTake(link_changed_,
+                 pdMS_TO_TICKS(CONFIG_FLUIDITY_TCP_POLL_INTERVAL_MS));
+  return false;
+}
+
+void TcpServerUnit::run() {
+  while (running_.load(std::memory_order_acquire)) {
+    if (!wait_for_link()) {
+      continue;
+    }
+
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(listen_socket_, &read_set);
+    int max_fd = listen_socket_;
+    bool deferred = false;
+
+    for (size_t i = 0; i < config_.max_clients; i++) {
+      connection_t& connection = connections_[i];
+      if (connection.socket < 0) {
+        continue;
+      }
+      // a full buffer is not read again until the handler consumes some
+      if (connection.rx_length < config_.rx_buffer_size) {
+        FD_SET(connection.socket, &read_set);
+        max_fd = std::max(max_fd, connection.socket);
+      }
+      deferred |= connection.deferred;
+    }
+
+    // deferred frames are retried every tick instead of every poll interval
+    // select() refuses tv_usec of a second or more
+    uint32_t wait_ms =
+        deferred ? portTICK_PERIOD_MS : CONFIG_FLUIDITY_TCP_POLL_INTERVAL_MS;
+    timeval timeout{};
+    timeout.tv_sec = wait_ms / 1000;
+    timeout.tv_usec = (wait_ms % 1000) * 1000;
+
+    int ready = select(max_fd + 1, &read_set, nullptr, nullptr, &timeout);
+    if (ready < 0) {
+      // a listener torn down with the link is picked up by wait_for_link()
+      if (errno == EINTR || !link_up_.load(std::memory_order_acquire)) {
+        continue;
+      }
+      ESP_LOGE(TAG, "%s select failed: errno %d", config_.name, errno);
+      break;
+    }
+
+    if (ready == 0) {
+      FD_ZERO(&read_set);
+    } else if (FD_ISSET(listen_socket_, &read_set)) {
+      accept_client();
+    }
+
+    for (size_t i = 0; i < config_.max_clients; i++) {
+      connection_t& connection = connections_[i];
+      if (connection.socket < 0) {
+        continue;
+      }
+      if (FD_ISSET(connection.socket, &read_set)) {
+        service_client(connection);
+      } else if (connection.deferred) {
+        dispatch(connection);
+      }
+    }
+  }
+
+  close_all();
+  close_listener();
+
+  running_.store(false, std::memory_order_release);
+  task_ = nullptr;
+  xSemaphoreGive(stopped_);
+  vTaskDelete(nullptr);
+}
+
+void TcpServerUnit::accept_client() {
+  sockaddr_in address{};
+  socklen_t address_length = sizeof(address);
+
+  int client = accept(listen_socket_, reinterpret_cast<sockaddr*>(&address),
+                      &address_length);
+  if (client < 0) {
+    return;
+  }
+
+  connection_t* slot = nullptr;
+  for (size_t i = 0; i < config_.max_clients; i++) {
+    if (connections_[i].socket < 0) {
+      slot = &connections_[i];
+      break;
+    }
+  }
+
+  if (slot == nullptr) {
+    ESP_LOGW(TAG, "%s has no free client slot, rejecting", config_.name);
+    close(client);
+    return;
+  }
+
+  slot->socket = client;
+  slot->rx_length = 0;
+  slot->context = nullptr;
+  slot->deferred = false;
+
+  if (handler_.on_connect(*slot) != ESP_OK) {
+    ESP_LOGW(TAG, "%s handler refused the client", config_.name);
+    close(client);
+    slot->socket = -1;
+    return;
+  }
+
+  ESP_LOGI(TAG, "%s accepted client (socket %d)", config_.name, client);
+}
+
+void TcpServerUnit::service_client(connection_t& connection) {
+  size_t free_space = config_.rx_buffer_size - connection.rx_length;
+  if (free_space == 0) {
+    // recv() into no space returns 0, which would read as the peer closing
+    dispatch(connection);
+    return;
+  }
+  ssize_t received = recv(connection.socket,
+                          connection.rx_buffer + connection.rx_length,
+                          free_space, 0);
+
+  if (received == 0) {
+    close_client(connection);
+    return;
+  }
+
+  if (received < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return;
+    }
+    FLOG_W(TCP, TAG, "%s recv failed: errno %d", config_.name, errno);
+    close_client(connection);
+    return;
+  }
+
+  connection.rx_length += received;
+  dispatch(connection);
+}
+
+void TcpServerUnit::dispatch(connection_t& connection) {
+  connection.deferred = false;
+
+  size_t consumed = handler_.on_receive(
+      connection,
+      std::span<const uint8_t>(connection.rx_buffer, connection.rx_length));
+  if (consumed == TcpHandler::CLOSE_CONNECTION) {
+    close_client(connection);
+    return;
+  }
+
+  consumed = std::min(consumed, connection.rx_length);
+  size_t remaining = connection.rx_length - consumed;
+
+  // only the unconsumed tail (at most one partial frame) is moved
+  if (consumed > 0 && remaining > 0) {
+    memmove(connection.rx_buffer, connection.rx_buffer + consumed, remaining);
+  }
+  connection.rx_length = remaining;
+
+  if (connection.rx_length == config_.rx_buffer_size &&
+      !connection.deferred) {
+    FLOG_W(TCP, TAG, "%s frame exceeds receive buffer, dropping client",
+           config_.name);
+    close_client(connection);
+  }
+}
+
+void TcpServerUnit::close_client(connection_t& connection) {
+  if (connection.socket < 0) {
+    return;
+  }
+
+  handler_.on_disconnect(connection);
+
+  shutdown(connection.socket, SHUT_RDWR);
+  close(connection.socket);
+  ESP_LOGI(TAG, "%s closed client (socket %d)", config_.name,
+           connection.socket);
+
+  connection.socket = -1;
+  connection.rx_length = 0;
+  connection.context = nullptr;
+  connection.deferred = false;
+}
+
+void TcpServerUnit::close_all() {
+  for (size_t i = 0; i < config_.max_clients; i++) {
+    close_client(connections_[i]);
+  }
+}
+
+TcpServerUnit::~TcpServerUnit() {
+  stop();
+
+  if (subscribed_) {
+    controller::NetworkManager::get_instance().unsubscribe(&link_callback,
+                                                           this);
+  }
+
+  for (uint8_t* buffer : rx_buffers_) {
+    if (buffer != nullptr) {
+      memory::BufferPool::get_instance().release_any(buffer);
+    }
+  }
+
+  if (stopped_) {
+    vSemaphoreDelete(stopped_);
+  }
+
+  if (link_changed_) {
+    vSemaphoreDelete(link_changed_);
+  }
+}
+
+}  // namespace server
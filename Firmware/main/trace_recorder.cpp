@@ -0,0 +1,291 @@
+#include "trace_recorder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "buffer_pool.hpp"
+#include "esp_timer.h"
+#include "task_topology.hpp"
+
+namespace trace {
+
+TraceRecorder& TraceRecorder::get_instance() {
+  static TraceRecorder instance;
+  return instance;
+}
+
+esp_err_t TraceRecorder::init() {
+  if (is_ok()) {
+    return ESP_OK;
+  }
+
+  partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY, "trace");
+  if (partition_ == nullptr) {
+    ESP_LOGE(TAG, "No trace partition");
+    return ESP_ERR_NOT_FOUND;
+  }
+  block_count_ = partition_->size / SEGMENT_SIZE;
+  if (block_count_ < 2) {
+    ESP_LOGE(TAG, "Trace partition too small");
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  memory::BufferPool& pool = memory::BufferPool::get_instance();
+  for (size_t i = 0; i < CHUNK_COUNT; i++) {
+    chunks_[i].data = static_cast<uint8_t*>(
+        pool.allocate_or_heap(CHUNK_SIZE, memory::region_t::PSRAM));
+    if (chunks_[i].data == nullptr) {
+      ESP_LOGE(TAG, "Failed to allocate staging chunks");
+      return ESP_ERR_NO_MEM;
+    }
+    free_.try_push(static_cast<uint8_t>(i));
+  }
+
+  recover();
+
+  if (xTaskCreatePinnedToCore(writer_entry, "trace_writer",
+                              topology::TRACE_WRITER.stack_size, this,
+                              topology::TRACE_WRITER.priority, &writer_task_,
+                              topology::TRACE_WRITER.core_id) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create writer task");
+    writer_task_ = nullptr;
+    return ESP_ERR_NO_MEM;
+  }
+
+  ok_.store(true, std::memory_order_release);
+  ESP_LOGI(TAG, "%u segments of %u KiB, resuming at sequence %lu",
+           static_cast<unsigned>(block_count_),
+           static_cast<unsigned>(SEGMENT_SIZE / 1024),
+           static_cast<unsigned long>(sequence_));
+  return ESP_OK;
+}
+
+bool TraceRecorder::append(stream_t stream, const void* data, size_t length) {
+  if (!is_ok()) {
+    return false;
+  }
+
+  auto* payload = static_cast<const uint8_t*>(data);
+  bool notify = false;
+  bool stored = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t timestamp = static_cast<uint32_t>(esp_timer_get_time());
+
+    while (length > 0) {
+      size_t part = std::min(length, MAX_PAYLOAD);
+      size_t needed = sizeof(record_header_t) + part;
+
+      // records never straddle chunks
+      if (filling_ >= 0 && chunks_[filling_].length + needed > CHUNK_SIZE) {
+        full_.try_push(static_cast<uint8_t>(filling_));
+        filling_ = -1;
+        notify = true;
+      }
+      if (filling_ < 0) {
+        uint8_t index;
+        if (!free_.try_pop(index)) {
+          dropped_.fetch_add(length, std::memory_order_relaxed);
+          stored = false;
+          break;
+        }
+        filling_ = index;
+        chunks_[index].length = 0;
+      }
+
+      chunk_t& chunk = chunks_[filling_];
+      record_header_t header{
+          .length = static_cast<uint16_t>(part),
+          .stream = stream,
+          .reserved = 0,
+          .timestamp = timestamp,
+      };
+      memcpy(chunk.data + chunk.length, &header, sizeof(header));
+      memcpy(chunk.data + chunk.length + sizeof(header), payload, part);
+      chunk.length += needed;
+
+      payload += part;
+      length -= part;
+    }
+  }
+
+  if (notify) {
+    xTaskNotifyGive(writer_task_);
+  }
+  return stored;
+}
+
+bool TraceRecorder::get_range(uint32_t& first, uint32_t& last) const {
+  size_t stored = stored_.load(std::memory_order_acquire);
+  if (stored == 0) {
+    return false;
+  }
+
+  last = last_.load(std::memory_order_acquire);
+  first = last - static_cast<uint32_t>(stored - 1);
+  return true;
+}
+
+bool TraceRecorder::locate(uint32_t sequence, size_t& offset) const {
+  size_t stored = stored_.load(std::memory_order_acquire);
+  uint32_t last = last_.load(std::memory_order_acquire);
+  uint32_t age = last - sequence;
+  if (stored == 0 || age >= stored) {
+    return false;
+  }
+
+  size_t last_block = last_block_.load(std::memory_order_acquire);
+  offset = (last_block + block_count_ - age) % block_count_ * SEGMENT_SIZE;
+  return true;
+}
+
+void TraceRecorder::recover() {
+  // the newest header wins; the segments before it stay readable for as
+  // long as their sequences run back contiguously
+  bool found = false;
+  uint32_t newest = 0;
+  size_t newest_block = 0;
+  for (size_t block = 0; block < block_count_; block++) {
+    segment_header_t header;
+    if (esp_partition_read(partition_, block * SEGMENT_SIZE, &header,
+                           sizeof(header)) != ESP_OK ||
+        header.magic != SEGMENT_MAGIC) {
+      continue;
+    }
+    if (!found || static_cast<int32_t>(header.sequence - newest) > 0) {
+      newest = header.sequence;
+      newest_block = block;
+      found = true;
+    }
+  }
+
+  if (!found) {
+    ESP_LOGI(TAG, "Trace partition is empty");
+    return;
+  }
+
+  size_t stored = 1;
+  while (stored < block_count_) {
+    size_t block = (newest_block + block_count_ - stored) % block_count_;
+    segment_header_t header;
+    if (esp_partition_read(partition_, block * SEGMENT_SIZE, &header,
+                           sizeof(header)) != ESP_OK ||
+        header.magic != SEGMENT_MAGIC ||
+        header.sequence != newest - stored) {
+      break;
+    }
+    stored++;
+  }
+
+  // the segment open at reset is left as it is, writing resumes in the next
+  block_ = newest_block;
+  sequence_ = newest + 1;
+  last_.store(newest, std::memory_order_relaxed);
+  last_block_.store(newest_block, std::memory_order_relaxed);
+  stored_.store(stored, std::memory_order_release);
+}
+
+void TraceRecorder::flush_partial() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (filling_ >= 0 && chunks_[filling_].length > 0) {
+    full_.try_push(static_cast<uint8_t>(filling_));
+    filling_ = -1;
+  }
+}
+
+void TraceRecorder::write_chunk(const chunk_t& chunk) {
+  const uint8_t* cursor = chunk.data;
+  const uint8_t* end = chunk.data + chunk.length;
+
+  while (cursor < end) {
+    if (offset_ == 0 && open_segment() != ESP_OK) {
+      dropped_.fetch_add(end - cursor, std::memory_order_relaxed);
+      return;
+    }
+
+    // as many whole records as the segment still holds
+    const uint8_t* stop = cursor;
+    while (stop < end) {
+      record_header_t header;
+      memcpy(&header, stop, sizeof(header));
+      size_t size = sizeof(header) + header.length;
+      if (offset_ + (stop - cursor) + size > SEGMENT_SIZE) {
+        break;
+      }
+      stop += size;
+    }
+
+    if (stop > cursor) {
+      esp_err_t ret = esp_partition_write(
+          partition_, block_ * SEGMENT_SIZE + offset_, cursor, stop - cursor);
+      if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Segment write failed: %s", esp_err_to_name(ret));
+        dropped_.fetch_add(stop - cursor, std::memory_order_relaxed);
+      }
+      offset_ += stop - cursor;
+      cursor = stop;
+    }
+    if (cursor < end) {
+      offset_ = 0;
+    }
+  }
+}
+
+esp_err_t TraceRecorder::open_segment() {
+  size_t stored = stored_.load(std::memory_order_relaxed);
+  size_t block = stored == 0 ? 0 : (block_ + 1) % block_count_;
+
+  // the erase takes the oldest segment with it
+  if (stored == block_count_) {
+    stored--;
+    stored_.store(stored, std::memory_order_release);
+  }
+
+  esp_err_t ret = esp_partition_erase_range(partition_, block * SEGMENT_SIZE,
+                                            SEGMENT_SIZE);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Segment erase failed: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  segment_header_t header{
+      .magic = SEGMENT_MAGIC,
+      .sequence = sequence_,
+      .dropped = dropped_.exchange(0, std::memory_order_relaxed),
+      .length = UINT32_MAX,
+  };
+  ret = esp_partition_write(partition_, block * SEGMENT_SIZE, &header,
+                            sizeof(header));
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Segment header write failed: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  block_ = block;
+  offset_ = sizeof(header);
+  last_.store(sequence_, std::memory_order_relaxed);
+  last_block_.store(block, std::memory_order_relaxed);
+  stored_.store(stored + 1, std::memory_order_release);
+  sequence_++;
+  return ESP_OK;
+}
+
+void TraceRecorder::run() {
+  while (true) {
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FLUSH_INTERVAL_MS)) == 0) {
+      flush_partial();
+    }
+
+    uint8_t index;
+    while (full_.try_pop(index)) {
+      write_chunk(chunks_[index]);
+      free_.try_push(index);
+    }
+  }
+}
+
+esp_err_t start_trace_recorder() {
+  return TraceRecorder::get_instance().init();
+}
+
+}  // namespace trace
@@ -0,0 +1,134 @@
+#include "trace_server.hpp"
+
+#include <cstring>
+#include "esp_partition.h"
+#include "task_topology.hpp"
+
+namespace trace {
+
+TraceServer& TraceServer::get_instance() {
+  static TraceServer instance;
+  return instance;
+}
+
+TraceServer::TraceServer()
+    : unit_(
+          server::tcp_server_config_t{
+              .name = "trace_server",
+              .port = CONFIG_FLUIDITY_TRACE_PORT,
+              // one readout at a time keeps the mappings bounded
+              .max_clients = 1,
+              // nothing is read from the client
+              .rx_buffer_size = 64,
+              .rx_region = memory::region_t::INTERNAL,
+              .stack_size = topology::TRACE_SERVER.stack_size,
+              .priority = topology::TRACE_SERVER.priority,
+              .core_id = topology::TRACE_SERVER.core_id,
+          },
+          *this) {}
+
+esp_err_t TraceServer::start() {
+  if (!TraceRecorder::get_instance().is_ok()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  return unit_.start();
+}
+
+esp_err_t TraceServer::stop() {
+  return unit_.stop();
+}
+
+esp_err_t TraceServer::on_connect(server::connection_t& connection) {
+  // the range is fixed now; segments opened meanwhile wait for the next dump
+  if (!TraceRecorder::get_instance().get_range(next_, last_)) {
+    next_ = 1;
+    last_ = 0;
+  }
+
+  ESP_LOGI(TAG, "Sending segments %lu to %lu",
+           static_cast<unsigned long>(next_),
+           static_cast<unsigned long>(last_));
+  connection.deferred = true;
+  return ESP_OK;
+}
+
+size_t TraceServer::on_receive(server::connection_t& connection,
+                               std::span<const uint8_t> data) {
+  if (static_cast<int32_t>(next_ - last_) > 0) {
+    return CLOSE_CONNECTION;
+  }
+
+  // one segment per dispatch, so the unit's other work is not held up
+  esp_err_t ret = send_segment(connection.socket, next_);
+  if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+    return CLOSE_CONNECTION;
+  }
+
+  next_++;
+  connection.deferred = true;
+  return data.size();
+}
+
+esp_err_t TraceServer::send_segment(int socket, uint32_t sequence) {
+  TraceRecorder& recorder = TraceRecorder::get_instance();
+  size_t offset;
+  if (!recorder.locate(sequence, offset)) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  const void* mapped;
+  esp_partition_mmap_handle_t handle;
+  esp_err_t ret =
+      esp_partition_mmap(recorder.get_partition(), offset, SEGMENT_SIZE,
+                         ESP_PARTITION_MMAP_DATA, &mapped, &handle);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Segment mmap failed: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  const auto* base = static_cast<const uint8_t*>(mapped);
+  segment_header_t header;
+  memcpy(&header, base, sizeof(header));
+  if (header.magic != SEGMENT_MAGIC || header.sequence != sequence) {
+    esp_partition_munmap(handle);
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  // the records end at the first erased header, or with the segment
+  size_t end = sizeof(header);
+  while (end + sizeof(record_header_t) <= SEGMENT_SIZE) {
+    record_header_t record;
+    memcpy(&record, base + end, sizeof(record));
+    if (record.length == RECORD_END ||
+        end + sizeof(record) + record.length > SEGMENT_SIZE) {
+      break;
+    }
+    end += sizeof(record) + record.length;
+  }
+  header.length = end - sizeof(header);
+
+  iovec vectors[2] = {
+      {.iov_base = &header, .iov_len = sizeof(header)},
+      {.iov_base = const_cast<uint8_t*>(base + sizeof(header)),
+       .iov_len = header.length},
+  };
+  ret = server::TcpServerUnit::send_vectored(socket, vectors, 2);
+
+  // overwritten while it was going out: what the client got is garbage
+  segment_header_t after;
+  memcpy(&after, base, sizeof(after));
+  esp_partition_munmap(handle);
+  if (ret == ESP_OK && after.sequence != sequence) {
+    ESP_LOGW(TAG, "Segment %lu overwritten during readout",
+             static_cast<unsigned long>(sequence));
+    return ESP_FAIL;
+  }
+  return ret;
+}
+
+esp_err_t start_trace_server() {
+  return TraceServer::get_instance().start();
+}
+
+}  // namespace trace
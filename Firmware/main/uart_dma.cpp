@@ -0,0 +1,366 @@
+#include "uart_dma.hpp"
+
+#include <algorithm>
+#include <bit>
+#include "esp_heap_caps.h"
+#include "esp_rom_sys.h"
+#include "freertos/task.h"
+#include "hal/uart_ll.h"
+#include "soc/soc_caps.h"
+#include "deferred_log.hpp"
+
+namespace serial {
+
+namespace {
+
+// GDMA moves whole words out of internal RAM
+constexpr size_t DMA_ALIGNMENT = 4;
+constexpr size_t DMA_BURST_SIZE = 32;
+
+// start, parity and two stop bits bound the time of one character
+constexpr uint32_t MAX_CHARACTER_BITS = 12;
+// a FIFO that drains within this is spun on, a slower one slept on
+constexpr uint32_t FIFO_SPIN_US = 1000;
+constexpr uint32_t FIFO_POLL_US = 10;
+
+void release_block(std::atomic<uint32_t>& mask, size_t index) {
+  mask.fetch_or(1u << index, std::memory_order_release);
+}
+
+}  // namespace
+
+esp_err_t UartDma::init(const uart_dma_config_t& config) {
+  if (controller_ != nullptr) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  static_assert(RX_BLOCK_SIZE % DMA_ALIGNMENT == 0);
+  static_assert(TX_BLOCK_SIZE % DMA_ALIGNMENT == 0);
+
+  port_ = config.port;
+
+  uart_config_t uart_config{};
+  uart_config.baud_rate = static_cast<int>(config.baud_rate);
+  uart_config.data_bits = UART_DATA_8_BITS;
+  uart_config.parity = UART_PARITY_DISABLE;
+  uart_config.stop_bits = UART_STOP_BITS_1;
+  uart_config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  uart_config.source_clk = UART_SCLK_DEFAULT;
+
+  esp_err_t ret = uart_param_config(port_, &uart_config);
+  if (ret == ESP_OK) {
+    ret = uart_set_pin(port_, config.tx_pin, config.rx_pin, UART_PIN_NO_CHANGE,
+                       UART_PIN_NO_CHANGE);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to configure UART%d: %s", port_,
+             esp_err_to_name(ret));
+    return ret;
+  }
+
+  uint32_t caps = MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL;
+  rx_blocks_ = static_cast<uint8_t*>(
+      heap_caps_aligned_alloc(DMA_ALIGNMENT, RX_BLOCKS * RX_BLOCK_SIZE, caps));
+  tx_blocks_ = static_cast<uint8_t*>(
+      heap_caps_aligned_alloc(DMA_ALIGNMENT, TX_BLOCKS * TX_BLOCK_SIZE, caps));
+  rx_ready_ = xSemaphoreCreateBinary();
+  if (rx_blocks_ == nullptr || tx_blocks_ == nullptr || rx_ready_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to allocate DMA blocks");
+    return ESP_ERR_NO_MEM;
+  }
+
+  uhci_controller_config_t uhci_config{};
+  uhci_config.uart_port = port_;
+  uhci_config.tx_trans_queue_depth = TX_BLOCKS;
+  uhci_config.max_transmit_size = TX_BLOCK_SIZE;
+  uhci_config.max_receive_internal_mem = RX_BLOCK_SIZE;
+  uhci_config.dma_burst_size = DMA_BURST_SIZE;
+  // a line going quiet ends a chunk, so short bursts are not held back
+  uhci_config.rx_eof_flags.idle_eof = 1;
+
+  ret = uhci_new_controller(&uhci_config, &controller_);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to create UHCI controller: %s",
+             esp_err_to_name(ret));
+    controller_ = nullptr;
+    return ret;
+  }
+
+  uhci_event_callbacks_t callbacks{};
+  callbacks.on_rx_trans_event = rx_callback;
+  callbacks.on_tx_trans_done = tx_callback;
+  ret = uhci_register_event_callbacks(controller_, &callbacks, this);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to register UHCI callbacks: %s",
+             esp_err_to_name(ret));
+    return ret;
+  }
+
+  tx_free_.store(TX_BLOCKS == 32 ? ~0u : (1u << TX_BLOCKS) - 1,
+                 std::memory_order_release);
+
+  rx_busy_.store(1, std::memory_order_relaxed);
+  armed_.store(0, std::memory_order_release);
+  ret = uhci_receive(controller_, rx_blocks_, RX_BLOCK_SIZE);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start reception: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  ESP_LOGI(TAG, "UART%d on DMA, %zu x %zu byte RX blocks, %zu x %zu TX",
+           port_, RX_BLOCKS, RX_BLOCK_SIZE, TX_BLOCKS, TX_BLOCK_SIZE);
+  return ESP_OK;
+}
+
+bool UartDma::receive(rx_chunk_t& chunk, TickType_t timeout) {
+  while (true) {
+    if (rx_purge_.exchange(false, std::memory_order_acq_rel)) {
+      drop_chunks();
+    }
+    // the EOF callback found no free block, one may be free since
+    if (rx_stalled_.load(std::memory_order_acquire)) {
+      arm_next(false);
+    }
+
+    if (chunks_.try_pop(chunk)) {
+      return true;
+    }
+    if (woken_.exchange(false, std::memory_order_acq_rel)) {
+      return false;
+    }
+
+    if (xSemaphoreTake(rx_ready_, timeout) != pdTRUE) {
+      return false;
+    }
+  }
+}
+
+void UartDma::release(const rx_chunk_t& chunk) {
+  if (!chunk.last) {
+    return;
+  }
+
+  rx_busy_.fetch_and(~(1u << chunk.block), std::memory_order_release);
+  if (rx_stalled_.load(std::memory_order_acquire)) {
+    arm_next(false);
+  }
+}
+
+uint8_t* UartDma::acquire_tx() {
+  uint32_t free = tx_free_.load(std::memory_order_acquire);
+
+  while (free != 0) {
+    uint32_t lowest = free & (~free + 1);
+    if (tx_free_.compare_exchange_weak(free, free & ~lowest,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+      return tx_blocks_ + std::countr_zero(lowest) * TX_BLOCK_SIZE;
+    }
+  }
+
+  return nullptr;
+}
+
+esp_err_t UartDma::transmit(uint8_t* block, size_t length) {
+  size_t index = (block - tx_blocks_) / TX_BLOCK_SIZE;
+
+  if (length == 0) {
+    release_block(tx_free_, index);
+    return ESP_OK;
+  }
+
+  esp_err_t ret = uhci_transmit(controller_, block, length);
+  if (ret != ESP_OK) {
+    FLOG_W(SERIAL, TAG, "Failed to queue %zu bytes: %s", length,
+           esp_err_to_name(ret));
+    release_block(tx_free_, index);
+  }
+  return ret;
+}
+
+esp_err_t UartDma::set_baud_rate(uint32_t baud_rate) {
+  esp_err_t ret = uart_set_baudrate(port_, baud_rate);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to set %lu baud: %s",
+             static_cast<unsigned long>(baud_rate), esp_err_to_name(ret));
+  }
+  return ret;
+}
+
+esp_err_t UartDma::set_format(uart_word_length_t data_bits,
+                              uart_parity_t parity,
+                              uart_stop_bits_t stop_bits) {
+  esp_err_t ret = uart_set_word_length(port_, data_bits);
+  if (ret == ESP_OK) {
+    ret = uart_set_parity(port_, parity);
+  }
+  if (ret == ESP_OK) {
+    ret = uart_set_stop_bits(port_, stop_bits);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to set line format: %s", esp_err_to_name(ret));
+  }
+  return ret;
+}
+
+uint32_t UartDma::baud_rate() const {
+  uint32_t baud_rate = 0;
+  uart_get_baudrate(port_, &baud_rate);
+  return baud_rate;
+}
+
+esp_err_t UartDma::wait_tx_done(TickType_t timeout) {
+  esp_err_t ret = uhci_wait_all_tx_transaction_done(
+      controller_, static_cast<int>(pdTICKS_TO_MS(timeout)));
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  // the DMA is done once the FIFO holds the tail, which still has to shift
+  // out at the current rate: under a millisecond at fast rates, seconds at
+  // 300 baud, so only the short case is spun on
+  uint32_t baud_rate = std::max<uint32_t>(this->baud_rate(), 1);
+  uint32_t budget_us = static_cast<uint32_t>(
+      uint64_t{SOC_UART_FIFO_LEN} * MAX_CHARACTER_BITS * 1000000 / baud_rate);
+  uart_dev_t* hw = UART_LL_GET_HW(port_);
+
+  if (budget_us <= FIFO_SPIN_US) {
+    for (uint32_t waited = 0; !uart_ll_is_tx_idle(hw);
+         waited += FIFO_POLL_US) {
+      if (waited > budget_us) {
+        return ESP_ERR_TIMEOUT;
+      }
+      esp_rom_delay_us(FIFO_POLL_US);
+    }
+    return ESP_OK;
+  }
+
+  // a tick on top, the first delay may end right away
+  TickType_t budget = pdMS_TO_TICKS(budget_us / 1000) + 2;
+  for (TickType_t waited = 0; !uart_ll_is_tx_idle(hw); waited++) {
+    if (waited > budget) {
+      return ESP_ERR_TIMEOUT;
+    }
+    vTaskDelay(1);
+  }
+  return ESP_OK;
+}
+
+void UartDma::purge_rx() {
+  rx_purge_.store(true, std::memory_order_release);
+  xSemaphoreGive(rx_ready_);
+}
+
+void UartDma::wake_receiver() {
+  woken_.store(true, std::memory_order_release);
+  xSemaphoreGive(rx_ready_);
+}
+
+size_t UartDma::overruns() const {
+  return overruns_.load(std::memory_order_relaxed);
+}
+
+size_t UartDma::rx_blocks_busy() const {
+  return std::popcount(rx_busy_.load(std::memory_order_relaxed));
+}
+
+void UartDma::arm_next(bool from_isr) {
+  // the callback and the consumer may both find reception stalled, only
+  // the one that takes the stall arms the next block
+  bool stalled = true;
+  if (!rx_stalled_.compare_exchange_strong(stalled, false,
+                                           std::memory_order_acq_rel)) {
+    return;
+  }
+
+  size_t next = (armed_.load(std::memory_order_relaxed) + 1) % RX_BLOCKS;
+  uint32_t bit = 1u << next;
+
+  // the consumer is a whole ring behind; the UART FIFO overflows until it
+  // releases a block, counted once per stall
+  if (rx_busy_.load(std::memory_order_acquire) & bit) {
+    if (from_isr) {
+      overruns_.fetch_add(1, std::memory_order_relaxed);
+    }
+    rx_stalled_.store(true, std::memory_order_release);
+    return;
+  }
+
+  rx_busy_.fetch_or(bit, std::memory_order_acq_rel);
+  armed_.store(next, std::memory_order_release);
+
+  uint8_t* block = rx_blocks_ + next * RX_BLOCK_SIZE;
+  esp_err_t ret = uhci_receive(controller_, block, RX_BLOCK_SIZE);
+  if (ret != ESP_OK) {
+    if (!from_isr) {
+      FLOG_E(SERIAL, TAG, "Failed to rearm reception: %s",
+             esp_err_to_name(ret));
+    }
+    rx_busy_.fetch_and(~bit, std::memory_order_release);
+    rx_stalled_.store(true, std::memory_order_release);
+  }
+}
+
+void UartDma::drop_chunks() {
+  // the ring may wrap, so it takes up to two regions
+  for (auto region = chunks_.peek(); !region.empty(); region = chunks_.peek()) {
+    for (const rx_chunk_t& chunk : region) {
+      if (chunk.last) {
+        rx_busy_.fetch_and(~(1u << chunk.block), std::memory_order_release);
+      }
+    }
+    chunks_.consume(region.size());
+  }
+}
+
+bool UartDma::on_rx(const uhci_rx_event_data_t* event) {
+  size_t block = armed_.load(std::memory_order_relaxed);
+  bool last = event->flags.totally_received;
+
+  if (event->recv_size > 0 || last) {
+    bool queued = chunks_.try_push(rx_chunk_t{
+        .data = event->data,
+        .length = event->recv_size,
+        .block = static_cast<uint8_t>(block),
+        .last = last,
+    });
+    if (!queued) {
+      overruns_.fetch_add(1, std::memory_order_relaxed);
+      // the block would otherwise never be released again
+      if (last) {
+        rx_busy_.fetch_and(~(1u << block), std::memory_order_release);
+      }
+    }
+  }
+
+  // the next block is armed right away, so the FIFO alone only has to
+  // cover this callback and not the consumer's scheduling latency
+  if (last) {
+    rx_stalled_.store(true, std::memory_order_release);
+    arm_next(true);
+  }
+
+  BaseType_t woken = pdFALSE;
+  xSemaphoreGiveFromISR(rx_ready_, &woken);
+  return woken == pdTRUE;
+}
+
+bool UartDma::on_tx_done(const uhci_tx_done_event_data_t* event) {
+  size_t index =
+      (static_cast<uint8_t*>(event->buffer) - tx_blocks_) / TX_BLOCK_SIZE;
+  release_block(tx_free_, index);
+  return false;
+}
+
+UartDma::~UartDma() {
+  if (controller_ != nullptr) {
+    uhci_del_controller(controller_);
+  }
+  heap_caps_free(rx_blocks_);
+  heap_caps_free(tx_blocks_);
+  if (rx_ready_ != nullptr) {
+    vSemaphoreDelete(rx_ready_);
+  }
+}
+
+}  // namespace serial
@@ -0,0 +1,398 @@
+#include "urb_engine.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include "deferred_log.hpp"
+#include "metrics.hpp"
+#include "tcp_server_unit.hpp"
+#include "usbip_wire.hpp"
+
+namespace usbip {
+
+UrbEngine::UrbEngine(UrbBackend& backend) : backend_(backend) {}
+
+esp_err_t UrbEngine::attach(int socket) {
+  int expected = -1;
+  if (!socket_.compare_exchange_strong(expected, socket,
+                                       std::memory_order_acq_rel)) {
+    ESP_LOGW(TAG, "Device is already attached to socket %d", expected);
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  ESP_LOGI(TAG, "Attached to socket %d", socket);
+  return ESP_OK;
+}
+
+void UrbEngine::detach() {
+  if (socket_.exchange(-1, std::memory_order_acq_rel) < 0) {
+    return;
+  }
+
+  // everything still in flight completes silently once the backend cancels it
+  urb_t pending[MAX_IN_FLIGHT];
+  size_t count = 0;
+  {
+    std::lock_guard<std::mutex> lock(table_mutex_);
+    in_flight_.for_each([&](uint32_t seq_num, urb_t& urb) {
+      urb.unlinked = true;
+      pending[count++] = urb;
+    });
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (pending[i].transfer != nullptr) {
+      backend_.unlink(pending[i]);
+    }
+  }
+
+  // replies queued for the old socket must not reach the next client
+  {
+    std::lock_guard<std::mutex> lock(tx_mutex_);
+    batch_.count = 0;
+    batch_.vector_count = 0;
+  }
+
+  ESP_LOGI(TAG, "Detached, %zu URBs cancelled", count);
+}
+
+bool UrbEngine::is_attached() const {
+  return socket_.load(std::memory_order_acquire) >= 0;
+}
+
+size_t UrbEngine::handle(std::span<const uint8_t> data, bool& deferred) {
+  size_t consumed = 0;
+  deferred = false;
+
+  while (data.size() - consumed >= HEADER_SIZE) {
+    std::span<const uint8_t> pending = data.subspan(consumed);
+
+    // CMD_SUBMIT and CMD_UNLINK share the header size, so one decode serves
+    cmd_submit_t command;
+    wire::decode(pending.data(), command);
+
+    size_t size = frame_size(command);
+    if (size == PROTOCOL_ERROR) {
+      return PROTOCOL_ERROR;
+    }
+
+    if (pending.size() < size) {
+      break;
+    }
+
+    std::span<const uint8_t> frame = pending.first(size);
+    if (command.header.command == CMD_SUBMIT) {
+      submit_t result = handle_submit(command, frame);
+      if (result == submit_t::REJECTED) {
+        return PROTOCOL_ERROR;
+      }
+      if (result == submit_t::DEFERRED) {
+        deferred = true;
+        break;
+      }
+    } else {
+      handle_unlink(frame);
+    }
+
+    consumed += size;
+  }
+
+  // error replies, RET_UNLINKs and locally completed control requests
+  flush();
+  return consumed;
+}
+
+void UrbEngine::complete(uint32_t seq_num,
+                         const urb_completion_t& completion) {
+  urb_t urb;
+  {
+    std::lock_guard<std::mutex> lock(table_mutex_);
+    urb_t* entry = in_flight_.find(seq_num);
+    if (entry == nullptr) {
+      FLOG_W(USBIP, TAG, "Completion for unknown seq_num %lu",
+             static_cast<unsigned long>(seq_num));
+      return;
+    }
+    urb = *entry;
+    in_flight_.erase(seq_num);
+  }
+
+  metrics::observe(metrics::HIST_URB, urb.started);
+  if (completion.status != 0) {
+    metrics::count(metrics::URB_ERRORS);
+  }
+  if (urb.unlinked) {
+    return;
+  }
+
+  queue_ret_submit(urb, completion);
+}
+
+void UrbEngine::flush() {
+  std::lock_guard<std::mutex> lock(tx_mutex_);
+  flush_locked();
+}
+
+size_t UrbEngine::in_flight() const {
+  std::lock_guard<std::mutex> lock(table_mutex_);
+  return in_flight_.size();
+}
+
+size_t UrbEngine::frame_size(const cmd_submit_t& command) const {
+  switch (command.header.command) {
+    case CMD_UNLINK:
+      return sizeof(cmd_unlink_t);
+
+    case CMD_SUBMIT: {
+      // both counts come off the wire, bound them before doing any sums
+      bool iso = command.number_of_packets != NON_ISO_PACKETS;
+      if (iso && command.number_of_packets >
+                     CONFIG_FLUIDITY_USBIP_ISO_MAX_PACKETS) {
+        FLOG_E(USBIP, TAG, "CMD_SUBMIT with %lu ISO packets",
+               static_cast<unsigned long>(command.number_of_packets));
+        return PROTOCOL_ERROR;
+      }
+      size_t payload = command.header.direction == OUT
+                           ? command.transfer_buffer_length
+                           : 0;
+      if (payload > CONFIG_FLUIDITY_USBIP_RX_BUFFER_SIZE) {
+        FLOG_E(USBIP, TAG, "CMD_SUBMIT of %zu bytes exceeds receive buffer",
+               payload);
+        return PROTOCOL_ERROR;
+      }
+
+      size_t size = HEADER_SIZE + payload;
+      if (iso) {
+        size += static_cast<size_t>(command.number_of_packets) *
+                sizeof(iso_packet_descriptor_t);
+      }
+
+      // a frame must fit the receive buffer, or it can never be consumed
+      if (size > CONFIG_FLUIDITY_USBIP_RX_BUFFER_SIZE) {
+        FLOG_E(USBIP, TAG, "CMD_SUBMIT of %zu bytes exceeds receive buffer",
+               size);
+        return PROTOCOL_ERROR;
+      }
+      return size;
+    }
+
+    default:
+      FLOG_E(USBIP, TAG, "Unexpected command 0x%08lx",
+             static_cast<unsigned long>(command.header.command));
+      return PROTOCOL_ERROR;
+  }
+}
+
+UrbEngine::submit_t UrbEngine::handle_submit(const cmd_submit_t& command,
+                                             std::span<const uint8_t> frame) {
+  urb_t urb{};
+  urb.seq_num = command.header.seq_num;
+  urb.device_id = command.header.device_id;
+  urb.direction = command.header.direction;
+  urb.endpoint = command.header.endpoint;
+  urb.transfer_flags = command.transfer_flags;
+  urb.transfer_buffer_length = command.transfer_buffer_length;
+  urb.start_frame = command.start_frame;
+  urb.number_of_packets = command.number_of_packets;
+  urb.interval = command.interval;
+  memcpy(urb.setup, &command.setup, sizeof(urb.setup));
+  urb.started = metrics::now();
+
+  bool duplicate = false;
+  {
+    std::lock_guard<std::mutex> lock(table_mutex_);
+    if (in_flight_.full()) {
+      return submit_t::DEFERRED;
+    }
+
+    urb_t* entry = in_flight_.insert(urb.seq_num);
+    if (entry != nullptr) {
+      *entry = urb;
+      metrics::level(metrics::GAUGE_URBS_IN_FLIGHT, in_flight_.size());
+    } else {
+      duplicate = true;
+    }
+  }
+
+  // any reply under this seq_num would be matched to the URB in flight
+  if (duplicate) {
+    FLOG_E(USBIP, TAG, "Duplicate seq_num %lu, dropping the client",
+           static_cast<unsigned long>(urb.seq_num));
+    return submit_t::REJECTED;
+  }
+
+  std::span<const uint8_t> out_data;
+  if (urb.direction == OUT) {
+    out_data = frame.subspan(HEADER_SIZE, urb.transfer_buffer_length);
+  }
+
+  // ISO descriptors trail the OUT payload, still in wire order
+  std::span<const uint8_t> iso_descriptors;
+  if (urb.number_of_packets != NON_ISO_PACKETS) {
+    iso_descriptors = frame.subspan(HEADER_SIZE + out_data.size());
+  }
+
+  metrics::count(metrics::URB_SUBMITS);
+  // the backend may complete the URB before submit() even returns, so the
+  // table entry is looked up again instead of being held across the call
+  esp_err_t ret = backend_.submit(*this, urb, out_data, iso_descriptors);
+
+  if (ret == ESP_OK) {
+    bool unlinked = false;
+    {
+      std::lock_guard<std::mutex> lock(table_mutex_);
+      urb_t* entry = in_flight_.find(urb.seq_num);
+      if (entry != nullptr) {
+        entry->transfer = urb.transfer;
+        unlinked = entry->unlinked;
+      }
+    }
+
+    // a CMD_UNLINK raced with the submission and found no transfer yet
+    if (unlinked) {
+      backend_.unlink(urb);
+    }
+    return submit_t::ACCEPTED;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(table_mutex_);
+    in_flight_.erase(urb.seq_num);
+  }
+
+  if (ret == ESP_ERR_NO_MEM) {
+    return submit_t::DEFERRED;
+  }
+
+  int32_t status = URB_STATUS_PROTO;
+  if (ret == ESP_ERR_INVALID_SIZE) {
+    status = URB_STATUS_NOMEM;
+  } else if (ret == ESP_ERR_INVALID_STATE || ret == ESP_ERR_NOT_FOUND) {
+    status = URB_STATUS_NODEV;
+  }
+
+  queue_ret_submit(urb, urb_completion_t{.status = status});
+  return submit_t::ACCEPTED;
+}
+
+void UrbEngine::handle_unlink(std::span<const uint8_t> frame) {
+  cmd_unlink_t command;
+  wire::decode(frame.data(), command);
+
+  uint32_t seq_num = command.header.seq_num;
+  uint32_t target = command.unlink_seqnum;
+
+  urb_t victim;
+  bool found = false;
+  {
+    std::lock_guard<std::mutex> lock(table_mutex_);
+    urb_t* entry = in_flight_.find(target);
+    if (entry != nullptr && !entry->unlinked) {
+      entry->unlinked = true;
+      victim = *entry;
+      found = true;
+    }
+  }
+
+  // already completed: its RET_SUBMIT is on the wire, report nothing to undo
+  if (!found) {
+    queue_ret_unlink(seq_num, URB_STATUS_OK);
+    return;
+  }
+
+  if (victim.transfer != nullptr) {
+    backend_.unlink(victim);
+  }
+  queue_ret_unlink(seq_num, URB_STATUS_CONNRESET);
+}
+
+void UrbEngine::queue_ret_submit(const urb_t& urb,
+                                 const urb_completion_t& completion) {
+  if (!is_attached()) {
+    return;
+  }
+
+  ret_submit_t reply{};
+  reply.header.command = RET_SUBMIT;
+  reply.header.seq_num = urb.seq_num;
+  reply.status = static_cast<uint32_t>(completion.status);
+  reply.actual_length = completion.actual_length;
+  reply.start_frame = urb.start_frame;
+  reply.number_of_packets = urb.number_of_packets;
+  // the host reads as many descriptors as announced; an error reply has none
+  if (urb.number_of_packets != NON_ISO_PACKETS) {
+    reply.number_of_packets =
+        completion.iso_descriptors.size() / sizeof(iso_packet_descriptor_t);
+  }
+  reply.error_count = completion.error_count;
+
+  size_t payload = 0;
+  if (urb.direction == IN) {
+    payload = std::min<size_t>(completion.actual_length,
+                               completion.data.size());
+  }
+
+  std::lock_guard<std::mutex> lock(tx_mutex_);
+  wire::encode(reply, reserve_header_locked());
+  push_vector_locked(completion.data.data(), payload);
+  push_vector_locked(completion.iso_descriptors.data(),
+                     completion.iso_descriptors.size());
+}
+
+void UrbEngine::queue_ret_unlink(uint32_t seq_num, int32_t status) {
+  if (!is_attached()) {
+    return;
+  }
+
+  ret_unlink_t reply{};
+  reply.header.command = RET_UNLINK;
+  reply.header.seq_num = seq_num;
+  reply.status = static_cast<uint32_t>(status);
+
+  std::lock_guard<std::mutex> lock(tx_mutex_);
+  wire::encode(reply, reserve_header_locked());
+}
+
+uint8_t* UrbEngine::reserve_header_locked() {
+  if (batch_.count == MAX_BATCH) {
+    flush_locked();
+  }
+
+  uint8_t* header = batch_.headers[batch_.count++];
+  push_vector_locked(header, HEADER_SIZE);
+  return header;
+}
+
+void UrbEngine::push_vector_locked(const void* data, size_t length) {
+  if (length == 0) {
+    return;
+  }
+
+  iovec& vector = batch_.vectors[batch_.vector_count++];
+  vector.iov_base = const_cast<void*>(data);
+  vector.iov_len = length;
+}
+
+void UrbEngine::flush_locked() {
+  if (batch_.count == 0) {
+    return;
+  }
+
+  int socket = socket_.load(std::memory_order_acquire);
+  if (socket >= 0 &&
+      server::TcpServerUnit::send_vectored(socket, batch_.vectors,
+                                           batch_.vector_count) != ESP_OK) {
+    FLOG_W(USBIP, TAG, "Failed to send %zu replies: errno %d", batch_.count,
+           errno);
+  }
+
+  batch_.count = 0;
+  batch_.vector_count = 0;
+}
+
+UrbEngine::~UrbEngine() {
+  detach();
+}
+
+}  // namespace usbip
@@ -0,0 +1,748 @@
+#include "usb_host_backend.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include "esp_intr_alloc.h"
+#include "deferred_log.hpp"
+#include "task_topology.hpp"
+#include "usbip_wire.hpp"
+
+namespace usbip {
+
+namespace {
+
+constexpr uint32_t URB_ZERO_PACKET = 0x0040;  // Linux URB transfer flag
+
+constexpr uint8_t REQUEST_CLEAR_FEATURE = 0x01;
+constexpr uint8_t REQUEST_SET_CONFIGURATION = 0x09;
+constexpr uint8_t REQUEST_SET_INTERFACE = 0x0b;
+
+constexpr uint8_t RECIPIENT_DEVICE = 0x00;
+constexpr uint8_t RECIPIENT_INTERFACE = 0x01;
+constexpr uint8_t RECIPIENT_ENDPOINT = 0x02;
+
+uint16_t setup_word(const uint8_t* setup, size_t offset) {
+  return setup[offset] | (setup[offset + 1] << 8);
+}
+
+}  // namespace
+
+UsbHostBackend& UsbHostBackend::get_instance() {
+  static UsbHostBackend instance;
+  return instance;
+}
+
+esp_err_t UsbHostBackend::init() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (initialized_.load(std::memory_order_acquire)) {
+    ESP_LOGI(TAG, "USB host is already initialized");
+    return ESP_OK;
+  }
+
+  usb_host_config_t host_config{};
+  host_config.skip_phy_setup = false;
+  host_config.intr_flags = ESP_INTR_FLAG_LEVEL1;
+
+  esp_err_t ret = usb_host_install(&host_config);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to install USB host: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  if (xTaskCreatePinnedToCore(daemon_task, "usb_daemon",
+                              topology::USB_HOST.stack_size, this,
+                              topology::USB_HOST.priority, nullptr,
+                              topology::USB_HOST.core_id) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create USB host daemon task");
+    return ESP_ERR_NO_MEM;
+  }
+
+  usb_host_client_config_t client_config{};
+  client_config.is_synchronous = false;
+  client_config.max_num_event_msg = 5;
+  client_config.async.client_event_callback = client_event_callback;
+  client_config.async.callback_arg = this;
+
+  ret = usb_host_client_register(&client_config, &client_);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to register USB host client: %s",
+             esp_err_to_name(ret));
+    return ret;
+  }
+
+  // every transfer the pipeline can ever have in flight is allocated here
+  for (auto& slot : slots_) {
+    ret = usb_host_transfer_alloc(CONFIG_FLUIDITY_USBIP_TRANSFER_SIZE, 0,
+                                  &slot.transfer);
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to allocate USB transfers: %s",
+               esp_err_to_name(ret));
+      return ret;
+    }
+    slot.busy = false;
+  }
+
+  if (xTaskCreatePinnedToCore(client_task, "usb_client",
+                              topology::USB_HOST.stack_size, this,
+                              topology::USB_HOST.priority, nullptr,
+                              topology::USB_HOST.core_id) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create USB host client task");
+    return ESP_ERR_NO_MEM;
+  }
+
+  initialized_.store(true, std::memory_order_release);
+  ESP_LOGI(TAG, "USB host initialized, %zu transfers of %d bytes",
+           slots_.size(), CONFIG_FLUIDITY_USBIP_TRANSFER_SIZE);
+  return ESP_OK;
+}
+
+bool UsbHostBackend::has_device() const {
+  return device_ready_.load(std::memory_order_acquire);
+}
+
+bool UsbHostBackend::get_device(exported_device_t& device) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!device_ready_.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  device = exported_;
+  return true;
+}
+
+uint32_t UsbHostBackend::generation() const {
+  return generation_.load(std::memory_order_acquire);
+}
+
+esp_err_t UsbHostBackend::submit(UrbEngine& engine,
+                                 urb_t& urb,
+                                 std::span<const uint8_t> out_data,
+                                 std::span<const uint8_t> iso_descriptors) {
+  if (!device_ready_.load(std::memory_order_acquire)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // device_id is (busnum << 16) | devnum
+  if ((urb.device_id & 0xffff) != exported_.address) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  uint8_t endpoint = urb.endpoint & 0x0f;
+  bool control = endpoint == 0;
+
+  if (control && intercept_control(engine, urb)) {
+    return ESP_OK;
+  }
+
+  uint8_t address = endpoint | (urb.direction == IN ? 0x80 : 0x00);
+  if (!control) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (find_iso_ring(address) != nullptr) {
+      lock.unlock();
+      return submit_iso(engine, urb, address, out_data, iso_descriptors);
+    }
+  }
+
+  // IN transfers on the host library must span whole packets
+  size_t offset = control ? SETUP_SIZE : 0;
+  size_t num_bytes = urb.transfer_buffer_length;
+  if (!control && urb.direction == IN) {
+    uint16_t max_packet = max_packet_size_[IN][endpoint];
+    if (max_packet > 0) {
+      num_bytes = (num_bytes + max_packet - 1) / max_packet * max_packet;
+    }
+  }
+
+  if (offset + num_bytes > CONFIG_FLUIDITY_USBIP_TRANSFER_SIZE) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  transfer_slot_t* slot = acquire_slot();
+  if (slot == nullptr) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  usb_transfer_t* transfer = slot->transfer;
+  if (control) {
+    memcpy(transfer->data_buffer, urb.setup, SETUP_SIZE);
+  }
+  if (!out_data.empty()) {
+    memcpy(transfer->data_buffer + offset, out_data.data(), out_data.size());
+  }
+
+  transfer->num_bytes = offset + num_bytes;
+  transfer->bEndpointAddress = control ? 0 : address;
+  transfer->flags =
+      (urb.transfer_flags & URB_ZERO_PACKET) ? USB_TRANSFER_FLAG_ZERO_PACK : 0;
+  slot->packet_count = 0;
+
+  return queue_transfer(engine, urb, *slot, control);
+}
+
+esp_err_t UsbHostBackend::unlink(urb_t& urb) {
+  auto* slot = static_cast<transfer_slot_t*>(urb.transfer);
+
+  uint8_t address;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // the slot may already have been recycled for another URB
+    if (slot == nullptr || !slot->busy || slot->seq_num != urb.seq_num) {
+      return ESP_ERR_NOT_FOUND;
+    }
+    address = slot->transfer->bEndpointAddress;
+
+    // the default pipe cannot be halted
+    if ((address & 0x0f) == 0) {
+      return ESP_ERR_NOT_SUPPORTED;
+    }
+    slot->unlinked = true;
+  }
+
+  // the host library cancels per endpoint; finish() puts the URBs that were
+  // only caught up in it back on the endpoint
+  usb_host_endpoint_halt(device_, address);
+  usb_host_endpoint_flush(device_, address);
+  usb_host_endpoint_clear(device_, address);
+  return ESP_OK;
+}
+
+void UsbHostBackend::open_device(uint8_t address) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (device_ != nullptr) {
+    ESP_LOGW(TAG, "Only one device is exported, ignoring address %u", address);
+    return;
+  }
+
+  esp_err_t ret = usb_host_device_open(client_, address, &device_);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to open device: %s", esp_err_to_name(ret));
+    device_ = nullptr;
+    return;
+  }
+
+  usb_device_info_t info;
+  const usb_device_desc_t* device_descriptor = nullptr;
+  const usb_config_desc_t* config_descriptor = nullptr;
+
+  if (usb_host_device_info(device_, &info) != ESP_OK ||
+      usb_host_get_device_descriptor(device_, &device_descriptor) != ESP_OK ||
+      usb_host_get_active_config_descriptor(device_, &config_descriptor) !=
+          ESP_OK) {
+    ESP_LOGE(TAG, "Failed to read descriptors of device %u", address);
+    usb_host_device_close(client_, device_);
+    device_ = nullptr;
+    return;
+  }
+
+  exported_ = exported_device_t{};
+  exported_.address = info.dev_addr;
+  exported_.speed = info.speed;
+  exported_.descriptor = *device_descriptor;
+  exported_.configuration_value = config_descriptor->bConfigurationValue;
+
+  claim_interfaces(config_descriptor);
+
+  device_ready_.store(true, std::memory_order_release);
+  generation_.fetch_add(1, std::memory_order_release);
+  ESP_LOGI(TAG, "Exporting device %04x:%04x at address %u with %u interfaces",
+           exported_.descriptor.idVendor, exported_.descriptor.idProduct,
+           exported_.address, exported_.interface_count);
+}
+
+void UsbHostBackend::close_device() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (device_ == nullptr) {
+    return;
+  }
+
+  device_ready_.store(false, std::memory_order_release);
+  generation_.fetch_add(1, std::memory_order_release);
+
+  // pending transfers complete with USB_TRANSFER_STATUS_NO_DEVICE
+  for (uint8_t i = 0; i < exported_.interface_count; i++) {
+    usb_host_interface_release(client_, device_, i);
+  }
+
+  usb_host_device_close(client_, device_);
+  device_ = nullptr;
+  memset(max_packet_size_, 0, sizeof(max_packet_size_));
+
+  // the transfers stay allocated for the next device with the same shape
+  for (auto& ring : iso_rings_) {
+    ring.address = 0;
+    ring.packet_bytes = 0;
+  }
+  ESP_LOGI(TAG, "Device at address %u is gone", exported_.address);
+}
+
+void UsbHostBackend::claim_interfaces(const usb_config_desc_t* config) {
+  uint8_t count = std::min<uint8_t>(config->bNumInterfaces,
+                                    CONFIG_FLUIDITY_USBIP_MAX_INTERFACES);
+  if (config->bNumInterfaces > count) {
+    ESP_LOGW(TAG, "Only %u of %u interfaces are exported", count,
+             config->bNumInterfaces);
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    int offset = 0;
+    const usb_intf_desc_t* interface =
+        usb_parse_interface_descriptor(config, i, 0, &offset);
+    if (interface == nullptr) {
+      continue;
+    }
+
+    device_interface_t& exported = exported_.interfaces[i];
+    exported.interface_class = interface->bInterfaceClass;
+    exported.interface_subclass = interface->bInterfaceSubClass;
+    exported.interface_protocol = interface->bInterfaceProtocol;
+
+    scan_endpoints(config, interface, offset);
+
+    // isochronous endpoints usually only appear in the non-zero alternates
+    for (uint8_t alternate = 1;; alternate++) {
+      int alternate_offset = 0;
+      const usb_intf_desc_t* setting = usb_parse_interface_descriptor(
+          config, i, alternate, &alternate_offset);
+      if (setting == nullptr) {
+        break;
+      }
+      scan_endpoints(config, setting, alternate_offset);
+    }
+
+    esp_err_t ret = usb_host_interface_claim(client_, device_, i, 0);
+    if (ret != ESP_OK) {
+      ESP_LOGW(TAG, "Failed to claim interface %u: %s", i,
+               esp_err_to_name(ret));
+    }
+  }
+
+  exported_.interface_count = count;
+}
+
+void UsbHostBackend::scan_endpoints(const usb_config_desc_t* config,
+                                    const usb_intf_desc_t* interface,
+                                    int offset) {
+  for (int e = 0; e < interface->bNumEndpoints; e++) {
+    int endpoint_offset = offset;
+    const usb_ep_desc_t* endpoint = usb_parse_endpoint_descriptor_by_index(
+        interface, e, config->wTotalLength, &endpoint_offset);
+    if (endpoint == nullptr) {
+      continue;
+    }
+
+    uint8_t address = endpoint->bEndpointAddress;
+    uint8_t direction = (address & USB_B_ENDPOINT_ADDRESS_EP_DIR_MASK) ? IN
+                                                                       : OUT;
+    uint16_t max_packet = endpoint->wMaxPacketSize & 0x7ff;
+
+    // the default alternate setting is scanned first and wins
+    uint16_t& packet_size = max_packet_size_[direction][address & 0x0f];
+    if (packet_size == 0) {
+      packet_size = max_packet;
+    }
+
+    if ((endpoint->bmAttributes & USB_BM_ATTRIBUTES_XFERTYPE_MASK) ==
+        USB_BM_ATTRIBUTES_XFER_ISOC) {
+      // high-bandwidth endpoints move up to three packets per microframe
+      size_t transactions = 1 + ((endpoint->wMaxPacketSize >> 11) & 0x3);
+      register_iso_endpoint(address, max_packet * transactions);
+    }
+  }
+}
+
+void UsbHostBackend::register_iso_endpoint(uint8_t address,
+                                           size_t packet_bytes) {
+  iso_ring_t* ring = find_iso_ring(address);
+  if (ring == nullptr) {
+    ring = find_iso_ring(0);
+  }
+
+  if (ring == nullptr) {
+    ESP_LOGW(TAG, "No ISO ring left for endpoint 0x%02x", address);
+    return;
+  }
+
+  ring->address = address;
+  ring->packet_bytes = std::max(ring->packet_bytes, packet_bytes);
+}
+
+UsbHostBackend::transfer_slot_t* UsbHostBackend::acquire_slot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto& slot : slots_) {
+    if (!slot.busy) {
+      slot.busy = true;
+      return &slot;
+    }
+  }
+
+  return nullptr;
+}
+
+void UsbHostBackend::release_slot(transfer_slot_t& slot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  slot.engine = nullptr;
+  slot.busy = false;
+}
+
+esp_err_t UsbHostBackend::queue_transfer(UrbEngine& engine,
+                                         urb_t& urb,
+                                         transfer_slot_t& slot,
+                                         bool control) {
+  usb_transfer_t* transfer = slot.transfer;
+  transfer->device_handle = device_;
+  transfer->timeout_ms = 0;
+  transfer->callback = transfer_callback;
+  transfer->context = &slot;
+
+  slot.engine = &engine;
+  slot.seq_num = urb.seq_num;
+  slot.direction = urb.direction;
+  slot.length = urb.transfer_buffer_length;
+  slot.unlinked = false;
+  urb.transfer = &slot;
+
+  esp_err_t ret = control ? usb_host_transfer_submit_control(client_, transfer)
+                          : usb_host_transfer_submit(transfer);
+  if (ret != ESP_OK) {
+    FLOG_W(USBIP, TAG, "Failed to submit transfer: %s",
+           esp_err_to_name(ret));
+    urb.transfer = nullptr;
+    release_slot(slot);
+    // out of host library resources is not the engine's backpressure case
+    return ret == ESP_ERR_NO_MEM ? ESP_FAIL : ret;
+  }
+
+  return ESP_OK;
+}
+
+UsbHostBackend::iso_ring_t* UsbHostBackend::find_iso_ring(uint8_t address) {
+  for (auto& ring : iso_rings_) {
+    if (ring.address == address) {
+      return &ring;
+    }
+  }
+  return nullptr;
+}
+
+esp_err_t UsbHostBackend::shape_iso_ring(iso_ring_t& ring,
+                                         size_t packet_count) {
+  size_t buffer_size =
+      std::min(packet_count * ring.packet_bytes, ISO_BUFFER_SIZE);
+  if (ring.packet_count == packet_count && ring.buffer_size == buffer_size) {
+    return ESP_OK;
+  }
+
+  // a transfer's packet count is fixed at allocation, so the ring can only
+  // be reshaped once the endpoint has drained
+  for (const auto& slot : ring.slots) {
+    if (slot.busy) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  ring.packet_count = 0;
+  ring.buffer_size = 0;
+  ring.next = 0;
+
+  for (size_t i = 0; i < ISO_RING_DEPTH; i++) {
+    transfer_slot_t& slot = ring.slots[i];
+    usb_host_transfer_free(slot.transfer);
+    slot.transfer = nullptr;
+
+    esp_err_t ret =
+        usb_host_transfer_alloc(buffer_size, packet_count, &slot.transfer);
+    if (ret != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to allocate ISO transfers of %zu bytes: %s",
+               buffer_size, esp_err_to_name(ret));
+      slot.transfer = nullptr;
+      return ESP_ERR_INVALID_SIZE;
+    }
+    slot.iso = ring.descriptors[i];
+  }
+
+  ring.packet_count = packet_count;
+  ring.buffer_size = buffer_size;
+  ESP_LOGI(TAG, "ISO endpoint 0x%02x: %zu transfers of %zu packets",
+           ring.address, ISO_RING_DEPTH, packet_count);
+  return ESP_OK;
+}
+
+esp_err_t UsbHostBackend::submit_iso(UrbEngine& engine,
+                                     urb_t& urb,
+                                     uint8_t address,
+                                     std::span<const uint8_t> out_data,
+                                     std::span<const uint8_t> iso_descriptors) {
+  size_t packets = urb.number_of_packets;
+  if (packets == 0 || packets == NON_ISO_PACKETS ||
+      iso_descriptors.size() < packets * sizeof(iso_packet_descriptor_t)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (packets > ISO_MAX_PACKETS) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  transfer_slot_t* slot = nullptr;
+  size_t packet_bytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    iso_ring_t* ring = find_iso_ring(address);
+    if (ring == nullptr) {
+      return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t ret = shape_iso_ring(*ring, packets);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+
+    slot = &ring->slots[ring->next];
+    if (slot->busy) {
+      return ESP_ERR_NO_MEM;
+    }
+    slot->busy = true;
+    ring->next = (ring->next + 1) % ISO_RING_DEPTH;
+    packet_bytes = ring->packet_bytes;
+  }
+
+  // the host library lays packets out back to back, whatever offsets the
+  // driver used, so OUT payload is packed while it is copied in
+  usb_transfer_t* transfer = slot->transfer;
+  size_t total = 0;
+  for (size_t i = 0; i < packets; i++) {
+    iso_packet_descriptor_t& descriptor = slot->iso[i];
+    wire::decode(iso_descriptors.data() + i * sizeof(descriptor), descriptor);
+
+    if (descriptor.length > packet_bytes ||
+        total + descriptor.length > transfer->data_buffer_size) {
+      release_slot(*slot);
+      return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (urb.direction == OUT) {
+      if (static_cast<size_t>(descriptor.offset) + descriptor.length >
+          out_data.size()) {
+        release_slot(*slot);
+        return ESP_ERR_INVALID_ARG;
+      }
+      memcpy(transfer->data_buffer + total,
+             out_data.data() + descriptor.offset, descriptor.length);
+    }
+
+    transfer->isoc_packet_desc[i].num_bytes = descriptor.length;
+    total += descriptor.length;
+  }
+
+  transfer->num_bytes = total;
+  transfer->bEndpointAddress = address;
+  transfer->flags = 0;
+  slot->packet_count = packets;
+
+  return queue_transfer(engine, urb, *slot, false);
+}
+
+bool UsbHostBackend::intercept_control(UrbEngine& engine, const urb_t& urb) {
+  uint8_t request_type = urb.setup[0];
+  uint8_t request = urb.setup[1];
+  uint16_t value = setup_word(urb.setup, 2);
+  uint16_t index = setup_word(urb.setup, 4);
+
+  // the host library owns the configuration, it only has to match
+  if (request_type == RECIPIENT_DEVICE &&
+      request == REQUEST_SET_CONFIGURATION) {
+    int32_t status = URB_STATUS_OK;
+    if (value != exported_.configuration_value) {
+      ESP_LOGW(TAG, "Refusing to switch to configuration %u", value);
+      status = URB_STATUS_PIPE;
+    }
+    engine.complete(urb.seq_num, urb_completion_t{.status = status});
+    return true;
+  }
+
+  // rebind the host pipes to the new alternate setting, then let the
+  // request itself through to the device
+  if (request_type == RECIPIENT_INTERFACE &&
+      request == REQUEST_SET_INTERFACE) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    usb_host_interface_release(client_, device_, index);
+    esp_err_t ret = usb_host_interface_claim(client_, device_, index, value);
+    if (ret != ESP_OK) {
+      ESP_LOGW(TAG, "Failed to select alternate setting %u of interface %u",
+               value, index);
+      engine.complete(urb.seq_num,
+                      urb_completion_t{.status = URB_STATUS_PIPE});
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void UsbHostBackend::finish(usb_transfer_t* transfer) {
+  auto* slot = static_cast<transfer_slot_t*>(transfer->context);
+  int32_t status = to_urb_status(transfer->status);
+
+  if (status == URB_STATUS_CONNRESET && requeue(*slot)) {
+    return;
+  }
+  configASSERT(completed_count_ < completed_.size());
+
+  if (slot->packet_count > 0) {
+    urb_completion_t completion{.status = status};
+    finish_iso(*slot, completion);
+    slot->engine->complete(slot->seq_num, completion);
+    completed_[completed_count_++] = slot;
+    return;
+  }
+
+  bool control = transfer->bEndpointAddress == 0;
+  size_t offset = control ? SETUP_SIZE : 0;
+
+  size_t actual = transfer->actual_num_bytes > static_cast<int>(offset)
+                      ? transfer->actual_num_bytes - offset
+                      : 0;
+  actual = std::min<size_t>(actual, slot->length);
+
+  // a successful CLEAR_FEATURE(ENDPOINT_HALT) also resets the host pipe
+  const uint8_t* setup = transfer->data_buffer;
+  if (control && status == URB_STATUS_OK && setup[0] == RECIPIENT_ENDPOINT &&
+      setup[1] == REQUEST_CLEAR_FEATURE && setup_word(setup, 2) == 0) {
+    usb_host_endpoint_clear(device_, setup_word(setup, 4) & 0xff);
+  }
+
+  urb_completion_t completion{
+      .status = status,
+      .actual_length = static_cast<uint32_t>(actual),
+  };
+  if (slot->direction == IN) {
+    completion.data =
+        std::span<const uint8_t>(transfer->data_buffer + offset, actual);
+  }
+
+  // the payload is sent straight from the transfer, so the slot is only
+  // recycled by flush_completions() once the batch is on the wire
+  slot->engine->complete(slot->seq_num, completion);
+  completed_[completed_count_++] = slot;
+}
+
+bool UsbHostBackend::requeue(transfer_slot_t& slot) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (slot.unlinked || !device_ready_.load(std::memory_order_acquire)) {
+      return false;
+    }
+  }
+
+  // a transfer that already moved data completes with what it has, resending
+  // it would repeat that part on the bus
+  usb_transfer_t* transfer = slot.transfer;
+  if (transfer->actual_num_bytes > 0) {
+    return false;
+  }
+
+  esp_err_t ret = usb_host_transfer_submit(transfer);
+  if (ret != ESP_OK) {
+    FLOG_W(USBIP, TAG, "Failed to re-queue transfer %lu: %s",
+           static_cast<unsigned long>(slot.seq_num), esp_err_to_name(ret));
+    return false;
+  }
+  return true;
+}
+
+void UsbHostBackend::finish_iso(transfer_slot_t& slot,
+                                urb_completion_t& completion) {
+  usb_transfer_t* transfer = slot.transfer;
+  uint8_t* buffer = transfer->data_buffer;
+  size_t source = 0;  // Where the host library placed the packet
+  size_t packed = 0;  // End of the compacted payload
+  uint32_t errors = 0;
+
+  for (uint32_t i = 0; i < slot.packet_count; i++) {
+    const usb_isoc_packet_desc_t& packet = transfer->isoc_packet_desc[i];
+    size_t actual = std::clamp(packet.actual_num_bytes, 0, packet.num_bytes);
+    int32_t status = to_urb_status(packet.status);
+    if (status != URB_STATUS_OK) {
+      errors++;
+    }
+
+    // short IN packets leave holes; the RET_SUBMIT carries the payload
+    // without them and the client pads it back out using the offsets
+    if (slot.direction == IN && packed != source && actual > 0) {
+      memmove(buffer + packed, buffer + source, actual);
+    }
+    packed += actual;
+    source += packet.num_bytes;
+
+    iso_packet_descriptor_t& descriptor = slot.iso[i];
+    descriptor.actual_length = actual;
+    descriptor.status = static_cast<uint32_t>(status);
+    wire::to_wire(descriptor);
+  }
+
+  completion.actual_length = packed;
+  completion.error_count = errors;
+  if (slot.direction == IN) {
+    completion.data = std::span<const uint8_t>(buffer, packed);
+  }
+  completion.iso_descriptors = std::span<const uint8_t>(
+      reinterpret_cast<const uint8_t*>(slot.iso),
+      slot.packet_count * sizeof(iso_packet_descriptor_t));
+}
+
+void UsbHostBackend::flush_completions() {
+  UrbEngine* flushed = nullptr;
+  for (size_t i = 0; i < completed_count_; i++) {
+    UrbEngine* engine = completed_[i]->engine;
+    if (engine != flushed) {
+      engine->flush();
+      flushed = engine;
+    }
+  }
+
+  for (size_t i = 0; i < completed_count_; i++) {
+    release_slot(*completed_[i]);
+  }
+  completed_count_ = 0;
+}
+
+int32_t UsbHostBackend::to_urb_status(usb_transfer_status_t status) {
+  switch (status) {
+    case USB_TRANSFER_STATUS_COMPLETED:
+      return URB_STATUS_OK;
+    case USB_TRANSFER_STATUS_STALL:
+      return URB_STATUS_PIPE;
+    case USB_TRANSFER_STATUS_NO_DEVICE:
+      return URB_STATUS_NODEV;
+    case USB_TRANSFER_STATUS_CANCELED:
+      return URB_STATUS_CONNRESET;
+    case USB_TRANSFER_STATUS_TIMED_OUT:
+      return URB_STATUS_TIME;
+    case USB_TRANSFER_STATUS_OVERFLOW:
+      return URB_STATUS_OVERFLOW;
+    default:
+      return URB_STATUS_PROTO;
+  }
+}
+
+void UsbHostBackend::daemon_task(void* arg) {
+  while (true) {
+    uint32_t event_flags = 0;
+    usb_host_lib_handle_events(portMAX_DELAY, &event_flags);
+  }
+}
+
+void UsbHostBackend::client_task(void* arg) {
+  auto* backend = static_cast<UsbHostBackend*>(arg);
+  while (true) {
+    // one pass handles every pending transfer event, so its completions
+    // leave in a single write
+    usb_host_client_handle_events(backend->client_, portMAX_DELAY);
+    backend->flush_completions();
+  }
+}
+
+}  // namespace usbip
@@ -0,0 +1,208 @@
+#include "usbip_server.hpp"
+
+#include <cstring>
+#include <iterator>
+#include "session_manager.hpp"
+#include "task_topology.hpp"
+#include "usbip_wire.hpp"
+
+namespace usbip {
+
+UsbipServer& UsbipServer::get_instance() {
+  static UsbipServer instance;
+  return instance;
+}
+
+UsbipServer::UsbipServer()
+    : cache_(UsbHostBackend::get_instance()),
+      engine_(UsbHostBackend::get_instance()),
+      unit_(
+          server::tcp_server_config_t{
+              .name = "usbip_server",
+              .port = CONFIG_FLUIDITY_USBIP_PORT,
+              .max_clients = CONFIG_FLUIDITY_TCP_MAX_CLIENTS,
+              .rx_buffer_size = CONFIG_FLUIDITY_USBIP_RX_BUFFER_SIZE,
+              // OUT payloads are staged here until copied into a transfer
+              .rx_region = memory::region_t::PSRAM,
+              .stack_size = topology::USBIP_SERVER.stack_size,
+              .priority = topology::USBIP_SERVER.priority,
+              .core_id = topology::USBIP_SERVER.core_id,
+          },
+          *this) {}
+
+esp_err_t UsbipServer::start() {
+  esp_err_t ret = UsbHostBackend::get_instance().init();
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "USB host backend is unavailable");
+    return ret;
+  }
+
+  return unit_.start();
+}
+
+esp_err_t UsbipServer::stop() {
+  return unit_.stop();
+}
+
+esp_err_t UsbipServer::on_connect(server::connection_t& connection) {
+  // replies are already coalesced per flush, Nagle would only hold them back
+  int no_delay = 1;
+  setsockopt(connection.socket, IPPROTO_TCP, TCP_NODELAY, &no_delay,
+             sizeof(no_delay));
+
+  for (auto& session : sessions_) {
+    if (!session.used) {
+      session.used = true;
+      session.stage = stage_t::OPERATION;
+      connection.context = &session;
+      return ESP_OK;
+    }
+  }
+
+  return ESP_ERR_NO_MEM;
+}
+
+size_t UsbipServer::on_receive(server::connection_t& connection,
+                               std::span<const uint8_t> data) {
+  auto* session = static_cast<session_t*>(connection.context);
+  size_t consumed = 0;
+
+  if (session->stage == stage_t::OPERATION) {
+    consumed = handle_operation(connection, *session, data);
+    if (consumed == CLOSE_CONNECTION || session->stage == stage_t::OPERATION) {
+      return consumed;
+    }
+  }
+
+  // URB traffic may already follow OP_REQ_IMPORT in the same read
+  bool deferred = false;
+  size_t handled = engine_.handle(data.subspan(consumed), deferred);
+  if (handled == UrbEngine::PROTOCOL_ERROR) {
+    return CLOSE_CONNECTION;
+  }
+
+  connection.deferred = deferred;
+  return consumed + handled;
+}
+
+void UsbipServer::on_disconnect(server::connection_t& connection) {
+  auto* session = static_cast<session_t*>(connection.context);
+  if (session == nullptr) {
+    return;
+  }
+
+  if (session->stage == stage_t::TRANSMISSION) {
+    engine_.detach();
+    ::session::leases().release(::session::RESOURCE_USB_PORT,
+                                ::session::CLIENT_USBIP);
+  }
+  session->used = false;
+}
+
+size_t UsbipServer::handle_operation(server::connection_t& connection,
+                                     session_t& session,
+                                     std::span<const uint8_t> data) {
+  if (data.size() < sizeof(op_header_t)) {
+    return 0;
+  }
+
+  op_header_t header;
+  wire::decode(data.data(), header);
+
+  if (header.version != VERSION) {
+    ESP_LOGW(TAG, "Unsupported protocol version 0x%04x", header.version);
+    return CLOSE_CONNECTION;
+  }
+
+  switch (header.code) {
+    case OP_REQ_DEVLIST:
+      if (reply_devlist(connection.socket) != ESP_OK) {
+        return CLOSE_CONNECTION;
+      }
+      return sizeof(op_req_devlist_t);
+
+    case OP_REQ_IMPORT: {
+      if (data.size() < sizeof(op_req_import_t)) {
+        return 0;
+      }
+
+      op_req_import_t request;
+      wire::decode(data.data(), request);
+
+      char bus_id[sizeof(request.bus_id) + 1];
+      memcpy(bus_id, request.bus_id, sizeof(request.bus_id));
+      bus_id[sizeof(request.bus_id)] = '\0';
+
+      if (reply_import(connection, session, bus_id) != ESP_OK) {
+        return CLOSE_CONNECTION;
+      }
+      return sizeof(op_req_import_t);
+    }
+
+    default:
+      ESP_LOGW(TAG, "Unexpected operation 0x%04x", header.code);
+      return CLOSE_CONNECTION;
+  }
+}
+
+esp_err_t UsbipServer::reply_devlist(int socket) {
+  cache_.refresh();
+  std::span<const uint8_t> reply = cache_.devlist();
+  return server::TcpServerUnit::send_all(socket, reply.data(), reply.size());
+}
+
+esp_err_t UsbipServer::reply_import(server::connection_t& connection,
+                                    session_t& session,
+                                    const char* bus_id) {
+  cache_.refresh();
+  std::span<const uint8_t> descriptor = cache_.find(bus_id);
+
+  op_header_t header{};
+  header.version = VERSION;
+  header.code = OP_REP_IMPORT;
+
+  // the engine takes one import; the port lease stays until it detaches
+  bool imported =
+      !descriptor.empty() && engine_.attach(connection.socket) == ESP_OK;
+  if (imported && ::session::leases().begin(::session::RESOURCE_USB_PORT,
+                                            ::session::CLIENT_USBIP) ==
+                      ::session::grant_t::DENIED) {
+    engine_.detach();
+    imported = false;
+  }
+  if (!imported) {
+    ESP_LOGW(TAG, "Refusing to import bus id %s", bus_id);
+    header.status = ERROR;
+    wire::to_wire(header);
+    return server::TcpServerUnit::send_all(connection.socket, &header,
+                                           sizeof(header));
+  }
+
+  header.status = OK;
+  wire::to_wire(header);
+
+  // the descriptor goes out straight from the cache
+  iovec vectors[] = {
+      {.iov_base = &header, .iov_len = sizeof(header)},
+      {.iov_base = const_cast<uint8_t*>(descriptor.data()),
+       .iov_len = descriptor.size()},
+  };
+  esp_err_t ret = server::TcpServerUnit::send_vectored(
+      connection.socket, vectors, std::size(vectors));
+  if (ret != ESP_OK) {
+    engine_.detach();
+    ::session::leases().release(::session::RESOURCE_USB_PORT,
+                                ::session::CLIENT_USBIP);
+    return ret;
+  }
+
+  session.stage = stage_t::TRANSMISSION;
+  ESP_LOGI(TAG, "Bus id %s imported", bus_id);
+  return ESP_OK;
+}
+
+esp_err_t start_usbip_server() {
+  return UsbipServer::get_instance().start();
+}
+
+}  // namespace usbip
@@ -1,4 +1,12 @@
 #include "wifi_controller.hpp"
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include "mbedtls/md.h"
+#include "mbedtls/pkcs5.h"
+#include "metrics.hpp"
+#include "network_manager.hpp"
+#include "settings_store.hpp"
 
 namespace controller {
 
@@ -37,37 +45,35 @@ esp_err_t WifiController::connect(const char* ssid, const char* password) {
     return ESP_ERR_INVALID_ARG;
   }
 
-  char* stored_ssid = current_ssid_.load(std::memory_order_acquire);
-  if (stored_ssid != nullptr && strcmp(stored_ssid, ssid) == 0 &&
+  if (strcmp(ssid_, ssid) == 0 &&
       state_.load(std::memory_order_acquire) == connection_state::CONNECTED) {
     ESP_LOGI(TAG, "Already connected to SSID: %s", ssid);
     return ESP_OK;
   }
 
   if (state_.load(std::memory_order_acquire) == connection_state::CONNECTED) {
-    ESP_LOGI(TAG, "Disconnecting from current SSID: %s",
-             stored_ssid ? stored_ssid : "");
-    if (disconnect() != ESP_OK) {
+    ESP_LOGI(TAG, "Disconnecting from current SSID: %s", ssid_);
+    if (disconnect_locked() != ESP_OK) {
       return ESP_FAIL;
     }
   }
 
-  if (stored_ssid != nullptr) {
-    free(stored_ssid);
-    current_ssid_.store(nullptr, std::memory_order_release);
-  }
-
-  char* new_ssid = strdup(ssid);
-  current_ssid_.store(new_ssid, std::memory_order_release);
-
-  wifi_config_t wifi_config{};
-  strncpy(reinterpret_cast<char*>(wifi_config.sta.ssid), ssid,
-          sizeof(wifi_config.sta.ssid) - 1);
-  strncpy(reinterpret_cast<char*>(wifi_config.sta.password), password,
-          sizeof(wifi_config.sta.password));
+  strlcpy(ssid_, ssid, sizeof(ssid_));
+  strlcpy(passphrase_, password, sizeof(passphrase_));
+  update_link_info([&](link_info_t& info) {
+    info = link_info_t{};
+    strlcpy(info.ssid, ssid_, sizeof(info.ssid));
+  });
+  prepare_link_cache();
+  retry_num_ = 0;
+  auto_reconnect_.store(true, std::memory_order_release);
 
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-  ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+  ESP_ERROR_CHECK(configure_attempt(cache_valid_ ? attempt_t::CACHED
+                                                 : scan_attempt()));
+  if (apply_link_profile() != ESP_OK) {
+    ESP_LOGW(TAG, "Low-latency link profile is not fully applied");
+  }
   ESP_ERROR_CHECK(esp_wifi_start());
 
   state_.store(connection_state::CONNECTING, std::memory_order_release);
@@ -77,6 +83,18 @@ esp_err_t WifiController::connect(const char* ssid, const char* password) {
 
 esp_err_t WifiController::disconnect() {
   std::lock_guard<std::mutex> lock(mutex_);
+  return disconnect_locked();
+}
+
+esp_err_t WifiController::disconnect_locked() {
+  // an explicit disconnect is final, no retry may bring the link back
+  auto_reconnect_.store(false, std::memory_order_release);
+  if (retry_timer_ != nullptr) {
+    esp_timer_stop(retry_timer_);
+  }
+  if (rssi_timer_ != nullptr) {
+    esp_timer_stop(rssi_timer_);
+  }
 
   if (state_.load(std::memory_order_acquire) ==
           connection_state::DISCONNECTED ||
@@ -96,19 +114,31 @@ esp_err_t WifiController::disconnect() {
   state_.store(connection_state::DISCONNECTED, std::memory_order_release);
   last_error_.store(connection_error::NONE, std::memory_order_release);
 
-  char* stored_ssid = current_ssid_.load(std::memory_order_acquire);
-  if (stored_ssid) {
-    free(stored_ssid);
-    current_ssid_.store(nullptr, std::memory_order_release);
-  }
+  ssid_[0] = '\0';
+  update_link_info([](link_info_t& info) { info = link_info_t{}; });
+  return ESP_OK;
+}
 
-  char* stored_ip = ip_address_.load(std::memory_order_acquire);
-  if (stored_ip) {
-    free(stored_ip);
-    ip_address_.store(nullptr, std::memory_order_release);
+esp_err_t WifiController::wait_connected(TickType_t timeout) {
+  if (wifi_event_group_ == nullptr) {
+    return ESP_ERR_INVALID_STATE;
   }
 
-  return ESP_OK;
+  EventBits_t bits = xEventGroupWaitBits(wifi_event_group_, WIFI_CONNECTED_BIT,
+                                         pdFALSE, pdTRUE, timeout);
+  return (bits & WIFI_CONNECTED_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+esp_err_t WifiController::subscribe(link_callback_t callback, void* arg) {
+  return link_.subscribe(callback, arg);
+}
+
+void WifiController::unsubscribe(link_callback_t callback, void* arg) {
+  link_.unsubscribe(callback, arg);
+}
+
+esp_netif_t* WifiController::get_netif() const {
+  return netif_;
 }
 
 void WifiController::set_connection_error(connection_error error) {
@@ -118,18 +148,20 @@ void WifiController::set_connection_error(connection_error error) {
 }
 
 esp_err_t WifiController::setup_netif_and_event_group() {
-  ESP_ERROR_CHECK(controller::ensure_nvs());
+  ESP_ERROR_CHECK(controller::ensure_settings());
 
   wifi_event_group_ = xEventGroupCreate();
   ESP_LOGI(TAG, "Wi-Fi event group created");
 
-  ESP_ERROR_CHECK(esp_netif_init());
-  ESP_ERROR_CHECK(esp_event_loop_create_default());
-  esp_netif_create_default_wifi_sta();
+  ESP_ERROR_CHECK(controller::ensure_network());
+  netif_ = esp_netif_create_default_wifi_sta();
   ESP_LOGI(TAG, "Network interface setup completed");
 
   wifi_init_config_t config = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&config));
+  // the driver would rewrite its NVS copy of the config on every attempt;
+  // the settings store keeps what is worth keeping
+  ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
 
   esp_event_handler_instance_t wifi_instance;
   esp_event_handler_instance_t ip_instance;
@@ -140,9 +172,185 @@ esp_err_t WifiController::setup_netif_and_event_group() {
       IP_EVENT, IP_EVENT_STA_GOT_IP, &ip_event_handler, this, &ip_instance));
 
   ESP_LOGI(TAG, "Event handlers registered successfully");
+
+  const esp_timer_create_args_t timer_args = {
+      .callback = &retry_timer_callback,
+      .arg = this,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "wifi_retry",
+      .skip_unhandled_events = true,
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &retry_timer_));
+
+  const esp_timer_create_args_t rssi_args = {
+      .callback = &rssi_timer_callback,
+      .arg = this,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "wifi_rssi",
+      .skip_unhandled_events = true,
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&rssi_args, &rssi_timer_));
   return ESP_OK;
 }
 
+esp_err_t WifiController::apply_link_profile() {
+#if CONFIG_FLUIDITY_WIFI_LOW_LATENCY
+  // 802.11n is needed for HT40 and aggregation
+  esp_err_t ret = esp_wifi_set_protocol(
+      WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to enable 802.11n: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+#if CONFIG_FLUIDITY_WIFI_HT40
+  ret = esp_wifi_set_bandwidth(WIFI_IF_STA, WIFI_BW_HT40);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to select HT40: %s", esp_err_to_name(ret));
+    return ret;
+  }
+#endif
+
+  // modem sleep defers every frame to the next beacon the radio wakes for
+  ret = esp_wifi_set_ps(WIFI_PS_NONE);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to disable power save: %s", esp_err_to_name(ret));
+    return ret;
+  }
+
+  ESP_LOGI(TAG, "Low-latency link profile applied");
+#endif
+  return ESP_OK;
+}
+
+namespace {
+
+// FNV-1a over both strings, enough to tell a cache entry from other
+// credentials without keeping the passphrase itself in the record
+uint32_t secret_hash(const char* ssid, const char* passphrase) {
+  uint32_t hash = 2166136261u;
+  for (const char* s : {ssid, passphrase}) {
+    for (; *s != '\0'; s++) {
+      hash = (hash ^ static_cast<uint8_t>(*s)) * 16777619u;
+    }
+    hash = (hash ^ 0xff) * 16777619u;
+  }
+  return hash;
+}
+
+// WPA2 PSK from the passphrase, 4096 rounds of PBKDF2-HMAC-SHA1 salted with
+// the SSID; the driver would otherwise redo this on every connect
+bool derive_pmk(const char* ssid, const char* passphrase, uint8_t* pmk) {
+  size_t length = strlen(passphrase);
+  // 64 hex digits already are the PSK, and SAE only takes a passphrase
+  if (length < 8 || length > 63) {
+    return false;
+  }
+
+  int ret = mbedtls_pkcs5_pbkdf2_hmac_ext(
+      MBEDTLS_MD_SHA1, reinterpret_cast<const unsigned char*>(passphrase),
+      length, reinterpret_cast<const unsigned char*>(ssid), strlen(ssid),
+      4096, 32, pmk);
+  return ret == 0;
+}
+
+}  // namespace
+
+void WifiController::prepare_link_cache() {
+  cache_valid_ = false;
+  cache_ = link_cache_t{};
+  cache_.secret_hash = secret_hash(ssid_, passphrase_);
+
+#if CONFIG_FLUIDITY_WIFI_FAST_RECONNECT
+  link_cache_t stored{};
+  esp_err_t ret = SettingsStore::get_instance().get_blob(
+      NVS_NAMESPACE, LINK_CACHE_KEY, &stored, sizeof(stored));
+  if (ret == ESP_OK && stored.secret_hash == cache_.secret_hash) {
+    cache_ = stored;
+    cache_valid_ = stored.channel != 0;
+    ESP_LOGI(TAG, "Cached AP " MACSTR " on channel %u",
+             MAC2STR(cache_.bssid), cache_.channel);
+    return;
+  }
+  if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND) {
+    ESP_LOGW(TAG, "Ignoring link cache: %s", esp_err_to_name(ret));
+  }
+
+  // new credentials: the PMK is derived here once and kept with the AP
+  cache_.pmk_valid = derive_pmk(ssid_, passphrase_, cache_.pmk);
+#endif
+}
+
+void WifiController::remember_ap(const wifi_ap_record_t& ap) {
+#if CONFIG_FLUIDITY_WIFI_FAST_RECONNECT
+  link_cache_t cache = cache_;
+  memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+  cache.channel = ap.primary;
+  if (attempt_ == attempt_t::PASSPHRASE) {
+    // the PMK was refused or never derived, later boots skip it
+    cache.pmk_valid = false;
+  }
+
+  // the store drops unchanged values, the same AP on every boot costs no
+  // flash wear
+  cache_ = cache;
+  cache_valid_ = true;
+  SettingsStore::get_instance().set_blob(NVS_NAMESPACE, LINK_CACHE_KEY,
+                                         &cache_, sizeof(cache_));
+#endif
+}
+
+WifiController::attempt_t WifiController::scan_attempt() const {
+  return cache_.pmk_valid ? attempt_t::SCAN : attempt_t::PASSPHRASE;
+}
+
+esp_err_t WifiController::configure_attempt(attempt_t attempt) {
+  wifi_config_t config{};
+  memcpy(config.sta.ssid, ssid_, strlen(ssid_));
+
+  if (attempt == attempt_t::PASSPHRASE) {
+    memcpy(config.sta.password, passphrase_, strlen(passphrase_));
+  } else {
+    // the driver takes a 64 digit hex password as the PSK itself
+    static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+    for (size_t i = 0; i < sizeof(cache_.pmk); i++) {
+      config.sta.password[i * 2] = HEX_DIGITS[cache_.pmk[i] >> 4];
+      config.sta.password[i * 2 + 1] = HEX_DIGITS[cache_.pmk[i] & 0x0f];
+    }
+  }
+
+  if (attempt == attempt_t::CACHED) {
+    config.sta.bssid_set = true;
+    memcpy(config.sta.bssid, cache_.bssid, sizeof(config.sta.bssid));
+    config.sta.channel = cache_.channel;
+    config.sta.scan_method = WIFI_FAST_SCAN;
+  } else {
+    config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+  }
+
+  attempt_ = attempt;
+  esp_err_t ret = esp_wifi_set_config(WIFI_IF_STA, &config);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to configure station: %s", esp_err_to_name(ret));
+  }
+  return ret;
+}
+
+void WifiController::schedule_retry() {
+  // doubles per failed attempt up to the maximum, and never gives up
+  uint32_t shift = std::min<uint32_t>(retry_num_, 16);
+  uint64_t delay_ms = std::min<uint64_t>(uint64_t{BACKOFF_MIN_MS} << shift,
+                                         BACKOFF_MAX_MS);
+  retry_num_++;
+  metrics::count(metrics::WIFI_RECONNECTS);
+
+  ESP_LOGI(TAG, "Retrying to connect to the AP in %llu ms (attempt %lu)",
+           static_cast<unsigned long long>(delay_ms),
+           static_cast<unsigned long>(retry_num_));
+  esp_timer_start_once(retry_timer_, delay_ms * 1000);
+}
+
 bool WifiController::validate_credentials(const char* ssid,
                                           const char* password) {
   if (ssid == nullptr || strlen(ssid) == 0) {
@@ -175,6 +383,16 @@ void WifiController::handle_wifi_event(int32_t event_id, void* event_data) {
       ESP_LOGW(TAG, "%s disconnected. Reason number: %d", disconnected->ssid,
                disconnected->reason);
 
+      xEventGroupClearBits(wifi_event_group_, WIFI_CONNECTED_BIT);
+      esp_timer_stop(rssi_timer_);
+      update_link_info([](link_info_t& info) {
+        info.ip[0] = '\0';
+        memset(info.bssid, 0, sizeof(info.bssid));
+        info.channel = 0;
+        info.rssi = 0;
+      });
+      link_.notify(false);
+
       connection_error err = connection_error::UNKNOWN_ERROR;
       switch (disconnected->reason) {
         case WIFI_REASON_NO_AP_FOUND:
@@ -190,16 +408,36 @@ void WifiController::handle_wifi_event(int32_t event_id, void* event_data) {
           break;
       }
 
+      bool was_connected =
+          state_.load(std::memory_order_acquire) == connection_state::CONNECTED;
+      if (!auto_reconnect_.load(std::memory_order_acquire)) {
+        // asked for by disconnect()
+        break;
+      }
       set_connection_error(err);
 
-      if (retry_num_ < 5) {
-        ESP_LOGI(TAG, "Retrying to connect to the AP... (attempt %zu/%zu)",
-                 retry_num_ + 1, 5);
-        ESP_ERROR_CHECK(esp_wifi_connect());
-        retry_num_++;
+      // a lost link or a stale cache entry gets its next attempt at once,
+      // only a rejected full attempt waits for the backoff
+      attempt_t next = attempt_;
+      if (was_connected) {
+        retry_num_ = 0;
+        next = cache_valid_ ? attempt_t::CACHED : scan_attempt();
+      } else if (attempt_ == attempt_t::CACHED) {
+        ESP_LOGI(TAG, "Cached AP unavailable, scanning all channels");
+        next = scan_attempt();
+      } else if (attempt_ == attempt_t::SCAN &&
+                 err == connection_error::AUTHENTICATION_FAILED) {
+        ESP_LOGI(TAG, "PMK refused, retrying with the passphrase");
+        next = attempt_t::PASSPHRASE;
+      }
+
+      if (next != attempt_ || was_connected) {
+        configure_attempt(next);
+        state_.store(connection_state::CONNECTING, std::memory_order_release);
+        esp_wifi_connect();
       } else {
         xEventGroupSetBits(wifi_event_group_, WIFI_FAIL_BIT);
-        ESP_LOGE(TAG, "Failed to connect to the AP after %zu attempts", 5);
+        schedule_retry();
       }
       break;
     }
@@ -212,17 +450,32 @@ void WifiController::handle_wifi_event(int32_t event_id, void* event_data) {
 void WifiController::handle_ip_event(int32_t event_id, void* event_data) {
   if (event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t* event = static_cast<ip_event_got_ip_t*>(event_data);
+    wifi_ap_record_t ap{};
+    bool associated = esp_wifi_sta_get_ap_info(&ap) == ESP_OK;
+
     char ip_addr[16];
     snprintf(ip_addr, sizeof(ip_addr), IPSTR, IP2STR(&event->ip_info.ip));
-
-    ip_address_.store(ip_addr, std::memory_order_release);
+    update_link_info([&](link_info_t& info) {
+      memcpy(info.ip, ip_addr, sizeof(info.ip));
+      if (associated) {
+        memcpy(info.bssid, ap.bssid, sizeof(info.bssid));
+        info.channel = ap.primary;
+        info.rssi = ap.rssi;
+      }
+    });
+    esp_timer_start_periodic(rssi_timer_, RSSI_REFRESH_US);
 
     retry_num_ = 0;
     last_error_.store(connection_error::NONE, std::memory_order_release);
     state_.store(connection_state::CONNECTED, std::memory_order_release);
+    if (associated) {
+      remember_ap(ap);
+    }
 
+    xEventGroupClearBits(wifi_event_group_, WIFI_FAIL_BIT);
     xEventGroupSetBits(wifi_event_group_, WIFI_CONNECTED_BIT);
     ESP_LOGI(TAG, "Connected successfully! IP address: %s", ip_addr);
+    link_.notify(true);
   }
 }
 
@@ -234,15 +487,17 @@ connection_error WifiController::get_last_error() {
   return last_error_.load(std::memory_order_acquire);
 }
 
+link_info_t WifiController::get_link_info() const {
+  return link_info_.load();
+}
+
 WifiController::~WifiController() {
-  char* stored_ssid = current_ssid_.load(std::memory_order_acquire);
-  if (stored_ssid) {
-    free(stored_ssid);
+  if (retry_timer_) {
+    esp_timer_delete(retry_timer_);
   }
 
-  char* stored_ip = ip_address_.load(std::memory_order_acquire);
-  if (stored_ip) {
-    free(stored_ip);
+  if (rssi_timer_) {
+    esp_timer_delete(rssi_timer_);
   }
 
   if (wifi_event_group_) {
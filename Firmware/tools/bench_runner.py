@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+"""Runs the benchmark firmware's workloads and collects them as JSON.
+
+The probe must run the benchmark build (sdkconfig.bench). Every workload is
+repeated and its median kept; with --baseline the run is compared against
+an earlier result and the exit status is 1 when any figure regressed by
+more than --tolerance percent.
+
+    bench_runner.py 192.168.4.1 --output bench.json
+    bench_runner.py 192.168.4.1 --baseline bench.json --tolerance 10
+"""
+
+import argparse
+import json
+import socket
+import statistics
+import sys
+import time
+
+RET_SUBMIT_SIZE = 48
+ECHO_CHUNK = 4096
+
+
+def receive(sock, count):
+    chunk = sock.recv(count)
+    if not chunk:
+        raise ConnectionError("probe closed the connection")
+    return chunk
+
+
+class Probe:
+    def __init__(self, host, port, timeout):
+        self.address = (host, port)
+        self.timeout = timeout
+        self.sock = self.connect()
+        self.pending = b""
+
+    def connect(self):
+        sock = socket.create_connection(self.address, timeout=self.timeout)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        return sock
+
+    def read_exact(self, count):
+        data = self.pending
+        while len(data) < count:
+            data += receive(self.sock, max(count - len(data), ECHO_CHUNK))
+        self.pending = data[count:]
+        return data[:count]
+
+    def read_line(self):
+        while b"\n" not in self.pending:
+            self.pending += receive(self.sock, ECHO_CHUNK)
+        line, self.pending = self.pending.split(b"\n", 1)
+        return json.loads(line)
+
+    def command(self, line, skip=0):
+        self.sock.sendall(line.encode() + b"\n")
+        if skip:
+            self.read_exact(skip)
+        result = self.read_line()
+        if "error" in result:
+            raise RuntimeError(f"{line}: {result['error']}")
+        return result
+
+    def echo(self, samples, total):
+        """RTT of 64-byte pings and bulk throughput, on a second socket."""
+        sock = self.connect()
+        try:
+            sock.sendall(b"echo\n")
+            reply = b""
+            while not reply.endswith(b"\n"):
+                reply += receive(sock, 64)
+
+            ping = bytes(range(64))
+            rtts = []
+            for _ in range(samples):
+                start = time.perf_counter()
+                sock.sendall(ping)
+                received = 0
+                while received < len(ping):
+                    received += len(receive(sock, len(ping) - received))
+                rtts.append((time.perf_counter() - start) * 1e6)
+
+            # keep at most one window in flight, so neither side stalls
+            block = bytes(ECHO_CHUNK)
+            sent = received = 0
+            start = time.perf_counter()
+            while received < total:
+                if sent < total and sent - received < 65536:
+                    sock.sendall(block[: min(ECHO_CHUNK, total - sent)])
+                    sent += min(ECHO_CHUNK, total - sent)
+                else:
+                    received += len(receive(sock, ECHO_CHUNK))
+            elapsed = time.perf_counter() - start
+        finally:
+            sock.close()
+
+        rtts.sort()
+        return {
+            "bench": "echo",
+            "rtt_us_p50": round(rtts[len(rtts) // 2], 1),
+            "rtt_us_p99": round(rtts[min(len(rtts) - 1,
+                                         len(rtts) * 99 // 100)], 1),
+            "bytes_per_s": int(total / elapsed),
+        }
+
+
+# figures compared against a baseline and whether larger is better
+FIGURES = {
+    "echo": {"rtt_us_p50": False, "rtt_us_p99": False, "bytes_per_s": True},
+    "urb": {"urbs_per_s": True},
+    "swd": {"line_bits_per_s": True, "words_per_s": True},
+    "uart": {"max_clean_baud": True},
+}
+
+
+def median_of(runs):
+    """The first run, with every numeric figure replaced by the median."""
+    result = dict(runs[0])
+    for key, value in runs[0].items():
+        if isinstance(value, (int, float)) and not isinstance(value, bool):
+            result[key] = statistics.median(run[key] for run in runs)
+    return result
+
+
+def median_alloc(runs):
+    result = dict(runs[0])
+    result["classes"] = []
+    for index, first in enumerate(runs[0]["classes"]):
+        entry = dict(first)
+        for key in ("pool_ops_per_s", "heap_ops_per_s"):
+            entry[key] = statistics.median(
+                run["classes"][index][key] for run in runs)
+        result["classes"].append(entry)
+    return result
+
+
+def figures(results):
+    flat = {}
+    for name, larger in FIGURES.items():
+        for key, better in larger.items():
+            if name in results and key in results[name]:
+                flat[f"{name}.{key}"] = (results[name][key], better)
+    for entry in results.get("alloc", {}).get("classes", []):
+        flat[f"alloc.{entry['size']}.pool_ops_per_s"] = (
+            entry["pool_ops_per_s"], True)
+    return flat
+
+
+def compare(results, baseline, tolerance):
+    regressions = []
+    current = figures(results)
+    for name, (old, better) in figures(baseline).items():
+        if name not in current or old == 0:
+            continue
+        new = current[name][0]
+        change = (new - old) / old * 100
+        if (change < -tolerance) if better else (change > tolerance):
+            regressions.append(f"{name}: {old} -> {new} ({change:+.1f}%)")
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=3250)
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--timeout", type=float, default=60)
+    parser.add_argument("--alloc-pairs", type=int, default=100000)
+    parser.add_argument("--urb-count", type=int, default=10000)
+    parser.add_argument("--swd-clock", type=int, default=4000000)
+    parser.add_argument("--swd-address", type=lambda v: int(v, 0),
+                        default=0x20000000)
+    parser.add_argument("--swd-words", type=int, default=65536)
+    parser.add_argument("--uart-bytes", type=int, default=16384)
+    parser.add_argument("--echo-samples", type=int, default=200)
+    parser.add_argument("--echo-bytes", type=int, default=8 << 20)
+    parser.add_argument("--skip", action="append", default=[],
+                        choices=["alloc", "urb", "swd", "uart", "echo"])
+    parser.add_argument("--output", help="write the results here")
+    parser.add_argument("--baseline", help="earlier results to compare with")
+    parser.add_argument("--tolerance", type=float, default=10,
+                        help="allowed regression in percent")
+    args = parser.parse_args()
+
+    probe = Probe(args.host, args.port, args.timeout)
+    commands = {
+        "alloc": (f"alloc {args.alloc_pairs}", 0),
+        "urb": (f"urb {args.urb_count}", args.urb_count * RET_SUBMIT_SIZE),
+        "swd": (f"swd {args.swd_clock} {args.swd_address} {args.swd_words}",
+                0),
+        "uart": (f"uart {args.uart_bytes}", 0),
+    }
+
+    results = {"info": probe.command("info"), "repeat": args.repeat}
+    for name, (line, skip) in commands.items():
+        if name in args.skip:
+            continue
+        runs = [probe.command(line, skip) for _ in range(args.repeat)]
+        results[name] = (median_alloc if name == "alloc" else median_of)(runs)
+        print(f"{name}: {json.dumps(results[name])}", file=sys.stderr)
+
+    if "echo" not in args.skip:
+        runs = [probe.echo(args.echo_samples, args.echo_bytes)
+                for _ in range(args.repeat)]
+        results["echo"] = median_of(runs)
+        print(f"echo: {json.dumps(results['echo'])}", file=sys.stderr)
+
+    text = json.dumps(results, indent=2)
+    if args.output:
+        with open(args.output, "w") as output:
+            output.write(text + "\n")
+    else:
+        print(text)
+
+    if args.baseline:
+        with open(args.baseline) as baseline:
+            regressions = compare(results, json.load(baseline),
+                                  args.tolerance)
+        for regression in regressions:
+            print(f"regression: {regression}", file=sys.stderr)
+        return 1 if regressions else 0
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
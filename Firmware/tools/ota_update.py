@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""Updates the firmware of one or more probes over the network.
+
+Each probe streams the image into its spare application slot, boots it and
+is then confirmed once it answers on the update port again. A probe that
+does not come back in time rolls back to its previous firmware on its own.
+Every request is signed with the update key the probes were built with,
+taken from --key or the FLUIDITY_OTA_KEY environment variable, over a fresh
+nonce from the probe.
+
+    ota_update.py build/fluidity.bin 192.168.4.1 192.168.4.2
+"""
+
+import argparse
+import hashlib
+import hmac
+import os
+import socket
+import struct
+import sys
+import time
+
+OTA_WRITE = 0x01
+OTA_REBOOT = 0x02
+OTA_CONFIRM = 0x03
+OTA_CHALLENGE = 0x04
+
+STATUS = {
+    0x00: "ok",
+    0x01: "bad request",
+    0x02: "image does not fit the update slot",
+    0x03: "flash write failed",
+    0x04: "digest mismatch",
+    0x05: "not a valid application image",
+    0x06: "request is not signed with the probe's update key",
+}
+
+REQUEST = struct.Struct("<B3xI")
+RESPONSE = struct.Struct("<BBHI")
+CHUNK = 4096
+
+
+def connect(host, port, timeout):
+    sock = socket.create_connection((host, port), timeout=timeout)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    return sock
+
+
+def receive(sock, length):
+    data = b""
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if not chunk:
+            raise ConnectionError("probe closed the connection")
+        data += chunk
+    return data
+
+
+def response(sock, command):
+    data = receive(sock, RESPONSE.size)
+    answered, status, _, value = RESPONSE.unpack(data)
+    if answered != command or status != 0:
+        raise RuntimeError(STATUS.get(status, f"status 0x{status:02x}"))
+    return value
+
+
+def sign(sock, key, command, subject=b""):
+    """Fetches a nonce and signs one request with it."""
+    sock.sendall(REQUEST.pack(OTA_CHALLENGE, 0))
+    nonce = receive(sock, response(sock, OTA_CHALLENGE))
+    message = nonce + bytes([command]) + subject
+    return hmac.new(key, message, hashlib.sha256).digest()
+
+
+def signed(sock, key, command):
+    signature = sign(sock, key, command)
+    sock.sendall(REQUEST.pack(command, len(signature)) + signature)
+    return response(sock, command)
+
+
+def write(sock, image, key):
+    digest = hashlib.sha256(image).digest()
+    header = digest + sign(sock, key, OTA_WRITE, digest)
+    sock.sendall(REQUEST.pack(OTA_WRITE, len(header) + len(image)) + header)
+    for offset in range(0, len(image), CHUNK):
+        sock.sendall(image[offset:offset + CHUNK])
+    return response(sock, OTA_WRITE)
+
+
+def confirm(host, port, timeout, deadline, key):
+    """Waits for the probe to come back on the new image, then keeps it."""
+    while True:
+        try:
+            with connect(host, port, timeout) as sock:
+                return signed(sock, key, OTA_CONFIRM)
+        except OSError:
+            if time.monotonic() > deadline:
+                raise
+            time.sleep(1)
+
+
+def update(host, args, image):
+    start = time.monotonic()
+    key = args.key.encode()
+    with connect(host, args.port, args.timeout) as sock:
+        written = write(sock, image, key)
+        print(f"{host}: wrote {written} bytes in "
+              f"{time.monotonic() - start:.1f} s", file=sys.stderr)
+        if args.no_reboot:
+            return
+        signed(sock, key, OTA_REBOOT)
+
+    # give the probe time to go down before looking for it
+    time.sleep(2)
+    pending = confirm(host, args.port, args.timeout,
+                      time.monotonic() + args.boot_timeout, key)
+    state = "confirmed" if pending else "already confirmed"
+    print(f"{host}: back after {time.monotonic() - start:.1f} s, {state}",
+          file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image", help="application binary, as idf.py builds")
+    parser.add_argument("hosts", nargs="+")
+    parser.add_argument("--port", type=int, default=3244)
+    parser.add_argument("--timeout", type=float, default=30)
+    parser.add_argument("--boot-timeout", type=float, default=60,
+                        help="seconds a rebooted probe has to come back")
+    parser.add_argument("--no-reboot", action="store_true",
+                        help="only write the image, boot it later")
+    parser.add_argument("--key", default=os.environ.get("FLUIDITY_OTA_KEY"),
+                        help="update key, FLUIDITY_OTA_KEY by default")
+    args = parser.parse_args()
+    if not args.key:
+        parser.error("no update key, pass --key or set FLUIDITY_OTA_KEY")
+
+    with open(args.image, "rb") as image_file:
+        image = image_file.read()
+
+    failed = []
+    for host in args.hosts:
+        try:
+            update(host, args, image)
+        except (OSError, RuntimeError) as error:
+            print(f"{host}: {error}", file=sys.stderr)
+            failed.append(host)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())